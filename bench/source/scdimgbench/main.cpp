@@ -0,0 +1,182 @@
+/**
+ *
+ * @brief Load generator and benchmark harness for SCD Image Server
+ *
+ *        SCD Image server is a TCP server for fast uploading/downloading of image or binary files
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QCoreApplication>
+#include <QTextStream>
+#include "scdimgbench.h"
+
+#define  echo QTextStream(stderr) <<
+
+/**
+ * @brief usage
+ */
+void usage()
+{
+   echo "Usage scdimgbench <host> <port> [options]\n\n";
+   echo "  -c:<connections>    closed loop: concurrent connections, open loop: max requests in flight (default 8)\n";
+   echo "  -n:<requests>       requests to issue (default 1000)\n";
+   echo "  -d:<secs>           run for secs instead of a number of requests\n";
+   echo "  -w:<requests>       warmup requests, not recorded (default 0)\n";
+   echo "  -r:<req/s>          open loop arrival rate (default 0: closed loop)\n";
+   echo "  -constant           open loop constant inter-arrival times (default poisson)\n";
+   echo "  -mix:<mix>          operations weights (default get=70,thumb=10,put=15,del=5)\n";
+   echo "  -sizes:<dist>       PUT/GET sizes: corpus, fixed:<bytes>, uniform:<min>:<max>, lognormal:<median>:<sigma> (sizes accept K and M)\n";
+   echo "  -corpus:<folder>    images folder (default ../../client/bin/media/)\n";
+   echo "  -prefix:<folder>    remote folder of bench objects (default /bench/)\n";
+   echo "  -seed:<n>           random seed (default 1)\n";
+   echo "  -json:<file>        write results to json file too\n";
+   echo "  -replay:<capture>   replay a server traffic capture (open loop, -c sets max requests in flight)\n";
+   echo "  -speed:<x>          replay speed (default 1: real time, 10: ten times faster)\n";
+}
+
+/**
+ * @brief main
+ * @param argc
+ * @param argv
+ * @return
+ */
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   echo "\nSC-Develop Image Bench v1.0\n";
+   echo "Copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com\n";
+   echo "https://github.com/sc-develop - git.sc.develop@gmail.com\n\n";
+
+   if (argc<3)
+   {
+      usage();
+      return 0;
+   }
+
+   SCDImgBenchOptions options;
+
+   options.host   = argv[1];
+   options.port   = static_cast<quint16>(QString(argv[2]).toUInt());
+   options.corpus = QCoreApplication::applicationDirPath() + "/../../client/bin/media/";
+
+   QStringList args = QCoreApplication::arguments().mid(3);
+
+   bool ok = (options.port>0);
+
+   foreach (QString arg, args)
+   {
+      QString option = arg.section(':',0,0);
+      QString value  = arg.section(':',1);
+
+      bool valid = true;
+
+      if (option=="-c")
+      {
+         options.connections = value.toInt(&valid);
+      }
+      else
+      if (option=="-n")
+      {
+         options.requests = value.toInt(&valid);
+      }
+      else
+      if (option=="-d")
+      {
+         options.duration = value.toInt(&valid);
+         options.requests = 0;
+      }
+      else
+      if (option=="-w")
+      {
+         options.warmup = value.toInt(&valid);
+      }
+      else
+      if (option=="-r")
+      {
+         options.rate = value.toDouble(&valid);
+      }
+      else
+      if (option=="-constant")
+      {
+         options.poisson = false;
+      }
+      else
+      if (option=="-mix")
+      {
+         valid = options.parseMix(value);
+      }
+      else
+      if (option=="-sizes")
+      {
+         options.sizes = value;
+      }
+      else
+      if (option=="-corpus")
+      {
+         options.corpus = value;
+      }
+      else
+      if (option=="-prefix")
+      {
+         options.prefix = value.endsWith('/') ? value : value + "/";
+      }
+      else
+      if (option=="-seed")
+      {
+         options.seed = value.toUInt(&valid);
+      }
+      else
+      if (option=="-json")
+      {
+         options.jsonFile = value;
+      }
+      else
+      if (option=="-replay")
+      {
+         options.replay = value;
+      }
+      else
+      if (option=="-speed")
+      {
+         options.speed = value.toDouble(&valid);
+      }
+      else
+      {
+         valid = false; // unknown option
+      }
+
+      if (!valid)
+      {
+         echo "Invalid option: " << arg << "\n";
+         ok = false;
+      }
+   }
+
+   if (ok && (options.connections<1 || (options.requests<1 && options.duration<1) || options.warmup<0 || options.rate<0 || options.speed<=0 || !options.prefix.startsWith('/')))
+   {
+      echo "Invalid load\n";
+      ok = false;
+   }
+
+   if (!ok)
+   {
+      echo "\n";
+      usage();
+      return 1;
+   }
+
+   SCDImgBench bench(options);
+
+   if (!bench.start())
+   {
+      echo bench.lastError() << "\n";
+      return 1;
+   }
+
+   return a.exec();
+}
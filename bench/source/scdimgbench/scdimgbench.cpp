@@ -0,0 +1,1084 @@
+/**
+ * @class SCDImgBench - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server load generator. The bench first uploads the corpus (and the synthetic objects) under
+ *        the bench prefix, then issues the requests mix:
+ *
+ *          closed loop: <connections> clients, each one issues a new request as soon as the previous one ends
+ *          open loop:   requests arrive at <rate> per second (poisson or constant) whatever the server speed;
+ *                       at most <connections> requests are in flight, the others wait in a backlog
+ *
+ *        Latency is measured from the scheduled arrival time, so open loop latencies include the time spent
+ *        in backlog when the server falls behind (no coordinated omission).
+ *
+ *          replay:      the requests of a traffic capture arrive at their recorded times divided by <speed>
+ *                       (open loop); paths read or deleted before being written are seeded first, thumbnail
+ *                       targets with corpus images, the others with random data of the recorded size
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QSet>
+
+#include <algorithm>
+#include <cmath>
+
+#include "scdimgbench.h"
+
+#define echo QTextStream(stderr) <<
+
+#define PAYLOADS 64 // synthetic payloads generated from the size distribution
+
+/**
+ * @brief SCDImgBenchOptions::SCDImgBenchOptions default load
+ */
+SCDImgBenchOptions::SCDImgBenchOptions()
+{
+   port        = 12345;
+   connections = 8;
+   requests    = 1000;
+   duration    = 0;
+   warmup      = 0;
+   rate        = 0;
+   poisson     = true;
+   sizes       = "corpus";
+   prefix      = "/bench/";
+   timeout     = 10000;
+   seed        = 1;
+   speed       = 1;
+
+   mix[OP_GET]      = 70;
+   mix[OP_GETTHUMB] = 10;
+   mix[OP_PUT]      = 15;
+   mix[OP_DEL]      = 5;
+}
+
+/**
+ * @brief SCDImgBenchOptions::parseMix
+ * @param mix weights of operations: get=70,thumb=10,put=15,del=5 (missing operations get 0)
+ * @return 1 on success, 0 on invalid mix
+ */
+int SCDImgBenchOptions::parseMix(QString mix)
+{
+   static const char *names[] = {"get","thumb","put","del"};
+
+   int weights[OP_COUNT] = {0,0,0,0};
+   int total = 0;
+
+   foreach (QString item, mix.split(',',QString::SkipEmptyParts))
+   {
+      QStringList pair = item.split('=');
+
+      bool ok = (pair.count()==2);
+
+      int op = OP_COUNT;
+
+      for (int i=0; ok && i<OP_COUNT; i++)
+      {
+         if (pair.at(0).trimmed().toLower()==names[i])
+         {
+            op = i;
+         }
+      }
+
+      if (!ok || op==OP_COUNT)
+      {
+         return 0;
+      }
+
+      weights[op] = pair.at(1).toInt(&ok);
+
+      if (!ok || weights[op]<0)
+      {
+         return 0;
+      }
+
+      total += weights[op];
+   }
+
+   if (total==0)
+   {
+      return 0;
+   }
+
+   for (int i=0; i<OP_COUNT; i++)
+   {
+      this->mix[i] = weights[i];
+   }
+
+   return 1;
+}
+
+/**
+ * @class SCDImgBench
+ *
+ * @brief Load generator
+ */
+
+/**
+ * @brief SCDImgBench::SCDImgBench constructor
+ * @param options
+ * @param parent
+ */
+SCDImgBench::SCDImgBench(const SCDImgBenchOptions &options, QObject *parent) : QObject(parent), options(options), random(options.seed)
+{
+   stage       = ST_SEED;
+   issued      = 0;
+   putCount    = 0;
+   seedErrors  = 0;
+   nextArrival = 0;
+   recordStart = 0;
+   runTime     = 0;
+   fallbacks   = 0;
+   traceIndex  = 0;
+
+   for (int i=0; i<SCDImgBenchOptions::OP_COUNT; i++)
+   {
+      errors[i] = 0;
+      bytes[i]  = 0;
+
+      capturedErrors[i] = 0;
+      capturedBytes[i]  = 0;
+   }
+
+   arrivals.setTimerType(Qt::PreciseTimer);
+
+   connect(&arrivals, SIGNAL(timeout()), this, SLOT(onArrival()));
+}
+
+/**
+ * @brief SCDImgBench::start load corpus and payloads, and start seeding the server
+ * @return 1 on success, 0 on failure (see lastError)
+ */
+int SCDImgBench::start()
+{
+   if (!loadCorpus() || (options.replay.isEmpty() ? !makePayloads() : !loadCapture()))
+   {
+      return 0;
+   }
+
+   seed();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgBench::lastError
+ * @return
+ */
+QString SCDImgBench::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgBench::loadCorpus read all images of corpus folder
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgBench::loadCorpus()
+{
+   QDir root(options.corpus);
+
+   QDirIterator it(options.corpus, QStringList() << "*.jpg" << "*.JPG" << "*.jpeg" << "*.png" << "*.PNG", QDir::Files, QDirIterator::Subdirectories);
+
+   while (it.hasNext())
+   {
+      QFile f(it.next());
+
+      if (!f.open(QIODevice::ReadOnly))
+      {
+         lastErrorMsg = "Open file error: " + f.fileName() + " => " + f.errorString();
+         return 0;
+      }
+
+      images.append(f.readAll());
+      imageNames.append(root.relativeFilePath(f.fileName()));
+   }
+
+   if (images.isEmpty())
+   {
+      lastErrorMsg = "No images found into corpus: " + options.corpus;
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgBench::makePayloads make PUT bodies: corpus images, or random data sized by the size distribution
+ * @return 1 on success, 0 on invalid distribution
+ */
+int SCDImgBench::makePayloads()
+{
+   if (options.sizes=="corpus")
+   {
+      payloads = images;
+      return 1;
+   }
+
+   QStringList args = options.sizes.split(':');
+
+   QString dist = args.takeFirst();
+
+   bool ok = (dist=="fixed" && args.count()==1) || (dist=="uniform" && args.count()==2) || (dist=="lognormal" && args.count()==2);
+
+   qint64 first  = ok ? parseSize(args.at(0),&ok) : 0;
+   qint64 second = first;
+   double sigma  = 1.0;
+
+   if (ok && dist=="uniform")
+   {
+      second = parseSize(args.at(1),&ok);
+
+      ok = ok && second>=first;
+   }
+   else
+   if (ok && dist=="lognormal")
+   {
+      sigma = args.at(1).toDouble(&ok);
+
+      ok = ok && sigma>0;
+   }
+
+   if (!ok)
+   {
+      lastErrorMsg = "Invalid size distribution: " + options.sizes;
+      return 0;
+   }
+
+   std::uniform_int_distribution<qint64> uniform(first,second);
+   std::lognormal_distribution<double>   lognormal(std::log(static_cast<double>(first)),sigma); // first is the median
+
+   for (int i=0; i<PAYLOADS; i++)
+   {
+      qint64 size = first;
+
+      if (dist=="uniform")
+      {
+         size = uniform(random);
+      }
+      else
+      if (dist=="lognormal")
+      {
+         size = static_cast<qint64>(lognormal(random));
+      }
+
+      QByteArray payload(static_cast<int>(qBound<qint64>(1,size,256*1024*1024)),Qt::Uninitialized);
+
+      for (int j=0; j<payload.size(); j++)
+      {
+         payload[j] = static_cast<char>(random());
+      }
+
+      payloads.append(payload);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgBench::loadCapture replay: read the capture, sort it by arrival time and make the payloads of the
+ *                                 recorded sizes (views of a single random buffer)
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgBench::loadCapture()
+{
+   QFile f(options.replay);
+
+   if (!f.open(QIODevice::ReadOnly))
+   {
+      lastErrorMsg = "Open capture error: " + options.replay + " => " + f.errorString();
+      return 0;
+   }
+
+   qint64 startMsecs;
+
+   if (!SCDImgCapture::read(&f,trace,startMsecs,lastErrorMsg))
+   {
+      lastErrorMsg = options.replay + ": " + lastErrorMsg;
+      return 0;
+   }
+
+   if (trace.isEmpty())
+   {
+      lastErrorMsg = "Empty capture: " + options.replay;
+      return 0;
+   }
+
+   std::stable_sort(trace.begin(),trace.end(),[](const SCDImgCapture::Record &a, const SCDImgCapture::Record &b) {return a.time<b.time;});
+
+   qint64 maxSize = 1;
+
+   foreach (const SCDImgCapture::Record &record, trace)
+   {
+      int op = benchOp(record);
+
+      if (record.failed)
+      {
+         capturedErrors[op]++;
+      }
+      else
+      {
+         captured[op].append(record.latency);
+
+         capturedBytes[op] += record.size;
+      }
+
+      maxSize = qMax(maxSize, qMin<qint64>(record.size,256*1024*1024));
+   }
+
+   pool.resize(static_cast<int>(maxSize));
+
+   for (int i=0; i<pool.size(); i++)
+   {
+      pool[i] = static_cast<char>(random());
+   }
+
+   foreach (const SCDImgCapture::Record &record, trace) // all payloads are made before requests point to them
+   {
+      qint64 size = qBound<qint64>(1,record.size,pool.size());
+
+      if (!sized.contains(size))
+      {
+         sized.insert(size, QByteArray::fromRawData(pool.constData(),static_cast<int>(size)));
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgBench::seed upload corpus images (GET T targets) and synthetic objects (GET targets)
+ */
+void SCDImgBench::seed()
+{
+   if (!options.replay.isEmpty()) // objects read or deleted by the capture before being written
+   {
+      QSet<QString> written;
+      QSet<QString> seeded;
+      QSet<QString> thumbnails;
+
+      foreach (const SCDImgCapture::Record &record, trace)
+      {
+         if (record.thumbnail)
+         {
+            thumbnails.insert(record.path);
+         }
+      }
+
+      foreach (const SCDImgCapture::Record &record, trace)
+      {
+         if (record.op==SCDImgCapture::OP_PUT)
+         {
+            written.insert(record.path);
+         }
+         else
+         if (!written.contains(record.path) && !seeded.contains(record.path))
+         {
+            seeded.insert(record.path);
+
+            QByteArray *data = payload(record.size);
+
+            if (thumbnails.contains(record.path) || record.size==0)
+            {
+               data = &images[static_cast<int>(qHash(record.path) % static_cast<uint>(images.count()))]; // thumbnails need an image
+            }
+
+            seeds.enqueue({SCDImgBenchOptions::OP_PUT, replayKey(record.path), data, 0, false});
+         }
+      }
+
+      echo "Replaying " << trace.count() << " requests of " << options.replay << ", seeding " << seeds.count() << " objects under " << options.prefix << "\n";
+
+      while (!seeds.isEmpty() && inFlight.count()<options.connections)
+      {
+         issue(seeds.dequeue());
+      }
+
+      if (inFlight.isEmpty())
+      {
+         runStart(); // nothing to seed
+      }
+
+      return;
+   }
+
+   for (int i=0; i<images.count(); i++)
+   {
+      QString key = options.prefix + "seed/" + imageNames.at(i);
+
+      imageKeys.append(key);
+
+      seeds.enqueue({SCDImgBenchOptions::OP_PUT, key, &images[i], 0, false});
+   }
+
+   if (options.sizes=="corpus")
+   {
+      objectKeys = imageKeys;
+   }
+   else
+   {
+      for (int i=0; i<payloads.count(); i++)
+      {
+         QString key = options.prefix + "seed/obj" + QString::number(i) + ".bin";
+
+         objectKeys.append(key);
+
+         seeds.enqueue({SCDImgBenchOptions::OP_PUT, key, &payloads[i], 0, false});
+      }
+   }
+
+   echo "Seeding " << seeds.count() << " objects under " << options.prefix << "seed/\n";
+
+   while (!seeds.isEmpty() && inFlight.count()<options.connections)
+   {
+      issue(seeds.dequeue());
+   }
+}
+
+/**
+ * @brief SCDImgBench::moreRequests
+ * @return true if load is not over
+ */
+bool SCDImgBench::moreRequests()
+{
+   if (!options.replay.isEmpty())
+   {
+      return (traceIndex < trace.count());
+   }
+
+   if (options.requests>0)
+   {
+      return (issued < options.requests + options.warmup);
+   }
+
+   return (clock.elapsed() < static_cast<qint64>(options.duration)*1000);
+}
+
+/**
+ * @brief SCDImgBench::nextRequest draw the next request from the mix
+ * @param scheduled arrival time (nsecs since run start)
+ * @return
+ */
+SCDImgBench::Request SCDImgBench::nextRequest(qint64 scheduled)
+{
+   Request request = {SCDImgBenchOptions::OP_GET, QString(), 0, scheduled, issued>=options.warmup};
+
+   if (issued==options.warmup)
+   {
+      recordStart = scheduled;
+   }
+
+   issued++;
+
+   if (!options.replay.isEmpty()) // next request of capture
+   {
+      const SCDImgCapture::Record &record = trace.at(traceIndex++);
+
+      request.op   = benchOp(record);
+      request.path = replayKey(record.path);
+
+      if (request.op==SCDImgBenchOptions::OP_PUT)
+      {
+         request.payload = payload(record.size);
+      }
+
+      return request;
+   }
+
+   int total = 0;
+
+   for (int i=0; i<SCDImgBenchOptions::OP_COUNT; i++)
+   {
+      total += options.mix[i];
+   }
+
+   int pick = std::uniform_int_distribution<int>(0,total-1)(random);
+
+   while (pick >= options.mix[request.op])
+   {
+      pick -= options.mix[request.op];
+
+      request.op++;
+   }
+
+   if (request.op==SCDImgBenchOptions::OP_DEL && putKeys.isEmpty())
+   {
+      request.op = SCDImgBenchOptions::OP_PUT; // nothing left to delete
+
+      fallbacks++;
+   }
+
+   switch (request.op)
+   {
+      case SCDImgBenchOptions::OP_GET:
+        request.path = objectKeys.at(std::uniform_int_distribution<int>(0,objectKeys.count()-1)(random));
+      break;
+
+      case SCDImgBenchOptions::OP_GETTHUMB:
+        request.path = imageKeys.at(std::uniform_int_distribution<int>(0,imageKeys.count()-1)(random));
+      break;
+
+      case SCDImgBenchOptions::OP_PUT:
+      {
+         int index = std::uniform_int_distribution<int>(0,payloads.count()-1)(random);
+
+         request.payload = &payloads[index];
+         request.path    = options.prefix + "put/" + QString::number(putCount++) + (options.sizes=="corpus" ? ".jpg" : ".bin");
+      }
+      break;
+
+      case SCDImgBenchOptions::OP_DEL:
+        request.path = putKeys.takeAt(std::uniform_int_distribution<int>(0,putKeys.count()-1)(random)); // no other request can pick it
+      break;
+   }
+
+   return request;
+}
+
+/**
+ * @brief SCDImgBench::issue send a request on a new connection (the protocol serves one request per connection)
+ * @param request
+ */
+void SCDImgBench::issue(const Request &request)
+{
+   SCDImgClient *client = new SCDImgClient(options.host,options.port,options.timeout);
+
+   connect(client, &SCDImgClient::finished, this, &SCDImgBench::onFinished);
+
+   inFlight.insert(client,request);
+
+   switch (request.op)
+   {
+      case SCDImgBenchOptions::OP_GET:
+        client->requestFile(request.path,false,false);
+      break;
+
+      case SCDImgBenchOptions::OP_GETTHUMB:
+        client->requestFile(request.path,true,false);
+      break;
+
+      case SCDImgBenchOptions::OP_PUT:
+        client->sendFileBuff(request.path,request.payload);
+      break;
+
+      case SCDImgBenchOptions::OP_DEL:
+        client->deleteFile(request.path);
+      break;
+   }
+}
+
+/**
+ * @brief SCDImgBench::runStart seeding is over: start the load
+ */
+void SCDImgBench::runStart()
+{
+   stage = ST_RUN;
+
+   echo "Running " << (options.rate>0 || !options.replay.isEmpty() ? "open" : "closed") << " loop load...\n";
+
+   clock.start();
+
+   if (options.rate>0 || !options.replay.isEmpty())
+   {
+      nextArrival = 0;
+
+      arrivals.start(1);
+
+      return;
+   }
+
+   while (inFlight.count()<options.connections && moreRequests())
+   {
+      issue(nextRequest(clock.nsecsElapsed()));
+   }
+
+   if (inFlight.isEmpty())
+   {
+      finish();
+   }
+}
+
+/**
+ * @brief SCDImgBench::onArrival open loop: issue all the requests arrived since last tick
+ */
+void SCDImgBench::onArrival()
+{
+   qint64 now = clock.nsecsElapsed();
+
+   while (nextArrival<=now && moreRequests())
+   {
+      Request request = nextRequest(nextArrival);
+
+      if (inFlight.count()<options.connections)
+      {
+         issue(request);
+      }
+      else
+      {
+         backlog.enqueue(request);
+      }
+
+      if (!options.replay.isEmpty())
+      {
+         nextArrival = moreRequests() ? replayTime(traceIndex) : nextArrival;
+      }
+      else
+      if (options.poisson)
+      {
+         nextArrival += static_cast<qint64>(std::exponential_distribution<double>(options.rate)(random)*1e9);
+      }
+      else
+      {
+         nextArrival += static_cast<qint64>(1e9/options.rate);
+      }
+   }
+
+   if (!moreRequests())
+   {
+      arrivals.stop();
+
+      if (inFlight.isEmpty() && backlog.isEmpty())
+      {
+         finish();
+      }
+   }
+}
+
+/**
+ * @brief SCDImgBench::onFinished a request is over: record it and issue the next one
+ * @param success
+ * @param errMsg
+ */
+void SCDImgBench::onFinished(bool success, QString errMsg)
+{
+   SCDImgClient *client = qobject_cast<SCDImgClient*>(sender());
+
+   if (!inFlight.contains(client)) // some failures are notified twice
+   {
+      return;
+   }
+
+   qint64 end = clock.nsecsElapsed();
+
+   Request request = inFlight.take(client);
+
+   qint64 size = (request.op==SCDImgBenchOptions::OP_PUT) ? request.payload->size() : client->receivedFile()->size();
+
+   client->disconnect(this);
+   client->deleteLater();
+
+   if (stage==ST_SEED)
+   {
+      if (!success)
+      {
+         echo "Seed error: " << request.path << " => " << errMsg.trimmed() << "\n";
+
+         seedErrors++;
+      }
+
+      if (!seeds.isEmpty())
+      {
+         issue(seeds.dequeue());
+      }
+      else
+      if (inFlight.isEmpty())
+      {
+         if (seedErrors)
+         {
+            echo "Seeding failed: " << seedErrors << " errors\n";
+
+            QCoreApplication::exit(1);
+
+            return;
+         }
+
+         runStart();
+      }
+
+      return;
+   }
+
+   if (request.op==SCDImgBenchOptions::OP_PUT && success)
+   {
+      putKeys.append(request.path);
+   }
+
+   if (request.recorded)
+   {
+      if (success)
+      {
+         latencies[request.op].append((end - request.scheduled)/1000);
+
+         bytes[request.op] += size;
+      }
+      else
+      {
+         errors[request.op]++;
+      }
+   }
+
+   if (!backlog.isEmpty())
+   {
+      issue(backlog.dequeue());
+   }
+   else
+   if (options.rate<=0 && options.replay.isEmpty() && moreRequests())
+   {
+      issue(nextRequest(clock.nsecsElapsed()));
+   }
+
+   if (inFlight.isEmpty() && backlog.isEmpty() && !arrivals.isActive())
+   {
+      finish();
+   }
+}
+
+/**
+ * @brief SCDImgBench::finish print results and quit
+ */
+void SCDImgBench::finish()
+{
+   if (stage==ST_DONE)
+   {
+      return;
+   }
+
+   stage = ST_DONE;
+
+   runTime = clock.nsecsElapsed() - recordStart;
+
+   report();
+
+   int ret = 0;
+
+   if (!options.jsonFile.isEmpty() && !writeJson())
+   {
+      echo lastErrorMsg << "\n";
+
+      ret = 1;
+   }
+
+   QCoreApplication::exit(ret);
+}
+
+/**
+ * @brief SCDImgBench::stats
+ * @param op      operation, OP_COUNT: all operations
+ * @param capture replay: requests of capture, as recorded by server
+ * @return counters and latency percentiles of recorded requests
+ */
+SCDImgBench::Stats SCDImgBench::stats(int op, bool capture)
+{
+   QVector<qint64> samples;
+
+   Stats stats = {0,0,0,0,0,0,0};
+
+   for (int i=0; i<SCDImgBenchOptions::OP_COUNT; i++)
+   {
+      if (op==i || op==SCDImgBenchOptions::OP_COUNT)
+      {
+         samples      += capture ? captured[i]       : latencies[i];
+         stats.errors += capture ? capturedErrors[i] : errors[i];
+         stats.bytes  += capture ? capturedBytes[i]  : bytes[i];
+      }
+   }
+
+   std::sort(samples.begin(),samples.end());
+
+   stats.count = samples.count();
+   stats.p50   = quantile(samples,0.50);
+   stats.p99   = quantile(samples,0.99);
+   stats.p999  = quantile(samples,0.999);
+   stats.max   = samples.isEmpty() ? 0 : samples.last()/1000.0;
+
+   return stats;
+}
+
+/**
+ * @brief SCDImgBench::report print results to stdout
+ */
+void SCDImgBench::report()
+{
+   QTextStream out(stdout);
+
+   double secs = runTime/1e9;
+
+   Stats all = stats(SCDImgBenchOptions::OP_COUNT);
+
+   out << "\nTarget:     " << options.host << ":" << options.port << "\n";
+
+   if (!options.replay.isEmpty())
+   {
+      out << "Load:       replay of " << options.replay << " at " << options.speed << "x, max " << options.connections << " in flight\n";
+      out << "Capture:    " << trace.count() << " requests over " << QString::number((trace.last().time-trace.first().time)/1e6,'f',3) << " s\n";
+   }
+   else
+   if (options.rate>0)
+   {
+      out << "Load:       open loop, " << options.rate << " req/s " << (options.poisson ? "poisson" : "constant") << ", max " << options.connections << " in flight\n";
+   }
+   else
+   {
+      out << "Load:       closed loop, " << options.connections << " connections\n";
+   }
+
+   if (options.replay.isEmpty())
+   {
+      out << "Mix:        get=" << options.mix[0] << " thumb=" << options.mix[1] << " put=" << options.mix[2] << " del=" << options.mix[3] << "\n";
+      out << "Sizes:      " << options.sizes << " (" << payloads.count() << " payloads)\n";
+   }
+   out << "Requests:   " << all.count + all.errors << " (warmup " << options.warmup << "), errors " << all.errors << ", del->put fallbacks " << fallbacks << "\n";
+   out << "Duration:   " << QString::number(secs,'f',3) << " s\n";
+   out << "Throughput: " << QString::number(secs>0 ? all.count/secs : 0,'f',1) << " req/s, " << QString::number(secs>0 ? all.bytes/secs/1048576 : 0,'f',2) << " MB/s\n\n";
+
+   out << QString("%1%2%3%4%5%6%7%8%9\n").arg("op",-8).arg("count",10).arg("errors",8).arg("req/s",10).arg("MB/s",9).arg("p50 ms",10).arg("p99 ms",10).arg("p999 ms",10).arg("max ms",10);
+
+   for (int op=0; op<=SCDImgBenchOptions::OP_COUNT; op++)
+   {
+      Stats s = (op==SCDImgBenchOptions::OP_COUNT) ? all : stats(op);
+
+      if (s.count + s.errors == 0)
+      {
+         continue;
+      }
+
+      out << QString("%1%2%3%4%5%6%7%8%9\n").arg(opName(op),-8)
+                                            .arg(s.count,10)
+                                            .arg(s.errors,8)
+                                            .arg(secs>0 ? s.count/secs : 0,10,'f',1)
+                                            .arg(secs>0 ? s.bytes/secs/1048576 : 0,9,'f',2)
+                                            .arg(s.p50,10,'f',3)
+                                            .arg(s.p99,10,'f',3)
+                                            .arg(s.p999,10,'f',3)
+                                            .arg(s.max,10,'f',3);
+   }
+
+   out << "\n";
+
+   if (options.replay.isEmpty())
+   {
+      return;
+   }
+
+   // replay: captured latencies are measured by server (header to reply), replayed ones by client (connect included)
+
+   out << "Latency distribution, captured vs replayed (ms)\n\n";
+
+   out << QString("%1%2%3%4%5%6%7%8%9\n").arg("op",-8).arg("count",10).arg("errors",8).arg("p50 cap",10).arg("p50 rep",10).arg("p99 cap",10).arg("p99 rep",10).arg("p999 cap",10).arg("p999 rep",10);
+
+   for (int op=0; op<=SCDImgBenchOptions::OP_COUNT; op++)
+   {
+      Stats c = stats(op,true);
+      Stats r = stats(op);
+
+      if (c.count + c.errors == 0)
+      {
+         continue;
+      }
+
+      out << QString("%1%2%3%4%5%6%7%8%9\n").arg(opName(op),-8)
+                                            .arg(c.count,10)
+                                            .arg(c.errors,8)
+                                            .arg(c.p50,10,'f',3)
+                                            .arg(r.p50,10,'f',3)
+                                            .arg(c.p99,10,'f',3)
+                                            .arg(r.p99,10,'f',3)
+                                            .arg(c.p999,10,'f',3)
+                                            .arg(r.p999,10,'f',3);
+   }
+
+   out << "\n";
+}
+
+/**
+ * @brief SCDImgBench::writeJson write results to json file
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgBench::writeJson()
+{
+   double secs = runTime/1e9;
+
+   QJsonObject ops;
+
+   for (int op=0; op<=SCDImgBenchOptions::OP_COUNT; op++)
+   {
+      Stats s = stats(op);
+
+      QJsonObject entry;
+
+      entry.insert("count",   s.count);
+      entry.insert("errors",  s.errors);
+      entry.insert("rps",     secs>0 ? s.count/secs : 0);
+      entry.insert("mbps",    secs>0 ? s.bytes/secs/1048576 : 0);
+      entry.insert("p50_ms",  s.p50);
+      entry.insert("p99_ms",  s.p99);
+      entry.insert("p999_ms", s.p999);
+      entry.insert("max_ms",  s.max);
+
+      if (!options.replay.isEmpty())
+      {
+         Stats c = stats(op,true);
+
+         QJsonObject capture;
+
+         capture.insert("count",   c.count);
+         capture.insert("errors",  c.errors);
+         capture.insert("p50_ms",  c.p50);
+         capture.insert("p99_ms",  c.p99);
+         capture.insert("p999_ms", c.p999);
+         capture.insert("max_ms",  c.max);
+
+         entry.insert("captured", capture);
+      }
+
+      ops.insert(opName(op),entry);
+   }
+
+   QJsonObject root;
+
+   root.insert("host",        options.host);
+   root.insert("port",        options.port);
+   root.insert("loop",        options.rate>0 ? "open" : "closed");
+   root.insert("connections", options.connections);
+   root.insert("rate",        options.rate);
+   root.insert("sizes",       options.sizes);
+   root.insert("seed",        static_cast<qint64>(options.seed));
+   root.insert("replay",      options.replay);
+   root.insert("speed",       options.speed);
+   root.insert("duration_s",  secs);
+   root.insert("ops",         ops);
+
+   QFile f(options.jsonFile);
+
+   if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || f.write(QJsonDocument(root).toJson())==-1)
+   {
+      lastErrorMsg = "Write json error: " + options.jsonFile + " => " + f.errorString();
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgBench::replayTime
+ * @param index request of capture
+ * @return scheduled arrival of request: nsecs since run start (capture time divided by speed)
+ */
+qint64 SCDImgBench::replayTime(int index)
+{
+   return static_cast<qint64>((trace.at(index).time - trace.first().time)*1000/options.speed);
+}
+
+/**
+ * @brief SCDImgBench::replayKey
+ * @param path captured path
+ * @return path under bench prefix
+ */
+QString SCDImgBench::replayKey(QString path)
+{
+   return options.prefix + (path.startsWith('/') ? path.mid(1) : path);
+}
+
+/**
+ * @brief SCDImgBench::payload
+ * @param size recorded size
+ * @return random payload of size bytes (at least 1 byte, at most 256MB)
+ */
+QByteArray *SCDImgBench::payload(qint64 size)
+{
+   return &sized[qBound<qint64>(1,size,pool.size())]; // made by loadCapture()
+}
+
+/**
+ * @brief SCDImgBench::benchOp
+ * @param record
+ * @return bench operation of a captured request
+ */
+int SCDImgBench::benchOp(const SCDImgCapture::Record &record)
+{
+   switch (record.op)
+   {
+      case SCDImgCapture::OP_PUT:
+        return SCDImgBenchOptions::OP_PUT;
+
+      case SCDImgCapture::OP_DEL:
+        return SCDImgBenchOptions::OP_DEL;
+   }
+
+   return record.thumbnail ? SCDImgBenchOptions::OP_GETTHUMB : SCDImgBenchOptions::OP_GET;
+}
+
+/**
+ * @brief SCDImgBench::quantile
+ * @param sorted latencies (usecs)
+ * @param q      0..1
+ * @return msecs
+ */
+double SCDImgBench::quantile(const QVector<qint64> &sorted, double q)
+{
+   if (sorted.isEmpty())
+   {
+      return 0;
+   }
+
+   int index = qBound(0, static_cast<int>(std::ceil(q*sorted.count()))-1, sorted.count()-1);
+
+   return sorted.at(index)/1000.0;
+}
+
+/**
+ * @brief SCDImgBench::parseSize
+ * @param size bytes, with optional K or M suffix (64K, 2M)
+ * @param ok
+ * @return
+ */
+qint64 SCDImgBench::parseSize(QString size, bool *ok)
+{
+   size = size.trimmed().toUpper();
+
+   qint64 unit = 1;
+
+   if (size.endsWith('K'))
+   {
+      unit = 1024;
+   }
+   else
+   if (size.endsWith('M'))
+   {
+      unit = 1024*1024;
+   }
+
+   if (unit>1)
+   {
+      size.chop(1);
+   }
+
+   qint64 value = size.toLongLong(ok);
+
+   *ok = *ok && value>0;
+
+   return value*unit;
+}
+
+/**
+ * @brief SCDImgBench::opName
+ * @param op
+ * @return
+ */
+const char *SCDImgBench::opName(int op)
+{
+   static const char *names[] = {"get","thumb","put","del","all"};
+
+   return names[op];
+}
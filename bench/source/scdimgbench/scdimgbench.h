@@ -0,0 +1,167 @@
+#ifndef SCDIMGBENCH_H
+#define SCDIMGBENCH_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QVector>
+#include <QStringList>
+#include <QByteArray>
+
+#include <random>
+
+#include "scdimgclient.h"
+#include "scdimgcapture.h"
+
+/**
+ * @brief The SCDImgBenchOptions struct is the load description
+ */
+struct SCDImgBenchOptions
+{
+   enum Op {OP_GET=0,OP_GETTHUMB=1,OP_PUT=2,OP_DEL=3,OP_COUNT=4};
+
+   QString host;
+   quint16 port;
+
+   int     connections; // closed loop: concurrent clients, open loop: max requests in flight
+   int     requests;    // requests to issue (0: run for duration)
+   int     duration;    // secs (used when requests is 0)
+   int     warmup;      // requests not recorded
+   double  rate;        // open loop arrivals per second (0: closed loop)
+   bool    poisson;     // open loop: exponential inter-arrival times, otherwise constant
+   int     mix[OP_COUNT];
+   QString sizes;       // corpus | fixed:<bytes> | uniform:<min>:<max> | lognormal:<median>:<sigma>
+   QString corpus;      // images folder (GET T targets and corpus payloads)
+   QString prefix;      // remote folder of bench objects
+   QString jsonFile;    // write results as json too
+   QString replay;      // traffic capture to replay (mix, sizes, requests and rate are ignored)
+   double  speed;       // replay speed (1: real time)
+   int     timeout;     // msecs
+   quint32 seed;        // random seed (same seed, same requests sequence)
+
+   SCDImgBenchOptions();
+
+   int parseMix(QString mix);
+};
+
+/**
+ * @brief The SCDImgBench class is a load generator for SCD Image Server: it seeds the server with the corpus,
+ *        then drives concurrent connections with a mix of GET, GET T, PUT and DEL requests in closed loop
+ *        (each connection issues a new request as soon as the previous one ends) or open loop (requests
+ *        arrive at a fixed rate whatever the server speed) and reports throughput and latency percentiles.
+ *        In replay mode the requests of a server traffic capture are issued at their recorded times (divided by
+ *        speed), with payloads of the recorded sizes, and the replayed latencies are compared with the captured ones.
+ */
+class SCDImgBench : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgBench(const SCDImgBenchOptions &options, QObject *parent=0);
+
+     int start();
+
+     QString lastError();
+
+   private:
+
+     enum Stage {ST_SEED,ST_RUN,ST_DONE};
+
+     struct Stats
+     {
+        qint64 count;
+        qint64 errors;
+        qint64 bytes;
+        double p50;  // msecs
+        double p99;
+        double p999;
+        double max;
+     };
+
+     struct Request
+     {
+        int         op;
+        QString     path;
+        QByteArray *payload;
+        qint64      scheduled; // nsecs since run start (latency is measured from here)
+        bool        recorded;
+     };
+
+     SCDImgBenchOptions options;
+
+     std::mt19937 random;
+
+     QList<QByteArray> images;     // corpus images
+     QStringList       imageNames; // corpus relative paths
+     QList<QByteArray> payloads;   // PUT bodies
+     QStringList       imageKeys;  // seeded images (GET T)
+     QStringList       objectKeys; // seeded objects (GET)
+     QStringList       putKeys;    // objects put by the run and not yet deleted (DEL)
+
+     QQueue<Request>               seeds;
+     QQueue<Request>               backlog;  // open loop arrivals waiting for a free connection
+     QHash<SCDImgClient*, Request> inFlight;
+
+     int stage;
+     int issued;
+     int putCount;
+     int seedErrors;
+
+     QTimer        arrivals;
+     qint64        nextArrival;   // nsecs since run start
+     QElapsedTimer clock;
+     qint64        recordStart;   // nsecs since run start of the first recorded request
+     qint64        runTime;       // nsecs of recorded requests
+
+     QVector<qint64> latencies[SCDImgBenchOptions::OP_COUNT]; // usecs
+     qint64          errors[SCDImgBenchOptions::OP_COUNT];
+     qint64          bytes[SCDImgBenchOptions::OP_COUNT];
+
+     QList<SCDImgCapture::Record> trace;      // replay: capture sorted by arrival time
+     int                          traceIndex; // next request of capture
+     QByteArray                   pool;       // replay: random bytes payloads are cut from
+     QHash<qint64,QByteArray>     sized;      // replay: payloads by size (views of pool)
+
+     QVector<qint64> captured[SCDImgBenchOptions::OP_COUNT]; // replay: latencies recorded by server (usecs)
+     qint64          capturedErrors[SCDImgBenchOptions::OP_COUNT];
+     qint64          capturedBytes[SCDImgBenchOptions::OP_COUNT];
+     qint64          fallbacks;   // DEL turned into PUT because no object was left to delete
+
+     QString lastErrorMsg;
+
+     int  loadCorpus();
+     int  makePayloads();
+     int  loadCapture();
+     void seed();
+
+     bool     moreRequests();
+     Request  nextRequest(qint64 scheduled);
+     void     issue(const Request &request);
+     void     runStart();
+     void     finish();
+
+     qint64      replayTime(int index); // scheduled time of a capture request (nsecs since run start)
+     QString     replayKey(QString path); // remote path of a captured path
+     QByteArray *payload(qint64 size);    // replay payload of size bytes
+
+     static int benchOp(const SCDImgCapture::Record &record);
+
+     Stats stats(int op, bool capture=false); // op OP_COUNT: all requests, capture: latencies recorded by server
+     void  report();
+     int   writeJson();
+
+     static double quantile(const QVector<qint64> &sorted, double q);
+     static qint64 parseSize(QString size, bool *ok);
+     static const char *opName(int op);
+
+   private slots:
+
+     void onFinished(bool success, QString errMsg);
+     void onArrival();
+};
+
+#endif // SCDIMGBENCH_H
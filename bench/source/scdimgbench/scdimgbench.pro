@@ -0,0 +1,38 @@
+QT -= gui
+QT += network
+QT += concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which as been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+DESTDIR = ../../bin/
+
+# the load generator drives the server through the SCD Image Client class
+INCLUDEPATH += "../../../client/source/"
+INCLUDEPATH += "../../../lib/protocol/"
+
+SOURCES += main.cpp \
+    scdimgbench.cpp \
+    ../../../client/source/scdimgclient.cpp \
+    ../../../client/source/scdimgclientcache.cpp \
+    ../../../client/source/scdimgclientpool.cpp \
+    ../../../client/source/scdimgclientring.cpp \
+    ../../../lib/protocol/scdimgcapture.cpp \
+    ../../../lib/protocol/scdimgdelta.cpp \
+    ../../../lib/protocol/scdimglocalsocket.cpp
+
+HEADERS += \
+    scdimgbench.h \
+    ../../../client/source/scdimgclient.h \
+    ../../../client/source/scdimgclientcache.h \
+    ../../../client/source/scdimgclientpool.h \
+    ../../../client/source/scdimgclientring.h \
+    ../../../lib/protocol/scdimgcapture.h \
+    ../../../lib/protocol/scdimgdelta.h \
+    ../../../lib/protocol/scdimglocalsocket.h
@@ -0,0 +1,130 @@
+/**
+ *
+ * @brief Micro benchmarks of SCD Image Server connection handler
+ *
+ *        SCD Image server is a TCP server for fast uploading/downloading of image or binary files
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QFile>
+#include "scdimgmicrobench.h"
+
+#define  echo QTextStream(stderr) <<
+
+/**
+ * @brief usage
+ */
+void usage()
+{
+   echo "Usage scdimgmicrobench [options]\n\n";
+   echo "  -rounds:<n>          rounds of each benchmark (default 5)\n";
+   echo "  -corpus:<folder>     sample images folder (default ../../client/bin/media/)\n";
+   echo "  -json:<file>         write results to json file (copy it to the baseline file to store a new baseline)\n";
+   echo "  -baseline:<file>     baseline to compare with (default ../baseline/scdimgmicrobench.json)\n";
+   echo "  -tolerance:<percent> slowdown reported as regression (default 10)\n";
+}
+
+/**
+ * @brief main
+ * @param argc
+ * @param argv
+ * @return 0 on success, 1 on failure or regression
+ */
+int main(int argc, char *argv[])
+{
+   QCoreApplication a(argc, argv);
+
+   echo "\nSC-Develop Image Micro Bench v1.0\n";
+   echo "Copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com\n";
+   echo "https://github.com/sc-develop - git.sc.develop@gmail.com\n\n";
+
+   int     rounds    = 5;
+   QString corpus    = QCoreApplication::applicationDirPath() + "/../../client/bin/media/";
+   QString jsonFile;
+   QString baseline  = QCoreApplication::applicationDirPath() + "/../baseline/scdimgmicrobench.json";
+   double  tolerance = 10;
+
+   foreach (QString arg, QCoreApplication::arguments().mid(1))
+   {
+      QString option = arg.section(':',0,0);
+      QString value  = arg.section(':',1);
+
+      bool valid = true;
+
+      if (option=="-rounds")
+      {
+         rounds = value.toInt(&valid);
+
+         valid = valid && rounds>0;
+      }
+      else
+      if (option=="-corpus")
+      {
+         corpus = value;
+      }
+      else
+      if (option=="-json")
+      {
+         jsonFile = value;
+      }
+      else
+      if (option=="-baseline")
+      {
+         baseline = value;
+      }
+      else
+      if (option=="-tolerance")
+      {
+         tolerance = value.toDouble(&valid);
+      }
+      else
+      {
+         valid = false; // unknown option
+      }
+
+      if (!valid)
+      {
+         echo "Invalid option: " << arg << "\n\n";
+         usage();
+         return 1;
+      }
+   }
+
+   SCDImgMicroBench bench(corpus, rounds);
+
+   if (!bench.run())
+   {
+      echo bench.lastError() << "\n";
+      return 1;
+   }
+
+   bench.report();
+
+   if (!jsonFile.isEmpty() && !bench.save(jsonFile))
+   {
+      echo bench.lastError() << "\n";
+      return 1;
+   }
+
+   if (!QFile::exists(baseline))
+   {
+      echo "No baseline found: " << baseline << "\n";
+      echo "Run with -json:" << baseline << " to store the current results as baseline\n";
+      return 0;
+   }
+
+   int ret = bench.compare(baseline, tolerance/100);
+
+   if (ret<0)
+   {
+      echo bench.lastError() << "\n";
+   }
+
+   return (ret==1) ? 0 : 1;
+}
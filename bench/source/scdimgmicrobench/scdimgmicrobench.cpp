@@ -0,0 +1,600 @@
+/**
+ * @class SCDImgMicroBench - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server micro benchmarks. Each benchmark runs a number of rounds and records the nsecs
+ *        per operation of every round; median and min are reported:
+ *
+ *          check_header_field     SignalsHandler::checkHeaderField (field name overload)
+ *          check_header_command   SignalsHandler::checkHeaderField (command overload)
+ *          read_header_<cmd>      SignalsHandler::readHeader of GET, GET T, PUT and DEL lines buffered into a loopback socket
+ *          thumbnail_corpus       SignalsHandler::makeThumbnail of each sample image (thumbnail removed before each call)
+ *          read_data_<size>       SignalsHandler::fileReceivingPrepare + readData of an upload, until file is renamed
+ *
+ *        Results are written as json and compared with a stored baseline, in order to spot regressions
+ *        after a Qt upgrade or a code change.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QTextStream>
+#include <QJsonDocument>
+
+#include <algorithm>
+
+#include "scdimgmicrobench.h"
+
+/**
+ * @brief SCDImgMicroBench::SCDImgMicroBench constructor
+ * @param corpus sample images folder
+ * @param rounds rounds of each benchmark
+ * @param parent
+ */
+SCDImgMicroBench::SCDImgMicroBench(QString corpus, int rounds, QObject *parent) : QObject(parent), corpus(corpus), rounds(rounds)
+{
+   server = new SCDImgServer(this, 0, tmpDir.path() + "/");
+
+   server->setConnectionLimits(0, 128, 0, 0, 100); // no timeouts: handlers are driven by the bench
+
+   thread = new SCDImgServerThread(server, -1); // owned by server
+}
+
+/**
+ * @brief SCDImgMicroBench::run run all benchmarks
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::run()
+{
+   if (!tmpDir.isValid())
+   {
+      lastErrorMsg = "Create temporary dir error: " + tmpDir.path();
+      return 0;
+   }
+
+   if (!listener.listen(QHostAddress::LocalHost, 0))
+   {
+      lastErrorMsg = "Loopback listen error: " + listener.errorString();
+      return 0;
+   }
+
+   return benchHeaderFields(100000)
+       && benchReadHeader("read_header_get",   "SCDFTH:1.0\tGET:/sicily/caltanissetta/1.jpg\n",       20000)
+       && benchReadHeader("read_header_thumb", "SCDFTH:1.0\tGET:/sicily/caltanissetta/1.jpg\tT\n",    20000)
+       && benchReadHeader("read_header_put",   "SCDFTH:1.0\tPUT:/sicily/caltanissetta/1.jpg\t65536\n", 20000)
+       && benchReadHeader("read_header_del",   "SCDFTH:1.0\tDEL:/sicily/caltanissetta/1.jpg\n",       20000)
+       && benchThumbnail()
+       && benchReadData(64*1024,     200)
+       && benchReadData(1024*1024,   20)
+       && benchReadData(8*1024*1024, 4);
+}
+
+/**
+ * @brief SCDImgMicroBench::openPair connect a loopback socket pair and attach a handler to the server side.
+ *                                   Socket signals are disconnected from the handler: the bench calls it directly
+ * @param pair
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::openPair(Pair &pair)
+{
+   pair.client = new QTcpSocket();
+
+   pair.client->connectToHost(QHostAddress::LocalHost, listener.serverPort());
+
+   if (!pair.client->waitForConnected(5000) || !listener.waitForNewConnection(5000))
+   {
+      lastErrorMsg = "Loopback connection error: " + pair.client->errorString();
+
+      delete pair.client;
+
+      return 0;
+   }
+
+   pair.peer    = listener.nextPendingConnection();
+   pair.handler = new SignalsHandler(thread, pair.peer);
+
+   QObject::disconnect(pair.peer, 0, pair.handler, 0);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgMicroBench::closePair
+ * @param pair
+ */
+void SCDImgMicroBench::closePair(Pair &pair)
+{
+   delete pair.handler;
+
+   pair.peer->abort();
+   pair.client->abort();
+
+   delete pair.peer;
+   delete pair.client;
+}
+
+/**
+ * @brief SCDImgMicroBench::transfer wait until bytes written by client are buffered by peer socket
+ * @param pair
+ * @param bytes
+ * @return 1 on success, 0 on timeout
+ */
+int SCDImgMicroBench::transfer(Pair &pair, qint64 bytes)
+{
+   QElapsedTimer timer;
+
+   timer.start();
+
+   while (pair.peer->bytesAvailable()<bytes)
+   {
+      if (pair.client->bytesToWrite()>0)
+      {
+         pair.client->waitForBytesWritten(10);
+      }
+
+      pair.peer->waitForReadyRead(10);
+
+      if (timer.elapsed()>10000)
+      {
+         lastErrorMsg = "Loopback transfer timeout";
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgMicroBench::benchHeaderFields time both checkHeaderField overloads
+ * @param iterations calls of a round
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::benchHeaderFields(int iterations)
+{
+   Pair pair;
+
+   if (!openPair(pair))
+   {
+      return 0;
+   }
+
+   QString typeItem    = "SCDFTH:1.0";
+   QString commandItem = "GET:/sicily/caltanissetta/1.jpg";
+
+   SignalsHandler::Command command;
+
+   QVector<double> fieldSamples;
+   QVector<double> commandSamples;
+
+   QElapsedTimer timer;
+
+   int ok = 1;
+
+   for (int r=0; ok && r<rounds; r++)
+   {
+      timer.start();
+
+      for (int i=0; ok && i<iterations; i++)
+      {
+         ok = pair.handler->checkHeaderField(typeItem,"SCDFTH");
+      }
+
+      fieldSamples.append(timer.nsecsElapsed()/static_cast<double>(iterations));
+
+      timer.start();
+
+      for (int i=0; ok && i<iterations; i++)
+      {
+         ok = pair.handler->checkHeaderField(commandItem,command);
+      }
+
+      commandSamples.append(timer.nsecsElapsed()/static_cast<double>(iterations));
+   }
+
+   if (!ok)
+   {
+      lastErrorMsg = "checkHeaderField failure: " + pair.handler->lastError();
+   }
+
+   closePair(pair);
+
+   addResult("check_header_field",   iterations, fieldSamples);
+   addResult("check_header_command", iterations, commandSamples);
+
+   return ok;
+}
+
+/**
+ * @brief SCDImgMicroBench::benchReadHeader time readHeader of header lines already buffered by the socket
+ * @param name       result name
+ * @param line       header line
+ * @param iterations lines of a round
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::benchReadHeader(QString name, QByteArray line, int iterations)
+{
+   Pair pair;
+
+   if (!openPair(pair))
+   {
+      return 0;
+   }
+
+   QByteArray batch = line.repeated(iterations);
+
+   SignalsHandler::Command command;
+
+   QVector<double> samples;
+
+   QElapsedTimer timer;
+
+   int ok = 1;
+
+   for (int r=0; ok && r<rounds; r++)
+   {
+      pair.client->write(batch);
+
+      ok = transfer(pair,batch.size());
+
+      timer.start();
+
+      for (int i=0; ok && i<iterations; i++)
+      {
+         ok = (pair.handler->readHeader(command)==1);
+
+         if (!ok)
+         {
+            lastErrorMsg = "readHeader failure: " + pair.handler->lastError();
+         }
+      }
+
+      samples.append(timer.nsecsElapsed()/static_cast<double>(iterations));
+   }
+
+   closePair(pair);
+
+   addResult(name, iterations, samples);
+
+   return ok;
+}
+
+/**
+ * @brief SCDImgMicroBench::benchThumbnail time makeThumbnail of the sample images
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::benchThumbnail()
+{
+   QDir dir(tmpDir.path() + "/thumb");
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastErrorMsg = "Make dir error: " + dir.absolutePath();
+      return 0;
+   }
+
+   QStringList files;
+
+   QDirIterator it(corpus, QStringList() << "*.jpg" << "*.JPG" << "*.jpeg", QDir::Files, QDirIterator::Subdirectories);
+
+   while (it.hasNext())
+   {
+      QString source = it.next();
+      QString file   = dir.absolutePath() + "/" + QString::number(files.count()) + "." + QFileInfo(source).suffix();
+
+      if (!QFile::copy(source,file))
+      {
+         lastErrorMsg = "Copy file error: " + source;
+         return 0;
+      }
+
+      files.append(file);
+   }
+
+   if (files.isEmpty())
+   {
+      lastErrorMsg = "No sample images found into: " + corpus;
+      return 0;
+   }
+
+   Pair pair;
+
+   if (!openPair(pair))
+   {
+      return 0;
+   }
+
+   QVector<double> samples;
+
+   QElapsedTimer timer;
+
+   int ok = 1;
+
+   for (int r=0; ok && r<rounds; r++)
+   {
+      qint64 elapsed = 0;
+
+      foreach (QString file, files)
+      {
+         QString thumbName = pair.handler->getThumbName(file);
+
+         QFile::remove(thumbName); // existing thumbnails are not re-generated
+
+         timer.start();
+
+         ok = pair.handler->makeThumbnail(file,thumbName);
+
+         elapsed += timer.nsecsElapsed();
+
+         if (!ok)
+         {
+            lastErrorMsg = "makeThumbnail failure: " + pair.handler->lastError();
+            break;
+         }
+      }
+
+      samples.append(elapsed/static_cast<double>(files.count()));
+   }
+
+   closePair(pair);
+
+   addResult("thumbnail_corpus", files.count(), samples);
+
+   return ok;
+}
+
+/**
+ * @brief SCDImgMicroBench::benchReadData time an upload through fileReceivingPrepare and readData
+ *                                        (synchronous write path: no disk writer stage)
+ * @param size       upload size
+ * @param iterations uploads of a round
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::benchReadData(qint64 size, int iterations)
+{
+   QByteArray payload(static_cast<int>(size), Qt::Uninitialized);
+
+   for (int i=0; i<payload.size(); i++)
+   {
+      payload[i] = static_cast<char>(i*131);
+   }
+
+   QString key = "/recv/" + QString::number(size) + ".bin";
+
+   QVector<double> samples;
+
+   QElapsedTimer timer;
+
+   int ok = 1;
+
+   for (int r=0; ok && r<rounds; r++)
+   {
+      qint64 elapsed = 0;
+
+      for (int i=0; ok && i<iterations; i++)
+      {
+         Pair pair;
+
+         if (!openPair(pair))
+         {
+            return 0;
+         }
+
+         SignalsHandler *handler = pair.handler;
+
+         handler->objectKey = key;
+         handler->fileName  = server->rootPaths()->home(key);
+         handler->fileSize  = static_cast<int>(size);
+         handler->op        = SCDImgMetricsBlock::OP_PUT;
+
+         handler->requestTimer.start();
+
+         pair.client->write(payload);
+
+         timer.start();
+
+         int ret = handler->fileReceivingPrepare(handler->fileName);
+
+         while (ret==1)
+         {
+            if (pair.client->bytesToWrite()>0)
+            {
+               pair.client->waitForBytesWritten(10);
+            }
+
+            if (pair.peer->bytesAvailable()==0 && !pair.peer->waitForReadyRead(10000))
+            {
+               handler->lastErrorMsg = "Loopback transfer timeout";
+               ret = 0;
+               break;
+            }
+
+            ret = handler->readData();
+         }
+
+         elapsed += timer.nsecsElapsed();
+
+         if (ret!=2)
+         {
+            lastErrorMsg = "readData failure: " + handler->lastError();
+            ok = 0;
+         }
+
+         closePair(pair);
+      }
+
+      samples.append(elapsed/static_cast<double>(iterations));
+   }
+
+   QString label = (size>=1024*1024) ? QString::number(size/(1024*1024)) + "m" : QString::number(size/1024) + "k";
+
+   addResult("read_data_" + label, iterations, samples);
+
+   return ok;
+}
+
+/**
+ * @brief SCDImgMicroBench::addResult
+ * @param name
+ * @param ops     operations of a round
+ * @param samples nsecs per operation of each round
+ */
+void SCDImgMicroBench::addResult(QString name, qint64 ops, QVector<double> samples)
+{
+   if (samples.isEmpty())
+   {
+      return;
+   }
+
+   std::sort(samples.begin(),samples.end());
+
+   Result result = {name, ops, samples.at(samples.count()/2), samples.first()};
+
+   resultList.append(result);
+}
+
+/**
+ * @brief SCDImgMicroBench::report print results to stdout
+ */
+void SCDImgMicroBench::report()
+{
+   QTextStream out(stdout);
+
+   out << "\nQt " << qVersion() << ", " << rounds << " rounds\n\n";
+
+   out << QString("%1%2%3%4\n").arg("benchmark",-24).arg("ops",10).arg("median ns/op",16).arg("min ns/op",16);
+
+   foreach (Result result, resultList)
+   {
+      out << QString("%1%2%3%4\n").arg(result.name,-24).arg(result.ops,10).arg(result.median,16,'f',1).arg(result.min,16,'f',1);
+   }
+
+   out << "\n";
+}
+
+/**
+ * @brief SCDImgMicroBench::results
+ * @return results as json object
+ */
+QJsonObject SCDImgMicroBench::results()
+{
+   QJsonObject list;
+
+   foreach (Result result, resultList)
+   {
+      QJsonObject entry;
+
+      entry.insert("ops",           result.ops);
+      entry.insert("ns_per_op",     result.median);
+      entry.insert("min_ns_per_op", result.min);
+
+      list.insert(result.name,entry);
+   }
+
+   QJsonObject root;
+
+   root.insert("qt",      qVersion());
+   root.insert("rounds",  rounds);
+   root.insert("results", list);
+
+   return root;
+}
+
+/**
+ * @brief SCDImgMicroBench::save write results to json file (copy it to the baseline file to store a new baseline)
+ * @param fileName
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMicroBench::save(QString fileName)
+{
+   QFile f(fileName);
+
+   if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || f.write(QJsonDocument(results()).toJson())==-1)
+   {
+      lastErrorMsg = "Write json error: " + fileName + " => " + f.errorString();
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgMicroBench::compare compare median of each result with the baseline and print the differences
+ * @param baseline  baseline json file
+ * @param tolerance allowed slowdown ratio (0.1: 10% slower)
+ * @return 1 no regressions, 0 regressions found, -1 baseline error
+ */
+int SCDImgMicroBench::compare(QString baseline, double tolerance)
+{
+   QFile f(baseline);
+
+   if (!f.open(QIODevice::ReadOnly))
+   {
+      lastErrorMsg = "Open baseline error: " + baseline + " => " + f.errorString();
+      return -1;
+   }
+
+   QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
+
+   if (!doc.isObject())
+   {
+      lastErrorMsg = "Invalid baseline: " + baseline;
+      return -1;
+   }
+
+   QJsonObject base = doc.object().value("results").toObject();
+
+   QTextStream out(stdout);
+
+   out << "Baseline: " << baseline << " (Qt " << doc.object().value("qt").toString() << ")\n\n";
+
+   out << QString("%1%2%3%4\n").arg("benchmark",-24).arg("baseline ns/op",16).arg("ns/op",16).arg("change",10);
+
+   int ret = 1;
+
+   foreach (Result result, resultList)
+   {
+      double before = base.value(result.name).toObject().value("ns_per_op").toDouble();
+
+      if (before<=0)
+      {
+         out << QString("%1%2\n").arg(result.name,-24).arg("not in baseline",16);
+         continue;
+      }
+
+      double change = result.median/before - 1;
+
+      bool regression = (change>tolerance);
+
+      out << QString("%1%2%3%4%5\n").arg(result.name,-24)
+                                    .arg(before,16,'f',1)
+                                    .arg(result.median,16,'f',1)
+                                    .arg(QString::number(change*100,'f',1) + "%",10)
+                                    .arg(regression ? "  REGRESSION" : "");
+
+      if (regression)
+      {
+         ret = 0;
+      }
+   }
+
+   out << "\n";
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgMicroBench::lastError
+ * @return
+ */
+QString SCDImgMicroBench::lastError()
+{
+   return lastErrorMsg;
+}
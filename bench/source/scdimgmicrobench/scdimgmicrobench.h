@@ -0,0 +1,77 @@
+#ifndef SCDIMGMICROBENCH_H
+#define SCDIMGMICROBENCH_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QJsonObject>
+#include <QVector>
+#include <QList>
+
+#include "scdimgserverthread.h"
+
+/**
+ * @brief The SCDImgMicroBench class times the connection handler hot paths in isolation: header parsing,
+ *        thumbnailing of the sample images and the receive (readData) write path. Handlers are driven
+ *        directly over loopback socket pairs, files are written into a temporary root path.
+ */
+class SCDImgMicroBench : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgMicroBench(QString corpus, int rounds=5, QObject *parent=0);
+
+     int run();                                           // run all benchmarks
+
+     void        report();                                // print results to stdout
+     QJsonObject results();
+     int         save(QString fileName);                  // write results as json
+     int         compare(QString baseline, double tolerance); // 1: no regressions, 0: regressions found, -1: baseline error
+
+     QString lastError();
+
+   private:
+
+     struct Result
+     {
+        QString name;
+        qint64  ops;     // operations of a round
+        double  median;  // nsecs per operation
+        double  min;
+     };
+
+     struct Pair
+     {
+        QTcpSocket     *client;  // bench side
+        QTcpSocket     *peer;    // server side, driven by handler
+        SignalsHandler *handler;
+     };
+
+     QString corpus;
+     int     rounds;
+
+     QTemporaryDir       tmpDir;
+     SCDImgServer       *server;  // not started: provides handler settings only
+     SCDImgServerThread *thread;  // not started: handler parent
+     QTcpServer          listener;
+
+     QList<Result> resultList;
+
+     QString lastErrorMsg;
+
+     int  openPair(Pair &pair);
+     void closePair(Pair &pair);
+     int  transfer(Pair &pair, qint64 bytes); // move client output to peer read buffer
+
+     int benchHeaderFields(int iterations);
+     int benchReadHeader(QString name, QByteArray line, int iterations);
+     int benchThumbnail();
+     int benchReadData(qint64 size, int iterations);
+
+     void addResult(QString name, qint64 ops, QVector<double> samples);
+};
+
+#endif // SCDIMGMICROBENCH_H
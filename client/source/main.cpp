@@ -13,7 +13,10 @@
 #include <QCoreApplication>
 #include <QDir>
 #include <QTextStream>
+#include <QFile>
 #include "scdimgclient.h"
+#include "scdimgclientring.h"
+#include "scdimgclientbatch.h"
 
 #define  echo QTextStream(stderr) <<
 
@@ -101,8 +104,18 @@ int main(int argc, char *argv[])
    {
       echo "Usage scdimgclient <host> <port> <PUT> <file path to transfer> <dest file path>" << endl;           // single file tranfer: send a file to server
       echo "Usage scdimgclient <host> <port> <PUT> <folder path to transfer> <dest file path> -f " << endl;     // multiple file transfer: send a folder to server
-      echo "Usage scdimgclient <host> <port> <GET> <remote file path to get> [-file:<file path>] [-T]" << endl; // get a file and save to disk. -T optin download a thumbnail
+      echo "Usage scdimgclient <host> <port> <GET> <remote file path to get> [-file:<file path>] [-T] [-cache:<folder>]" << endl; // get a file and save to disk. -T optin download a thumbnail, -cache revalidates a cached copy
       echo "Usage scdimgclient <host> <port> <DEL> <remote file path to delete>" << endl;                       // delete a file from server
+      echo "Usage scdimgclient <host> <port> <INFO> <remote file path> [<remote file path> ...]" << endl;       // width, height, format, orientation and capture date of images
+      echo "Usage scdimgclient <host> <port> <SHEET> <remote folder> [-page:<page>:<size>] [-file:<image file>]" << endl; // thumbnails of a folder in one sprite, positions table to stdout
+      echo "Usage scdimgclient <hosts> <port> <MIGRATE> <new hosts> <remote paths file>" << endl;               // move files whose server changes when servers are added or removed
+      echo "Usage scdimgclient <host> <port> <BATCH> <manifest file|-> [-connections:<n>]" << endl;             // run the GET/PUT/DEL lines of a manifest (- reads stdin) concurrently
+      echo "\n<host> can be a list of servers host[:port],host[:port],... each path is sent to its server of the list (consistent hashing)" << endl;
+      echo "Option -replicas:<n> sets the servers tried when the server of a path is down (default 2)" << endl;
+      echo "Option -delta on PUT sends only the changes of files already stored by the server" << endl;
+      echo "Option -hash on PUT sends the SHA-256 of files first: content already stored by the server is not sent" << endl;
+      echo "Option -tcp on GET disables the Unix socket of a server running on this host" << endl;
+      echo "Option -cachesize:<MB> on GET bounds the -cache folder, least recently used files are removed (default 256, 0: unbounded)" << endl;
       return 0;
    }
 
@@ -119,6 +132,29 @@ int main(int argc, char *argv[])
 
    SCDImgClient imgc(host,Port,10000);
 
+   SCDImgClientRing ring;
+   SCDImgClientRing newRing; // MIGRATE destination servers
+
+   int replicas = 2;
+
+   if (host.contains(',') || host.contains(':')) // servers list: route each path to its server
+   {
+      if (!ring.setNodes(host,Port))
+      {
+         echo ring.lastError() << endl;
+         return 0;
+      }
+
+      QStringList opts = QCoreApplication::arguments().filter("-replicas:"); // check for -replicas: option
+
+      if (opts.count())
+      {
+         replicas = opts.at(0).section(':',1).toInt();
+      }
+
+      imgc.setRing(&ring,replicas);
+   }
+
    imgc.connect(&imgc, &SCDImgClient::finished,         onFinished);
    imgc.connect(&imgc, &SCDImgClient::notifyConnected,  onConnect);
    imgc.connect(&imgc, &SCDImgClient::notifyDisconnect, onDisconnect);
@@ -128,6 +164,10 @@ int main(int argc, char *argv[])
 
    int ret=0;
 
+   SCDImgClientCache *cache = 0;
+
+   SCDImgRingMigrator *migrator = 0;
+
    if (action=="PUT")
    {
       if (argc<6)
@@ -139,6 +179,9 @@ int main(int argc, char *argv[])
 
       QString destPath = argv[5];
 
+      imgc.setDelta(QCoreApplication::arguments().contains("-delta"));    // check for -delta option
+      imgc.setHashFirst(QCoreApplication::arguments().contains("-hash")); // check for -hash option
+
       if (args.count())
       {
          QDir dir(filePath);
@@ -159,6 +202,26 @@ int main(int argc, char *argv[])
       QString destPath;
       bool    thumbnail = false;
 
+      imgc.setLocalSocket(!QCoreApplication::arguments().contains("-tcp")); // check for -tcp option
+
+      args = QCoreApplication::arguments().filter("-cache:"); // check for -cache: option
+
+      if (args.count())
+      {
+         qint64 cacheSize = 256; // MB
+
+         QStringList opts = QCoreApplication::arguments().filter("-cachesize:"); // check for -cachesize: option
+
+         if (opts.count())
+         {
+            cacheSize = qMax(0,opts.at(0).section(':',1).toInt());
+         }
+
+         cache = new SCDImgClientCache(args.at(0).section(':',1),cacheSize*1048576);
+
+         imgc.setCache(cache);
+      }
+
       if (argc>5)
       {
           args = QCoreApplication::arguments().filter("-file:"); // check for -file: option
@@ -192,6 +255,187 @@ int main(int argc, char *argv[])
    {
       ret = imgc.deleteFile(filePath);
    }
+   else
+   if (action=="INFO")
+   {
+      QStringList paths;
+
+      for (int i=4; i<argc; i++)
+      {
+         if (argv[i][0]=='/') // remote paths (options excluded)
+         {
+            paths.append(argv[i]);
+         }
+      }
+
+      ret = imgc.requestInfo(paths,true); // one line for each path to stdout
+   }
+   else
+   if (action=="SHEET")
+   {
+      QString imageFile = "./sheet.jpg";
+      int     page      = 0;
+      int     pageSize  = 0;
+
+      args = QCoreApplication::arguments().filter("-file:"); // check for -file: option
+
+      if (args.count())
+      {
+         imageFile = args.at(0).section(':',1);
+      }
+
+      args = QCoreApplication::arguments().filter("-page:"); // check for -page: option
+
+      if (args.count())
+      {
+         page     = args.at(0).section(':',1,1).toInt();
+         pageSize = args.at(0).section(':',2,2).toInt();
+      }
+
+      imgc.connect(&imgc, &SCDImgClient::fileReceived, [&imgc,imageFile](QString)
+      {
+         const QByteArray &reply = *imgc.receivedFile();
+
+         int pos = reply.indexOf('\n');
+
+         QList<QByteArray> head = reply.left(pos).split('\t'); // <count>\t<total>\t<columns>
+
+         int count = head.value(0).toInt();
+
+         QTextStream out(stdout); // positions table: x, y, width, height, file name
+
+         for (int i=0; i<count && pos>=0; i++)
+         {
+            int next = reply.indexOf('\n',pos+1);
+
+            out << reply.mid(pos+1,next-pos);
+
+            pos = next;
+         }
+
+         out.flush();
+
+         QFile f(imageFile);
+
+         if (count>0 && pos>=0 && f.open(QIODevice::WriteOnly))
+         {
+            f.write(reply.mid(pos+1)); // JPEG sprite
+         }
+
+         echo "Sheet: " << head.value(0) << " of " << head.value(1) << " images => " << imageFile << endl;
+      });
+
+      ret = imgc.requestSheet(filePath,page,pageSize);
+   }
+   else
+   if (action=="MIGRATE")
+   {
+      if (argc<6)
+      {
+         echo "<remote paths file> required for MIGRATE" << endl;
+         echo "Type scdimgclient for help\n" << endl;
+         return 0;
+      }
+
+      QFile f(argv[5]); // one remote path for each line
+
+      if (!f.open(QIODevice::ReadOnly))
+      {
+         echo "Open file error: " << f.fileName() << " => " << f.errorString() << endl;
+         return 0;
+      }
+
+      QStringList paths = QString::fromUtf8(f.readAll()).split('\n',QString::SkipEmptyParts);
+
+      if (ring.count()==0)
+      {
+         ring.setNodes(host,Port); // single server
+      }
+
+      if (!newRing.setNodes(filePath,Port))
+      {
+         echo newRing.lastError() << endl;
+         return 0;
+      }
+
+      migrator = new SCDImgRingMigrator(&ring,&newRing);
+
+      migrator->connect(migrator, &SCDImgRingMigrator::progress, [](QString path, bool success, QString errMsg)
+      {
+         echo (success ? "Moved: " : "Not moved: ") << path << (success ? "" : " => " + errMsg) << endl;
+      });
+
+      migrator->connect(migrator, &SCDImgRingMigrator::finished, [](bool success)
+      {
+         QCoreApplication::exit(!success);
+      });
+
+      int count = migrator->start(paths);
+
+      echo "Files to move: " << count << " of " << paths.count() << endl;
+
+      if (count==0)
+      {
+         QMetaObject::invokeMethod(&a, "quit", Qt::QueuedConnection); // nothing to do
+      }
+
+      ret = 1;
+   }
+   else
+   if (action=="BATCH")
+   {
+      int connections = 8;
+
+      args = QCoreApplication::arguments().filter("-connections:"); // check for -connections: option
+
+      if (args.count())
+      {
+         connections = qMax(1,args.at(0).section(':',1).toInt());
+      }
+
+      SCDImgClientBatch batch(host,Port,0,connections);
+
+      if (ring.count())
+      {
+         batch.setRing(&ring,replicas);
+      }
+
+      batch.connect(&batch, &SCDImgClientBatch::result, [](int line, QString command, QString path, bool success, qint64 bytes, qint64 msecs, QString errMsg)
+      {
+         QTextStream out(stdout); // one result line for each command, in completion order: line, status, command, path, bytes, msecs [, error]
+
+         out << line << '\t' << (success ? "ok" : "ko") << '\t' << command << '\t' << path << '\t' << bytes << '\t' << msecs;
+
+         if (!success)
+         {
+            out << '\t' << errMsg;
+         }
+
+         out << endl;
+      });
+
+      batch.connect(&batch, &SCDImgClientBatch::finished, [](bool success)
+      {
+         QCoreApplication::exit(!success);
+      });
+
+      if (!batch.start(filePath))
+      {
+         echo batch.lastError() << endl;
+         echo "status: ko\n\n";
+         return 1;
+      }
+
+      int status = a.exec();
+
+      qint64 msecs = qMax<qint64>(1,batch.elapsed());
+
+      echo "Commands: " << batch.succeeded()+batch.failed() << " ok: " << batch.succeeded() << " failed: " << batch.failed() << endl;
+      echo "Bytes: " << batch.bytes() << " in " << msecs << " ms (" << (batch.succeeded()+batch.failed())*1000/msecs << " commands/s)" << endl;
+      echo (status ? "status: ko\n\n" : "status: ok\n\n");
+
+      return status; // 0: all commands succeeded
+   }
 
    QString error;
 
@@ -222,5 +466,8 @@ int main(int argc, char *argv[])
       break;
    }
 
+   delete cache;
+   delete migrator;
+
    return ret;
 }
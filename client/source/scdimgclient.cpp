@@ -16,38 +16,582 @@
 #include <QFile>
 #include <QCoreApplication>
 #include <QDir>
+#include <QCryptographicHash>
+#include <QHostAddress>
+#include <QNetworkInterface>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "scdimgclient.h"
+#include "scdimglocalsocket.h"
 
 /**
  * @brief SCDImgClient::SCDImgClient
  * @param Host
  * @param Port
- * @param Timeout
+ * @param Timeout connect and read timeout msecs (0: no timeout)
  */
-SCDImgClient::SCDImgClient(QString host, quint16 port, int timeout=0) : host(host),port(port),timeout(timeout)
+SCDImgClient::SCDImgClient(QString host, quint16 port, int timeout=0) : host(host),port(port),connectTimeout(timeout),readTimeout(timeout)
 {
    connect(this, SIGNAL(connected())                        , this, SLOT(onConnected()));
    connect(this, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(onError(QAbstractSocket::SocketError)));
    connect(this, SIGNAL(disconnected())                     , this, SLOT(onDisconnected()));
    connect(this, SIGNAL(readyRead())                        , this, SLOT(onReadyRead()));
+   connect(this, SIGNAL(bytesWritten(qint64))               , this, SLOT(onBytesWritten(qint64)));
+
+   timer.setSingleShot(true);
+
+   connect(&timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+
+   commandStatus = TS_INACTIVE;
+   transferMode  = TM_NONE;
+   thumbRequest  = false;
+   notModified   = false;
+
+   replicas      = 2;
+   routeIndex    = 0;
+   connectedOnce = false;
+
+   deltaPut = false;
+
+   hashPut       = false;
+   uploadSkipped = false;
+}
+
+/**
+ * @brief SCDImgClient::~SCDImgClient
+ */
+SCDImgClient::~SCDImgClient()
+{
+   closeLocal();
+}
+
+/**
+ * @brief SCDImgClient::setTimeouts
+ * @param connectTimeout msecs to establish the connection (0: no timeout)
+ * @param readTimeout    max msecs without receiving or sending data once connected (0: no timeout)
+ */
+void SCDImgClient::setTimeouts(int connectTimeout, int readTimeout)
+{
+   this->connectTimeout = connectTimeout;
+   this->readTimeout    = readTimeout;
+}
+
+/**
+ * @brief SCDImgClient::setCache enable downloads cache: GET asks the validator of downloaded files and stores them
+ *                               into cache; a cached file is revalidated with a conditional GET, and is not downloaded
+ *                               again if server answers it is not modified
+ * @param cache shared cache (not owned), null to disable
+ */
+void SCDImgClient::setCache(SCDImgClientCache *cache)
+{
+   this->cache = cache;
+}
+
+/**
+ * @brief SCDImgClient::setRing route each command to the server owning its remote path. If connection to that server
+ *                              fails (refused, unreachable or connect timeout) the next servers of the ring are tried.
+ *                              A command is never retried once connected: it could have been executed.
+ * @param ring     servers ring (not owned), null to use host and port of constructor
+ * @param replicas servers tried for each command (owner included)
+ */
+void SCDImgClient::setRing(SCDImgClientRing *ring, int replicas)
+{
+   this->ring     = ring;
+   this->replicas = qMax(1,replicas);
+}
+
+/**
+ * @brief SCDImgClient::setDelta delta uploads: the server sends the block signatures of its copy of the file, and only
+ *                               changed bytes and references to unchanged blocks are sent. Files smaller than
+ *                               SCDImgDelta::MIN_FILE are always sent whole.
+ * @param enabled
+ */
+void SCDImgClient::setDelta(bool enabled)
+{
+   delta = enabled;
+}
+
+/**
+ * @brief SCDImgClient::setHashFirst hash-first uploads: the PUT header declares the SHA-256 of the file, and the server
+ *                                   answers "ok" without receiving data if it already stores that content (under the
+ *                                   same path or another one). Otherwise it asks for data, and verifies it against the
+ *                                   hash. Delta uploads, when enabled, take precedence for files they apply to.
+ * @param enabled
+ */
+void SCDImgClient::setHashFirst(bool enabled)
+{
+   hashFirst = enabled;
+}
+
+/**
+ * @brief SCDImgClient::setLocalSocket GET from a server running on this host (enabled by default): if the server
+ *                                     listens on its Unix socket, the GET is sent there and the server passes a
+ *                                     read-only descriptor of the object instead of its data. The object is read
+ *                                     from the descriptor, or copied in kernel to the output file or stdout.
+ *                                     Thumbnail and cached GETs always use TCP.
+ * @param enabled
+ * @param path    Unix socket path (empty: SCDImgLocalSocket::defaultPath() of server port)
+ */
+void SCDImgClient::setLocalSocket(bool enabled, QString path)
+{
+   localEnabled = enabled;
+   localPath    = path;
+}
+
+/**
+ * @brief SCDImgClient::currentServer
+ * @return host:port of server of last command
+ */
+QString SCDImgClient::currentServer()
+{
+   return host + ":" + QString::number(port);
+}
+
+/**
+ * @brief SCDImgClient::getHeader make GET header
+ * @param thumbnail
+ */
+void SCDImgClient::getHeader(bool thumbnail)
+{
+   QString options = thumbnail ? "\tT" : "";
+
+   if (cache)
+   {
+      QByteArray cached;
+
+      if (cache->lookup(SCDImgClientCache::key(fileName,thumbnail),cached))
+      {
+         options += "\tIF:" + cached; // conditional get
+      }
+      else
+      {
+         options += "\tV";            // ask validator
+      }
+   }
+
+   thumbRequest = thumbnail;
+   notModified  = false;
+
+   validator.clear();
+
+   header.clear();
+   header.append("SCDFTH:1.0\tGET:"+fileName+options+"\n");
+}
+
+/**
+ * @brief SCDImgClient::connectHost connect to server: command fails if connection is not established within connect timeout
+ */
+void SCDImgClient::connectHost()
+{
+   connectedOnce = false;
+
+   if (ring)
+   {
+      route      = ring->lookup(opFileName, replicas);
+      routeIndex = 0;
+
+      if (!route.isEmpty())
+      {
+         host = route.first().host;
+         port = route.first().port;
+      }
+   }
+
+   if (localSocket() && localGet()) // server on this host: the object is read from a descriptor passed by server
+   {
+      return;
+   }
+
+   connectReplica();
+}
+
+/**
+ * @brief SCDImgClient::localSocket
+ * @return true if current command is a GET to a server on this host that listens on its Unix socket
+ */
+bool SCDImgClient::localSocket()
+{
+   if (!localEnabled || operationType!=GET || thumbRequest || cache)
+   {
+      return false;
+   }
+
+   QHostAddress address(host);
+
+   if (host!="localhost" && !address.isLoopback() && !QNetworkInterface::allAddresses().contains(address))
+   {
+      return false;
+   }
+
+   return QFileInfo::exists(localPath.isEmpty() ? SCDImgLocalSocket::defaultPath(port) : localPath);
+}
+
+/**
+ * @brief SCDImgClient::localGet connect to Unix socket of server and send current GET with the descriptor option
+ * @return true if GET has been sent, false if connection failed (command is sent by TCP)
+ */
+bool SCDImgClient::localGet()
+{
+   QByteArray path = QFile::encodeName(localPath.isEmpty() ? SCDImgLocalSocket::defaultPath(port) : localPath);
+
+   struct sockaddr_un addr;
+
+   memset(&addr,0,sizeof(addr));
+
+   if (path.size()>=static_cast<int>(sizeof(addr.sun_path)))
+   {
+      return false;
+   }
+
+   addr.sun_family = AF_UNIX;
+
+   memcpy(addr.sun_path,path.constData(),static_cast<size_t>(path.size()));
+
+   localSock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (localSock<0)
+   {
+      return false;
+   }
+
+   QByteArray head = header.left(header.size()-1) + "\tF\n"; // F: reply with a descriptor
+
+   if (::connect(localSock,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr))!=0 ||
+       ::send(localSock,head.constData(),static_cast<size_t>(head.size()),MSG_NOSIGNAL)!=head.size())
+   {
+      closeLocal(); // stale socket file or accept backlog full
+
+      return false;
+   }
+
+   connectedOnce = true;
+
+   lastError.clear();
+   localHead.clear();
+   buffer.clear();
+   validator.clear();
+
+   notModified = false;
+
+   localNotifier = new QSocketNotifier(localSock, QSocketNotifier::Read, this);
+
+   connect(localNotifier, SIGNAL(activated(int)), this, SLOT(onLocalReadyRead()));
+
+   if (readTimeout>0)
+   {
+      timer.start(readTimeout);
+   }
+
+   emit notifyConnected("Connected to: " + QString::fromUtf8(path), host, port);
+
+   return true;
+}
+
+/**
+ * @brief SCDImgClient::onLocalReadyRead local GET reply: FD\t<offset>\t<size>[\t<validator>]\n and the descriptor,
+ *                                       or an error message
+ */
+void SCDImgClient::onLocalReadyRead()
+{
+   int ret = SCDImgLocalSocket::receive(localSock, localHead, localFd);
+
+   int eol = localHead.indexOf('\n');
+
+   if (eol<0)
+   {
+      if (ret>0)
+      {
+         return; // reply not complete
+      }
+
+      lastError = (ret<0) ? "Socket read error: " + opFileName : "Connection closed by server: " + opFileName;
+
+      commandStatus = TS_ERROR;
+
+      localDone();
+
+      return;
+   }
+
+   QList<QByteArray> fields = localHead.left(eol).trimmed().split('\t');
+
+   bool ok = (fields.at(0)=="FD" && fields.count()>=3 && localFd>=0);
+
+   if (ok)
+   {
+      localOffset = fields.at(1).toLongLong(&ok);
+   }
+
+   if (ok)
+   {
+      filesize = fields.at(2).toInt(&ok);
+   }
+
+   validator = fields.value(3);
+
+   if (!ok)
+   {
+      lastError = localHead.left(eol); // server error
+
+      commandStatus = TS_ERROR;
+
+      localDone();
+
+      return;
+   }
+
+   emit fileReceived(fileName);
+
+   switch(downloadStream)
+   {
+      case DS_TO_STDOUT: // copy in kernel from server descriptor to stdout
+
+        fflush(stdout);
+
+        ok = SCDImgLocalSocket::copyRange(localFd, localOffset, filesize, fileno(stdout));
+
+        if (!ok)
+        {
+           lastError = "Write error: stdout";
+        }
+
+      break;
+
+      case DS_TO_BUFFER:
+
+        ok = SCDImgLocalSocket::readRange(localFd, localOffset, filesize, buffer);
+
+        if (!ok)
+        {
+           lastError = "Read error: " + fileName;
+        }
+
+      break;
+
+      default:
+
+        ok = writeFile();
+
+      break;
+   }
+
+   commandStatus = ok ? TS_SUCCESS : TS_ERROR;
+
+   localDone();
+}
+
+/**
+ * @brief SCDImgClient::localDone local GET completed: as a TCP command on disconnection
+ */
+void SCDImgClient::localDone()
+{
+   closeLocal();
+
+   QString mess = "Connection: closed";
+
+   if (commandStatus==TS_ERROR)
+   {
+      mess = lastError;
+   }
+
+   emit notifyDisconnect(success(),mess.trimmed());
+
+   emitEndSignal(transferMode != TM_MULTIFILE, lastError); // finish signal is self emitted by sendNext()
+
+   if (transferMode == TM_MULTIFILE)
+   {
+      sendNext();
+   }
+}
+
+/**
+ * @brief SCDImgClient::closeLocal close Unix socket and descriptor of local GET
+ */
+void SCDImgClient::closeLocal()
+{
+   if (localNotifier)
+   {
+      localNotifier->setEnabled(false);
+      localNotifier->deleteLater(); // can be called by its activated signal
+      localNotifier = Q_NULLPTR;
+   }
+
+   if (localFd>=0)
+   {
+      ::close(localFd);
+      localFd = -1;
+   }
+
+   if (localSock>=0)
+   {
+      ::close(localSock);
+      localSock = -1;
+   }
+}
+
+/**
+ * @brief SCDImgClient::connectReplica connect to current server of route with connect timeout
+ */
+void SCDImgClient::connectReplica()
+{
+   if (connectTimeout>0)
+   {
+      timer.start(connectTimeout);
+   }
+
+   connectToHost(host, port, QIODevice::ReadWrite);
+}
+
+/**
+ * @brief SCDImgClient::nextReplica connection to current server failed: command is sent to the next server of route
+ * @return true if another server is tried, false if route is over (command fails)
+ */
+bool SCDImgClient::nextReplica()
+{
+   if (!ring || connectedOnce || routeIndex+1>=route.count())
+   {
+      return false;
+   }
+
+   timer.stop();
+
+   routeIndex++;
+
+   host = route.at(routeIndex).host;
+   port = route.at(routeIndex).port;
+
+   commandStatus = TS_PENDING;
+
+   lastError.clear();
+
+   QMetaObject::invokeMethod(this, "connectReplica", Qt::QueuedConnection); // reconnect out of socket error signal
+
+   return true;
+}
+
+/**
+ * @brief SCDImgClient::putFile
+ * @return
+ */
+int SCDImgClient::putFile()
+{
+   if (write(header.constData(),header.size())==-1)
+   {
+      lastError = "Write file header error!";
+      return 0;
+   }
+
+   if (deltaPut || hashPut) // data is sent once signatures (or send request) are received
+   {
+      operationStatus = WAITINGFORHEADER;
+
+      replyBuff.clear();
+
+      return 1;
+   }
+
+   if (write(fileBuff->constData(),fileBuff->size())==-1)
+   {
+      lastError = "Write file error!";
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClient::sendDelta delta PUT: read the block signatures sent by server (<block size>\t<count>\n<signatures>),
+ *                                then send the delta stream of the file
+ * @return 1 on success (or signatures not entirely received), 0 on failure
+ */
+int SCDImgClient::sendDelta()
+{
+   replyBuff += readAll();
+
+   int eol = replyBuff.indexOf('\n');
+
+   if (eol<0)
+   {
+      return 1; // wait for signatures header
+   }
+
+   QList<QByteArray> fields = replyBuff.left(eol).split('\t');
+
+   bool ok1 = false;
+   bool ok2 = false;
+
+   int blockSize = fields.value(0).toInt(&ok1);
+   int count     = fields.value(1).toInt(&ok2);
+
+   if (fields.count()!=2 || !ok1 || !ok2 || count<0 || (count>0 && blockSize<=0))
+   {
+      lastError = replyBuff.left(eol); // error message of server
+      return 0;
+   }
+
+   if (replyBuff.size()-eol-1 < count*SCDImgDelta::SIG_SIZE)
+   {
+      return 1; // wait for signatures
+   }
+
+   QByteArray stream = SCDImgDelta::encode(*fileBuff, replyBuff.mid(eol+1,count*SCDImgDelta::SIG_SIZE), blockSize);
+
+   replyBuff.clear();
+
+   operationStatus = WAITINGFORDATA; // wait for ok
+
+   if (write(stream)==-1)
+   {
+      lastError = "Write delta error!";
+      return 0;
+   }
 
-   commandStatus = TS_INACTIVE;
-   transferMode  = TM_NONE;
+   return 1;
 }
 
 /**
- * @brief SCDImgClient::putFile
- * @return
+ * @brief SCDImgClient::sendData hash-first PUT: read the server answer, "ok" (content already stored, upload completed)
+ *                               or "send\n" (send the file)
+ * @return 1 on success (or answer not entirely received), 0 on failure
  */
-int SCDImgClient::putFile()
+int SCDImgClient::sendData()
 {
-   if (write(header.constData(),header.size())==-1)
+   replyBuff += readAll();
+
+   if (replyBuff=="ok") // the server closes the connection after ok
    {
-      lastError = "Write file header error!";
+      uploadSkipped = true;
+      commandStatus = TS_SUCCESS;
+
+      replyBuff.clear();
+
+      disconnectFromHost();
+
+      return 1;
+   }
+
+   int eol = replyBuff.indexOf('\n');
+
+   if (eol<0)
+   {
+      return 1; // wait for answer
+   }
+
+   if (replyBuff.left(eol)!="send")
+   {
+      lastError = replyBuff; // error message of server
       return 0;
    }
 
+   replyBuff.clear();
+
+   operationStatus = WAITINGFORDATA; // wait for ok
+
    if (write(fileBuff->constData(),fileBuff->size())==-1)
    {
       lastError = "Write file error!";
@@ -98,6 +642,8 @@ int SCDImgClient::delFile()
  */
 void SCDImgClient::emitEndSignal(bool emitFinished, QString errMess)
 {
+   timer.stop();
+
    bool success = this->success();
 
    switch (operationType)
@@ -107,6 +653,8 @@ void SCDImgClient::emitEndSignal(bool emitFinished, QString errMess)
       break;
 
       case GET:
+      case INFO:
+      case SHEET:
         emit downloadFinished(success, errMess);
         emit downloadFinished(success, fileName, buffer, errMess);
       break;
@@ -130,33 +678,81 @@ int SCDImgClient::sendFile(QString fileName, QString destPath)
 {
    commandStatus = TS_INACTIVE;
 
-   if (!QFile::exists(fileName))
+   LoadedFile file;
+
+   if (prefetch.isStarted() && prefetchName==fileName)
+   {
+      file = prefetch.result(); // read (and hashed) while previous file was uploaded
+   }
+   else
+   {
+      file = loadFile(fileName, hashFirst);
+   }
+
+   prefetch = QFuture<LoadedFile>();
+
+   prefetchName.clear();
+
+   if (!file.error.isEmpty())
    {
-      lastError = "File not found: " + fileName;
+      lastError = file.error;
       return 0;
    }
 
+   buffer = file.data;
+
+   if (transferMode==TM_MULTIFILE && fIndex+1<fList.count()) // pipeline: the next file is read and hashed while this one is uploaded
+   {
+      prefetchName = sourceFolder + fList.at(fIndex+1);
+      prefetch     = QtConcurrent::run(&SCDImgClient::loadFile, prefetchName, hashFirst);
+   }
+
+   putBuff(destPath, &buffer, file.hash);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClient::loadFile read a file to upload, and hash it for hash-first uploads (runs on a pool thread for
+ *                               prefetched files: no members are used)
+ * @param fileName
+ * @param hash     compute SHA-256 of data
+ * @return file data, or error
+ */
+SCDImgClient::LoadedFile SCDImgClient::loadFile(QString fileName, bool hash)
+{
+   LoadedFile file;
+
+   if (!QFile::exists(fileName))
+   {
+      file.error = "File not found: " + fileName;
+      return file;
+   }
+
    QFile f(fileName);
 
    if (!f.open(QIODevice::ReadOnly))
    {
-      lastError = "Open File Error: " + fileName + " => " + f.errorString();
-      return 0;
+      file.error = "Open File Error: " + fileName + " => " + f.errorString();
+      return file;
    }
 
-   buffer = f.readAll();
+   file.data = f.readAll();
 
-   if (buffer.size()==0)
+   if (file.data.size()==0)
    {
-      lastError = "Error to read file: " + fileName + " => " + f.errorString();
-      return 0;
+      file.error = "Error to read file: " + fileName + " => " + f.errorString();
+      return file;
    }
 
    f.close();
 
-   sendFileBuff(destPath, &buffer);
+   if (hash)
+   {
+      file.hash = QCryptographicHash::hash(file.data, QCryptographicHash::Sha256);
+   }
 
-   return 1;
+   return file;
 }
 
 /**
@@ -204,12 +800,9 @@ int SCDImgClient::requestFile(QString filePath, QString destFolderPath, bool thu
    transferMode   = TM_SINGLEFILE;
    downloadStream = thumbnail ? DS_TO_THUMBNAIL : DS_TO_FILE;
 
-   QString thumbOption = thumbnail ? "\tT" : "";
-
-   header.clear();
-   header.append("SCDFTH:1.0\tGET:"+fileName+thumbOption+"\n");
+   getHeader(thumbnail);
    
-   connectToHost(host, port, QIODevice::ReadWrite);
+   connectHost();
 
    return 1;
 }
@@ -229,12 +822,89 @@ int SCDImgClient::requestFile(QString filePath, bool thumbnail, bool stream_to_s
    transferMode   = TM_SINGLEFILE;
    downloadStream = stream_to_stdout ? DS_TO_STDOUT : DS_TO_BUFFER;
 
-   QString thumbOption = thumbnail ? "\tT" : "";
+   getHeader(thumbnail);
+
+   connectHost();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClient::requestInfo ask width, height, format, orientation and capture date of remote files, in one
+ *                                  command. The reply (see receivedFile()) has a line for each path, in order:
+ *                                  <width>\t<height>\t<format>\t<orientation>\t<date>, or '-' if the file is not
+ *                                  stored. On a servers ring the command is sent to the server of the first path.
+ * @param filePaths
+ * @param stream_to_stdout
+ * @return
+ */
+int SCDImgClient::requestInfo(QStringList filePaths, bool stream_to_stdout)
+{
+   if (filePaths.isEmpty())
+   {
+      lastError = "No file paths";
+      return 0;
+   }
+
+   fileName       = filePaths.first();
+   opFileName     = fileName;
+   operationType  = INFO;
+   commandStatus  = TS_PENDING;
+   transferMode   = TM_SINGLEFILE;
+   downloadStream = stream_to_stdout ? DS_TO_STDOUT : DS_TO_BUFFER;
+   thumbRequest   = false;
+   notModified    = false;
+
+   header.clear();
+   header.append("SCDFTH:1.0\tINFO:" + fileName);
+
+   if (filePaths.count()>1)
+   {
+      header.append("\t" + QString::number(filePaths.count()-1) + "\n" + QStringList(filePaths.mid(1)).join("\n")); // batch: more paths follow
+   }
+
+   header.append("\n");
+
+   connectHost();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClient::requestSheet ask the contact sheet of a remote folder: the thumbnails of its images in a single
+ *                                   JPEG sprite. The reply (see receivedFile()) is
+ *
+ *                                     <count>\t<total>\t<columns>\n
+ *                                     <x>\t<y>\t<width>\t<height>\t<file name>\n  (count lines)
+ *                                     <JPEG sprite>
+ *
+ * @param folderPath remote folder
+ * @param page       page of folder images (from 0)
+ * @param pageSize   images for each page (0: whole folder, up to server limit)
+ * @return
+ */
+int SCDImgClient::requestSheet(QString folderPath, int page, int pageSize)
+{
+   fileName       = folderPath;
+   opFileName     = fileName;
+   operationType  = SHEET;
+   commandStatus  = TS_PENDING;
+   transferMode   = TM_SINGLEFILE;
+   downloadStream = DS_TO_BUFFER;
+   thumbRequest   = false;
+   notModified    = false;
 
    header.clear();
-   header.append("SCDFTH:1.0\tGET:"+fileName+thumbOption+"\n");
+   header.append("SCDFTH:1.0\tSHEET:" + fileName);
 
-   connectToHost(host, port, QIODevice::ReadWrite);
+   if (pageSize>0)
+   {
+      header.append("\t" + QString::number(page) + "\t" + QString::number(pageSize));
+   }
+
+   header.append("\n");
+
+   connectHost();
 
    return 1;
 }
@@ -254,7 +924,7 @@ int SCDImgClient::deleteFile(QString fileName)
    header.clear();
    header.append("SCDFTH:1.0\tDEL:"+fileName+"\n");
 
-   connectToHost(host, port, QIODevice::ReadWrite);
+   connectHost();
 
    return 1;
 }
@@ -264,6 +934,17 @@ int SCDImgClient::deleteFile(QString fileName)
  * @param filePath
  */
 void SCDImgClient::sendFileBuff(QString filePath, QByteArray *buff)
+{
+   putBuff(filePath, buff, hashFirst ? QCryptographicHash::hash(*buff, QCryptographicHash::Sha256) : QByteArray());
+}
+
+/**
+ * @brief SCDImgClient::putBuff
+ * @param filePath
+ * @param buff
+ * @param hash     SHA-256 of buff (empty: plain PUT)
+ */
+void SCDImgClient::putBuff(QString filePath, QByteArray *buff, const QByteArray &hash)
 {
    fileName      = filePath;
    opFileName    = fileName;
@@ -272,10 +953,17 @@ void SCDImgClient::sendFileBuff(QString filePath, QByteArray *buff)
    commandStatus = TS_PENDING;
    transferMode  = (transferMode != TM_MULTIFILE) ? TM_SINGLEFILE : transferMode;
 
+   deltaPut = (delta && buff->size()>=SCDImgDelta::MIN_FILE);
+   hashPut  = (hashFirst && !deltaPut && !hash.isEmpty());
+
+   uploadSkipped = false;
+
+   QString options = hashPut ? "\tH:" + QString::fromLatin1(hash.toHex()) : "";
+
    header.clear();
-   header.append("SCDFTH:1.0\tPUT:"+fileName+"\t"+QString::number(buff->size())+"\n");
+   header.append("SCDFTH:1.0\t"+QString(deltaPut ? "DPUT:" : "PUT:")+fileName+"\t"+QString::number(buff->size())+options+"\n");
 
-   connectToHost(host, port, QIODevice::ReadWrite);
+   connectHost();
 }
 
 /**
@@ -296,6 +984,42 @@ QByteArray *SCDImgClient::receivedFile()
     return &buffer;
 }
 
+/**
+ * @brief SCDImgClient::getValidator
+ * @return server validator of last downloaded file (empty if cache is disabled)
+ */
+QByteArray SCDImgClient::getValidator()
+{
+   return validator;
+}
+
+/**
+ * @brief SCDImgClient::isNotModified
+ * @return true if last downloaded file was not modified on server, and it has been read from cache
+ */
+bool SCDImgClient::isNotModified()
+{
+   return notModified;
+}
+
+/**
+ * @brief SCDImgClient::isUploadSkipped
+ * @return true if last PUT was hash-first and server already stored its content: data has not been sent
+ */
+bool SCDImgClient::isUploadSkipped()
+{
+   return uploadSkipped;
+}
+
+/**
+ * @brief SCDImgClient::hasConnected
+ * @return true if last command has connected to its server: a failed command could have been executed
+ */
+bool SCDImgClient::hasConnected()
+{
+   return connectedOnce;
+}
+
 /**
  * @brief SCDImgClient::success return true if commandStatus == TS_SUCCESS.
  *                              You can call this method after disconnection to check command execution result.
@@ -313,6 +1037,17 @@ void SCDImgClient::onConnected()
 {
    lastError.clear();
 
+   connectedOnce = true;
+
+   if (readTimeout>0)
+   {
+      timer.start(readTimeout); // connect timeout is replaced by read timeout
+   }
+   else
+   {
+      timer.stop();
+   }
+
    QString mess = "Connected to: " + host + ":" + QString::number(port);
 
    emit notifyConnected(mess, host, port);
@@ -328,6 +1063,8 @@ void SCDImgClient::onConnected()
       break;
 
       case GET:
+      case INFO:
+      case SHEET:
       {
          ret = getFile();         
       }
@@ -384,6 +1121,11 @@ void SCDImgClient::onError(QAbstractSocket::SocketError socketError)
 
    if (socketState==QAbstractSocket::UnconnectedState)
    {
+       if (nextReplica()) // server down: try next server of ring
+       {
+          return;
+       }
+
        emitEndSignal(transferMode!=TM_MULTIFILE,lastError); // finish signal is self emitted by sendNext()
 
        if (transferMode==TM_MULTIFILE)
@@ -402,11 +1144,38 @@ void SCDImgClient::onError(QAbstractSocket::SocketError socketError)
  */
 void SCDImgClient::onReadyRead()
 {
+   if (readTimeout>0)
+   {
+      timer.start(readTimeout);
+   }
+
    switch (operationType)
    {
       case DEL:  // server response to DEL command
       case PUT:  // server response to PUT command
       {
+         if (operationType==PUT && deltaPut && operationStatus==WAITINGFORHEADER) // delta PUT: signatures received
+         {
+            if (!sendDelta())
+            {
+               commandStatus = TS_ERROR;
+               abort();
+            }
+
+            return;
+         }
+
+         if (operationType==PUT && hashPut && operationStatus==WAITINGFORHEADER) // hash-first PUT: server answer received
+         {
+            if (!sendData())
+            {
+               commandStatus = TS_ERROR;
+               abort();
+            }
+
+            return;
+         }
+
          QByteArray buff = readAll();
 
          if (buff.trimmed()=="ok")
@@ -423,7 +1192,9 @@ void SCDImgClient::onReadyRead()
       }
       return;
 
-      case GET: // server response to GET command
+      case GET:  // server response to GET command
+      case INFO: // server response to INFO command: as a GET to buffer or stdout
+      case SHEET:
       {
          switch(operationStatus)
          {
@@ -431,9 +1202,28 @@ void SCDImgClient::onReadyRead()
             {
                QByteArray buff = readLine(256);
 
+               QList<QByteArray> fields = buff.trimmed().split('\t'); // <size>[\t<validator>] or NM\t<validator>
+
                bool ok;
 
-               filesize = QString(buff).trimmed().toInt(&ok);
+               if (fields.at(0)=="NM" && fields.count()==2 && cache) // not modified: data are read from cache
+               {
+                  ok = cache->lookup(SCDImgClientCache::key(fileName,thumbRequest),validator,&buffer);
+
+                  notModified = ok;
+                  filesize    = buffer.size();
+
+                  if (!ok)
+                  {
+                     buff = "Cached file not found: " + fileName.toUtf8();
+                  }
+               }
+               else
+               {
+                  filesize = fields.at(0).toInt(&ok);
+
+                  validator = fields.value(1);
+               }
 
                if (ok)
                {
@@ -457,6 +1247,11 @@ void SCDImgClient::onReadyRead()
 
                if (buffer.size()>=filesize)
                {
+                  if (cache && !notModified && !validator.isEmpty())
+                  {
+                     cache->store(SCDImgClientCache::key(fileName,thumbRequest),validator,buffer); // a failed store only disables revalidation
+                  }
+
                   emit fileReceived(fileName);
 
                   switch(downloadStream)
@@ -476,50 +1271,13 @@ void SCDImgClient::onReadyRead()
                      case DS_TO_THUMBNAIL:
                      case DS_TO_FILE:   // write output to file
                      {
-                        if (downloadStream==DS_TO_THUMBNAIL)
-                        {
-                           fileName = getThumbName(fileName);
-                        }
-
-                        QFileInfo fi(fileName);
-
-                        QDir dir(destFolder);
-
-                        if (dir.mkpath(dir.absolutePath()))
+                        if (writeFile())
                         {
-                           QString filePath = dir.absolutePath() + "/" + fi.fileName();
-
-                           QFile f(filePath);
+                           commandStatus = TS_SUCCESS;
 
-                           emit fileSaving(filePath);
+                           disconnectFromHost();
 
-                           if (f.open(QIODevice::WriteOnly))
-                           {
-                              qint64 ret = f.write(buffer);
-
-                              f.close();
-
-                              if (ret>0)
-                              {
-                                 commandStatus = TS_SUCCESS;                      
-
-                                 disconnectFromHost();
-
-                                 return;
-                              }
-                              else
-                              {
-                                 lastError = "Write file error: " + fileName + " => " + f.errorString();
-                              }
-                           }
-                           else
-                           {
-                              lastError = "Open file error: " + fileName + " => " + f.errorString();
-                           }
-                        }
-                        else
-                        {
-                           lastError = "Make dir error: " + dir.absolutePath();
+                           return;
                         }
                      }
                      break;
@@ -537,6 +1295,118 @@ void SCDImgClient::onReadyRead()
    }
 }
 
+/**
+ * @brief SCDImgClient::writeFile save downloaded file into destination folder: local GETs copy it in kernel from
+ *                                the descriptor passed by server
+ * @return 1 on success, 0 on failure (lastError is set)
+ */
+int SCDImgClient::writeFile()
+{
+   if (downloadStream==DS_TO_THUMBNAIL)
+   {
+      fileName = getThumbName(fileName);
+   }
+
+   QFileInfo fi(fileName);
+
+   QDir dir(destFolder);
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastError = "Make dir error: " + dir.absolutePath();
+      return 0;
+   }
+
+   QString filePath = dir.absolutePath() + "/" + fi.fileName();
+
+   QFile f(filePath);
+
+   emit fileSaving(filePath);
+
+   if (!f.open(QIODevice::WriteOnly))
+   {
+      lastError = "Open file error: " + fileName + " => " + f.errorString();
+      return 0;
+   }
+
+   bool ok;
+
+   if (localFd>=0)
+   {
+      ok = SCDImgLocalSocket::copyRange(localFd, localOffset, filesize, f.handle());
+   }
+   else
+   {
+      ok = (f.write(buffer)>0);
+   }
+
+   f.close();
+
+   if (!ok)
+   {
+      lastError = "Write file error: " + fileName + " => " + f.errorString();
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClient::onBytesWritten upload is going on: restart read timeout
+ * @param bytes
+ */
+void SCDImgClient::onBytesWritten(qint64 bytes)
+{
+   Q_UNUSED(bytes)
+
+   if (readTimeout>0 && timer.isActive())
+   {
+      timer.start(readTimeout);
+   }
+}
+
+/**
+ * @brief SCDImgClient::onTimeout connect or read timeout expired: abort current command
+ */
+void SCDImgClient::onTimeout()
+{
+   commandStatus = TS_ERROR;
+
+   if (localSock>=0) // local GET: server has not replied
+   {
+      lastError = "Read timeout: " + opFileName;
+
+      localDone();
+
+      return;
+   }
+
+   if (state()!=QAbstractSocket::ConnectedState)
+   {
+      lastError = "Connection timeout: " + host + ":" + QString::number(port);
+
+      abort();
+
+      if (nextReplica()) // server unreachable: try next server of ring
+      {
+         return;
+      }
+
+      emitEndSignal(transferMode!=TM_MULTIFILE,lastError); // finish signal is self emitted by sendNext()
+
+      if (transferMode==TM_MULTIFILE)
+      {
+         sendNext(); // send the next file of list
+      }
+
+      return;
+   }
+
+   lastError = "Read timeout: " + opFileName;
+
+   abort(); // command ends on disconnection
+}
+
 /**
  * @brief SCDImgClient::onSendNext send next file of list on end of list emits finished signal
  */
@@ -599,5 +1469,7 @@ QString SCDImgClient::getCurrentFileName()
  */
 void SCDImgClient::stop()
 {
+   closeLocal();
+
    abort();
 }
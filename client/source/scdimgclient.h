@@ -5,6 +5,13 @@
 #include <QByteArray>
 #include <QTcpSocket>
 #include <QDir>
+#include <QTimer>
+#include <QFuture>
+#include <QSocketNotifier>
+
+#include "scdimgclientcache.h"
+#include "scdimgclientring.h"
+#include "scdimgdelta.h"
 
 class SCDImgClient : public QTcpSocket
 {
@@ -12,7 +19,7 @@ class SCDImgClient : public QTcpSocket
 
   private:
 
-    enum OperationType   {PUT,GET,DEL};
+    enum OperationType   {PUT,GET,DEL,INFO,SHEET};
     enum OperationStatus {WAITINGFORHEADER,WAITINGFORDATA};
     enum CommandStatus   {TS_INACTIVE,TS_PENDING,TS_SUCCESS,TS_ERROR};
     enum TransferMode    {TM_NONE=0,TM_SINGLEFILE=1,TM_MULTIFILE=2};
@@ -21,7 +28,9 @@ class SCDImgClient : public QTcpSocket
     QString host;
     quint16 port;
 
-    int  timeout;
+    int    connectTimeout; // msecs to establish the connection (0: no timeout)
+    int    readTimeout;    // max msecs without socket activity once connected (0: no timeout)
+    QTimer timer;
 
     QString fileName;         // file name to GET/PUT
     QString opFileName;       // last operation file name
@@ -39,6 +48,42 @@ class SCDImgClient : public QTcpSocket
     QByteArray  buffer;
     QByteArray *fileBuff = Q_NULLPTR;
 
+    SCDImgClientCache *cache = Q_NULLPTR; // downloads cache (not owned)
+    QByteArray         validator;         // server validator of last downloaded file
+    bool               thumbRequest;      // last GET requested a thumbnail
+    bool               notModified;       // last GET was served from cache
+
+    SCDImgClientRing     *ring = Q_NULLPTR; // servers ring (not owned): each command is sent to the owner of its path
+    int                   replicas;          // servers tried when connection fails (owner first)
+    QList<SCDImgEndpoint> route;             // servers of current command
+    int                   routeIndex;        // server being tried
+    bool                  connectedOnce;     // current command has connected: it is not retried on another server
+
+    bool       delta = false; // PUT of large files sends a delta against the server copy
+    bool       deltaPut;      // current PUT is a delta PUT
+    QByteArray replyBuff;     // delta PUT: block signatures received from server, hash-first PUT: server answer
+
+    struct LoadedFile // file read (and hashed) by sendFile
+    {
+       QByteArray data;
+       QByteArray hash;  // SHA-256 of data (hash-first uploads)
+       QString    error;
+    };
+
+    bool                hashFirst = false; // PUT declares the content hash: data is sent only if server has not that content
+    bool                hashPut;           // current PUT is a hash-first PUT
+    bool                uploadSkipped;     // last PUT completed without sending data
+    QFuture<LoadedFile> prefetch;          // sendFiles: next file of list, read and hashed while current file is uploaded
+    QString             prefetchName;      // file name of prefetch
+
+    bool             localEnabled = true;         // GET from a server on this host uses its Unix socket (if listening)
+    QString          localPath;                   // Unix socket path (empty: SCDImgLocalSocket::defaultPath(port))
+    int              localSock = -1;              // Unix socket of current GET (-1: TCP)
+    QSocketNotifier *localNotifier = Q_NULLPTR;
+    QByteArray       localHead;                   // reply header being received
+    int              localFd = -1;                // descriptor received from server
+    qint64           localOffset;                 // object offset into localFd
+
     int operationType;
     int operationStatus; // used only for GET Operation
     int commandStatus;
@@ -53,15 +98,50 @@ class SCDImgClient : public QTcpSocket
     int putFile();
     int getFile();
     int delFile();
+    int sendDelta();
+    int sendData();
+
+    void putBuff(QString filePath, QByteArray *buff, const QByteArray &hash); // PUT of buff, hash is declared by hash-first uploads
+
+    static LoadedFile loadFile(QString fileName, bool hash);
 
     void sendNext();
 
+    void connectHost(); // connect to server with connect timeout
+
+    bool nextReplica(); // connection to current server failed: try the next server of the route
+
+    bool localSocket(); // current GET can be sent to the Unix socket of a server on this host
+    bool localGet();    // send current GET to Unix socket: false if server is not listening on it
+    void localDone();   // local GET completed
+    void closeLocal();
+
+    int writeFile(); // save downloaded file into destFolder
+
+    void getHeader(bool thumbnail); // GET header: conditional if file is cached
+
     void emitEndSignal(bool emitFinished, QString errMess);
 
   public:
 
     SCDImgClient(QString host, quint16 port, int timeout);
 
+    virtual ~SCDImgClient();
+
+    void setTimeouts(int connectTimeout, int readTimeout);
+
+    void setCache(SCDImgClientCache *cache); // GET revalidates cached copies and caches downloads (null: disabled)
+
+    void setRing(SCDImgClientRing *ring, int replicas=2); // route commands to servers of ring (null: use host and port)
+
+    void setDelta(bool enabled); // upload files of at least SCDImgDelta::MIN_FILE bytes as a delta against the server copy
+
+    void setHashFirst(bool enabled); // PUT declares the SHA-256 of file: data is not sent if server already stores that content
+
+    void setLocalSocket(bool enabled, QString path=QString()); // GET from a server on this host reads a descriptor passed on its Unix socket
+
+    QString currentServer(); // host:port of last command
+
     int sendFile(QString fileName, QString destPath);
 
     int sendFiles(QString folderPath, QString destFolderPath, bool breakOnError);
@@ -72,12 +152,23 @@ class SCDImgClient : public QTcpSocket
 
     int deleteFile(QString fileName);
 
+    int requestInfo(QStringList filePaths, bool stream_to_stdout=false); // image metadata of remote files, one line for each path
+
+    int requestSheet(QString folderPath, int page=0, int pageSize=0); // thumbnails of a remote folder (page) in a single sprite
+
     void sendFileBuff(QString filePath, QByteArray *buff);
 
     QString getLastError();
 
     QByteArray *receivedFile();
 
+    QByteArray getValidator();
+    bool       isNotModified();
+
+    bool isUploadSkipped(); // last PUT completed without sending data (hash-first)
+
+    bool hasConnected(); // last command has connected to its server (failed otherwise before reaching it)
+
     int success();
 
     QString getThumbName(QString fileName);
@@ -93,6 +184,14 @@ class SCDImgClient : public QTcpSocket
     void onError(QAbstractSocket::SocketError socketError);
 
     void onReadyRead();
+    void onBytesWritten(qint64 bytes);
+    void onTimeout();
+
+  private slots:
+
+    void connectReplica();
+
+    void onLocalReadyRead(); // local GET reply
 
   signals:
 
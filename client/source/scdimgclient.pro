@@ -1,5 +1,6 @@
 QT -= gui
 QT += network
+QT += concurrent
 
 CONFIG += c++11 console
 CONFIG -= app_bundle
@@ -20,7 +21,19 @@ INCLUDEPATH += "../../lib/protocol/"
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += main.cpp \
-    scdimgclient.cpp
+    scdimgclient.cpp \
+    scdimgclientbatch.cpp \
+    scdimgclientcache.cpp \
+    scdimgclientpool.cpp \
+    scdimgclientring.cpp \
+    ../../lib/protocol/scdimgdelta.cpp \
+    ../../lib/protocol/scdimglocalsocket.cpp
 
 HEADERS += \
-    scdimgclient.h
+    scdimgclient.h \
+    scdimgclientbatch.h \
+    scdimgclientcache.h \
+    scdimgclientpool.h \
+    scdimgclientring.h \
+    ../../lib/protocol/scdimgdelta.h \
+    ../../lib/protocol/scdimglocalsocket.h
@@ -0,0 +1,418 @@
+/**
+ * @class  SCDImgClientBatch
+ *
+ * @brief Bulk commands for SCD Image Server
+ *
+ *        Runs the GET/PUT/DEL commands of a manifest concurrently over pooled connections, reporting each result
+ *        as soon as its command completes:
+ *
+ *          SCDImgClientBatch batch("localhost", 12345);
+ *
+ *          connect(&batch, &SCDImgClientBatch::result, [](int line, QString command, QString path, bool success, ...)
+ *          {
+ *             ...
+ *          });
+ *
+ *          batch.start("./manifest.txt");
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QStringList>
+
+#include <stdio.h>
+
+#include "scdimgclientbatch.h"
+
+/**
+ * @brief SCDImgClientBatch::SCDImgClientBatch
+ * @param host           server host (when no ring is set)
+ * @param port           server port (when no ring is set)
+ * @param parent
+ * @param maxConnections max concurrent connections for each server
+ */
+SCDImgClientBatch::SCDImgClientBatch(QString host, quint16 port, QObject *parent, int maxConnections) : QObject(parent), host(host), port(port), maxConnections(qMax(1,maxConnections))
+{
+   pool     = new SCDImgClientPool(this, this->maxConnections);
+   ring     = 0;
+   replicas = 1;
+
+   lineNumber  = 0;
+   eof         = true;
+   ended       = true;
+   inFlight    = 0;
+   okCount     = 0;
+   failedCount = 0;
+   byteCount   = 0;
+}
+
+/**
+ * @brief SCDImgClientBatch::setRing route each path to its server of a consistent hash ring. If connection to that
+ *                                   server fails the next servers of the ring are tried, as SCDImgClient::setRing does
+ * @param ring     not owned (null: all commands are sent to host and port)
+ * @param replicas servers tried for each command (owner included)
+ */
+void SCDImgClientBatch::setRing(SCDImgClientRing *ring, int replicas)
+{
+   this->ring     = ring;
+   this->replicas = qMax(1,replicas);
+}
+
+/**
+ * @brief SCDImgClientBatch::start open the manifest and start its commands. Commands run when the event loop runs.
+ * @param manifest file path, "-" for stdin
+ * @return 1 on success, 0 if the manifest can not be opened (see lastError)
+ */
+int SCDImgClientBatch::start(QString manifest)
+{
+   bool ok;
+
+   this->manifest.close();
+
+   if (manifest=="-")
+   {
+      ok = this->manifest.open(stdin, QIODevice::ReadOnly);
+   }
+   else
+   {
+      this->manifest.setFileName(manifest);
+
+      ok = this->manifest.open(QIODevice::ReadOnly);
+   }
+
+   if (!ok)
+   {
+      lastErrorMsg = "Open file error: " + manifest + " => " + this->manifest.errorString();
+      return 0;
+   }
+
+   lineNumber  = 0;
+   eof         = false;
+   ended       = false;
+   inFlight    = 0;
+   okCount     = 0;
+   failedCount = 0;
+   byteCount   = 0;
+
+   timer.start();
+
+   QMetaObject::invokeMethod(this, "fill", Qt::QueuedConnection); // results are emitted once the caller has connected and runs the event loop
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClientBatch::succeeded
+ * @return commands succeeded
+ */
+int SCDImgClientBatch::succeeded()
+{
+   return okCount;
+}
+
+/**
+ * @brief SCDImgClientBatch::failed
+ * @return commands failed, invalid lines included
+ */
+int SCDImgClientBatch::failed()
+{
+   return failedCount;
+}
+
+/**
+ * @brief SCDImgClientBatch::bytes
+ * @return bytes of files sent and received
+ */
+qint64 SCDImgClientBatch::bytes()
+{
+   return byteCount;
+}
+
+/**
+ * @brief SCDImgClientBatch::elapsed
+ * @return msecs since start
+ */
+qint64 SCDImgClientBatch::elapsed()
+{
+   return timer.isValid() ? timer.elapsed() : 0;
+}
+
+/**
+ * @brief SCDImgClientBatch::lastError
+ * @return
+ */
+QString SCDImgClientBatch::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgClientBatch::window
+ * @return max commands in flight: enough to keep every connection busy while next lines are read
+ */
+int SCDImgClientBatch::window()
+{
+   int servers = (ring && ring->count()>0) ? ring->count() : 1;
+
+   return maxConnections*servers*2;
+}
+
+/**
+ * @brief SCDImgClientBatch::fill read manifest lines and start their commands while the window is not full
+ */
+void SCDImgClientBatch::fill()
+{
+   if (ended)
+   {
+      return; // finished already emitted
+   }
+
+   while (!eof && inFlight<window())
+   {
+      QByteArray line = manifest.readLine();
+
+      if (line.isEmpty())
+      {
+         eof = true; // end of manifest (empty lines hold '\n')
+         manifest.close();
+         break;
+      }
+
+      lineNumber++;
+
+      run(lineNumber, QString::fromUtf8(line).trimmed());
+   }
+
+   if (eof && inFlight==0)
+   {
+      ended = true;
+
+      emit finished(failedCount==0);
+   }
+}
+
+/**
+ * @brief SCDImgClientBatch::run parse a manifest line and queue its command
+ * @param line line number
+ * @param text
+ */
+void SCDImgClientBatch::run(int line, QString text)
+{
+   if (text.isEmpty() || text.startsWith('#'))
+   {
+      return;
+   }
+
+   QStringList fields = text.contains('\t') ? text.split('\t', QString::SkipEmptyParts) : text.split(QRegExp(" +"), QString::SkipEmptyParts);
+
+   QString command = fields.at(0).toUpper();
+   QString path;
+   QString local;
+   bool    thumbnail = false;
+
+   if (command=="GET" && fields.count()>=2)
+   {
+      path = fields.at(1);
+
+      for (int i=2; i<fields.count(); i++)
+      {
+         if (fields.at(i)=="T" || fields.at(i)=="-T")
+         {
+            thumbnail = true;
+         }
+         else
+         {
+            local = fields.at(i);
+         }
+      }
+   }
+   else
+   if (command=="PUT" && fields.count()==3)
+   {
+      local = fields.at(1);
+      path  = fields.at(2);
+   }
+   else
+   if (command=="DEL" && fields.count()==2)
+   {
+      path = fields.at(1);
+   }
+
+   inFlight++;
+
+   qint64 started = timer.elapsed();
+
+   if (!path.startsWith('/'))
+   {
+      done(line, command, path, false, 0, started, "Invalid line: " + text);
+      return;
+   }
+
+   Command cmd;
+
+   cmd.line       = line;
+   cmd.command    = command;
+   cmd.path       = path;
+   cmd.local      = local;
+   cmd.thumbnail  = thumbnail;
+   cmd.routeIndex = 0;
+   cmd.started    = started;
+
+   if (ring && ring->count()>0)
+   {
+      cmd.route = ring->lookup(path, replicas);
+   }
+   else
+   {
+      SCDImgEndpoint server;
+
+      server.host = host;
+      server.port = port;
+
+      cmd.route.append(server);
+   }
+
+   if (command=="GET")
+   {
+      if (!local.isEmpty() && (local.endsWith('/') || QFileInfo(local).isDir()))
+      {
+         cmd.local = QDir(local).filePath(QFileInfo(path).fileName()); // dest folder: keep remote file name
+      }
+   }
+   else
+   if (command=="PUT")
+   {
+      QFile f(local);
+
+      if (!f.open(QIODevice::ReadOnly))
+      {
+         done(line, command, path, false, 0, started, "Open file error: " + local + " => " + f.errorString());
+         return;
+      }
+
+      cmd.data = f.readAll();
+
+      f.close();
+   }
+
+   send(cmd);
+}
+
+/**
+ * @brief SCDImgClientBatch::send queue a command to the current server of its route
+ * @param cmd
+ */
+void SCDImgClientBatch::send(Command cmd)
+{
+   SCDImgEndpoint server = cmd.route.at(cmd.routeIndex);
+
+   if (cmd.command=="GET")
+   {
+      pool->get(server.host, server.port, cmd.path, cmd.thumbnail, [this, cmd](SCDImgReply *reply)
+      {
+         if (!reply->success())
+         {
+            if (!retry(cmd, reply))
+            {
+               done(cmd.line, cmd.command, cmd.path, false, 0, cmd.started, reply->errorString());
+            }
+
+            return;
+         }
+
+         QByteArray data = reply->data();
+
+         if (!cmd.local.isEmpty())
+         {
+            QDir().mkpath(QFileInfo(cmd.local).absolutePath());
+
+            QFile f(cmd.local);
+
+            if (!f.open(QIODevice::WriteOnly) || f.write(data)!=data.size())
+            {
+               done(cmd.line, cmd.command, cmd.path, false, 0, cmd.started, "Write file error: " + cmd.local + " => " + f.errorString());
+               return;
+            }
+         }
+
+         done(cmd.line, cmd.command, cmd.path, true, data.size(), cmd.started, QString());
+      });
+   }
+   else
+   if (cmd.command=="PUT")
+   {
+      pool->put(server.host, server.port, cmd.path, cmd.data, [this, cmd](SCDImgReply *reply)
+      {
+         if (!retry(cmd, reply))
+         {
+            done(cmd.line, cmd.command, cmd.path, reply->success(), reply->success() ? cmd.data.size() : 0, cmd.started, reply->errorString());
+         }
+      });
+   }
+   else
+   {
+      pool->del(server.host, server.port, cmd.path, [this, cmd](SCDImgReply *reply)
+      {
+         if (!retry(cmd, reply))
+         {
+            done(cmd.line, cmd.command, cmd.path, reply->success(), 0, cmd.started, reply->errorString());
+         }
+      });
+   }
+}
+
+/**
+ * @brief SCDImgClientBatch::retry send a failed command to the next server of its route. A command is retried only
+ *                                 if its server could not be reached: once connected it could have been executed.
+ * @param cmd
+ * @param reply
+ * @return true if the command has been sent again, false if it is done
+ */
+bool SCDImgClientBatch::retry(Command cmd, SCDImgReply *reply)
+{
+   if (reply->success() || reply->hasConnected() || cmd.routeIndex+1>=cmd.route.count())
+   {
+      return false;
+   }
+
+   cmd.routeIndex++;
+
+   send(cmd);
+
+   return true;
+}
+
+/**
+ * @brief SCDImgClientBatch::done a command has completed: report it and read next lines
+ * @param line    line number
+ * @param command
+ * @param path
+ * @param success
+ * @param bytes
+ * @param started msecs since batch start when command was queued
+ * @param errMsg
+ */
+void SCDImgClientBatch::done(int line, QString command, QString path, bool success, qint64 bytes, qint64 started, QString errMsg)
+{
+   inFlight--;
+
+   if (success)
+   {
+      okCount++;
+      byteCount += bytes;
+   }
+   else
+   {
+      failedCount++;
+   }
+
+   emit result(line, command, path, success, bytes, timer.elapsed()-started, success ? QString() : errMsg);
+
+   QMetaObject::invokeMethod(this, "fill", Qt::QueuedConnection); // read next lines out of pool callbacks
+}
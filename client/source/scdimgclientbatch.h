@@ -0,0 +1,97 @@
+#ifndef SCDIMGCLIENTBATCH_H
+#define SCDIMGCLIENTBATCH_H
+
+#include <QObject>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QList>
+
+#include "scdimgclientpool.h"
+#include "scdimgclientring.h"
+
+/**
+ * @brief The SCDImgClientBatch class runs the commands of a manifest (a file or stdin), one for each line:
+ *
+ *          GET <remote path> [<local file>] [T]
+ *          PUT <local file> <remote path>
+ *          DEL <remote path>
+ *
+ *        Fields are separated by tabs, or by spaces when the line has no tab. Empty lines and lines starting with '#'
+ *        are skipped. Commands run concurrently on a SCDImgClientPool: the manifest is read while commands complete,
+ *        keeping at most window commands in flight, so PUT files are loaded only when they are sent.
+ *        With a ring, a command whose server can not be reached is sent to the next replica of its path.
+ *        Each command ends with a result signal, in completion order.
+ */
+class SCDImgClientBatch : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgClientBatch(QString host, quint16 port, QObject *parent=0, int maxConnections=8);
+
+     void setRing(SCDImgClientRing *ring, int replicas=2); // route each path to its server (null: host and port)
+
+     int start(QString manifest); // manifest file path, "-" for stdin. 1 on success, 0 if manifest can not be opened
+
+     int     succeeded();
+     int     failed();
+     qint64  bytes();   // bytes sent and received
+     qint64  elapsed(); // msecs since start
+     QString lastError();
+
+   signals:
+
+     void result(int line, QString command, QString path, bool success, qint64 bytes, qint64 msecs, QString errMsg);
+     void finished(bool success); // all commands done
+
+   private slots:
+
+     void fill();
+
+   private:
+
+     struct Command
+     {
+        int                   line;
+        QString               command;
+        QString               path;
+        QString               local;      // GET: destination file (empty: discarded)
+        bool                  thumbnail;
+        QByteArray            data;       // PUT: file content
+        QList<SCDImgEndpoint> route;      // owner server first, then replicas
+        int                   routeIndex; // server being tried
+        qint64                started;
+     };
+
+     QString host;
+     quint16 port;
+
+     int maxConnections;
+
+     SCDImgClientRing *ring; // not owned
+     int               replicas;
+     SCDImgClientPool *pool;
+
+     QFile manifest;
+     int   lineNumber;
+     bool  eof;
+     bool  ended; // finished emitted
+
+     int    inFlight;
+     int    okCount;
+     int    failedCount;
+     qint64 byteCount;
+
+     QElapsedTimer timer;
+
+     QString lastErrorMsg;
+
+     int  window();
+     void run(int line, QString text);
+     void send(Command cmd);
+     bool retry(Command cmd, SCDImgReply *reply);
+     void done(int line, QString command, QString path, bool success, qint64 bytes, qint64 started, QString errMsg);
+};
+
+#endif // SCDIMGCLIENTBATCH_H
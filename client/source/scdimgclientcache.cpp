@@ -0,0 +1,321 @@
+/**
+ * @class  SCDImgClientCache
+ *
+ * @brief On-disk cache of SCD Image Client downloads
+ *
+ *        An entry is a file named by the SHA-1 of its key, containing the server validator line followed by the data:
+ *
+ *          <validator>\n<data>
+ *
+ *        Entries are written to a temporary file and renamed, so a reader never sees a partial entry.
+ *        Cached bytes are bounded: the least recently used entries are removed when a new one exceeds the limit.
+ *        Entries found in the folder when the cache is first used are ranked by modification time.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QCryptographicHash>
+
+#include "scdimgclientcache.h"
+
+/**
+ * @brief SCDImgClientCache::SCDImgClientCache
+ * @param path    cache folder (created on first store)
+ * @param maxSize max bytes of cached entries (0: unbounded)
+ */
+SCDImgClientCache::SCDImgClientCache(QString path, qint64 maxSize) : path(path), maxSize(qMax<qint64>(0,maxSize))
+{
+   if (!this->path.endsWith('/'))
+   {
+      this->path.append('/');
+   }
+
+   loaded = false;
+   tick   = 0;
+   bytes  = 0;
+}
+
+/**
+ * @brief SCDImgClientCache::lookup
+ * @param key       see key()
+ * @param validator output param validator of cached copy
+ * @param data      output param cached data (null: validator only)
+ * @return 1 if key is cached, 0 otherwise
+ */
+int SCDImgClientCache::lookup(const QString &key, QByteArray &validator, QByteArray *data)
+{
+   QMutexLocker locker(&mutex);
+
+   load();
+
+   QString name = fileName(key);
+
+   QFile f(name);
+
+   if (!f.open(QIODevice::ReadOnly))
+   {
+      drop(name);
+      return 0;
+   }
+
+   validator = f.readLine(256).trimmed();
+
+   if (validator.isEmpty())
+   {
+      return 0;
+   }
+
+   if (data)
+   {
+      *data = f.readAll();
+   }
+
+   touch(name, f.size());
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClientCache::store
+ * @param key
+ * @param validator server validator of data
+ * @param data
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgClientCache::store(const QString &key, const QByteArray &validator, const QByteArray &data)
+{
+   QMutexLocker locker(&mutex);
+
+   load();
+
+   qint64 entrySize = validator.size() + 1 + data.size();
+
+   if (maxSize>0 && entrySize>maxSize)
+   {
+      return 1; // larger than the whole cache: not cached
+   }
+
+   QDir dir(path);
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastErrorMsg = "Make dir error: " + dir.absolutePath();
+      return 0;
+   }
+
+   QString name = fileName(key);
+
+   QFile f(name + ".tmp");
+
+   if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+   {
+      lastErrorMsg = "Open file error: " + f.fileName() + " => " + f.errorString();
+      return 0;
+   }
+
+   if (f.write(validator + "\n")==-1 || f.write(data)==-1)
+   {
+      lastErrorMsg = "Write file error: " + f.fileName() + " => " + f.errorString();
+
+      f.remove();
+
+      return 0;
+   }
+
+   f.close();
+
+   QFile::remove(name);
+
+   drop(name);
+
+   if (!f.rename(name))
+   {
+      lastErrorMsg = "Rename file error: " + f.fileName() + " => " + f.errorString();
+
+      f.remove();
+
+      return 0;
+   }
+
+   touch(name, entrySize);
+
+   evict();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClientCache::remove
+ * @param key
+ * @return 1 on success, 0 if key is not cached
+ */
+int SCDImgClientCache::remove(const QString &key)
+{
+   QMutexLocker locker(&mutex);
+
+   QString name = fileName(key);
+
+   drop(name);
+
+   return QFile::remove(name);
+}
+
+/**
+ * @brief SCDImgClientCache::setMaxSize bound the cached bytes, evicting least recently used entries beyond it
+ * @param maxSize bytes (0: unbounded)
+ */
+void SCDImgClientCache::setMaxSize(qint64 maxSize)
+{
+   QMutexLocker locker(&mutex);
+
+   this->maxSize = qMax<qint64>(0,maxSize);
+
+   if (loaded)
+   {
+      evict();
+   }
+}
+
+/**
+ * @brief SCDImgClientCache::size
+ * @return bytes of cached entries
+ */
+qint64 SCDImgClientCache::size()
+{
+   QMutexLocker locker(&mutex);
+
+   load();
+
+   return bytes;
+}
+
+/**
+ * @brief SCDImgClientCache::count
+ * @return number of cached entries
+ */
+int SCDImgClientCache::count()
+{
+   QMutexLocker locker(&mutex);
+
+   load();
+
+   return entries.count();
+}
+
+/**
+ * @brief SCDImgClientCache::key
+ * @param remotePath
+ * @param thumbnail
+ * @return cache key of a remote file or of its thumbnail
+ */
+QString SCDImgClientCache::key(const QString &remotePath, bool thumbnail)
+{
+   return thumbnail ? remotePath + "\tT" : remotePath;
+}
+
+/**
+ * @brief SCDImgClientCache::lastError
+ * @return
+ */
+QString SCDImgClientCache::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgClientCache::fileName
+ * @param key
+ * @return entry file path
+ */
+QString SCDImgClientCache::fileName(const QString &key)
+{
+   return path + QCryptographicHash::hash(key.toUtf8(),QCryptographicHash::Sha1).toHex();
+}
+
+/**
+ * @brief SCDImgClientCache::load rank the entries found into cache folder by modification time, then evict
+ *                               the oldest ones beyond max size. Done once, on first use
+ */
+void SCDImgClientCache::load()
+{
+   if (loaded)
+   {
+      return;
+   }
+
+   loaded = true;
+
+   QFileInfoList files = QDir(path).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed); // oldest first
+
+   foreach (const QFileInfo &info, files)
+   {
+      if (info.fileName().length()==40 && !info.fileName().endsWith(".tmp")) // SHA-1 hex names only
+      {
+         touch(path + info.fileName(), info.size());
+      }
+   }
+
+   evict();
+}
+
+/**
+ * @brief SCDImgClientCache::touch make an entry the most recently used one
+ * @param name entry file name
+ * @param size entry file size
+ */
+void SCDImgClientCache::touch(const QString &name, qint64 size)
+{
+   drop(name);
+
+   Entry entry;
+
+   entry.size = size;
+   entry.used = ++tick;
+
+   entries.insert(name,entry);
+   lru.insert(entry.used,name);
+
+   bytes += size;
+}
+
+/**
+ * @brief SCDImgClientCache::drop forget an entry (its file is not removed)
+ * @param name entry file name
+ */
+void SCDImgClientCache::drop(const QString &name)
+{
+   QHash<QString,Entry>::iterator it = entries.find(name);
+
+   if (it==entries.end())
+   {
+      return;
+   }
+
+   lru.remove(it->used);
+
+   bytes -= it->size;
+
+   entries.erase(it);
+}
+
+/**
+ * @brief SCDImgClientCache::evict remove least recently used entries until cached bytes fit max size
+ */
+void SCDImgClientCache::evict()
+{
+   while (maxSize>0 && bytes>maxSize && !lru.isEmpty())
+   {
+      QString name = lru.first();
+
+      drop(name);
+
+      QFile::remove(name);
+   }
+}
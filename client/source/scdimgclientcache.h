@@ -0,0 +1,61 @@
+#ifndef SCDIMGCLIENTCACHE_H
+#define SCDIMGCLIENTCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+
+/**
+ * @brief The SCDImgClientCache class is an on-disk cache of downloaded files, keyed by remote path (and thumbnail flag).
+ *        Each entry keeps the server validator of the cached copy, used to revalidate it with a conditional GET.
+ *        The cache is bounded to maxSize bytes: storing an entry evicts the least recently used ones.
+ */
+class SCDImgClientCache
+{
+   public:
+
+     explicit SCDImgClientCache(QString path="./cache/", qint64 maxSize=268435456);
+
+     int lookup(const QString &key, QByteArray &validator, QByteArray *data=0); // 1 found, 0 not cached
+     int store(const QString &key, const QByteArray &validator, const QByteArray &data);
+     int remove(const QString &key);
+
+     void   setMaxSize(qint64 maxSize); // bytes (0: unbounded)
+     qint64 size();                     // bytes of cached entries
+     int    count();                    // cached entries
+
+     static QString key(const QString &remotePath, bool thumbnail);
+
+     QString lastError();
+
+   private:
+
+     struct Entry
+     {
+        qint64  size; // entry file size
+        quint64 used; // last use tick
+     };
+
+     QString path;
+     qint64  maxSize;
+
+     QMutex                mutex;   // the cache can be shared by clients of several threads
+     bool                  loaded;  // cache folder scanned
+     QHash<QString,Entry>  entries; // entry file name => entry
+     QMap<quint64,QString> lru;     // last use tick => entry file name, least recently used first
+     quint64               tick;
+     qint64                bytes;
+
+     QString lastErrorMsg;
+
+     QString fileName(const QString &key);
+
+     void load();                                  // call them holding mutex
+     void touch(const QString &name, qint64 size); // add or refresh an entry
+     void drop(const QString &name);               // forget an entry
+     void evict();                                 // remove least recently used entries beyond maxSize
+};
+
+#endif // SCDIMGCLIENTCACHE_H
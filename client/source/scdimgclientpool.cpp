@@ -0,0 +1,311 @@
+/**
+ * @class  SCDImgClientPool
+ *
+ * @brief Asynchronous pooled client for SCD Image Server
+ *
+ *        Any number of GET/PUT/DEL requests are queued and run concurrently, with a bounded number of connections
+ *        for each server. Every request enforces connect and read timeouts.
+ *
+ *          SCDImgClientPool pool(this, 16);
+ *
+ *          pool.get("localhost", 12345, "/sicily/eolie/1.jpg", false, [](SCDImgReply *reply)
+ *          {
+ *             if (reply->success()) image.loadFromData(reply->data());
+ *          });
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include "scdimgclientpool.h"
+
+/**
+ * @brief SCDImgReply::SCDImgReply
+ * @param op
+ * @param host
+ * @param port
+ * @param path
+ * @param callback
+ */
+SCDImgReply::SCDImgReply(int op, QString host, quint16 port, QString path, SCDImgCallback callback) : op(op), hostName(host), hostPort(port), remotePath(path), callback(callback)
+{
+   done      = false;
+   ok        = false;
+   connected = false;
+}
+
+/**
+ * @brief SCDImgClientPool::SCDImgClientPool
+ * @param parent
+ * @param maxConnections max concurrent connections for each server
+ * @param connectTimeout msecs (0: no timeout)
+ * @param readTimeout    msecs without data once connected (0: no timeout)
+ */
+SCDImgClientPool::SCDImgClientPool(QObject *parent, int maxConnections, int connectTimeout, int readTimeout) : QObject(parent), maxConnections(maxConnections), connectTimeout(connectTimeout), readTimeout(readTimeout)
+{
+   cache = 0;
+}
+
+/**
+ * @brief SCDImgClientPool::~SCDImgClientPool abort running requests: no signal nor callback is emitted
+ */
+SCDImgClientPool::~SCDImgClientPool()
+{
+   foreach (SCDImgClient *client, active.keys())
+   {
+      client->disconnect(this);
+      client->abort();
+   }
+}
+
+/**
+ * @brief SCDImgClientPool::get queue a download
+ * @param host
+ * @param port
+ * @param path      remote file path
+ * @param thumbnail download the thumbnail
+ * @param callback  called when request ends (optional)
+ * @return reply
+ */
+SCDImgReply *SCDImgClientPool::get(QString host, quint16 port, QString path, bool thumbnail, SCDImgCallback callback)
+{
+   return submit(new SCDImgReply(thumbnail ? SCDImgReply::GETTHUMB : SCDImgReply::GET, host, port, path, callback));
+}
+
+/**
+ * @brief SCDImgClientPool::put queue an upload
+ * @param host
+ * @param port
+ * @param path     remote file path
+ * @param data     file content
+ * @param callback called when request ends (optional)
+ * @return reply
+ */
+SCDImgReply *SCDImgClientPool::put(QString host, quint16 port, QString path, const QByteArray &data, SCDImgCallback callback)
+{
+   SCDImgReply *reply = new SCDImgReply(SCDImgReply::PUT, host, port, path, callback);
+
+   reply->buffer = data;
+
+   return submit(reply);
+}
+
+/**
+ * @brief SCDImgClientPool::del queue a delete
+ * @param host
+ * @param port
+ * @param path     remote file path
+ * @param callback called when request ends (optional)
+ * @return reply
+ */
+SCDImgReply *SCDImgClientPool::del(QString host, quint16 port, QString path, SCDImgCallback callback)
+{
+   return submit(new SCDImgReply(SCDImgReply::DEL, host, port, path, callback));
+}
+
+/**
+ * @brief SCDImgClientPool::setMaxConnections
+ * @param maxConnections max concurrent connections for each server
+ */
+void SCDImgClientPool::setMaxConnections(int maxConnections)
+{
+   this->maxConnections = maxConnections;
+
+   dispatch();
+}
+
+/**
+ * @brief SCDImgClientPool::setCache
+ * @param cache shared downloads cache (not owned), null to disable
+ */
+void SCDImgClientPool::setCache(SCDImgClientCache *cache)
+{
+   this->cache = cache;
+
+   foreach (const Server &server, servers)
+   {
+      foreach (SCDImgClient *client, server.clients)
+      {
+         client->setCache(cache);
+      }
+   }
+}
+
+/**
+ * @brief SCDImgClientPool::pending
+ * @return requests waiting for a connection
+ */
+int SCDImgClientPool::pending()
+{
+   int count = 0;
+
+   foreach (const Server &server, servers)
+   {
+      count += server.queue.count();
+   }
+
+   return count;
+}
+
+/**
+ * @brief SCDImgClientPool::running
+ * @return requests in progress
+ */
+int SCDImgClientPool::running()
+{
+   return active.count();
+}
+
+/**
+ * @brief SCDImgClientPool::submit queue a request to its server and start it if a connection is available
+ * @param reply
+ * @return reply
+ */
+SCDImgReply *SCDImgClientPool::submit(SCDImgReply *reply)
+{
+   reply->setParent(this);
+
+   QString key = reply->host() + ":" + QString::number(reply->port());
+
+   if (!servers.contains(key))
+   {
+      Server server;
+
+      server.host = reply->host();
+      server.port = reply->port();
+      server.busy = 0;
+
+      servers.insert(key,server);
+   }
+
+   Server &server = servers[key];
+
+   server.queue.enqueue(reply);
+
+   start(server);
+
+   return reply;
+}
+
+/**
+ * @brief SCDImgClientPool::start start queued requests of a server while connections are available
+ * @param server
+ */
+void SCDImgClientPool::start(Server &server)
+{
+   while (!server.queue.isEmpty() && server.busy<maxConnections)
+   {
+      SCDImgReply *reply = server.queue.dequeue();
+
+      SCDImgClient *client;
+
+      if (server.clients.isEmpty())
+      {
+         client = new SCDImgClient(server.host, server.port, 0);
+
+         client->setParent(this);
+         client->setTimeouts(connectTimeout, readTimeout);
+         client->setCache(cache);
+
+         connect(client, SIGNAL(finished(bool,QString)), this, SLOT(onFinished(bool,QString)));
+      }
+      else
+      {
+         client = server.clients.takeLast();
+      }
+
+      server.busy++;
+
+      active.insert(client,reply);
+
+      switch (reply->operation())
+      {
+         case SCDImgReply::GET:
+           client->requestFile(reply->path(),false,false);
+         break;
+
+         case SCDImgReply::GETTHUMB:
+           client->requestFile(reply->path(),true,false);
+         break;
+
+         case SCDImgReply::PUT:
+           client->sendFileBuff(reply->path(),&reply->buffer);
+         break;
+
+         case SCDImgReply::DEL:
+           client->deleteFile(reply->path());
+         break;
+      }
+   }
+}
+
+/**
+ * @brief SCDImgClientPool::onFinished a request ended: complete its reply and start the next queued ones
+ * @param success
+ * @param errMsg
+ */
+void SCDImgClientPool::onFinished(bool success, QString errMsg)
+{
+   SCDImgClient *client = qobject_cast<SCDImgClient*>(sender());
+
+   if (!active.contains(client)) // a failed command can notify its end twice
+   {
+      return;
+   }
+
+   SCDImgReply *reply = active.take(client);
+
+   Server &server = servers[reply->host() + ":" + QString::number(reply->port())];
+
+   server.busy--;
+
+   reply->done      = true;
+   reply->ok        = success;
+   reply->connected = client->hasConnected();
+   reply->error     = errMsg.isEmpty() ? client->getLastError() : errMsg;
+
+   if (reply->op==SCDImgReply::GET || reply->op==SCDImgReply::GETTHUMB)
+   {
+      reply->buffer = *client->receivedFile();
+   }
+
+   if (success)
+   {
+      server.clients.append(client); // reused by next request
+   }
+   else
+   {
+      client->disconnect(this);
+      client->deleteLater();
+   }
+
+   emit reply->finished(reply);
+   emit finished(reply);
+
+   if (reply->callback)
+   {
+      reply->callback(reply);
+   }
+
+   reply->deleteLater();
+
+   QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection); // next requests start out of client signal handlers
+}
+
+/**
+ * @brief SCDImgClientPool::dispatch start queued requests of all servers
+ */
+void SCDImgClientPool::dispatch()
+{
+   for (QHash<QString,Server>::iterator it=servers.begin(); it!=servers.end(); ++it)
+   {
+      start(it.value());
+   }
+
+   if (active.isEmpty() && pending()==0)
+   {
+      emit idle();
+   }
+}
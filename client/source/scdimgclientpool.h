@@ -0,0 +1,123 @@
+#ifndef SCDIMGCLIENTPOOL_H
+#define SCDIMGCLIENTPOOL_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QList>
+#include <QByteArray>
+
+#include <functional>
+
+#include "scdimgclient.h"
+
+class SCDImgReply;
+
+typedef std::function<void(SCDImgReply *reply)> SCDImgCallback;
+
+/**
+ * @brief The SCDImgReply class is the result of a request queued to SCDImgClientPool.
+ *        It is deleted by the pool after finished signal and callback: copy data you need before returning.
+ */
+class SCDImgReply : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     enum Operation {GET,GETTHUMB,PUT,DEL};
+
+     int        operation() const {return op;}
+     QString    host() const {return hostName;}
+     quint16    port() const {return hostPort;}
+     QString    path() const {return remotePath;}
+     bool       isFinished() const {return done;}
+     bool       success() const {return ok;}
+     bool       hasConnected() const {return connected;} // false: server could not be reached, request was not sent
+     QString    errorString() const {return error;}
+     QByteArray data() const {return buffer;}  // GET: received file, PUT: sent file
+
+   signals:
+
+     void finished(SCDImgReply *reply);
+
+   private:
+
+     friend class SCDImgClientPool;
+
+     SCDImgReply(int op, QString host, quint16 port, QString path, SCDImgCallback callback);
+
+     int            op;
+     QString        hostName;
+     quint16        hostPort;
+     QString        remotePath;
+     bool           done;
+     bool           ok;
+     bool           connected;
+     QString        error;
+     QByteArray     buffer;
+     SCDImgCallback callback;
+};
+
+/**
+ * @brief The SCDImgClientPool class queues any number of requests and runs them asynchronously, with at most
+ *        maxConnections concurrent connections for each server. Since the server closes the connection after each
+ *        request, the pool bounds concurrency per server and reuses the idle SCDImgClient objects.
+ *        Each request ends with reply finished signal, pool finished signal and the optional callback.
+ */
+class SCDImgClientPool : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgClientPool(QObject *parent=0, int maxConnections=8, int connectTimeout=5000, int readTimeout=30000);
+
+     ~SCDImgClientPool();
+
+     SCDImgReply *get(QString host, quint16 port, QString path, bool thumbnail=false, SCDImgCallback callback=SCDImgCallback());
+     SCDImgReply *put(QString host, quint16 port, QString path, const QByteArray &data, SCDImgCallback callback=SCDImgCallback());
+     SCDImgReply *del(QString host, quint16 port, QString path, SCDImgCallback callback=SCDImgCallback());
+
+     void setMaxConnections(int maxConnections); // per server
+
+     void setCache(SCDImgClientCache *cache);      // GET revalidates cached copies and caches downloads (null: disabled)
+
+     int pending(); // queued requests
+     int running(); // requests in progress
+
+   signals:
+
+     void finished(SCDImgReply *reply);
+     void idle();                        // no more queued or running requests
+
+   private slots:
+
+     void onFinished(bool success, QString errMsg);
+     void dispatch();
+
+   private:
+
+     struct Server
+     {
+        QString                host;
+        quint16                port;
+        QList<SCDImgClient*>   clients; // idle clients
+        int                    busy;    // running requests
+        QQueue<SCDImgReply*>   queue;   // waiting requests
+     };
+
+     int maxConnections;
+     int connectTimeout;
+     int readTimeout;
+
+     SCDImgClientCache *cache; // not owned
+
+     QHash<QString, Server>             servers; // key host:port
+     QHash<SCDImgClient*, SCDImgReply*> active;
+
+     SCDImgReply *submit(SCDImgReply *reply);
+     void         start(Server &server);
+};
+
+#endif // SCDIMGCLIENTPOOL_H
@@ -0,0 +1,391 @@
+/**
+ * @class  SCDImgClientRing
+ *
+ * @brief Consistent hash ring for SCD Image Server sharding
+ *
+ *        Remote paths are spread across several servers: every server is hashed on vnodes points of a 64 bit ring,
+ *        a path is owned by the server of the first point following its hash. Virtual nodes even out the load,
+ *        and when a server is added or removed only its share of the paths changes owner.
+ *
+ *          SCDImgClientRing ring;
+ *
+ *          ring.setNodes("10.0.0.1:12345,10.0.0.2:12345,10.0.0.3:12345");
+ *
+ *          SCDImgEndpoint server = ring.node("/sicily/eolie/1.jpg");
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include "scdimgclientring.h"
+#include "scdimgclientpool.h"
+
+/**
+ * @brief SCDImgClientRing::SCDImgClientRing
+ * @param vnodes ring points of each server
+ */
+SCDImgClientRing::SCDImgClientRing(int vnodes) : vnodes(qMax(1,vnodes))
+{
+}
+
+/**
+ * @brief SCDImgClientRing::setNodes replace ring servers
+ * @param list        comma separated host[:port] list
+ * @param defaultPort port of hosts without port
+ * @return 1 on success, 0 if list is empty or invalid (ring is not changed)
+ */
+int SCDImgClientRing::setNodes(QString list, quint16 defaultPort)
+{
+   QList<SCDImgEndpoint> endpoints;
+
+   foreach (QString item, list.split(',',QString::SkipEmptyParts))
+   {
+      item = item.trimmed();
+
+      SCDImgEndpoint endpoint;
+
+      endpoint.host = item.section(':',0,0);
+      endpoint.port = defaultPort;
+
+      if (item.contains(':'))
+      {
+         bool ok;
+
+         int port = item.section(':',1).toInt(&ok);
+
+         if (!ok || port<=0 || port>65535)
+         {
+            lastErrorMsg = "Invalid server: " + item;
+            return 0;
+         }
+
+         endpoint.port = static_cast<quint16>(port);
+      }
+
+      if (endpoint.host.isEmpty())
+      {
+         lastErrorMsg = "Invalid server: " + item;
+         return 0;
+      }
+
+      if (!endpoints.contains(endpoint))
+      {
+         endpoints.append(endpoint);
+      }
+   }
+
+   if (endpoints.isEmpty())
+   {
+      lastErrorMsg = "No servers";
+      return 0;
+   }
+
+   nodeList = endpoints;
+
+   rebuild();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgClientRing::addNode
+ * @param host
+ * @param port
+ */
+void SCDImgClientRing::addNode(QString host, quint16 port)
+{
+   SCDImgEndpoint endpoint;
+
+   endpoint.host = host;
+   endpoint.port = port;
+
+   if (!nodeList.contains(endpoint))
+   {
+      nodeList.append(endpoint);
+
+      rebuild();
+   }
+}
+
+/**
+ * @brief SCDImgClientRing::removeNode
+ * @param host
+ * @param port
+ */
+void SCDImgClientRing::removeNode(QString host, quint16 port)
+{
+   SCDImgEndpoint endpoint;
+
+   endpoint.host = host;
+   endpoint.port = port;
+
+   if (nodeList.removeAll(endpoint))
+   {
+      rebuild();
+   }
+}
+
+/**
+ * @brief SCDImgClientRing::nodes
+ * @return ring servers
+ */
+QList<SCDImgEndpoint> SCDImgClientRing::nodes()
+{
+   return nodeList;
+}
+
+/**
+ * @brief SCDImgClientRing::count
+ * @return number of servers
+ */
+int SCDImgClientRing::count()
+{
+   return nodeList.count();
+}
+
+/**
+ * @brief SCDImgClientRing::node
+ * @param path remote path
+ * @return server owning path (empty host if ring is empty)
+ */
+SCDImgEndpoint SCDImgClientRing::node(QString path)
+{
+   QList<SCDImgEndpoint> list = lookup(path,1);
+
+   if (list.isEmpty())
+   {
+      SCDImgEndpoint none;
+
+      none.port = 0;
+
+      return none;
+   }
+
+   return list.first();
+}
+
+/**
+ * @brief SCDImgClientRing::lookup walk the ring clockwise from path hash
+ * @param path     remote path
+ * @param replicas max servers returned
+ * @return path owner followed by the next distinct servers of the ring (fallback order)
+ */
+QList<SCDImgEndpoint> SCDImgClientRing::lookup(QString path, int replicas)
+{
+   QList<SCDImgEndpoint> list;
+
+   if (ring.isEmpty())
+   {
+      return list;
+   }
+
+   replicas = qBound(1,replicas,nodeList.count());
+
+   QMap<quint64,int>::const_iterator it = ring.lowerBound(hash(path.toUtf8()));
+
+   for (int points=0; points<ring.count() && list.count()<replicas; points++, ++it)
+   {
+      if (it==ring.constEnd())
+      {
+         it = ring.constBegin(); // wrap around
+      }
+
+      const SCDImgEndpoint &endpoint = nodeList.at(it.value());
+
+      if (!list.contains(endpoint))
+      {
+         list.append(endpoint);
+      }
+   }
+
+   return list;
+}
+
+/**
+ * @brief SCDImgClientRing::lastError
+ * @return
+ */
+QString SCDImgClientRing::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgClientRing::rebuild place vnodes points of each server on the ring
+ */
+void SCDImgClientRing::rebuild()
+{
+   ring.clear();
+
+   for (int n=0; n<nodeList.count(); n++)
+   {
+      QByteArray name = nodeList.at(n).name().toUtf8();
+
+      for (int v=0; v<vnodes; v++)
+      {
+         ring.insert(hash(name + "#" + QByteArray::number(v)), n); // a colliding point is kept by the last server
+      }
+   }
+}
+
+/**
+ * @brief SCDImgClientRing::hash FNV-1a 64 bit hash with splitmix64 finalizer: stable across runs and platforms
+ *                               (every client must route a path to the same server), well spread on the ring
+ * @param data
+ * @return
+ */
+quint64 SCDImgClientRing::hash(const QByteArray &data)
+{
+   quint64 h = 14695981039346656037ULL;
+
+   for (int i=0; i<data.size(); i++)
+   {
+      h ^= static_cast<quint8>(data.at(i));
+      h *= 1099511628211ULL;
+   }
+
+   h ^= h >> 30;
+   h *= 0xbf58476d1ce4e5b9ULL;
+   h ^= h >> 27;
+   h *= 0x94d049bb133111ebULL;
+   h ^= h >> 31;
+
+   return h;
+}
+
+/**
+ * @brief SCDImgRingMigrator::SCDImgRingMigrator
+ * @param from           ring before the change (not owned)
+ * @param to             ring after the change (not owned)
+ * @param parent
+ * @param maxConnections max concurrent connections for each server
+ */
+SCDImgRingMigrator::SCDImgRingMigrator(SCDImgClientRing *from, SCDImgClientRing *to, QObject *parent, int maxConnections) : QObject(parent), from(from), to(to)
+{
+   pool = new SCDImgClientPool(this, maxConnections);
+
+   remaining   = 0;
+   movedCount  = 0;
+   failedCount = 0;
+}
+
+/**
+ * @brief SCDImgRingMigrator::start move the files whose owner is changed
+ * @param paths remote paths to check
+ * @return number of files to move
+ */
+int SCDImgRingMigrator::start(QStringList paths)
+{
+   movedCount  = 0;
+   failedCount = 0;
+
+   QList<QString>        moving;
+   QList<SCDImgEndpoint> sources;
+   QList<SCDImgEndpoint> targets;
+
+   foreach (QString path, paths)
+   {
+      path = path.trimmed();
+
+      if (path.isEmpty())
+      {
+         continue;
+      }
+
+      SCDImgEndpoint source = from->node(path);
+      SCDImgEndpoint target = to->node(path);
+
+      if (source!=target)
+      {
+         moving.append(path);
+         sources.append(source);
+         targets.append(target);
+      }
+   }
+
+   remaining = moving.count();
+
+   for (int i=0; i<moving.count(); i++)
+   {
+      move(moving.at(i), sources.at(i), targets.at(i));
+   }
+
+   return moving.count();
+}
+
+/**
+ * @brief SCDImgRingMigrator::moved
+ * @return files moved
+ */
+int SCDImgRingMigrator::moved()
+{
+   return movedCount;
+}
+
+/**
+ * @brief SCDImgRingMigrator::failed
+ * @return files not moved
+ */
+int SCDImgRingMigrator::failed()
+{
+   return failedCount;
+}
+
+/**
+ * @brief SCDImgRingMigrator::move GET from source, PUT to target, DEL from source. Old copy is deleted only after upload succeeded.
+ * @param path
+ * @param source
+ * @param target
+ */
+void SCDImgRingMigrator::move(QString path, SCDImgEndpoint source, SCDImgEndpoint target)
+{
+   pool->get(source.host, source.port, path, false, [this, path, source, target](SCDImgReply *reply)
+   {
+      if (!reply->success())
+      {
+         done(path, false, "GET " + source.name() + ": " + reply->errorString());
+         return;
+      }
+
+      pool->put(target.host, target.port, path, reply->data(), [this, path, source, target](SCDImgReply *reply)
+      {
+         if (!reply->success())
+         {
+            done(path, false, "PUT " + target.name() + ": " + reply->errorString());
+            return;
+         }
+
+         pool->del(source.host, source.port, path, [this, path, source](SCDImgReply *reply)
+         {
+            done(path, reply->success(), reply->success() ? QString() : "DEL " + source.name() + ": " + reply->errorString());
+         });
+      });
+   });
+}
+
+/**
+ * @brief SCDImgRingMigrator::done a file has been processed
+ * @param path
+ * @param success
+ * @param errMsg
+ */
+void SCDImgRingMigrator::done(QString path, bool success, QString errMsg)
+{
+   if (success)
+   {
+      movedCount++;
+   }
+   else
+   {
+      failedCount++;
+   }
+
+   emit progress(path, success, errMsg);
+
+   if (--remaining==0)
+   {
+      emit finished(failedCount==0);
+   }
+}
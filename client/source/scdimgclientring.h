@@ -0,0 +1,102 @@
+#ifndef SCDIMGCLIENTRING_H
+#define SCDIMGCLIENTRING_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QMap>
+
+class SCDImgClientPool;
+
+/**
+ * @brief The SCDImgEndpoint struct is a server address
+ */
+struct SCDImgEndpoint
+{
+   QString host;
+   quint16 port;
+
+   QString name() const {return host + ":" + QString::number(port);}
+
+   bool operator==(const SCDImgEndpoint &other) const {return host==other.host && port==other.port;}
+   bool operator!=(const SCDImgEndpoint &other) const {return !(*this==other);}
+};
+
+/**
+ * @brief The SCDImgClientRing class routes remote paths to servers with a consistent hash ring.
+ *        Each server owns vnodes points of the ring: a path belongs to the server owning the first point
+ *        following the path hash, its replicas are the next distinct servers along the ring.
+ *        Adding or removing a server moves only the paths of the ring arcs it gains or loses.
+ */
+class SCDImgClientRing
+{
+   public:
+
+     explicit SCDImgClientRing(int vnodes=160);
+
+     int  setNodes(QString list, quint16 defaultPort=12345); // host[:port],host[:port],... 1 on success, 0 on invalid list
+     void addNode(QString host, quint16 port);
+     void removeNode(QString host, quint16 port);
+
+     QList<SCDImgEndpoint> nodes();
+     int                   count();
+
+     SCDImgEndpoint        node(QString path);                 // server owning a path
+     QList<SCDImgEndpoint> lookup(QString path, int replicas); // owner first, then fallback servers
+
+     QString lastError();
+
+   private:
+
+     int vnodes;
+
+     QList<SCDImgEndpoint> nodeList;
+     QMap<quint64,int>     ring;     // ring point => node index
+
+     QString lastErrorMsg;
+
+     void rebuild();
+
+     static quint64 hash(const QByteArray &data);
+};
+
+/**
+ * @brief The SCDImgRingMigrator class moves the files whose owner changes between two rings:
+ *        each file is downloaded from its old owner, uploaded to its new owner, then deleted from the old one.
+ *        The client does not list server files: paths to check are given by the caller.
+ */
+class SCDImgRingMigrator : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgRingMigrator(SCDImgClientRing *from, SCDImgClientRing *to, QObject *parent=0, int maxConnections=4);
+
+     int start(QStringList paths); // return number of files to move (0: nothing to do, finished is not emitted)
+
+     int moved();
+     int failed();
+
+   signals:
+
+     void progress(QString path, bool success, QString errMsg); // a file has been moved or has failed
+     void finished(bool success);
+
+   private:
+
+     SCDImgClientRing *from; // not owned
+     SCDImgClientRing *to;   // not owned
+
+     SCDImgClientPool *pool;
+
+     int remaining;
+     int movedCount;
+     int failedCount;
+
+     void move(QString path, SCDImgEndpoint source, SCDImgEndpoint target);
+     void done(QString path, bool success, QString errMsg);
+};
+
+#endif // SCDIMGCLIENTRING_H
@@ -0,0 +1,117 @@
+/**
+ * @class  SCDImgCapture
+ *
+ * @brief Traffic capture format of SCD Image Server
+ *
+ *        The server records the metadata of each request (no data): the bench replays the capture against a test
+ *        server, synthesizing payloads of the recorded sizes.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QtEndian>
+
+#include "scdimgcapture.h"
+
+#define MAGIC "SCDCAP01"
+
+/**
+ * @brief SCDImgCapture::header
+ * @param startMsecs capture start (msecs since epoch)
+ * @return capture header
+ */
+QByteArray SCDImgCapture::header(qint64 startMsecs)
+{
+   uchar start[8];
+
+   qToLittleEndian<qint64>(startMsecs, start);
+
+   return QByteArray(MAGIC) + QByteArray(reinterpret_cast<const char*>(start),8);
+}
+
+/**
+ * @brief SCDImgCapture::append encode a record. Latency and size are clamped to 32 bit, path to 64KB.
+ * @param buff   output param
+ * @param record
+ */
+void SCDImgCapture::append(QByteArray &buff, const Record &record)
+{
+   QByteArray path = record.path.toUtf8().left(0xFFFF);
+
+   uchar fields[RECORD_SIZE];
+
+   qToLittleEndian<quint64>(static_cast<quint64>(qMax<qint64>(0,record.time)), fields);
+   qToLittleEndian<quint32>(static_cast<quint32>(qBound<qint64>(0,record.latency,0xFFFFFFFF)), fields+8);
+   qToLittleEndian<quint32>(static_cast<quint32>(qBound<qint64>(0,record.size,0xFFFFFFFF)), fields+12);
+
+   fields[16] = static_cast<uchar>(record.op);
+   fields[17] = static_cast<uchar>((record.thumbnail ? FL_THUMBNAIL : 0) | (record.failed ? FL_ERROR : 0));
+
+   qToLittleEndian<quint16>(static_cast<quint16>(path.size()), fields+18);
+
+   buff.append(reinterpret_cast<const char*>(fields),RECORD_SIZE);
+   buff.append(path);
+}
+
+/**
+ * @brief SCDImgCapture::read read a capture from its start. A truncated last record (server killed while
+ *                            writing) is ignored.
+ * @param device     opened device
+ * @param records    output param
+ * @param startMsecs output param: capture start (msecs since epoch)
+ * @param errMsg     output param
+ * @return 1 on success, 0 on invalid capture
+ */
+int SCDImgCapture::read(QIODevice *device, QList<Record> &records, qint64 &startMsecs, QString &errMsg)
+{
+   QByteArray data = device->readAll();
+
+   records.clear();
+
+   if (data.size()<HEADER_SIZE || !data.startsWith(MAGIC))
+   {
+      errMsg = "Invalid capture header";
+      return 0;
+   }
+
+   startMsecs = qFromLittleEndian<qint64>(reinterpret_cast<const uchar*>(data.constData()+8));
+
+   int pos = HEADER_SIZE;
+
+   while (pos+RECORD_SIZE<=data.size())
+   {
+      const uchar *p = reinterpret_cast<const uchar*>(data.constData()+pos);
+
+      int length = qFromLittleEndian<quint16>(p+18);
+
+      if (pos+RECORD_SIZE+length>data.size())
+      {
+         break; // truncated
+      }
+
+      if (p[16]>=OP_COUNT)
+      {
+         errMsg = "Invalid capture record at offset " + QString::number(pos);
+         return 0;
+      }
+
+      Record record;
+
+      record.time      = static_cast<qint64>(qFromLittleEndian<quint64>(p));
+      record.latency   = qFromLittleEndian<quint32>(p+8);
+      record.size      = qFromLittleEndian<quint32>(p+12);
+      record.op        = p[16];
+      record.thumbnail = (p[17] & FL_THUMBNAIL)!=0;
+      record.failed    = (p[17] & FL_ERROR)!=0;
+      record.path      = QString::fromUtf8(data.constData()+pos+RECORD_SIZE,length);
+
+      records.append(record);
+
+      pos += RECORD_SIZE+length;
+   }
+
+   return 1;
+}
@@ -0,0 +1,45 @@
+#ifndef SCDIMGCAPTURE_H
+#define SCDIMGCAPTURE_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+
+/**
+ * @brief The SCDImgCapture class is the traffic capture format, written by the server and replayed by the bench.
+ *        A capture is a header followed by one record for each request (integers are little endian):
+ *
+ *          header: "SCDCAP01" <capture start: msecs since epoch, 64 bit>
+ *          record: <arrival: usecs since capture start, 64 bit> <latency usecs, 32 bit> <size, 32 bit>
+ *                  <op, 8 bit> <flags, 8 bit> <path length, 16 bit> <path UTF-8>
+ *
+ *        Records are written when requests end, so they are not sorted by arrival time.
+ */
+class SCDImgCapture
+{
+   public:
+
+     enum {HEADER_SIZE=16,RECORD_SIZE=20};
+     enum Op {OP_GET=0,OP_PUT=1,OP_DEL=2,OP_COUNT=3};
+     enum Flag {FL_THUMBNAIL=1,FL_ERROR=2};
+
+     struct Record
+     {
+        qint64  time;      // arrival, usecs since capture start
+        qint64  latency;   // usecs, measured by server from header to reply
+        qint64  size;      // bytes received or sent
+        int     op;
+        bool    thumbnail;
+        bool    failed;
+        QString path;
+     };
+
+     static QByteArray header(qint64 startMsecs);
+
+     static void append(QByteArray &buff, const Record &record); // encode record at end of buff
+
+     static int read(QIODevice *device, QList<Record> &records, qint64 &startMsecs, QString &errMsg); // all records of a capture
+};
+
+#endif // SCDIMGCAPTURE_H
@@ -0,0 +1,418 @@
+/**
+ * @class  SCDImgDelta
+ *
+ * @brief Block delta encoding for SCD Image Server uploads
+ *
+ *        A modified file (e.g. an image whose metadata has been re-saved) is uploaded as block references to the copy
+ *        already stored by the server plus the changed bytes. Shared by server (signatures, patch) and client (encode).
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <QMultiHash>
+#include <QtEndian>
+
+#include <math.h>
+#include <string.h>
+
+#include "scdimgdelta.h"
+
+/**
+ * @brief SCDImgDelta::blockSize
+ * @param baseSize size of old copy
+ * @return block size: about sqrt(baseSize) balances signatures size and literal bytes around a change
+ */
+int SCDImgDelta::blockSize(qint64 baseSize)
+{
+   int size = static_cast<int>(sqrt(static_cast<double>(baseSize))) & ~63;
+
+   return qBound(static_cast<int>(MIN_BLOCK), size, static_cast<int>(MAX_BLOCK));
+}
+
+/**
+ * @brief SCDImgDelta::weak rolling checksum of a block (rsync): a is the sum of bytes, b the sum of bytes weighted by
+ *                          their distance from block end. Both sums have no loop carried dependency but the
+ *                          accumulators, so the loop is vectorized by the compiler.
+ * @param data
+ * @param length
+ * @return (a mod 2^16) | (b mod 2^16) << 16
+ */
+quint32 SCDImgDelta::weak(const char *data, int length)
+{
+   const uchar *p = reinterpret_cast<const uchar*>(data);
+
+   quint32 a = 0;
+   quint32 b = 0;
+
+   for (int i=0; i<length; i++)
+   {
+      quint32 x = p[i];
+
+      a += x;
+      b += static_cast<quint32>(length-i)*x;
+   }
+
+   return (a & 0xFFFF) | (b << 16);
+}
+
+/**
+ * @brief SCDImgDelta::roll slide the checksum window of a byte
+ * @param sum    checksum of window
+ * @param out    byte leaving window (first)
+ * @param in     byte entering window (after last)
+ * @param length window length
+ * @return checksum of next window
+ */
+quint32 SCDImgDelta::roll(quint32 sum, uchar out, uchar in, int length)
+{
+   quint32 a = sum & 0xFFFF;
+   quint32 b = sum >> 16;
+
+   a = (a - out + in) & 0xFFFF;
+   b = (b - static_cast<quint32>(length)*out + a) & 0xFFFF;
+
+   return a | (b << 16);
+}
+
+/**
+ * @brief SCDImgDelta::strong
+ * @param data
+ * @param length
+ * @return first STRONG_SIZE bytes of block MD5
+ */
+QByteArray SCDImgDelta::strong(const char *data, int length)
+{
+   return QCryptographicHash::hash(QByteArray::fromRawData(data,length), QCryptographicHash::Md5).left(STRONG_SIZE);
+}
+
+/**
+ * @brief SCDImgDelta::signatures read base from its start and compute the signature of each full block
+ *                                (the last partial block is always sent as literal)
+ * @param base      opened device
+ * @param blockSize
+ * @param sigs      output param: SIG_SIZE bytes for each block (weak checksum, strong hash)
+ * @param errMsg    output param
+ * @return 1 on success, 0 on read error
+ */
+int SCDImgDelta::signatures(QIODevice *base, int blockSize, QByteArray &sigs, QString &errMsg)
+{
+   qint64 count = base->size()/blockSize;
+
+   sigs.clear();
+   sigs.reserve(static_cast<int>(count*SIG_SIZE));
+
+   if (!base->seek(0))
+   {
+      errMsg = "Seek error: " + base->errorString();
+      return 0;
+   }
+
+   uchar weakSum[4];
+
+   for (qint64 i=0; i<count; i++)
+   {
+      QByteArray block = base->read(blockSize);
+
+      if (block.size()!=blockSize)
+      {
+         errMsg = "Read error: " + base->errorString();
+         return 0;
+      }
+
+      qToLittleEndian<quint32>(weak(block.constData(),blockSize), weakSum);
+
+      sigs.append(reinterpret_cast<const char*>(weakSum),4);
+      sigs.append(strong(block.constData(),blockSize));
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgDelta::encode delta stream of data: matching blocks become copy ops (consecutive blocks are merged),
+ *                            other bytes literal ops
+ * @param data      new file
+ * @param sigs      signatures of old copy
+ * @param blockSize
+ * @return
+ */
+QByteArray SCDImgDelta::encode(const QByteArray &data, const QByteArray &sigs, int blockSize)
+{
+   QByteArray delta;
+
+   QMultiHash<quint32,int> blocks; // weak checksum => block
+
+   int count = (blockSize>0) ? sigs.size()/SIG_SIZE : 0;
+
+   for (int i=count-1; i>=0; i--) // lower blocks are found first
+   {
+      blocks.insert(qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(sigs.constData()+i*SIG_SIZE)), i);
+   }
+
+   int copyBlock = -1; // pending copy op
+   int copyCount = 0;
+   int maxCount  = (blockSize>0) ? qMax(1,MAX_COPY/blockSize) : 1;
+
+   uchar field[4];
+
+   auto flushCopy = [&]()
+   {
+      if (copyCount>0)
+      {
+         delta.append(static_cast<char>(OP_COPY));
+
+         qToLittleEndian<quint32>(static_cast<quint32>(copyBlock), field);
+         delta.append(reinterpret_cast<const char*>(field),4);
+
+         qToLittleEndian<quint32>(static_cast<quint32>(copyCount), field);
+         delta.append(reinterpret_cast<const char*>(field),4);
+
+         copyCount = 0;
+      }
+   };
+
+   auto literal = [&](int from, int to)
+   {
+      if (from<to)
+      {
+         flushCopy();
+      }
+
+      while (from<to)
+      {
+         int length = qMin(to-from, static_cast<int>(MAX_LITERAL));
+
+         delta.append(static_cast<char>(OP_LITERAL));
+
+         qToLittleEndian<quint32>(static_cast<quint32>(length), field);
+         delta.append(reinterpret_cast<const char*>(field),4);
+
+         delta.append(data.constData()+from, length);
+
+         from += length;
+      }
+   };
+
+   const char *p    = data.constData();
+   int         size = data.size();
+   int         pos  = 0;
+   int         lit  = 0; // first byte of pending literal
+
+   quint32 sum = (count>0 && size>=blockSize) ? weak(p,blockSize) : 0;
+
+   while (count>0 && pos+blockSize<=size)
+   {
+      int match = -1;
+
+      if (blocks.contains(sum))
+      {
+         QByteArray hash = strong(p+pos,blockSize);
+
+         for (QMultiHash<quint32,int>::const_iterator it=blocks.constFind(sum); it!=blocks.constEnd() && it.key()==sum; ++it)
+         {
+            if (memcmp(sigs.constData()+it.value()*SIG_SIZE+4, hash.constData(), STRONG_SIZE)==0)
+            {
+               match = it.value();
+
+               if (copyCount>0 && match==copyBlock+copyCount)
+               {
+                  break; // prefer the block continuing current copy
+               }
+            }
+         }
+      }
+
+      if (match<0)
+      {
+         if (pos+blockSize<size)
+         {
+            sum = roll(sum, static_cast<uchar>(p[pos]), static_cast<uchar>(p[pos+blockSize]), blockSize);
+         }
+
+         pos++;
+
+         continue;
+      }
+
+      literal(lit,pos);
+
+      if (copyCount>0 && match==copyBlock+copyCount && copyCount<maxCount)
+      {
+         copyCount++;
+      }
+      else
+      {
+         flushCopy();
+
+         copyBlock = match;
+         copyCount = 1;
+      }
+
+      pos += blockSize;
+      lit  = pos;
+
+      if (pos+blockSize<=size)
+      {
+         sum = weak(p+pos,blockSize);
+      }
+   }
+
+   literal(lit,size);
+
+   flushCopy();
+
+   delta.append(static_cast<char>(OP_END));
+   delta.append(QCryptographicHash::hash(data, QCryptographicHash::Md5));
+
+   return delta;
+}
+
+/**
+ * @brief SCDImgDeltaPatch::SCDImgDeltaPatch
+ * @param base      old copy, opened (owned, null if missing)
+ * @param blockSize block size of signatures sent to client
+ * @param size      size of new file
+ */
+SCDImgDeltaPatch::SCDImgDeltaPatch(QIODevice *base, int blockSize, qint64 size) : base(base), blockSize(blockSize), size(size), md5(QCryptographicHash::Md5)
+{
+   total = 0;
+}
+
+/**
+ * @brief SCDImgDeltaPatch::~SCDImgDeltaPatch
+ */
+SCDImgDeltaPatch::~SCDImgDeltaPatch()
+{
+   delete base;
+}
+
+/**
+ * @brief SCDImgDeltaPatch::apply
+ * @param input  received delta stream: complete ops are removed
+ * @param output rebuilt data is appended
+ * @return 1 more input needed, 2 end of stream and file verified, 0 on error (see lastError)
+ */
+int SCDImgDeltaPatch::apply(QByteArray &input, QByteArray &output)
+{
+   int pos = 0;
+   int ret = 1;
+
+   while (ret==1 && pos<input.size())
+   {
+      const uchar *p = reinterpret_cast<const uchar*>(input.constData()+pos);
+
+      int available = input.size()-pos;
+
+      if (p[0]==SCDImgDelta::OP_LITERAL)
+      {
+         if (available<5)
+         {
+            break;
+         }
+
+         quint32 length = qFromLittleEndian<quint32>(p+1);
+
+         if (length==0 || length>SCDImgDelta::MAX_LITERAL || total+length>size)
+         {
+            lastErrorMsg = "Invalid delta literal";
+            return 0;
+         }
+
+         if (available<5+static_cast<int>(length))
+         {
+            break;
+         }
+
+         output.append(input.constData()+pos+5, static_cast<int>(length));
+         md5.addData(input.constData()+pos+5, static_cast<int>(length));
+
+         total += length;
+         pos   += 5+static_cast<int>(length);
+      }
+      else
+      if (p[0]==SCDImgDelta::OP_COPY)
+      {
+         if (available<9)
+         {
+            break;
+         }
+
+         qint64 block = qFromLittleEndian<quint32>(p+1);
+         qint64 count = qFromLittleEndian<quint32>(p+5);
+         qint64 bytes = count*blockSize;
+
+         if (!base || count==0 || bytes>SCDImgDelta::MAX_COPY || (block+count)*blockSize>base->size() || total+bytes>size)
+         {
+            lastErrorMsg = "Invalid delta block reference";
+            return 0;
+         }
+
+         if (!base->seek(block*blockSize))
+         {
+            lastErrorMsg = "Seek error: " + base->errorString();
+            return 0;
+         }
+
+         QByteArray data = base->read(bytes);
+
+         if (data.size()!=bytes)
+         {
+            lastErrorMsg = "Read error: " + base->errorString();
+            return 0;
+         }
+
+         output.append(data);
+         md5.addData(data);
+
+         total += bytes;
+         pos   += 9;
+      }
+      else
+      if (p[0]==SCDImgDelta::OP_END)
+      {
+         if (available<17)
+         {
+            break;
+         }
+
+         if (total!=size || md5.result()!=input.mid(pos+1,16))
+         {
+            lastErrorMsg = "Delta checksum mismatch";
+            return 0;
+         }
+
+         pos += 17;
+         ret  = 2;
+      }
+      else
+      {
+         lastErrorMsg = "Invalid delta op";
+         return 0;
+      }
+   }
+
+   input.remove(0,pos);
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgDeltaPatch::written
+ * @return bytes rebuilt
+ */
+qint64 SCDImgDeltaPatch::written()
+{
+   return total;
+}
+
+/**
+ * @brief SCDImgDeltaPatch::lastError
+ * @return
+ */
+QString SCDImgDeltaPatch::lastError()
+{
+   return lastErrorMsg;
+}
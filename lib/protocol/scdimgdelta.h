@@ -0,0 +1,70 @@
+#ifndef SCDIMGDELTA_H
+#define SCDIMGDELTA_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QCryptographicHash>
+#include <QString>
+
+/**
+ * @brief The SCDImgDelta class encodes a file as a delta against the copy stored by the server (rsync algorithm).
+ *        The server splits its copy into blocks and sends a signature for each full block: a weak rolling checksum
+ *        and a strong hash (first 8 bytes of MD5). The client slides a window over the new file: where the rolling
+ *        checksum and then the strong hash match a block, a block reference is sent, elsewhere literal bytes.
+ *
+ *        Delta stream (integers are little endian 32 bit):
+ *
+ *          L <length> <length bytes>     literal data (max MAX_LITERAL bytes)
+ *          C <block> <count>             copy count consecutive blocks of server copy (max MAX_COPY bytes)
+ *          E <MD5 of new file>           end of stream: the rebuilt file is verified before it gets its final name
+ */
+class SCDImgDelta
+{
+   public:
+
+     enum {MIN_BLOCK=2048,MAX_BLOCK=65536,SIG_SIZE=12,STRONG_SIZE=8,MAX_LITERAL=65536,MAX_COPY=1048576};
+     enum {MIN_FILE=262144}; // smaller files are sent whole: the signatures round trip costs more than the bytes saved
+     enum Op {OP_LITERAL='L',OP_COPY='C',OP_END='E'};
+
+     static int blockSize(qint64 baseSize); // about sqrt(baseSize), multiple of 64, between MIN_BLOCK and MAX_BLOCK
+
+     static quint32    weak(const char *data, int length);                  // rolling checksum of a block
+     static quint32    roll(quint32 sum, uchar out, uchar in, int length); // slide the window of a byte
+     static QByteArray strong(const char *data, int length);                // strong hash of a block
+
+     static int signatures(QIODevice *base, int blockSize, QByteArray &sigs, QString &errMsg); // signatures of full blocks of base
+
+     static QByteArray encode(const QByteArray &data, const QByteArray &sigs, int blockSize); // delta stream of data against signatures
+};
+
+/**
+ * @brief The SCDImgDeltaPatch class rebuilds a file from a delta stream received in chunks, reading the referenced
+ *        blocks from the old copy (base), and verifies its size and MD5 at end of stream.
+ */
+class SCDImgDeltaPatch
+{
+   public:
+
+     SCDImgDeltaPatch(QIODevice *base, int blockSize, qint64 size); // base is owned (null: no old copy, literals only)
+
+     ~SCDImgDeltaPatch();
+
+     int apply(QByteArray &input, QByteArray &output); // consume complete ops of input and append rebuilt data to output.
+                                                      // 1 more input needed, 2 end of stream (file verified), 0 on error
+
+     qint64  written(); // bytes rebuilt
+     QString lastError();
+
+   private:
+
+     QIODevice *base;
+     int        blockSize;
+     qint64     size;   // size of new file
+     qint64     total;  // bytes rebuilt
+
+     QCryptographicHash md5;
+
+     QString lastErrorMsg;
+};
+
+#endif // SCDIMGDELTA_H
@@ -0,0 +1,252 @@
+/**
+ * @class  SCDImgLocalSocket
+ *
+ * @brief Unix socket descriptor passing for SCD Image Server
+ *
+ *        Clients running on the server host read objects straight from a descriptor passed by the server:
+ *        data is not copied through the loopback stack.
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+ *
+*/
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "scdimglocalsocket.h"
+
+#define COPY_CHUNK 65536 // pread/write chunk when sendfile is not supported by output
+
+/**
+ * @brief SCDImgLocalSocket::defaultPath
+ * @param port TCP port of server
+ * @return Unix socket path of server, used by clients to find a local server
+ */
+QString SCDImgLocalSocket::defaultPath(quint16 port)
+{
+   return "/tmp/scdimgserver." + QString::number(port) + ".sock";
+}
+
+/**
+ * @brief SCDImgLocalSocket::sendDescriptor send a header line with a descriptor attached (the receiver gets a
+ *                                          duplicate: the sender can close fd on return)
+ * @param sock connected Unix socket (nothing pending to write)
+ * @param fd
+ * @param head
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgLocalSocket::sendDescriptor(qintptr sock, int fd, const QByteArray &head)
+{
+   struct iovec iov;
+
+   iov.iov_base = const_cast<char*>(head.constData());
+   iov.iov_len  = static_cast<size_t>(head.size());
+
+   union
+   {
+      char           buff[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+   } control;
+
+   memset(&control,0,sizeof(control));
+
+   struct msghdr msg;
+
+   memset(&msg,0,sizeof(msg));
+
+   msg.msg_iov        = &iov;
+   msg.msg_iovlen     = 1;
+   msg.msg_control    = control.buff;
+   msg.msg_controllen = sizeof(control.buff);
+
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type  = SCM_RIGHTS;
+   cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+
+   memcpy(CMSG_DATA(cmsg),&fd,sizeof(int));
+
+   ssize_t sent;
+
+   do
+   {
+      sent = ::sendmsg(static_cast<int>(sock),&msg,MSG_NOSIGNAL);
+   }
+   while (sent<0 && errno==EINTR);
+
+   return (sent==head.size());
+}
+
+/**
+ * @brief SCDImgLocalSocket::receive read available data of a non blocking socket, and the descriptor attached to it
+ * @param sock
+ * @param data output param: data is appended
+ * @param fd   output param: received descriptor (close on exec), unchanged if none
+ * @return 1 on success (data may be empty), 0 connection closed, -1 on error
+ */
+int SCDImgLocalSocket::receive(int sock, QByteArray &data, int &fd)
+{
+   char buff[4096];
+
+   struct iovec iov;
+
+   iov.iov_base = buff;
+   iov.iov_len  = sizeof(buff);
+
+   union
+   {
+      char           buff[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+   } control;
+
+   struct msghdr msg;
+
+   memset(&msg,0,sizeof(msg));
+
+   msg.msg_iov        = &iov;
+   msg.msg_iovlen     = 1;
+   msg.msg_control    = control.buff;
+   msg.msg_controllen = sizeof(control.buff);
+
+   ssize_t n;
+
+   do
+   {
+      n = ::recvmsg(sock,&msg,MSG_CMSG_CLOEXEC);
+   }
+   while (n<0 && errno==EINTR);
+
+   if (n<0)
+   {
+      return (errno==EAGAIN || errno==EWOULDBLOCK) ? 1 : -1;
+   }
+
+   for (struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg,cmsg))
+   {
+      if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_RIGHTS && cmsg->cmsg_len==CMSG_LEN(sizeof(int)))
+      {
+         memcpy(&fd,CMSG_DATA(cmsg),sizeof(int));
+      }
+   }
+
+   if (n==0)
+   {
+      return 0;
+   }
+
+   data.append(buff,static_cast<int>(n));
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgLocalSocket::readRange
+ * @param fd
+ * @param offset
+ * @param size
+ * @param data   output param
+ * @return 1 on success, 0 on read error (or range beyond end of file)
+ */
+int SCDImgLocalSocket::readRange(int fd, qint64 offset, qint64 size, QByteArray &data)
+{
+   data.resize(static_cast<int>(size));
+
+   qint64 done = 0;
+
+   while (done<size)
+   {
+      ssize_t n = ::pread(fd, data.data()+done, static_cast<size_t>(size-done), static_cast<off_t>(offset+done));
+
+      if (n<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (n<=0)
+      {
+         data.clear();
+         return 0;
+      }
+
+      done += n;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgLocalSocket::copyRange copy a range of a descriptor to out by sendfile(2) (in kernel, no copies into
+ *                                     user space), by pread/write if out does not support it
+ * @param fd
+ * @param offset
+ * @param size
+ * @param out
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgLocalSocket::copyRange(int fd, qint64 offset, qint64 size, int out)
+{
+   off_t  pos  = static_cast<off_t>(offset);
+   qint64 left = size;
+
+   while (left>0)
+   {
+      ssize_t n = ::sendfile(out, fd, &pos, static_cast<size_t>(left));
+
+      if (n<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (n<=0)
+      {
+         break;
+      }
+
+      left -= n;
+   }
+
+   char buff[COPY_CHUNK];
+
+   while (left>0) // sendfile not supported (or failed): user space copy
+   {
+      ssize_t n = ::pread(fd, buff, static_cast<size_t>(qMin<qint64>(left,COPY_CHUNK)), pos);
+
+      if (n<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (n<=0)
+      {
+         return 0;
+      }
+
+      for (ssize_t written=0; written<n; )
+      {
+         ssize_t w = ::write(out, buff+written, static_cast<size_t>(n-written));
+
+         if (w<0 && errno==EINTR)
+         {
+            continue;
+         }
+
+         if (w<=0)
+         {
+            return 0;
+         }
+
+         written += w;
+      }
+
+      pos  += n;
+      left -= n;
+   }
+
+   return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef SCDIMGLOCALSOCKET_H
+#define SCDIMGLOCALSOCKET_H
+
+#include <QByteArray>
+#include <QString>
+
+/**
+ * @brief The SCDImgLocalSocket class holds the Unix socket helpers shared by server and client. A client on the server
+ *        host asks a GET with the F option and receives, instead of the data, a read-only descriptor of the file
+ *        (or of the segment file of a packed object) with the header line (SCM_RIGHTS):
+ *
+ *          SCDFTH:1.0\tGET:<path>\tF\n  =>  FD\t<offset>\t<size>[\t<validator>]\n + descriptor
+ *
+ *        The client reads the object from the descriptor, or copies it to its output in kernel (sendfile).
+ */
+class SCDImgLocalSocket
+{
+   public:
+
+     static QString defaultPath(quint16 port); // socket path of a server listening on TCP port
+
+     static int sendDescriptor(qintptr sock, int fd, const QByteArray &head);     // head and descriptor in one message
+     static int receive(int sock, QByteArray &data, int &fd);                     // data and descriptor (if any) received
+
+     static int readRange(int fd, qint64 offset, qint64 size, QByteArray &data);  // read a range of a descriptor
+     static int copyRange(int fd, qint64 offset, qint64 size, int out);           // copy a range of a descriptor to out
+};
+
+#endif // SCDIMGLOCALSOCKET_H
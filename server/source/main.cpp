@@ -10,6 +10,8 @@
  */
 #include <QCoreApplication>
 #include "scdimgserver.h"
+#include "scdimglogger.h"
+#include "scdimglocalsocket.h"
 #include <QSettings>
 
 #define  echo QTextStream(stderr) <<
@@ -30,18 +32,244 @@ int main(int argc, char *argv[])
 
    QString appPath = a.applicationDirPath();
 
-   QSettings cfg(appPath + "/config.cfg",QSettings::IniFormat);
+   QString cfgFile = appPath + "/config.cfg";
+
+   QStringList opts = a.arguments().filter("-config:"); // several servers on the same host: one config file each
+
+   if (opts.count())
+   {
+      cfgFile = opts.at(0).section(':',1);
+   }
+
+   QSettings cfg(cfgFile,QSettings::IniFormat);
 
    int port = cfg.value("port",12345).toInt();
    QString rootPath = cfg.value("rootpath","./").toString();
 
+   QStringList rootPaths = cfg.value("storage/rootpaths","").toStringList().join(',').split(',',QString::SkipEmptyParts); // quoted or not
+
+   bool    segEnabled      = cfg.value("segment/enabled",false).toBool();
+   QString segPath         = cfg.value("segment/path","./segments/").toString();
+   qint64  segThreshold    = cfg.value("segment/threshold",65536).toLongLong();
+   qint64  segMaxSize      = cfg.value("segment/maxsize",1073741824).toLongLong();
+   int     compactInterval = cfg.value("segment/compactinterval",60).toInt();
+   double  compactRatio    = cfg.value("segment/compactratio",0.5).toDouble();
+
+   QString ioBackend       = cfg.value("io/backend","qfile").toString();
+   int     ioQueueDepth    = cfg.value("io/queuedepth",64).toInt();
+
+   int     writerThreads   = cfg.value("writer/threads",0).toInt();
+   int     writerQueueSize = cfg.value("writer/queuesize",1024).toInt();
+   qint64  readBufferSize  = cfg.value("writer/readbuffer",262144).toLongLong();
+
+   qint64  rateGlobal      = cfg.value("ratelimit/global",0).toLongLong();
+   qint64  rateClientIp    = cfg.value("ratelimit/perclientip",0).toLongLong();
+   qint64  rateConnection  = cfg.value("ratelimit/perconnection",0).toLongLong();
+
+   int     maxConnections  = cfg.value("connections/max",0).toInt();
+   int     acceptBacklog   = cfg.value("connections/backlog",128).toInt();
+   int     headerTimeout   = cfg.value("connections/headertimeout",0).toInt();
+   int     idleTimeout     = cfg.value("connections/idletimeout",0).toInt();
+   int     timerTick       = cfg.value("connections/timertick",100).toInt();
+
+   int     metricsPort     = cfg.value("metrics/port",0).toInt();
+   QString metricsAddress  = cfg.value("metrics/address","127.0.0.1").toString();
+
+   QString durabilityMode  = cfg.value("durability/mode","none").toString();
+   int     groupInterval   = cfg.value("durability/groupinterval",5).toInt();
+
+   int     httpPort        = cfg.value("http/port",0).toInt();
+   QString httpAddress     = cfg.value("http/address","0.0.0.0").toString();
+
+   bool    localEnabled    = cfg.value("local/enabled",false).toBool();
+   QString localSocket     = cfg.value("local/socket","").toString(); // empty: /tmp/scdimgserver.<port>.sock
+   bool    localWorld      = cfg.value("local/world",false).toBool();   // false: owner and group only
+
+   bool    dedupEnabled    = cfg.value("dedup/enabled",false).toBool();
+   QString dedupIndex      = cfg.value("dedup/index","./hashes.idx").toString();
+
+   bool    metaEnabled     = cfg.value("metadata/enabled",false).toBool();
+   QString metaIndex       = cfg.value("metadata/index","./metadata.idx").toString();
+
+   qint64  sheetCache      = cfg.value("sheet/cache",67108864).toLongLong();
+
+   int     slowThreshold   = cfg.value("slowlog/threshold",0).toInt();
+   QString slowLogFile     = cfg.value("slowlog/file","./slow.log").toString();
+
+   QString captureFile     = cfg.value("capture/file","").toString();
+   qint64  captureMaxSize  = cfg.value("capture/maxsize",1073741824).toLongLong();
+
+   QStringList replPeers   = cfg.value("replication/peers","").toStringList().join(',').split(',',QString::SkipEmptyParts);
+   QString replLogPath     = cfg.value("replication/log","./replication/").toString();
+   int     replBatch       = cfg.value("replication/batch",64).toInt();
+   int     replPipeline    = cfg.value("replication/pipeline",8).toInt();
+   qint64  replSegmentSize = cfg.value("replication/segmentsize",16777216).toLongLong();
+   int     replTimeout     = cfg.value("replication/timeout",30000).toInt();
+
+   QString logLevel        = cfg.value("log/level","info").toString();
+   QString serverLogFile   = cfg.value("log/file","").toString();
+   QString accessLogFile   = cfg.value("log/access","").toString();
+
    cfg.setValue("port",port);
    cfg.setValue("rootpath",rootPath);
 
+   cfg.setValue("storage/rootpaths",rootPaths.join(","));
+
+   cfg.setValue("segment/enabled",segEnabled);
+   cfg.setValue("segment/path",segPath);
+   cfg.setValue("segment/threshold",segThreshold);
+   cfg.setValue("segment/maxsize",segMaxSize);
+   cfg.setValue("segment/compactinterval",compactInterval);
+   cfg.setValue("segment/compactratio",compactRatio);
+
+   cfg.setValue("io/backend",ioBackend);
+   cfg.setValue("io/queuedepth",ioQueueDepth);
+
+   cfg.setValue("writer/threads",writerThreads);
+   cfg.setValue("writer/queuesize",writerQueueSize);
+   cfg.setValue("writer/readbuffer",readBufferSize);
+
+   cfg.setValue("ratelimit/global",rateGlobal);
+   cfg.setValue("ratelimit/perclientip",rateClientIp);
+   cfg.setValue("ratelimit/perconnection",rateConnection);
+
+   cfg.setValue("connections/max",maxConnections);
+   cfg.setValue("connections/backlog",acceptBacklog);
+   cfg.setValue("connections/headertimeout",headerTimeout);
+   cfg.setValue("connections/idletimeout",idleTimeout);
+   cfg.setValue("connections/timertick",timerTick);
+
+   cfg.setValue("metrics/port",metricsPort);
+   cfg.setValue("metrics/address",metricsAddress);
+
+   cfg.setValue("durability/mode",durabilityMode);
+   cfg.setValue("durability/groupinterval",groupInterval);
+
+   cfg.setValue("http/port",httpPort);
+   cfg.setValue("http/address",httpAddress);
+
+   cfg.setValue("local/enabled",localEnabled);
+   cfg.setValue("local/socket",localSocket);
+   cfg.setValue("local/world",localWorld);
+
+   cfg.setValue("dedup/enabled",dedupEnabled);
+   cfg.setValue("dedup/index",dedupIndex);
+
+   cfg.setValue("metadata/enabled",metaEnabled);
+   cfg.setValue("metadata/index",metaIndex);
+
+   cfg.setValue("sheet/cache",sheetCache);
+
+   cfg.setValue("slowlog/threshold",slowThreshold);
+   cfg.setValue("slowlog/file",slowLogFile);
+
+   cfg.setValue("capture/file",captureFile);
+   cfg.setValue("capture/maxsize",captureMaxSize);
+
+   cfg.setValue("replication/peers",replPeers.join(","));
+   cfg.setValue("replication/log",replLogPath);
+   cfg.setValue("replication/batch",replBatch);
+   cfg.setValue("replication/pipeline",replPipeline);
+   cfg.setValue("replication/segmentsize",replSegmentSize);
+   cfg.setValue("replication/timeout",replTimeout);
+
+   cfg.setValue("log/level",logLevel);
+   cfg.setValue("log/file",serverLogFile);
+   cfg.setValue("log/access",accessLogFile);
+
    cfg.sync();
 
+   SCDImgLogger logger(0,SCDImgLogger::levelFromName(logLevel),serverLogFile,accessLogFile);
+
+   if (!logger.open())
+   {
+      echo logger.lastError() << "\n";
+      return 0;
+   }
+
+   if (a.arguments().contains("-rebalance")) // move files to their home root: can run while server is running
+   {
+      SCDImgRootPaths roots(rootPaths.isEmpty() ? QStringList(rootPath) : rootPaths);
+
+      roots.setExcludedPaths(QStringList() << segPath << replLogPath << dedupIndex << metaIndex << slowLogFile << captureFile
+                                           << serverLogFile << accessLogFile << cfg.fileName() << a.applicationFilePath());
+
+      bool dryRun = a.arguments().contains("-dry");
+
+      echo "Rebalancing " << roots.count() << " root paths" << (dryRun ? " (dry run)" : "") << "...\n";
+
+      int ret = roots.rebalance(dryRun);
+
+      echo (dryRun ? "Misplaced files: " : "Moved files: ") << roots.movedFiles() << ", removed copies: " << roots.removedFiles() << ", failures: " << roots.failedFiles() << "\n";
+
+      if (!ret)
+      {
+         echo roots.lastError() << "\n";
+         return 1;
+      }
+
+      return 0;
+   }
+
    SCDImgServer srv(0,port,rootPath);
 
+   srv.setRootPaths(rootPaths);
+
+   srv.setRateLimits(rateGlobal,rateClientIp,rateConnection);
+   srv.watchConfig(cfg.fileName());
+
+   srv.setConnectionLimits(maxConnections,acceptBacklog,headerTimeout,idleTimeout,timerTick);
+
+   srv.setMetricsEndpoint(metricsAddress,metricsPort);
+
+   srv.setHttpGateway(httpAddress,httpPort);
+
+   if (localEnabled)
+   {
+      srv.setLocalSocket(localSocket.isEmpty() ? SCDImgLocalSocket::defaultPath(static_cast<quint16>(port)) : localSocket, localWorld);
+   }
+
+   if (slowThreshold>0)
+   {
+      srv.setSlowLog(slowLogFile,slowThreshold);
+   }
+
+   if (!captureFile.isEmpty())
+   {
+      srv.setCapture(captureFile,captureMaxSize);
+   }
+
+   srv.setStorageIO(SCDImgStorageIO::backendFromName(ioBackend),ioQueueDepth);
+
+   srv.setDurability(SCDImgCommitter::modeFromName(durabilityMode),groupInterval);
+
+   if (writerThreads>0)
+   {
+      srv.setDiskWriter(writerThreads,writerQueueSize,readBufferSize);
+   }
+
+   if (replPeers.count())
+   {
+      srv.setReplication(replPeers,replLogPath,replBatch,replPipeline,replSegmentSize,replTimeout);
+   }
+
+   if (dedupEnabled)
+   {
+      srv.setHashIndex(dedupIndex);
+   }
+
+   if (metaEnabled)
+   {
+      srv.setMetaIndex(metaIndex);
+   }
+
+   srv.setSheetCache(sheetCache);
+
+   if (segEnabled)
+   {
+      srv.setSegmentStore(segPath,segThreshold,segMaxSize,compactInterval,compactRatio);
+   }
+
    if (srv.start())
    {
       return a.exec();
@@ -0,0 +1,161 @@
+#ifndef SCDIMGBOUNDEDQUEUE_H
+#define SCDIMGBOUNDEDQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief The SCDImgBoundedQueue class is a bounded lock-free multi producer/multi consumer queue
+ *        (array of cells stamped with sequence numbers). Capacity is rounded up to a power of two.
+ *        push() fails instead of blocking when the queue is full.
+ */
+template <typename T> class SCDImgBoundedQueue
+{
+   public:
+
+     explicit SCDImgBoundedQueue(size_t capacity=1024)
+     {
+        size_t size = 2;
+
+        while (size<capacity)
+        {
+           size <<= 1;
+        }
+
+        mask   = size - 1;
+        buffer = new Cell[size];
+
+        for (size_t i=0; i<size; i++)
+        {
+           buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+     }
+
+     ~SCDImgBoundedQueue()
+     {
+        delete [] buffer;
+     }
+
+     /**
+      * @brief push enqueue an item
+      * @return false if queue is full
+      */
+     bool push(const T &data)
+     {
+        Cell  *cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+           cell = &buffer[pos & mask];
+
+           size_t   seq = cell->sequence.load(std::memory_order_acquire);
+           intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+           if (dif==0)
+           {
+              if (enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+              {
+                 break;
+              }
+           }
+           else
+           if (dif<0)
+           {
+              return false; // full
+           }
+           else
+           {
+              pos = enqueuePos.load(std::memory_order_relaxed);
+           }
+        }
+
+        cell->data = data;
+        cell->sequence.store(pos+1, std::memory_order_release);
+
+        return true;
+     }
+
+     /**
+      * @brief pop dequeue an item
+      * @return false if queue is empty
+      */
+     bool pop(T &data)
+     {
+        Cell  *cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+           cell = &buffer[pos & mask];
+
+           size_t   seq = cell->sequence.load(std::memory_order_acquire);
+           intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos+1);
+
+           if (dif==0)
+           {
+              if (dequeuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+              {
+                 break;
+              }
+           }
+           else
+           if (dif<0)
+           {
+              return false; // empty
+           }
+           else
+           {
+              pos = dequeuePos.load(std::memory_order_relaxed);
+           }
+        }
+
+        data       = cell->data;
+        cell->data = T(); // release item resources
+        cell->sequence.store(pos+mask+1, std::memory_order_release);
+
+        return true;
+     }
+
+     /**
+      * @brief capacity max number of queued items
+      */
+     size_t capacity() const
+     {
+        return mask + 1;
+     }
+
+     /**
+      * @brief size approximate number of queued items
+      */
+     size_t size() const
+     {
+        size_t in  = enqueuePos.load(std::memory_order_relaxed);
+        size_t out = dequeuePos.load(std::memory_order_relaxed);
+
+        return (in>out) ? in-out : 0;
+     }
+
+   private:
+
+     struct Cell
+     {
+        std::atomic<size_t> sequence;
+        T                   data;
+     };
+
+     Cell  *buffer;
+     size_t mask;
+
+     alignas(64) std::atomic<size_t> enqueuePos;
+     alignas(64) std::atomic<size_t> dequeuePos;
+
+     SCDImgBoundedQueue(const SCDImgBoundedQueue &);
+     SCDImgBoundedQueue &operator=(const SCDImgBoundedQueue &);
+};
+
+#endif // SCDIMGBOUNDEDQUEUE_H
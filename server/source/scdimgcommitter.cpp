@@ -0,0 +1,358 @@
+/**
+ * @class SCDImgCommitter - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server durability stage. An upload is acknowledged ("ok") only when the configured
+ *        guarantee is met: with DM_FSYNC each file pays its own fdatasync and folder fsync, with DM_GROUP
+ *        concurrent uploads share them. Group commit starts the writeback of every file of the batch at once
+ *        (sync_file_range), waits for it (fdatasync), renames the files and syncs each folder once, so the
+ *        disk sees a few large flushes instead of a flush per file.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scdimgcommitter.h"
+#include "scdimgsegmentstore.h"
+#include "scdimglogger.h"
+
+/**
+ * @brief SCDImgCommitter::modeFromName
+ * @param name durability mode name (none, fsync, group)
+ * @return
+ */
+int SCDImgCommitter::modeFromName(QString name)
+{
+   name = name.trimmed().toLower();
+
+   if (name=="fsync")
+   {
+      return DM_FSYNC;
+   }
+
+   if (name=="group")
+   {
+      return DM_GROUP;
+   }
+
+   if (name!="none")
+   {
+      logWarning() << "Unknown durability mode " << name << ": using none";
+   }
+
+   return DM_NONE;
+}
+
+/**
+ * @brief SCDImgCommitter::SCDImgCommitter
+ * @param parent
+ * @param mode     durability mode (Mode)
+ * @param interval msecs between group commits (DM_GROUP)
+ */
+SCDImgCommitter::SCDImgCommitter(QObject *parent, int mode, int interval) : QThread(parent), durability(mode), interval(qMax(1,interval))
+{
+   store   = 0;
+   stopped = false;
+
+   batchCount.store(0);
+   fileCount.store(0);
+}
+
+/**
+ * @brief SCDImgCommitter::mode
+ * @return durability mode (Mode)
+ */
+int SCDImgCommitter::mode()
+{
+   return durability;
+}
+
+/**
+ * @brief SCDImgCommitter::setSegmentStore segment store synced when packed objects are committed
+ * @param store
+ */
+void SCDImgCommitter::setSegmentStore(SCDImgSegmentStore *store)
+{
+   this->store = store;
+}
+
+/**
+ * @brief SCDImgCommitter::run group commit loop: the first queued upload opens a batch, uploads queued
+ *                             within interval msecs join it
+ */
+void SCDImgCommitter::run()
+{
+   forever
+   {
+      QList<SCDImgUploadPtr> batch;
+
+      {
+         QMutexLocker locker(&mutex);
+
+         while (pending.isEmpty() && !stopped)
+         {
+            wait.wait(&mutex);
+         }
+
+         if (pending.isEmpty())
+         {
+            break; // stopped
+         }
+
+         QElapsedTimer timer;
+
+         timer.start();
+
+         while (!stopped && timer.elapsed()<interval)
+         {
+            wait.wait(&mutex, static_cast<unsigned long>(interval-timer.elapsed()));
+         }
+
+         batch.swap(pending);
+      }
+
+      commit(batch);
+   }
+}
+
+/**
+ * @brief SCDImgCommitter::stop commit queued uploads and stop committer thread
+ */
+void SCDImgCommitter::stop()
+{
+   {
+      QMutexLocker locker(&mutex);
+
+      stopped = true;
+
+      wait.wakeAll();
+   }
+
+   if (isRunning())
+   {
+      QThread::wait();
+   }
+}
+
+/**
+ * @brief SCDImgCommitter::submit queue a closed upload for next group commit. When committed (or failed)
+ *                                upload receiver writeCompleted(int,QString) slot is invoked.
+ * @param upload closed temp file, or a packed object (null io)
+ */
+void SCDImgCommitter::submit(const SCDImgUploadPtr &upload)
+{
+   QMutexLocker locker(&mutex);
+
+   if (stopped)
+   {
+      locker.unlock();
+
+      QList<SCDImgUploadPtr> batch;
+
+      batch.append(upload);
+
+      commit(batch); // committer is stopping: commit by caller thread
+
+      return;
+   }
+
+   pending.append(upload);
+
+   wait.wakeAll();
+}
+
+/**
+ * @brief SCDImgCommitter::batches
+ * @return group commits done
+ */
+quint64 SCDImgCommitter::batches()
+{
+   return batchCount.load();
+}
+
+/**
+ * @brief SCDImgCommitter::files
+ * @return files and packed objects committed by group commits
+ */
+quint64 SCDImgCommitter::files()
+{
+   return fileCount.load();
+}
+
+/**
+ * @brief SCDImgCommitter::commit commit a batch of uploads: data of all files is flushed (writeback of every
+ *                                file is started before waiting for any), files are renamed, folders and
+ *                                segment store are synced once, then receivers are notified
+ * @param batch
+ */
+void SCDImgCommitter::commit(QList<SCDImgUploadPtr> &batch)
+{
+   QList<int> fds;
+   bool       packed = false;
+
+   foreach (const SCDImgUploadPtr &upload, batch)
+   {
+      int fd = -1;
+
+      if (upload->aborted.load())
+      {
+         upload->failed = true; // connection closed: upload is removed when last reference is dropped
+      }
+      else
+      if (!upload->io)
+      {
+         packed = true;
+      }
+      else
+      if ((fd = ::open(QFile::encodeName(upload->io->fileName()).constData(), O_RDONLY|O_CLOEXEC))<0)
+      {
+         upload->failed = true;
+         upload->error  = "sync file error: " + upload->io->fileName() + " => " + QString::fromLocal8Bit(strerror(errno));
+      }
+      else
+      {
+         ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE); // start writeback: files of the batch are flushed together
+      }
+
+      fds.append(fd);
+   }
+
+   // wait file data, then rename -----------------------------------------------
+
+   QSet<QString> folders;
+
+   for (int i=0; i<batch.count(); i++)
+   {
+      SCDImgUpload *upload = batch.at(i).data();
+
+      int fd = fds.at(i);
+
+      if (fd<0)
+      {
+         continue;
+      }
+
+      if (::fdatasync(fd)!=0)
+      {
+         upload->failed = true;
+         upload->error  = "sync file error: " + upload->io->fileName() + " => " + QString::fromLocal8Bit(strerror(errno));
+      }
+
+      ::close(fd);
+
+      if (!upload->failed)
+      {
+         if (upload->io->rename(upload->fileName))
+         {
+            folders.insert(QFileInfo(upload->fileName).absolutePath());
+         }
+         else
+         {
+            upload->failed = true;
+            upload->error  = "Rename file error: " + upload->io->fileName() + " => " + upload->io->errorString();
+         }
+      }
+   }
+
+   // sync folders and segment store --------------------------------------------
+
+   QSet<QString> failedFolders;
+
+   foreach (const QString &folder, folders)
+   {
+      QString errMsg;
+
+      if (!syncDir(folder,errMsg))
+      {
+         logError() << errMsg;
+
+         failedFolders.insert(folder);
+      }
+   }
+
+   QString packedError;
+
+   if (packed && store && !store->sync())
+   {
+      packedError = "Segment sync error: " + store->lastError();
+
+      logError() << packedError;
+   }
+
+   // notify receivers ----------------------------------------------------------
+
+   foreach (const SCDImgUploadPtr &upload, batch)
+   {
+      if (upload->aborted.load())
+      {
+         continue;
+      }
+
+      if (!upload->io)
+      {
+         upload->completed = true;
+         upload->notify(packedError.isEmpty() ? 1 : 0, packedError);
+      }
+      else
+      if (upload->failed)
+      {
+         upload->io->remove();
+         upload->completed = true;
+         upload->notify(0,upload->error);
+      }
+      else
+      if (failedFolders.contains(QFileInfo(upload->fileName).absolutePath()))
+      {
+         upload->completed = true; // renamed, but the rename may not survive a power loss
+         upload->notify(0,"sync folder error: " + QFileInfo(upload->fileName).absolutePath());
+      }
+      else
+      {
+         upload->completed = true;
+         upload->notify(1,QString());
+      }
+   }
+
+   batchCount++;
+   fileCount += static_cast<quint64>(batch.count());
+}
+
+/**
+ * @brief SCDImgCommitter::syncDir flush a folder: creations and renames of its entries become durable
+ * @param path
+ * @param errMsg output param
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgCommitter::syncDir(const QString &path, QString &errMsg)
+{
+   int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+   if (fd<0 || ::fsync(fd)!=0)
+   {
+      errMsg = "sync folder error: " + path + " => " + QString::fromLocal8Bit(strerror(errno));
+
+      if (fd>=0)
+      {
+         ::close(fd);
+      }
+
+      return 0;
+   }
+
+   ::close(fd);
+
+   return 1;
+}
@@ -0,0 +1,71 @@
+#ifndef SCDIMGCOMMITTER_H
+#define SCDIMGCOMMITTER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include <QString>
+
+#include <atomic>
+
+#include "scdimgdiskwriter.h"
+
+class SCDImgSegmentStore;
+
+/**
+ * @brief The SCDImgCommitter class makes received files durable before the upload is acknowledged:
+ *
+ *          DM_NONE  : file is closed and renamed, the page cache is flushed by the kernel (fastest, no guarantee)
+ *          DM_FSYNC : file data is synced before rename and its folder after rename, by the thread receiving it
+ *          DM_GROUP : closed files are queued and committed in batches every interval msecs by the committer thread:
+ *                     data of the whole batch is synced, files are renamed, then each folder is synced once
+ *
+ *        A file is renamed to its final name only once its data is on disk, so a power loss never leaves an empty
+ *        or partial image under a valid name. Packed objects are committed by syncing the segment store.
+ */
+class SCDImgCommitter : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     enum Mode {DM_NONE=0,DM_FSYNC=1,DM_GROUP=2};
+
+     static int modeFromName(QString name);
+
+     explicit SCDImgCommitter(QObject *parent=0, int mode=DM_NONE, int interval=5);
+
+     int  mode();
+     void setSegmentStore(SCDImgSegmentStore *store);
+
+     void run();
+     void stop(); // commit queued files and stop thread
+
+     void submit(const SCDImgUploadPtr &upload); // DM_GROUP: queue a closed upload (null io: a packed object), receiver writeCompleted() is invoked when committed
+
+     quint64 batches(); // group commits done
+     quint64 files();   // files and packed objects committed by group commits
+
+     static int syncDir(const QString &path, QString &errMsg); // flush a folder (file creations and renames)
+
+   private:
+
+     int durability; // Mode
+     int interval;   // msecs between group commits
+
+     SCDImgSegmentStore *store;
+
+     QList<SCDImgUploadPtr> pending; // uploads waiting for next group commit
+
+     bool           stopped;
+     QMutex         mutex;
+     QWaitCondition wait;
+
+     std::atomic<quint64> batchCount;
+     std::atomic<quint64> fileCount;
+
+     void commit(QList<SCDImgUploadPtr> &batch);
+};
+
+#endif // SCDIMGCOMMITTER_H
@@ -0,0 +1,447 @@
+/**
+ * @class SCDImgDiskWriter - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server disk writer stage. Connection threads hand the received buffers to disk writer
+ *        threads through bounded lock-free queues, so a slow disk never stops the socket draining.
+ *        All jobs of an upload go to the same writer thread, preserving the writes order.
+ *
+ *        When a queue is full the connection thread stops reading the socket (TCP window closes) and
+ *        its upload is registered as waiter: the writer thread resumes it when the queue is half empty.
+ *        File completion (close and rename) is signalled back to the connection thread, which then
+ *        sends the reply to the client.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QMetaObject>
+#include <QFileInfo>
+
+#include "scdimgdiskwriter.h"
+#include "scdimgcommitter.h"
+
+/**
+ * @brief SCDImgUpload::SCDImgUpload constructor
+ * @param id       upload id
+ * @param io       opened temp file handle (ownership is taken), null for a packed object waiting for group commit
+ * @param fileName final file name
+ * @param receiver connection signals handler notified on completion
+ */
+SCDImgUpload::SCDImgUpload(quint64 id, SCDImgStorageIO *io, QString fileName, QObject *receiver) : id(id), io(io), fileName(fileName), receiver(receiver)
+{
+   failed    = false;
+   completed = false;
+
+   aborted.store(false);
+}
+
+/**
+ * @brief SCDImgUpload::~SCDImgUpload destructor: removes temp file of an uncompleted upload
+ */
+SCDImgUpload::~SCDImgUpload()
+{
+   if (!completed && io)
+   {
+      io->remove();
+   }
+
+   delete io;
+}
+
+/**
+ * @brief SCDImgUpload::notify queued invocation of a receiver slot
+ * @param method slot name
+ */
+void SCDImgUpload::notify(const char *method)
+{
+   QMutexLocker locker(&mutex);
+
+   if (receiver)
+   {
+      QMetaObject::invokeMethod(receiver, method, Qt::QueuedConnection);
+   }
+}
+
+/**
+ * @brief SCDImgUpload::notify queued invocation of receiver writeCompleted(int,QString) slot
+ * @param ret    1 on success, 0 on failure
+ * @param errMsg
+ */
+void SCDImgUpload::notify(int ret, const QString &errMsg)
+{
+   QMutexLocker locker(&mutex);
+
+   if (receiver)
+   {
+      QMetaObject::invokeMethod(receiver, "writeCompleted", Qt::QueuedConnection, Q_ARG(int,ret), Q_ARG(QString,errMsg));
+   }
+}
+
+/**
+ * @brief SCDImgUpload::detach called when the receiver is being destroyed
+ * @param abort discard queued writes and remove the file
+ */
+void SCDImgUpload::detach(bool abort)
+{
+   QMutexLocker locker(&mutex);
+
+   receiver = 0;
+
+   if (abort)
+   {
+      aborted.store(true);
+   }
+}
+
+/**
+ * @class SCDImgDiskWriterThread
+ *
+ * @brief Disk writer thread
+ */
+
+/**
+ * @brief SCDImgDiskWriterThread::SCDImgDiskWriterThread constructor
+ * @param parent
+ * @param queueSize
+ */
+SCDImgDiskWriterThread::SCDImgDiskWriterThread(QObject *parent, int queueSize) : QThread(parent), queue(static_cast<size_t>(queueSize))
+{
+   committer = 0;
+
+   hasWaiters.store(false);
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::setCommitter
+ * @param committer durability stage of completed files
+ */
+void SCDImgDiskWriterThread::setCommitter(SCDImgCommitter *committer)
+{
+   this->committer = committer;
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::run consume queued jobs
+ */
+void SCDImgDiskWriterThread::run()
+{
+   forever
+   {
+      available.acquire();
+
+      SCDImgWriteJob job;
+
+      if (!queue.pop(job))
+      {
+         continue;
+      }
+
+      if (job.type==SCDImgWriteJob::WJ_STOP)
+      {
+         break;
+      }
+
+      process(job);
+
+      job.upload.clear(); // drop upload reference before resuming
+
+      if (hasWaiters.load() && queue.size()<=queue.capacity()/2)
+      {
+         resumeWaiters();
+      }
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::push enqueue a job
+ * @param job
+ * @return 1 on success, 0 if queue is full
+ */
+int SCDImgDiskWriterThread::push(const SCDImgWriteJob &job)
+{
+   if (queue.push(job))
+   {
+      available.release();
+      return 1;
+   }
+
+   // queue full: register upload as waiter, then retry (the queue may have been drained meanwhile)
+
+   {
+      QMutexLocker locker(&waitLock);
+
+      waiters.append(job.upload);
+
+      hasWaiters.store(true);
+   }
+
+   if (queue.push(job))
+   {
+      available.release();
+      return 1;
+   }
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::stop enqueue a stop job
+ */
+void SCDImgDiskWriterThread::stop()
+{
+   SCDImgWriteJob job;
+
+   job.type = SCDImgWriteJob::WJ_STOP;
+
+   while (!queue.push(job))
+   {
+      msleep(1);
+   }
+
+   available.release();
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::queueDepth
+ * @return
+ */
+size_t SCDImgDiskWriterThread::queueDepth()
+{
+   return queue.size();
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::process execute a job
+ * @param job
+ */
+void SCDImgDiskWriterThread::process(SCDImgWriteJob &job)
+{
+   SCDImgUpload *upload = job.upload.data();
+
+   if (upload->aborted.load())
+   {
+      return; // upload is removed when last reference is dropped
+   }
+
+   switch (job.type)
+   {
+      case SCDImgWriteJob::WJ_WRITE:
+
+        if (!upload->failed && upload->io->write(job.data)==-1)
+        {
+           upload->failed = true;
+           upload->error  = "write file error: " + upload->io->fileName() + " => " + upload->io->errorString();
+        }
+
+      break;
+
+      case SCDImgWriteJob::WJ_FINISH:
+
+        if (!upload->failed && committer && committer->mode()==SCDImgCommitter::DM_FSYNC && !upload->io->sync()) // data on disk before rename
+        {
+           upload->failed = true;
+           upload->error  = "sync file error: " + upload->io->fileName() + " => " + upload->io->errorString();
+        }
+
+        if (!upload->failed && !upload->io->close()) // waits queued writes
+        {
+           upload->failed = true;
+           upload->error  = "write file error: " + upload->io->fileName() + " => " + upload->io->errorString();
+        }
+
+        if (!upload->failed && committer && committer->mode()==SCDImgCommitter::DM_GROUP)
+        {
+           committer->submit(job.upload); // synced, renamed and notified by next group commit
+           return;
+        }
+
+        if (!upload->failed)
+        {
+           if (upload->io->rename(upload->fileName))
+           {
+              QString errMsg;
+
+              upload->completed = true;
+
+              if (committer && committer->mode()==SCDImgCommitter::DM_FSYNC && !SCDImgCommitter::syncDir(QFileInfo(upload->fileName).absolutePath(),errMsg))
+              {
+                 upload->notify(0,errMsg); // renamed, but the rename may not survive a power loss
+                 return;
+              }
+
+              upload->notify(1,QString());
+              return;
+           }
+
+           upload->error = "Rename file error: " + upload->io->fileName() + " => " + upload->io->errorString();
+        }
+
+        upload->io->remove();
+        upload->completed = true;
+        upload->notify(0,upload->error);
+
+      break;
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriterThread::resumeWaiters notify paused uploads that the queue has free space
+ */
+void SCDImgDiskWriterThread::resumeWaiters()
+{
+   QList<SCDImgUploadPtr> list;
+
+   {
+      QMutexLocker locker(&waitLock);
+
+      list.swap(waiters);
+
+      hasWaiters.store(false);
+   }
+
+   foreach (SCDImgUploadPtr upload, list)
+   {
+      upload->notify("writeResumed");
+   }
+}
+
+/**
+ * @class SCDImgDiskWriter
+ *
+ * @brief Pool of disk writer threads
+ */
+
+/**
+ * @brief SCDImgDiskWriter::SCDImgDiskWriter constructor
+ * @param parent
+ * @param threads   number of writer threads
+ * @param queueSize capacity of each writer queue (jobs)
+ */
+SCDImgDiskWriter::SCDImgDiskWriter(QObject *parent, int threads, int queueSize) : QObject(parent)
+{
+   uploadId.store(0);
+
+   for (int i=0; i<qMax(1,threads); i++)
+   {
+      writers.append(new SCDImgDiskWriterThread(this,queueSize));
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriter::~SCDImgDiskWriter destructor
+ */
+SCDImgDiskWriter::~SCDImgDiskWriter()
+{
+   stop();
+}
+
+/**
+ * @brief SCDImgDiskWriter::start start writer threads
+ */
+void SCDImgDiskWriter::start()
+{
+   foreach (SCDImgDiskWriterThread *writer, writers)
+   {
+      writer->start();
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriter::stop stop writer threads when queued jobs have been written
+ */
+void SCDImgDiskWriter::stop()
+{
+   foreach (SCDImgDiskWriterThread *writer, writers)
+   {
+      if (writer->isRunning())
+      {
+         writer->stop();
+         writer->wait();
+      }
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriter::setCommitter completed files are made durable by committer before being acknowledged.
+ *                                       Call it before start()
+ * @param committer
+ */
+void SCDImgDiskWriter::setCommitter(SCDImgCommitter *committer)
+{
+   foreach (SCDImgDiskWriterThread *writer, writers)
+   {
+      writer->setCommitter(committer);
+   }
+}
+
+/**
+ * @brief SCDImgDiskWriter::nextId
+ * @return a new upload id
+ */
+quint64 SCDImgDiskWriter::nextId()
+{
+   return ++uploadId;
+}
+
+/**
+ * @brief SCDImgDiskWriter::write enqueue a buffer to append to upload file
+ * @param upload
+ * @param data
+ * @return 1 on success, 0 if queue is full (upload receiver writeResumed() slot is invoked later)
+ */
+int SCDImgDiskWriter::write(const SCDImgUploadPtr &upload, const QByteArray &data)
+{
+   SCDImgWriteJob job;
+
+   job.type   = SCDImgWriteJob::WJ_WRITE;
+   job.upload = upload;
+   job.data   = data;
+
+   return writer(upload)->push(job);
+}
+
+/**
+ * @brief SCDImgDiskWriter::finish enqueue upload completion: close and rename file,
+ *                                 then invokes receiver writeCompleted(int,QString) slot
+ * @param upload
+ * @return 1 on success, 0 if queue is full (upload receiver writeResumed() slot is invoked later)
+ */
+int SCDImgDiskWriter::finish(const SCDImgUploadPtr &upload)
+{
+   SCDImgWriteJob job;
+
+   job.type   = SCDImgWriteJob::WJ_FINISH;
+   job.upload = upload;
+
+   return writer(upload)->push(job);
+}
+
+/**
+ * @brief SCDImgDiskWriter::queueDepth
+ * @return number of queued jobs of all writers
+ */
+size_t SCDImgDiskWriter::queueDepth()
+{
+   size_t depth = 0;
+
+   foreach (SCDImgDiskWriterThread *writer, writers)
+   {
+      depth += writer->queueDepth();
+   }
+
+   return depth;
+}
+
+/**
+ * @brief SCDImgDiskWriter::writer
+ * @param upload
+ * @return writer thread of upload
+ */
+SCDImgDiskWriterThread *SCDImgDiskWriter::writer(const SCDImgUploadPtr &upload)
+{
+   return writers.at(static_cast<int>(upload->id % static_cast<quint64>(writers.size())));
+}
@@ -0,0 +1,138 @@
+#ifndef SCDIMGDISKWRITER_H
+#define SCDIMGDISKWRITER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QList>
+
+#include <atomic>
+
+#include "scdimgstorageio.h"
+#include "scdimgboundedqueue.h"
+
+class SCDImgCommitter;
+
+/**
+ * @brief The SCDImgUpload class is the state of a file being received, shared between a connection
+ *        thread (which fills buffers) and a disk writer thread (which writes them).
+ *        When the last reference is dropped an uncompleted file is removed.
+ */
+class SCDImgUpload
+{
+   public:
+
+     SCDImgUpload(quint64 id, SCDImgStorageIO *io, QString fileName, QObject *receiver);
+
+     ~SCDImgUpload();
+
+     quint64          id;
+     SCDImgStorageIO *io;       // opened temp file (owned), null for a packed object waiting for group commit
+     QString          fileName; // final file name
+
+     bool    failed;            // a write failed (writer thread only)
+     bool    completed;         // file renamed to its final name (writer thread only)
+     QString error;
+
+     std::atomic<bool> aborted; // connection closed before upload completion
+
+     void notify(const char *method);               // queued invocation of a receiver slot
+     void notify(int ret, const QString &errMsg);   // queued invocation of receiver writeCompleted(int,QString)
+     void detach(bool abort);                       // the receiver is being destroyed
+
+   private:
+
+     QMutex   mutex;
+     QObject *receiver; // connection signals handler (null when detached)
+};
+
+typedef QSharedPointer<SCDImgUpload> SCDImgUploadPtr;
+
+/**
+ * @brief The SCDImgWriteJob struct is a queued disk writer job
+ */
+struct SCDImgWriteJob
+{
+   enum Type {WJ_NONE,WJ_WRITE,WJ_FINISH,WJ_STOP};
+
+   int             type;
+   SCDImgUploadPtr upload;
+   QByteArray      data;
+
+   SCDImgWriteJob() : type(WJ_NONE) {}
+};
+
+/**
+ * @brief The SCDImgDiskWriterThread class consumes the write jobs of its bounded queue
+ */
+class SCDImgDiskWriterThread : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgDiskWriterThread(QObject *parent=0, int queueSize=1024);
+
+     void setCommitter(SCDImgCommitter *committer);
+
+     void run();
+
+     int  push(const SCDImgWriteJob &job);  // 0 if queue is full: the upload is resumed when space is available
+     void stop();
+
+     size_t queueDepth();
+
+   private:
+
+     SCDImgBoundedQueue<SCDImgWriteJob> queue;
+
+     SCDImgCommitter *committer; // durability of completed files (null: close and rename only)
+
+     QSemaphore available; // number of queued jobs
+
+     QMutex                 waitLock;
+     QList<SCDImgUploadPtr> waiters;    // uploads paused because queue was full
+     std::atomic<bool>      hasWaiters;
+
+     void process(SCDImgWriteJob &job);
+     void resumeWaiters();
+};
+
+/**
+ * @brief The SCDImgDiskWriter class is the server disk writer stage: a pool of writer threads which
+ *        decouples disk writes from the network threads event loop
+ */
+class SCDImgDiskWriter : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgDiskWriter(QObject *parent=0, int threads=2, int queueSize=1024);
+
+     ~SCDImgDiskWriter();
+
+     void start();
+     void stop();
+
+     void setCommitter(SCDImgCommitter *committer); // Call it before start()
+
+     quint64 nextId();
+
+     int write(const SCDImgUploadPtr &upload, const QByteArray &data); // 0 if queue is full
+     int finish(const SCDImgUploadPtr &upload);                        // 0 if queue is full
+
+     size_t queueDepth(); // number of queued jobs
+
+   private:
+
+     QList<SCDImgDiskWriterThread*> writers;
+
+     std::atomic<quint64> uploadId;
+
+     SCDImgDiskWriterThread *writer(const SCDImgUploadPtr &upload);
+};
+
+#endif // SCDIMGDISKWRITER_H
@@ -0,0 +1,439 @@
+/**
+ * @class SCDImgExif - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server EXIF reader. Camera JPEGs carry a small JPEG preview in the EXIF APP1 segment
+ *        (IFD1 JPEGInterchangeFormat): a thumbnail scaled from it costs the decoding of a few KB instead
+ *        of the whole image. The preview is used only when it is large enough and has the aspect ratio of
+ *        the main image (some cameras pad previews with black bars).
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QTransform>
+
+#include "scdimgexif.h"
+
+#define EXIF_ORIENTATION 0x0112
+#define EXIF_DATETIME    0x0132
+#define EXIF_DATE_ORIG   0x9003
+#define EXIF_IFD_POINTER 0x8769
+#define EXIF_PIXEL_X     0xA002
+#define EXIF_PIXEL_Y     0xA003
+#define EXIF_JPEG_OFFSET 0x0201
+#define EXIF_JPEG_LENGTH 0x0202
+
+/**
+ * @brief SCDImgExif::SCDImgExif parse JPEG header
+ * @param head first bytes of a file (HEAD_SIZE), or a whole object
+ */
+SCDImgExif::SCDImgExif(const QByteArray &head) : data(head)
+{
+   exif          = false;
+   orient1to8    = 1;
+   previewOffset = 0;
+   previewLength = 0;
+   bigEndian     = false;
+
+   if (data.size()<4 || static_cast<quint8>(data.at(0))!=0xFF || static_cast<quint8>(data.at(1))!=0xD8)
+   {
+      return; // not a JPEG file
+   }
+
+   int pos = 2;
+
+   while (pos+4<=data.size())
+   {
+      quint8 marker = static_cast<quint8>(data.at(pos+1));
+
+      if (static_cast<quint8>(data.at(pos))!=0xFF || marker==0xDA || marker==0xD9)
+      {
+         break; // scan data (or corrupted header): no more header segments
+      }
+
+      if (marker==0xFF)
+      {
+         pos++; // fill byte
+         continue;
+      }
+
+      int length = (static_cast<quint8>(data.at(pos+2))<<8) | static_cast<quint8>(data.at(pos+3));
+
+      if (length<2)
+      {
+         break;
+      }
+
+      if (marker==0xE1 && !exif && data.mid(pos+4,6)==QByteArray("Exif\0\0",6))
+      {
+         parseTiff(pos+10, qMin(pos+2+length,data.size())-(pos+10));
+      }
+
+      pos += 2+length;
+   }
+
+   if (!size.isValid())
+   {
+      size = frameSize(data,0,data.size()); // no EXIF image size: frame header, if it is in head
+   }
+}
+
+/**
+ * @brief SCDImgExif::hasExif
+ * @return true if an EXIF segment has been found
+ */
+bool SCDImgExif::hasExif()
+{
+   return exif;
+}
+
+/**
+ * @brief SCDImgExif::orientation
+ * @return EXIF orientation 1..8 (1 if missing)
+ */
+int SCDImgExif::orientation()
+{
+   return orient1to8;
+}
+
+/**
+ * @brief SCDImgExif::imageSize
+ * @return main image size (EXIF pixel dimensions, or frame header), invalid if unknown
+ */
+QSize SCDImgExif::imageSize()
+{
+   return size;
+}
+
+/**
+ * @brief SCDImgExif::captureDate
+ * @return date and time the picture was taken (camera local time), or last modified if missing; invalid if none
+ */
+QDateTime SCDImgExif::captureDate()
+{
+   return date;
+}
+
+/**
+ * @brief SCDImgExif::preview decode the embedded preview
+ * @param minSize min size of preview, once oriented
+ * @return preview (not oriented), null if missing, smaller than minSize or with a different aspect ratio than main image
+ */
+QImage SCDImgExif::preview(const QSize &minSize)
+{
+   if (!previewOffset || !size.isValid())
+   {
+      return QImage();
+   }
+
+   QSize previewSize = frameSize(data, previewOffset, previewOffset+previewLength);
+   QSize min         = (orient1to8>=5) ? minSize.transposed() : minSize; // orientations 5..8 swap width and height
+
+   if (!previewSize.isValid() || previewSize.width()<min.width() || previewSize.height()<min.height())
+   {
+      return QImage();
+   }
+
+   qint64 mismatch = qAbs(static_cast<qint64>(previewSize.width())*size.height() - static_cast<qint64>(size.width())*previewSize.height());
+
+   if (mismatch*50 > static_cast<qint64>(size.width())*previewSize.height()) // aspect ratios differ more than 2%
+   {
+      return QImage();
+   }
+
+   QImage image;
+
+   image.loadFromData(reinterpret_cast<const uchar*>(data.constData()+previewOffset), previewLength, "JPEG");
+
+   return image;
+}
+
+/**
+ * @brief SCDImgExif::orient apply EXIF orientation (same transformations of QImageReader auto transform)
+ * @param image
+ * @param orientation 1..8
+ * @return
+ */
+QImage SCDImgExif::orient(const QImage &image, int orientation)
+{
+   switch (orientation)
+   {
+      case 2: return image.mirrored(true,false);
+      case 3: return image.mirrored(true,true); // rotate 180
+      case 4: return image.mirrored(false,true);
+      case 5: return image.mirrored(false,true).transformed(QTransform().rotate(90)); // flip and rotate 90 (transpose)
+      case 6: return image.transformed(QTransform().rotate(90));
+      case 7: return image.mirrored(true,false).transformed(QTransform().rotate(90)); // mirror and rotate 90 (transverse)
+      case 8: return image.transformed(QTransform().rotate(270));
+   }
+
+   return image;
+}
+
+/**
+ * @brief SCDImgExif::parseTiff read orientation (IFD0), image size (Exif IFD) and preview location (IFD1) of EXIF TIFF structure
+ * @param tiff   offset of TIFF header into data
+ * @param length TIFF structure length
+ */
+void SCDImgExif::parseTiff(int tiff, int length)
+{
+   if (length<8)
+   {
+      return;
+   }
+
+   if (data.mid(tiff,2)=="II")
+   {
+      bigEndian = false;
+   }
+   else
+   if (data.mid(tiff,2)=="MM")
+   {
+      bigEndian = true;
+   }
+   else
+   {
+      return;
+   }
+
+   exif = true;
+
+   // IFD0: main image ------------------------------------------------------
+
+   qint64 ifd = u32(tiff+4);
+
+   if (ifd+2>length)
+   {
+      return;
+   }
+
+   int count = u16(tiff+static_cast<int>(ifd));
+
+   if (ifd+2+count*12+4>length)
+   {
+      return;
+   }
+
+   qint64 exifIfd = 0;
+
+   for (int i=0; i<count; i++)
+   {
+      int entry = tiff + static_cast<int>(ifd) + 2 + i*12;
+
+      if (u16(entry)==EXIF_ORIENTATION && u16(entry+2)==3) // SHORT
+      {
+         int value = u16(entry+8);
+
+         if (value>=1 && value<=8)
+         {
+            orient1to8 = value;
+         }
+      }
+      else
+      if (u16(entry)==EXIF_IFD_POINTER)
+      {
+         exifIfd = u32(entry+8);
+      }
+      else
+      if (u16(entry)==EXIF_DATETIME)
+      {
+         date = dateTime(entry,tiff,length);
+      }
+   }
+
+   // Exif IFD: main image size ---------------------------------------------
+
+   if (exifIfd>0 && exifIfd+2<=length)
+   {
+      int exifCount = u16(tiff+static_cast<int>(exifIfd));
+
+      if (exifIfd+2+exifCount*12<=length)
+      {
+         int width  = 0;
+         int height = 0;
+
+         for (int i=0; i<exifCount; i++)
+         {
+            int entry = tiff + static_cast<int>(exifIfd) + 2 + i*12;
+
+            quint16 tag   = u16(entry);
+            int     value = static_cast<int>((u16(entry+2)==3) ? u16(entry+8) : u32(entry+8)); // SHORT or LONG
+
+            if (tag==EXIF_PIXEL_X)
+            {
+               width = value;
+            }
+            else
+            if (tag==EXIF_PIXEL_Y)
+            {
+               height = value;
+            }
+            else
+            if (tag==EXIF_DATE_ORIG)
+            {
+               QDateTime original = dateTime(entry,tiff,length);
+
+               if (original.isValid())
+               {
+                  date = original; // DateTimeOriginal takes precedence over DateTime
+               }
+            }
+         }
+
+         if (width>0 && height>0)
+         {
+            size = QSize(width,height);
+         }
+      }
+   }
+
+   // IFD1: thumbnail -------------------------------------------------------
+
+   ifd = u32(tiff+static_cast<int>(ifd)+2+count*12);
+
+   if (ifd==0 || ifd+2>length)
+   {
+      return;
+   }
+
+   count = u16(tiff+static_cast<int>(ifd));
+
+   if (ifd+2+count*12>length)
+   {
+      return;
+   }
+
+   qint64 offset = 0;
+   qint64 bytes  = 0;
+
+   for (int i=0; i<count; i++)
+   {
+      int entry = tiff + static_cast<int>(ifd) + 2 + i*12;
+
+      quint16 tag   = u16(entry);
+      qint64  value = (u16(entry+2)==3) ? u16(entry+8) : u32(entry+8); // SHORT or LONG
+
+      if (tag==EXIF_JPEG_OFFSET)
+      {
+         offset = value;
+      }
+      else
+      if (tag==EXIF_JPEG_LENGTH)
+      {
+         bytes = value;
+      }
+   }
+
+   if (offset>0 && bytes>0 && offset+bytes<=length)
+   {
+      previewOffset = tiff + static_cast<int>(offset);
+      previewLength = static_cast<int>(bytes);
+   }
+}
+
+/**
+ * @brief SCDImgExif::u16 read a TIFF SHORT (caller checks bounds)
+ * @param offset
+ * @return
+ */
+quint16 SCDImgExif::u16(int offset)
+{
+   quint8 b0 = static_cast<quint8>(data.at(offset));
+   quint8 b1 = static_cast<quint8>(data.at(offset+1));
+
+   return bigEndian ? static_cast<quint16>((b0<<8) | b1) : static_cast<quint16>((b1<<8) | b0);
+}
+
+/**
+ * @brief SCDImgExif::u32 read a TIFF LONG (caller checks bounds)
+ * @param offset
+ * @return
+ */
+quint32 SCDImgExif::u32(int offset)
+{
+   quint32 lo = u16(offset);
+   quint32 hi = u16(offset+2);
+
+   return bigEndian ? ((lo<<16) | hi) : ((hi<<16) | lo);
+}
+
+/**
+ * @brief SCDImgExif::dateTime read an ASCII date tag (20 bytes, stored out of the entry)
+ * @param entry  IFD entry offset
+ * @param tiff   offset of TIFF header into data
+ * @param length TIFF structure length
+ * @return date, invalid if malformed or out of bounds
+ */
+QDateTime SCDImgExif::dateTime(int entry, int tiff, int length)
+{
+   qint64 offset = u32(entry+8);
+
+   if (u16(entry+2)!=2 || u32(entry+4)<19 || offset+19>length) // ASCII, "YYYY:MM:DD HH:MM:SS"
+   {
+      return QDateTime();
+   }
+
+   return QDateTime::fromString(QString::fromLatin1(data.mid(tiff+static_cast<int>(offset),19)), "yyyy:MM:dd HH:mm:ss");
+}
+
+/**
+ * @brief SCDImgExif::frameSize read image size from the frame header (SOFn) of a JPEG stream
+ * @param data
+ * @param offset start of JPEG stream (SOI)
+ * @param end    end of available bytes
+ * @return image size, invalid if not found
+ */
+QSize SCDImgExif::frameSize(const QByteArray &data, int offset, int end)
+{
+   end = qMin(end,data.size());
+
+   if (offset+4>end || static_cast<quint8>(data.at(offset))!=0xFF || static_cast<quint8>(data.at(offset+1))!=0xD8)
+   {
+      return QSize();
+   }
+
+   int pos = offset+2;
+
+   while (pos+4<=end)
+   {
+      quint8 marker = static_cast<quint8>(data.at(pos+1));
+
+      if (static_cast<quint8>(data.at(pos))!=0xFF || marker==0xDA || marker==0xD9)
+      {
+         break;
+      }
+
+      if (marker==0xFF)
+      {
+         pos++;
+         continue;
+      }
+
+      int length = (static_cast<quint8>(data.at(pos+2))<<8) | static_cast<quint8>(data.at(pos+3));
+
+      if (length<2)
+      {
+         break;
+      }
+
+      if (marker>=0xC0 && marker<=0xCF && marker!=0xC4 && marker!=0xC8 && marker!=0xCC) // SOFn (not DHT, JPG, DAC)
+      {
+         if (pos+9>end)
+         {
+            break;
+         }
+
+         int height = (static_cast<quint8>(data.at(pos+5))<<8) | static_cast<quint8>(data.at(pos+6));
+         int width  = (static_cast<quint8>(data.at(pos+7))<<8) | static_cast<quint8>(data.at(pos+8));
+
+         return QSize(width,height);
+      }
+
+      pos += 2+length;
+   }
+
+   return QSize();
+}
@@ -0,0 +1,57 @@
+#ifndef SCDIMGEXIF_H
+#define SCDIMGEXIF_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QDateTime>
+
+/**
+ * @brief The SCDImgExif class reads the EXIF APP1 segment of a JPEG header: orientation, capture date, embedded preview
+ *        (IFD1 JPEG thumbnail) and main image size (Exif IFD pixel dimensions, or frame header). Only the first
+ *        bytes of the file are needed (HEAD_SIZE): the image data is never decoded.
+ */
+class SCDImgExif
+{
+   public:
+
+     enum {HEAD_SIZE=65536}; // bytes read from file start: EXIF segment (max 64KB) follows SOI
+
+     explicit SCDImgExif(const QByteArray &head);
+
+     bool  hasExif();
+     int   orientation(); // EXIF orientation 1..8 (1: normal)
+     QSize imageSize();   // main image size (invalid if unknown)
+
+     QDateTime captureDate(); // DateTimeOriginal, or DateTime (invalid if missing)
+
+     QImage preview(const QSize &minSize); // embedded preview, null if missing, smaller than minSize or with a different aspect ratio
+
+     static QImage orient(const QImage &image, int orientation); // apply EXIF orientation
+
+   private:
+
+     QByteArray data; // file head
+
+     bool  exif;
+     int   orient1to8;
+     QSize size;
+
+     QDateTime date;
+
+     int previewOffset; // into data, 0 if missing
+     int previewLength;
+
+     bool bigEndian;
+
+     void parseTiff(int tiff, int length);
+
+     quint16 u16(int offset);
+     quint32 u32(int offset);
+
+     QDateTime dateTime(int entry, int tiff, int length); // ASCII date tag "YYYY:MM:DD HH:MM:SS"
+
+     static QSize frameSize(const QByteArray &data, int offset, int end); // size from SOFn marker of a JPEG stream
+};
+
+#endif // SCDIMGEXIF_H
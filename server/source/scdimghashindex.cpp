@@ -0,0 +1,230 @@
+/**
+ * @class SCDImgHashIndex - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server content hash index. Hash-first uploads declare the SHA-256 of the file in the PUT header:
+ *        when the object already has that content, or another object has it, the upload completes without
+ *        receiving the data.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+
+#include "scdimghashindex.h"
+
+/**
+ * @brief SCDImgHashIndex::SCDImgHashIndex
+ * @param parent
+ * @param fileName index log file
+ */
+SCDImgHashIndex::SCDImgHashIndex(QObject *parent, QString fileName) : QObject(parent), log(fileName,"hash index")
+{
+   unchangedCount.store(0);
+   copiedCount.store(0);
+}
+
+/**
+ * @brief SCDImgHashIndex::open replay index log, rewrite it with live entries only and open it for append
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgHashIndex::open()
+{
+   QMutexLocker locker(&mutex);
+
+   entries.clear();
+   byHash.clear();
+
+   int ret = log.replay([this](const QList<QByteArray> &fields)
+   {
+      QString key = QString::fromUtf8(fields.value(1));
+
+      if (fields.at(0)=="P" && fields.count()==4)
+      {
+         drop(key);
+
+         Entry entry;
+
+         entry.hash      = QByteArray::fromHex(fields.at(2));
+         entry.validator = fields.at(3);
+
+         entries.insert(key,entry);
+         byHash.insert(entry.hash,key);
+      }
+      else
+      if (fields.at(0)=="D" && fields.count()==2)
+      {
+         drop(key);
+      }
+      // else: truncated last line
+   });
+
+   // compact: live entries only ---------------------------------------------
+
+   if (ret)
+   {
+      ret = log.rewrite([this](QFile &tmp)
+      {
+         for (QHash<QString,Entry>::const_iterator it=entries.constBegin(); it!=entries.constEnd(); ++it)
+         {
+            tmp.write("P\t" + it.key().toUtf8() + "\t" + it.value().hash.toHex() + "\t" + it.value().validator + "\n");
+         }
+      });
+   }
+
+   if (!ret)
+   {
+      lastErrorMsg = log.errorString();
+   }
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgHashIndex::insert record the content hash of a stored object
+ * @param key       object path
+ * @param hash      SHA-256 of content
+ * @param validator object validator once stored
+ */
+void SCDImgHashIndex::insert(const QString &key, const QByteArray &hash, const QByteArray &validator)
+{
+   QMutexLocker locker(&mutex);
+
+   drop(key);
+
+   Entry entry;
+
+   entry.hash      = hash;
+   entry.validator = validator;
+
+   entries.insert(key,entry);
+   byHash.insert(hash,key);
+
+   log.append("P\t" + key.toUtf8() + "\t" + hash.toHex() + "\t" + validator + "\n");
+}
+
+/**
+ * @brief SCDImgHashIndex::remove forget the content hash of an object (deleted, or stored without hash)
+ * @param key
+ */
+void SCDImgHashIndex::remove(const QString &key)
+{
+   QMutexLocker locker(&mutex);
+
+   if (!entries.contains(key))
+   {
+      return;
+   }
+
+   drop(key);
+
+   log.append("D\t" + key.toUtf8() + "\n");
+}
+
+/**
+ * @brief SCDImgHashIndex::lookup
+ * @param key
+ * @param hash      output param: content hash
+ * @param validator output param: object validator when hash was recorded
+ * @return false if object has no recorded hash
+ */
+bool SCDImgHashIndex::lookup(const QString &key, QByteArray &hash, QByteArray &validator)
+{
+   QMutexLocker locker(&mutex);
+
+   QHash<QString,Entry>::const_iterator it = entries.constFind(key);
+
+   if (it==entries.constEnd())
+   {
+      return false;
+   }
+
+   hash      = it.value().hash;
+   validator = it.value().validator;
+
+   return true;
+}
+
+/**
+ * @brief SCDImgHashIndex::keys
+ * @param hash
+ * @return objects recorded with content hash (their validators must be checked)
+ */
+QStringList SCDImgHashIndex::keys(const QByteArray &hash)
+{
+   QMutexLocker locker(&mutex);
+
+   return byHash.values(hash);
+}
+
+/**
+ * @brief SCDImgHashIndex::count
+ * @return objects with a recorded hash
+ */
+int SCDImgHashIndex::count()
+{
+   QMutexLocker locker(&mutex);
+
+   return entries.count();
+}
+
+/**
+ * @brief SCDImgHashIndex::skipped count an upload completed without receiving its data
+ * @param copied true: stored as a copy of another object, false: object already had the content
+ */
+void SCDImgHashIndex::skipped(bool copied)
+{
+   if (copied)
+   {
+      copiedCount++;
+   }
+   else
+   {
+      unchangedCount++;
+   }
+}
+
+/**
+ * @brief SCDImgHashIndex::unchanged
+ * @return uploads skipped because the object already had their content
+ */
+quint64 SCDImgHashIndex::unchanged()
+{
+   return unchangedCount.load();
+}
+
+/**
+ * @brief SCDImgHashIndex::copies
+ * @return uploads stored as a copy of another object with the same content
+ */
+quint64 SCDImgHashIndex::copies()
+{
+   return copiedCount.load();
+}
+
+/**
+ * @brief SCDImgHashIndex::lastError
+ * @return
+ */
+QString SCDImgHashIndex::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgHashIndex::drop remove key from maps (mutex locked by caller)
+ * @param key
+ */
+void SCDImgHashIndex::drop(const QString &key)
+{
+   QHash<QString,Entry>::iterator it = entries.find(key);
+
+   if (it!=entries.end())
+   {
+      byHash.remove(it.value().hash,key);
+      entries.erase(it);
+   }
+}
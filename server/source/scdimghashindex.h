@@ -0,0 +1,72 @@
+#ifndef SCDIMGHASHINDEX_H
+#define SCDIMGHASHINDEX_H
+
+#include <QObject>
+#include <QHash>
+#include <QMultiHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include <atomic>
+
+#include "scdimgindexlog.h"
+
+/**
+ * @brief The SCDImgHashIndex class maps stored objects to the SHA-256 of their content, as declared (and verified) by
+ *        hash-first uploads. Each entry keeps the object validator at upload time: an entry whose object has changed
+ *        since (modified, moved or compacted) is stale and is never trusted. The index is a log of lines
+ *
+ *          P\t<key>\t<hex hash>\t<validator>\n   object stored with content hash
+ *          D\t<key>\n                            object deleted or stored without hash
+ *
+ *        replayed and compacted on open. It is not synced: a lost entry only costs an upload.
+ */
+class SCDImgHashIndex : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgHashIndex(QObject *parent=0, QString fileName="./hashes.idx");
+
+     int open(); // load and compact the index
+
+     void insert(const QString &key, const QByteArray &hash, const QByteArray &validator);
+     void remove(const QString &key);
+
+     bool        lookup(const QString &key, QByteArray &hash, QByteArray &validator); // false if key has no hash
+     QStringList keys(const QByteArray &hash);                                        // objects declared with content hash
+
+     int count();
+
+     void    skipped(bool copied); // count an upload completed without receiving data
+     quint64 unchanged();          // uploads of the content the object already had
+     quint64 copies();             // uploads stored as a copy of another object
+
+     QString lastError();
+
+   private:
+
+     struct Entry
+     {
+        QByteArray hash;
+        QByteArray validator;
+     };
+
+     QMutex         mutex;
+     SCDImgIndexLog log;
+
+     QHash<QString,Entry>           entries; // key => content hash
+     QMultiHash<QByteArray,QString> byHash;  // content hash => keys
+
+     std::atomic<quint64> unchangedCount;
+     std::atomic<quint64> copiedCount;
+
+     QString lastErrorMsg;
+
+     void drop(const QString &key); // remove key from maps (mutex locked)
+};
+
+#endif // SCDIMGHASHINDEX_H
@@ -0,0 +1,870 @@
+/**
+ * @class SCDImgHttpHandler - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server HTTP/1.1 gateway. Browsers, CDNs and HTTP caches read images and thumbnails directly:
+ *
+ *          GET /sicily/eolie/1.jpg          => file or packed object
+ *          GET /sicily/eolie/1.jpg?thumb    => thumbnail (generated on first request, as SCDFTH GET with T option)
+ *
+ *        The gateway is read-only (GET and HEAD): uploads and deletions stay on SCDFTH. Connections are served by
+ *        the same connection threads, sharing root paths lookup, segment store, thumbnails, rate limits, timeouts
+ *        and metrics. Connections are kept alive and pipelined requests are answered in order. Responses carry the
+ *        object validator as ETag (If-None-Match => 304) and a single byte range is honoured (Range, If-Range).
+ *
+ *        File bodies are sent by sendfile(2), straight from page cache to socket. The connection thread serves one
+ *        connection, so it simply waits (poll) while the socket buffer is full; rate limited responses go through
+ *        the rate limited output of the connection instead.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QUrl>
+#include <QTimer>
+#include <QLocale>
+#include <QDateTime>
+#include <QMimeDatabase>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+#include "scdimghttp.h"
+#include "scdimglogger.h"
+
+#define HTTP_MAX_HEADER   8192 // max size of request header
+#define HTTP_MAX_REQUESTS 1000 // requests served on a keep-alive connection before closing it
+
+/**
+ * @brief SCDImgHttpGateway::SCDImgHttpGateway
+ * @param server image server owning connection threads
+ */
+SCDImgHttpGateway::SCDImgHttpGateway(SCDImgServer *server) : QTcpServer(server), server(server)
+{
+}
+
+/**
+ * @brief SCDImgHttpGateway::incomingConnection HTTP connection: served by an image server connection thread
+ * @param socketDescriptor
+ */
+void SCDImgHttpGateway::incomingConnection(qintptr socketDescriptor)
+{
+   server->acceptConnection(socketDescriptor, SCDImgServerThread::PR_HTTP);
+}
+
+/**
+ * @brief SCDImgHttpHandler::SCDImgHttpHandler
+ * @param parent
+ * @param socket
+ */
+SCDImgHttpHandler::SCDImgHttpHandler(SCDImgServerThread *parent, QTcpSocket *socket) : SignalsHandler(parent,socket)
+{
+   maxHeaderSize = HTTP_MAX_HEADER;
+
+   keepAlive = true;
+   headOnly  = false;
+   requests  = 0;
+}
+
+/**
+ * @brief SCDImgHttpHandler::readyRead parse received requests: pipelined requests are processed in order,
+ *                                     a request waiting for rate limited output holds the following ones
+ */
+void SCDImgHttpHandler::readyRead()
+{
+   if (status==DATASEND)
+   {
+      return; // processed when current response is entirely sent
+   }
+
+   QByteArray buff = socket->readAll();
+
+   SCDImgMetricsBlock::add(metrics->bytesIn,static_cast<quint64>(buff.size()));
+
+   inBuff.append(buff);
+
+   bufferUsage();
+
+   while (status==WAITFORHEADER)
+   {
+      while (inBuff.startsWith("\r\n") || inBuff.startsWith("\n")) // empty lines before request line are ignored
+      {
+         inBuff.remove(0, inBuff.startsWith('\r') ? 2 : 1);
+      }
+
+      int sep = 4;
+      int end = inBuff.indexOf("\r\n\r\n");
+
+      if (end<0)
+      {
+         sep = 2;
+         end = inBuff.indexOf("\n\n");
+      }
+
+      if (end<0 && inBuff.size()<=maxHeaderSize)
+      {
+         return; // header not entirely received: wait for more data (or timeout)
+      }
+
+      if (end<0 || end>maxHeaderSize)
+      {
+         lastErrorMsg = "Request header too large";
+
+         keepAlive = false;
+         inBuff.clear();
+
+         if (sendError(431)>=0)
+         {
+            socket->disconnectFromHost();
+         }
+         else
+         {
+            socket->abort();
+         }
+
+         return;
+      }
+
+      QByteArray head = inBuff.left(end);
+
+      inBuff.remove(0,end+sep);
+
+      headerReceived = true;
+
+      touch(); // header timeout is replaced by idle timeout
+
+      switch (processRequest(head))
+      {
+         case 2: // response is sent by rate limited output: outputDone() resumes parsing
+         return;
+
+         case 0:
+           inBuff.clear();
+           socket->disconnectFromHost();
+         return;
+
+         case -1:
+           inBuff.clear();
+           socket->abort(); // socket error or response partially sent
+         return;
+      }
+   }
+}
+
+/**
+ * @brief SCDImgHttpHandler::outputDone rate limited response entirely sent: process next pipelined request
+ *                                      or close connection
+ */
+void SCDImgHttpHandler::outputDone()
+{
+   status = WAITFORHEADER;
+
+   endRequest(true);
+
+   if (!keepAlive)
+   {
+      socket->disconnectFromHost();
+      return;
+   }
+
+   QTimer::singleShot(0, this, SLOT(readyRead())); // requests already received do not raise readyRead() again
+}
+
+/**
+ * @brief SCDImgHttpHandler::processRequest parse and answer a request
+ * @param head request line and header fields
+ * @return 1 response sent, 2 response pending (rate limited), 0 response sent and connection must be closed,
+ *         -1 connection must be aborted
+ */
+int SCDImgHttpHandler::processRequest(const QByteArray &head)
+{
+   requestTimer.start();
+
+   trace.start(slowLog!=0);
+
+   headOnly = false;
+
+   fields.clear();
+
+   QList<QByteArray> lines   = head.split('\n');
+   QList<QByteArray> request = lines.first().simplified().split(' ');
+
+   if (request.count()!=3 || !request.at(2).startsWith("HTTP/1."))
+   {
+      lastErrorMsg = "Bad request line: " + QString::fromLatin1(lines.first().left(128).simplified());
+
+      keepAlive = false;
+
+      return sendError(400);
+   }
+
+   for (int i=1; i<lines.count(); i++)
+   {
+      const QByteArray &line = lines.at(i);
+
+      int colon = line.indexOf(':');
+
+      if (colon>0)
+      {
+         fields.insert(line.left(colon).trimmed().toLower(), line.mid(colon+1).trimmed());
+      }
+   }
+
+   QByteArray method     = request.at(0);
+   QByteArray target     = request.at(1);
+   QByteArray connection = fields.value("connection").toLower();
+
+   keepAlive = (request.at(2)=="HTTP/1.0") ? connection.contains("keep-alive") : !connection.contains("close");
+
+   if (requests+1>=HTTP_MAX_REQUESTS)
+   {
+      keepAlive = false;
+   }
+
+   headOnly = (method=="HEAD");
+
+   if (method!="GET" && !headOnly)
+   {
+      lastErrorMsg = "Method not allowed: " + QString::fromLatin1(method.left(16));
+
+      keepAlive = false; // a request body may follow
+
+      return sendError(405,"Allow: GET, HEAD\r\n");
+   }
+
+   if (fields.contains("transfer-encoding") || fields.value("content-length","0").toLongLong()!=0)
+   {
+      lastErrorMsg = "Request body not allowed";
+
+      keepAlive = false;
+
+      return sendError(400);
+   }
+
+   // object path and options -------------------------
+
+   int        mark  = target.indexOf('?');
+   QByteArray query = (mark<0) ? QByteArray() : target.mid(mark+1);
+
+   QString path = QDir::cleanPath(QUrl::fromPercentEncoding(target.left(mark<0 ? target.size() : mark)));
+
+   if (!path.startsWith('/') || path=="/" || path=="/.." || path.startsWith("/../") || path.contains(QChar(0)))
+   {
+      lastErrorMsg = "Invalid path: " + path;
+
+      return sendError(400);
+   }
+
+   thumbnail = false;
+
+   foreach (const QByteArray &option, query.split('&'))
+   {
+      QByteArray name = option.left(option.indexOf('=')<0 ? option.size() : option.indexOf('='));
+
+      if (name=="thumb" || name=="t")
+      {
+         thumbnail = true;
+      }
+   }
+
+   objectKey = path;
+
+   op = thumbnail ? SCDImgMetricsBlock::OP_GETTHUMB : SCDImgMetricsBlock::OP_GET;
+
+   trace.mark(SCDImgTrace::PH_HEADER);
+
+   logDebug() << "HTTP " << method << ": " << objectKey;
+
+   // locate object -----------------------------------
+
+   bool       inStore = store && store->contains(objectKey);
+   QString    name;      // file or packed object to send
+   QByteArray data;      // packed object
+   int        fd = -1;   // file to send
+   qint64     size = 0;
+
+   if (inStore)
+   {
+      name = objectKey;
+
+      if (thumbnail && !makePackedThumbnail(objectKey,name))
+      {
+         return sendError(500);
+      }
+
+      etag = packedValidator(name);
+   }
+   else
+   {
+      name = roots->locate(objectKey);
+
+      if (!QFileInfo(name).isFile()) // folders are not served
+      {
+         lastErrorMsg = "File not exists: " + name;
+
+         return sendError(404);
+      }
+
+      if (thumbnail)
+      {
+         QString thumbName;
+
+         if (!makeThumbnail(name,thumbName))
+         {
+            return sendError(500);
+         }
+
+         name = thumbName;
+      }
+
+      etag = fileValidator(name);
+   }
+
+   if (etag.isEmpty())
+   {
+      lastErrorMsg = "Object not exists: " + objectKey;
+
+      return sendError(404);
+   }
+
+   QByteArray quoted  = "\"" + etag + "\"";
+   QByteArray headers = "ETag: " + quoted + "\r\n";
+
+   if (notModified(quoted))
+   {
+      trace.setSize(0);
+
+      QByteArray reply = responseHead(304,headers,-1);
+
+      if (sendBuffer(reply.constData(),reply.size())<0)
+      {
+         return -1;
+      }
+
+      trace.mark(SCDImgTrace::PH_SEND);
+
+      endRequest(true);
+
+      return keepAlive ? 1 : 0;
+   }
+
+   if (inStore)
+   {
+      if (!store->read(name,data))
+      {
+         lastErrorMsg = "Read packed object error: " + name;
+
+         return sendError(500);
+      }
+
+      trace.mark(SCDImgTrace::PH_READ);
+
+      size = data.size();
+   }
+   else
+   {
+      fd = ::open(QFile::encodeName(name).constData(), O_RDONLY|O_CLOEXEC);
+
+      struct stat st;
+
+      if (fd<0 || ::fstat(fd,&st)!=0)
+      {
+         lastErrorMsg = "Open file error: " + name;
+
+         if (fd>=0)
+         {
+            ::close(fd);
+         }
+
+         return sendError(500);
+      }
+
+      if (!S_ISREG(st.st_mode)) // replaced by a folder meanwhile: no header has been sent yet
+      {
+         lastErrorMsg = "File not exists: " + name;
+
+         ::close(fd);
+
+         return sendError(404);
+      }
+
+      trace.mark(SCDImgTrace::PH_OPEN);
+
+      size = st.st_size;
+   }
+
+   // range -------------------------------------------
+
+   int    code  = 200;
+   qint64 first = 0;
+   qint64 last  = size-1;
+
+   if (fields.contains("range") && (!fields.contains("if-range") || fields.value("if-range")==quoted))
+   {
+      switch (parseRange(fields.value("range"),size,first,last))
+      {
+         case 1:
+           code = 206;
+           headers.append("Content-Range: bytes " + QByteArray::number(first) + "-" + QByteArray::number(last) + "/" + QByteArray::number(size) + "\r\n");
+         break;
+
+         case 0:
+           if (fd>=0)
+           {
+              ::close(fd);
+           }
+
+           lastErrorMsg = "Range not satisfiable: " + QString::fromLatin1(fields.value("range"));
+
+           return sendError(416,"Content-Range: bytes */" + QByteArray::number(size) + "\r\n");
+      }
+   }
+
+   qint64 length = last-first+1;
+
+   headers.append("Accept-Ranges: bytes\r\nContent-Type: " + mimeType(name) + "\r\n");
+
+   QByteArray reply = responseHead(code,headers,length);
+
+   if (headOnly)
+   {
+      length = 0;
+   }
+
+   SCDImgMetricsBlock::add(metrics->bytesOut,static_cast<quint64>(length));
+
+   trace.setSize(length);
+
+   // send --------------------------------------------
+
+   if (length>0 && limit->limited(SCDImgRateLimit::RL_OUT))
+   {
+      if (fd>=0)
+      {
+         ::close(fd);
+
+         f->setFileName(name);
+
+         if (!f->open(QIODevice::ReadOnly))
+         {
+            lastErrorMsg = "Open file error: " + name;
+
+            return sendError(500);
+         }
+
+         f->readAll(data);
+         f->close();
+
+         trace.mark(SCDImgTrace::PH_READ);
+
+         if (data.size()<first+length)
+         {
+            lastErrorMsg = "Read file error: " + name;
+
+            return sendError(500);
+         }
+      }
+
+      outBuff = reply + data.mid(static_cast<int>(first),static_cast<int>(length)); // sent by sendChunk() at the granted rate
+      outPos  = 0;
+      status  = DATASEND;
+
+      sendChunk();
+
+      return 2;
+   }
+
+   int ret = sendBuffer(reply.constData(), reply.size(), length>0 ? MSG_MORE : 0); // header and body in the same segments
+
+   if (ret>0 && length>0)
+   {
+      ret = (fd>=0) ? sendBody(fd,first,length) : sendBuffer(data.constData()+first,length);
+   }
+
+   if (fd>=0)
+   {
+      ::close(fd);
+   }
+
+   if (ret<0)
+   {
+      logWarning() << lastErrorMsg;
+
+      requestDone(false);
+
+      return -1; // response partially sent: connection cannot be reused
+   }
+
+   trace.mark(SCDImgTrace::PH_SEND);
+
+   endRequest(true);
+
+   return keepAlive ? 1 : 0;
+}
+
+/**
+ * @brief SCDImgHttpHandler::sendError send an error response, with a short text body
+ * @param code    HTTP status code
+ * @param headers additional header fields ("Name: value\r\n" each)
+ * @return 1 on success, 0 on success if connection must be closed, -1 on socket error
+ */
+int SCDImgHttpHandler::sendError(int code, const QByteArray &headers)
+{
+   logWarning() << "HTTP " << code << ": " << lastErrorMsg;
+
+   endRequest(false);
+
+   QByteArray body  = QByteArray::number(code) + " " + reason(code) + "\n";
+   QByteArray reply = responseHead(code, headers + "Content-Type: text/plain\r\n", body.size());
+
+   if (!headOnly)
+   {
+      reply.append(body);
+   }
+
+   if (sendBuffer(reply.constData(),reply.size())<0)
+   {
+      return -1;
+   }
+
+   return keepAlive ? 1 : 0;
+}
+
+/**
+ * @brief SCDImgHttpHandler::responseHead status line and header fields of a response
+ * @param code    HTTP status code
+ * @param headers response specific header fields ("Name: value\r\n" each)
+ * @param length  Content-Length, -1 if response has no body
+ * @return
+ */
+QByteArray SCDImgHttpHandler::responseHead(int code, const QByteArray &headers, qint64 length)
+{
+   QByteArray head = "HTTP/1.1 " + QByteArray::number(code) + " " + reason(code) + "\r\n"
+                     "Server: SCDImgServer\r\n"
+                     "Date: " + httpDate() + "\r\n";
+
+   head.append(headers);
+
+   if (length>=0)
+   {
+      head.append("Content-Length: " + QByteArray::number(length) + "\r\n");
+   }
+
+   head.append(keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+   return head;
+}
+
+/**
+ * @brief SCDImgHttpHandler::sendBuffer write a buffer straight to socket, waiting while socket buffer is full.
+ *                                      Output still queued by socket (rate limited response) is flushed first.
+ * @param data
+ * @param length
+ * @param flags  send(2) flags (MSG_MORE: more data follows)
+ * @return 1 on success, -1 on socket error or timeout
+ */
+int SCDImgHttpHandler::sendBuffer(const char *data, qint64 length, int flags)
+{
+   while (socket->bytesToWrite()>0)
+   {
+      if (!socket->waitForBytesWritten(idleTimeout>0 ? idleTimeout : -1))
+      {
+         lastErrorMsg = "Socket write error";
+         return -1;
+      }
+   }
+
+   int sd = static_cast<int>(socket->socketDescriptor());
+
+   while (length>0)
+   {
+      ssize_t bytes = ::send(sd, data, static_cast<size_t>(length), flags|MSG_NOSIGNAL);
+
+      if (bytes>0)
+      {
+         data   += bytes;
+         length -= bytes;
+      }
+      else
+      if (bytes<0 && errno==EINTR)
+      {
+         continue;
+      }
+      else
+      if (bytes<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+      {
+         if (waitWritable()<=0)
+         {
+            return -1;
+         }
+      }
+      else
+      {
+         lastErrorMsg = "Socket write error: " + QString::fromLocal8Bit(strerror(errno));
+         return -1;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgHttpHandler::sendBody send a file range by sendfile(2), waiting while socket buffer is full
+ * @param fd     opened file
+ * @param offset first byte
+ * @param length
+ * @return 1 on success, -1 on socket or file error (file shrunk while sending) or timeout
+ */
+int SCDImgHttpHandler::sendBody(int fd, qint64 offset, qint64 length)
+{
+   int   sd  = static_cast<int>(socket->socketDescriptor());
+   off_t off = static_cast<off_t>(offset);
+
+   while (length>0)
+   {
+      ssize_t bytes = ::sendfile(sd, fd, &off, static_cast<size_t>(length));
+
+      if (bytes>0)
+      {
+         length -= bytes;
+
+         touch();
+      }
+      else
+      if (bytes==0)
+      {
+         lastErrorMsg = "File truncated while sending";
+         return -1;
+      }
+      else
+      if (errno==EINTR)
+      {
+         continue;
+      }
+      else
+      if (errno==EAGAIN || errno==EWOULDBLOCK)
+      {
+         if (waitWritable()<=0)
+         {
+            return -1;
+         }
+      }
+      else
+      {
+         lastErrorMsg = "sendfile error: " + QString::fromLocal8Bit(strerror(errno));
+         return -1;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgHttpHandler::waitWritable wait until socket buffer has free space, at most idle timeout
+ * @return 1 writable, 0 timeout, -1 socket error
+ */
+int SCDImgHttpHandler::waitWritable()
+{
+   struct pollfd pfd;
+
+   pfd.fd      = static_cast<int>(socket->socketDescriptor());
+   pfd.events  = POLLOUT;
+   pfd.revents = 0;
+
+   int ret;
+
+   do
+   {
+      ret = ::poll(&pfd, 1, idleTimeout>0 ? idleTimeout : -1);
+   }
+   while (ret<0 && errno==EINTR);
+
+   if (ret==0)
+   {
+      lastErrorMsg = "Idle timeout while sending";
+      return 0;
+   }
+
+   if (ret<0 || (pfd.revents & (POLLERR|POLLHUP)) || !(pfd.revents & POLLOUT))
+   {
+      lastErrorMsg = "Socket write error";
+      return -1;
+   }
+
+   touch(); // client is reading
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgHttpHandler::endRequest record current request (latency, access log, slow log)
+ * @param success
+ */
+void SCDImgHttpHandler::endRequest(bool success)
+{
+   requestDone(success);
+
+   traceDone();
+
+   requests++;
+}
+
+/**
+ * @brief SCDImgHttpHandler::notModified check If-None-Match against object validator
+ * @param quotedEtag
+ * @return true if client cached copy is still valid
+ */
+bool SCDImgHttpHandler::notModified(const QByteArray &quotedEtag)
+{
+   if (!fields.contains("if-none-match"))
+   {
+      return false;
+   }
+
+   foreach (QByteArray tag, fields.value("if-none-match").split(','))
+   {
+      tag = tag.trimmed();
+
+      if (tag.startsWith("W/"))
+      {
+         tag = tag.mid(2); // weak comparison
+      }
+
+      if (tag=="*" || tag==quotedEtag)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * @brief SCDImgHttpHandler::parseRange parse a single byte range (bytes=first-last, bytes=first-, bytes=-suffix)
+ * @param value Range header field value
+ * @param size  object size
+ * @param first output param: first byte
+ * @param last  output param: last byte
+ * @return 1 valid range, 0 unsatisfiable range, -1 range ignored (invalid or multiple ranges: whole object is sent)
+ */
+int SCDImgHttpHandler::parseRange(const QByteArray &value, qint64 size, qint64 &first, qint64 &last)
+{
+   if (!value.startsWith("bytes="))
+   {
+      return -1;
+   }
+
+   QByteArray spec = value.mid(6).trimmed();
+
+   int dash = spec.indexOf('-');
+
+   if (dash<0 || spec.contains(','))
+   {
+      return -1;
+   }
+
+   QByteArray from = spec.left(dash).trimmed();
+   QByteArray to   = spec.mid(dash+1).trimmed();
+
+   bool ok = true;
+
+   if (from.isEmpty()) // suffix: last bytes
+   {
+      qint64 suffix = to.toLongLong(&ok);
+
+      if (!ok || suffix<0)
+      {
+         return -1;
+      }
+
+      if (suffix==0 || size==0)
+      {
+         return 0;
+      }
+
+      first = qMax<qint64>(0,size-suffix);
+      last  = size-1;
+
+      return 1;
+   }
+
+   qint64 begin = from.toLongLong(&ok);
+
+   if (!ok || begin<0)
+   {
+      return -1;
+   }
+
+   qint64 end = to.isEmpty() ? size-1 : to.toLongLong(&ok);
+
+   if (!ok || (!to.isEmpty() && end<begin))
+   {
+      return -1;
+   }
+
+   if (begin>=size)
+   {
+      return 0;
+   }
+
+   first = begin;
+   last  = qMin(end,size-1);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgHttpHandler::reason
+ * @param code HTTP status code
+ * @return reason phrase
+ */
+QByteArray SCDImgHttpHandler::reason(int code)
+{
+   switch (code)
+   {
+      case 200: return "OK";
+      case 206: return "Partial Content";
+      case 304: return "Not Modified";
+      case 400: return "Bad Request";
+      case 404: return "Not Found";
+      case 405: return "Method Not Allowed";
+      case 416: return "Range Not Satisfiable";
+      case 431: return "Request Header Fields Too Large";
+      case 503: return "Service Unavailable";
+   }
+
+   return "Internal Server Error";
+}
+
+/**
+ * @brief SCDImgHttpHandler::mimeType content type from file name extension (content is not read)
+ * @param fileName
+ * @return
+ */
+QByteArray SCDImgHttpHandler::mimeType(const QString &fileName)
+{
+   QMimeDatabase db;
+
+   return db.mimeTypeForFile(fileName, QMimeDatabase::MatchExtension).name().toLatin1();
+}
+
+/**
+ * @brief SCDImgHttpHandler::httpDate
+ * @return current time in HTTP date format
+ */
+QByteArray SCDImgHttpHandler::httpDate()
+{
+   return QLocale::c().toString(QDateTime::currentDateTimeUtc(), "ddd, dd MMM yyyy hh:mm:ss").toLatin1() + " GMT";
+}
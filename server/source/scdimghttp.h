@@ -0,0 +1,80 @@
+#ifndef SCDIMGHTTP_H
+#define SCDIMGHTTP_H
+
+#include <QTcpServer>
+#include <QByteArray>
+#include <QHash>
+
+#include "scdimgserverthread.h"
+
+/**
+ * @brief The SCDImgHttpGateway class listens for HTTP connections: each one is served by a connection thread
+ *        of the image server, with the same admission control, timeouts, rate limits and metrics.
+ */
+class SCDImgHttpGateway : public QTcpServer
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgHttpGateway(SCDImgServer *server);
+
+   protected:
+
+     void incomingConnection(qintptr socketDescriptor);
+
+   private:
+
+     SCDImgServer *server;
+};
+
+/**
+ * @brief The SCDImgHttpHandler class serves read-only HTTP/1.1 requests (GET, HEAD) on the image server storage:
+ *        files, packed objects and thumbnails (?thumb), with keep-alive, pipelining, single Range, ETag and
+ *        If-None-Match. File bodies are sent by sendfile(2), without copies into user space.
+ */
+class SCDImgHttpHandler : public SignalsHandler
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgHttpHandler(SCDImgServerThread *parent=0, QTcpSocket *socket=0);
+
+   protected slots:
+
+     void readyRead();
+
+   protected:
+
+     void outputDone();
+
+   private:
+
+     QByteArray inBuff;    // received data not yet parsed
+     bool       keepAlive; // connection is kept open after current response
+     bool       headOnly;  // HEAD request
+     int        requests;  // requests served on this connection
+
+     QHash<QByteArray,QByteArray> fields; // header fields of current request (lowercase names)
+
+     int processRequest(const QByteArray &head); // 1 done, 2 response pending (rate limited), 0 close connection, -1 abort connection
+
+     int sendError(int code, const QByteArray &headers=QByteArray());
+     int sendBuffer(const char *data, qint64 length, int flags=0);
+     int sendBody(int fd, qint64 offset, qint64 length);
+     int waitWritable();
+
+     QByteArray responseHead(int code, const QByteArray &headers, qint64 length); // length -1: no Content-Length
+
+     void endRequest(bool success);
+
+     bool notModified(const QByteArray &quotedEtag);
+
+     static int        parseRange(const QByteArray &value, qint64 size, qint64 &first, qint64 &last); // 1 valid, 0 unsatisfiable, -1 ignored
+     static QByteArray reason(int code);
+     static QByteArray mimeType(const QString &fileName);
+     static QByteArray httpDate();
+};
+
+#endif // SCDIMGHTTP_H
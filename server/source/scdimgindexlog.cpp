@@ -0,0 +1,159 @@
+/**
+ * @class SCDImgIndexLog - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server index log file, shared by the content hash and metadata indexes.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QFileInfo>
+#include <QDir>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scdimgindexlog.h"
+
+/**
+ * @brief SCDImgIndexLog::SCDImgIndexLog
+ * @param fileName log file
+ * @param name     index name (error messages)
+ */
+SCDImgIndexLog::SCDImgIndexLog(QString fileName, QString name) : file(fileName), name(name)
+{
+}
+
+/**
+ * @brief SCDImgIndexLog::replay read the log, if any, passing the fields of each line to apply.
+ *                              A truncated last line is passed too: apply must skip malformed lines.
+ * @param apply
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgIndexLog::replay(std::function<void(const QList<QByteArray> &fields)> apply)
+{
+   if (!file.exists())
+   {
+      return 1;
+   }
+
+   if (!file.open(QIODevice::ReadOnly))
+   {
+      return failure("Open", file.fileName(), file.errorString());
+   }
+
+   while (!file.atEnd())
+   {
+      apply(file.readLine().trimmed().split('\t'));
+   }
+
+   file.close();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgIndexLog::rewrite replace the log with the lines written by write: they go to a temporary file which
+ *                               is synced, renamed over the log and its folder synced. The log is then opened
+ *                               for append. On failure the previous log is left in place.
+ * @param write
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgIndexLog::rewrite(std::function<void(QFile &log)> write)
+{
+   QString folder = QFileInfo(file.fileName()).absolutePath();
+
+   QDir().mkpath(folder);
+
+   QFile tmp(file.fileName() + ".tmp");
+
+   if (!tmp.open(QIODevice::WriteOnly))
+   {
+      return failure("Write", tmp.fileName(), tmp.errorString());
+   }
+
+   write(tmp);
+
+   if (!tmp.flush() || tmp.error()!=QFileDevice::NoError || ::fsync(tmp.handle())!=0)
+   {
+      QString error = (tmp.error()!=QFileDevice::NoError) ? tmp.errorString() : QString::fromLocal8Bit(strerror(errno));
+
+      tmp.close();
+      tmp.remove();
+
+      return failure("Write", tmp.fileName(), error);
+   }
+
+   tmp.close();
+
+   if (::rename(QFile::encodeName(tmp.fileName()).constData(), QFile::encodeName(file.fileName()).constData())!=0)
+   {
+      QString error = QString::fromLocal8Bit(strerror(errno));
+
+      tmp.remove();
+
+      return failure("Compact", file.fileName(), error);
+   }
+
+   int fd = ::open(QFile::encodeName(folder).constData(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+   if (fd<0 || ::fsync(fd)!=0)
+   {
+      QString error = QString::fromLocal8Bit(strerror(errno));
+
+      if (fd>=0)
+      {
+         ::close(fd);
+      }
+
+      return failure("Sync", folder, error);
+   }
+
+   ::close(fd);
+
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+   {
+      return failure("Open", file.fileName(), file.errorString());
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgIndexLog::append append a line (not synced)
+ * @param line
+ */
+void SCDImgIndexLog::append(const QByteArray &line)
+{
+   file.write(line);
+   file.flush();
+}
+
+/**
+ * @brief SCDImgIndexLog::errorString
+ * @return
+ */
+QString SCDImgIndexLog::errorString()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgIndexLog::failure set last error message
+ * @param message  failed operation
+ * @param fileName
+ * @param error
+ * @return 0
+ */
+int SCDImgIndexLog::failure(QString message, QString fileName, QString error)
+{
+   lastErrorMsg = message + " " + name + " error: " + fileName + " => " + error;
+
+   return 0;
+}
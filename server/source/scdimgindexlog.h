@@ -0,0 +1,39 @@
+#ifndef SCDIMGINDEXLOG_H
+#define SCDIMGINDEXLOG_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+
+/**
+ * @brief The SCDImgIndexLog class is the append-only log file of a server index: lines of tab separated fields,
+ *        replayed on open and then rewritten with live entries only. The rewrite goes to a temporary file, synced
+ *        and renamed over the log, so a crash leaves either the old log or the new one, never none.
+ */
+class SCDImgIndexLog
+{
+   public:
+
+     explicit SCDImgIndexLog(QString fileName, QString name);
+
+     int replay(std::function<void(const QList<QByteArray> &fields)> apply); // apply every log line
+     int rewrite(std::function<void(QFile &log)> write);                     // compact log and open it for append
+
+     void append(const QByteArray &line);
+
+     QString errorString();
+
+   private:
+
+     QFile   file;
+     QString name; // index name, for error messages
+
+     QString lastErrorMsg;
+
+     int failure(QString message, QString fileName, QString error);
+};
+
+#endif // SCDIMGINDEXLOG_H
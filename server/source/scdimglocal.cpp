@@ -0,0 +1,35 @@
+/**
+ * @class SCDImgLocalListener - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server Unix socket listener. Clients on the server host (application servers) skip the TCP
+ *        loopback stack, and can read objects from a descriptor passed by the server (SCM_RIGHTS) instead of
+ *        receiving their bytes:
+ *
+ *          SCDFTH:1.0\tGET:/sicily/eolie/1.jpg\tF\n  =>  FD\t<offset>\t<size>\n + read-only descriptor
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include "scdimglocal.h"
+
+/**
+ * @brief SCDImgLocalListener::SCDImgLocalListener
+ * @param server image server owning connection threads
+ */
+SCDImgLocalListener::SCDImgLocalListener(SCDImgServer *server) : QLocalServer(server), server(server)
+{
+}
+
+/**
+ * @brief SCDImgLocalListener::incomingConnection local connection: served by an image server connection thread
+ *                                                (a QTcpSocket drives a Unix socket descriptor as well)
+ * @param socketDescriptor
+ */
+void SCDImgLocalListener::incomingConnection(quintptr socketDescriptor)
+{
+   server->acceptConnection(static_cast<qintptr>(socketDescriptor), SCDImgServerThread::PR_LOCAL);
+}
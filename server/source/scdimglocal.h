@@ -0,0 +1,30 @@
+#ifndef SCDIMGLOCAL_H
+#define SCDIMGLOCAL_H
+
+#include <QLocalServer>
+
+#include "scdimgserverthread.h"
+
+/**
+ * @brief The SCDImgLocalListener class listens on a Unix socket for clients running on the server host: each connection
+ *        is served by an image server connection thread (SCDFTH protocol), with the same admission control, timeouts,
+ *        rate limits and metrics. Local connections can ask GET replies as read-only descriptors (F option).
+ */
+class SCDImgLocalListener : public QLocalServer
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgLocalListener(SCDImgServer *server);
+
+   protected:
+
+     void incomingConnection(quintptr socketDescriptor);
+
+   private:
+
+     SCDImgServer *server;
+};
+
+#endif // SCDIMGLOCAL_H
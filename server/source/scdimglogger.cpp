@@ -0,0 +1,454 @@
+/**
+ * @class SCDImgLogger - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server asynchronous logger. Logging threads format their messages and push them into
+ *        their own lock-free ring, without locks nor system calls; the logger thread flushes all rings
+ *        to the outputs of the log channels:
+ *
+ *          server log: "<date time> [<level>] <message>" to stderr or to a file
+ *          access log: one compact line for each request "<msecs since epoch>\t<peer>\t<op>\t<path>\t<status>\t<bytes>\t<usecs>"
+ *
+ *        Messages pushed into a full ring are dropped and counted.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QDateTime>
+
+#include <cstdio>
+#include <cstring>
+
+#include "scdimglogger.h"
+
+std::atomic<SCDImgLogger*> SCDImgLogger::current(0);
+
+/**
+ * @brief The SCDImgLogRingRef struct is the ring of a thread: the ring is given back to the logger pool
+ *        when the thread ends
+ */
+struct SCDImgLogRingRef
+{
+   SCDImgLogger  *logger;
+   SCDImgLogRing *ring;
+
+   SCDImgLogRingRef() : logger(0), ring(0) {}
+
+   ~SCDImgLogRingRef()
+   {
+      if (ring && SCDImgLogger::current.load()==logger)
+      {
+         logger->releaseRing(ring);
+      }
+   }
+};
+
+/**
+ * @brief SCDImgLogRing::SCDImgLogRing constructor
+ */
+SCDImgLogRing::SCDImgLogRing()
+{
+   head.store(0);
+   tail.store(0);
+   dropped.store(0);
+}
+
+/**
+ * @brief SCDImgLogRing::push append a record (producer thread only)
+ * @param level
+ * @param channel
+ * @param text    truncated to LOG_TEXT_SIZE bytes
+ * @return false if ring is full (record is dropped and counted)
+ */
+bool SCDImgLogRing::push(int level, int channel, const QByteArray &text)
+{
+   quint32 h = head.load(std::memory_order_relaxed);
+
+   if (h - tail.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+   {
+      dropped.store(dropped.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+      return false;
+   }
+
+   SCDImgLogRecord &record = records[h & (LOG_RING_SIZE-1)];
+
+   record.time    = QDateTime::currentMSecsSinceEpoch();
+   record.level   = static_cast<quint8>(level);
+   record.channel = static_cast<quint8>(channel);
+   record.length  = static_cast<quint16>(qMin(text.size(),LOG_TEXT_SIZE));
+
+   memcpy(record.text,text.constData(),record.length);
+
+   head.store(h+1,std::memory_order_release);
+
+   return true;
+}
+
+/**
+ * @brief SCDImgLogRing::pop take the oldest record (flusher thread only)
+ * @param record
+ * @return false if ring is empty
+ */
+bool SCDImgLogRing::pop(SCDImgLogRecord &record)
+{
+   quint32 t = tail.load(std::memory_order_relaxed);
+
+   if (t==head.load(std::memory_order_acquire))
+   {
+      return false;
+   }
+
+   const SCDImgLogRecord &src = records[t & (LOG_RING_SIZE-1)];
+
+   record.time    = src.time;
+   record.level   = src.level;
+   record.channel = src.channel;
+   record.length  = src.length;
+
+   memcpy(record.text,src.text,src.length);
+
+   tail.store(t+1,std::memory_order_release);
+
+   return true;
+}
+
+/**
+ * @class SCDImgLogger
+ *
+ * @brief Asynchronous logger
+ */
+
+/**
+ * @brief SCDImgLogger::SCDImgLogger constructor
+ * @param parent
+ * @param level     min level of logged messages
+ * @param serverLog server log file (empty: stderr)
+ * @param accessLog access log file (empty: disabled)
+ */
+SCDImgLogger::SCDImgLogger(QObject *parent, int level, QString serverLog, QString accessLog) : QThread(parent), level(level), serverLogName(serverLog), accessLogName(accessLog)
+{
+   stopping = false;
+}
+
+/**
+ * @brief SCDImgLogger::~SCDImgLogger destructor
+ */
+SCDImgLogger::~SCDImgLogger()
+{
+   stop();
+
+   qDeleteAll(rings);
+}
+
+/**
+ * @brief SCDImgLogger::open open channels outputs and start logger thread: from now on messages are asynchronous
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgLogger::open()
+{
+   bool opened;
+
+   if (serverLogName.isEmpty())
+   {
+      opened = outputs[CH_SERVER].open(stderr,QIODevice::WriteOnly);
+   }
+   else
+   {
+      outputs[CH_SERVER].setFileName(serverLogName);
+
+      opened = outputs[CH_SERVER].open(QIODevice::WriteOnly | QIODevice::Append);
+   }
+
+   if (!opened)
+   {
+      lastErrorMsg = "Open server log error: " + serverLogName + " => " + outputs[CH_SERVER].errorString();
+      return 0;
+   }
+
+   if (!accessLogName.isEmpty())
+   {
+      outputs[CH_ACCESS].setFileName(accessLogName);
+
+      if (!outputs[CH_ACCESS].open(QIODevice::WriteOnly | QIODevice::Append))
+      {
+         lastErrorMsg = "Open access log error: " + accessLogName + " => " + outputs[CH_ACCESS].errorString();
+         return 0;
+      }
+   }
+
+   current.store(this);
+
+   start(QThread::LowPriority);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgLogger::stop flush pending messages and stop logger thread: from now on messages are synchronous
+ */
+void SCDImgLogger::stop()
+{
+   SCDImgLogger *self = this;
+
+   current.compare_exchange_strong(self,0);
+
+   if (isRunning())
+   {
+      {
+         QMutexLocker locker(&waitLock);
+
+         stopping = true;
+
+         wakeUp.wakeAll();
+      }
+
+      wait();
+   }
+}
+
+/**
+ * @brief SCDImgLogger::dropped
+ * @return messages dropped because a ring was full
+ */
+quint64 SCDImgLogger::dropped()
+{
+   QMutexLocker locker(&ringsLock);
+
+   quint64 count = 0;
+
+   foreach (SCDImgLogRing *ring, rings)
+   {
+      count += ring->dropped.load(std::memory_order_relaxed);
+   }
+
+   return count;
+}
+
+/**
+ * @brief SCDImgLogger::lastError
+ * @return
+ */
+QString SCDImgLogger::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgLogger::instance
+ * @return running logger, null if messages are written synchronously to stderr
+ */
+SCDImgLogger *SCDImgLogger::instance()
+{
+   return current.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief SCDImgLogger::enabled
+ * @param level
+ * @return true if messages of level are logged
+ */
+bool SCDImgLogger::enabled(int level)
+{
+   SCDImgLogger *logger = instance();
+
+   return (level >= (logger ? logger->level : static_cast<int>(LV_INFO)));
+}
+
+/**
+ * @brief SCDImgLogger::accessEnabled
+ * @return true if access log is enabled
+ */
+bool SCDImgLogger::accessEnabled()
+{
+   SCDImgLogger *logger = instance();
+
+   return (logger && !logger->accessLogName.isEmpty());
+}
+
+/**
+ * @brief SCDImgLogger::log push a message into the ring of calling thread (written to stderr if logger is not running)
+ * @param level
+ * @param channel
+ * @param text
+ */
+void SCDImgLogger::log(int level, int channel, const QString &text)
+{
+   SCDImgLogger *logger = instance();
+
+   if (!logger)
+   {
+      if (channel==CH_SERVER)
+      {
+         fprintf(stderr,"%s\n",text.toLocal8Bit().constData());
+      }
+
+      return;
+   }
+
+   logger->threadRing()->push(level,channel,text.toUtf8());
+}
+
+/**
+ * @brief SCDImgLogger::levelName
+ * @param level
+ * @return
+ */
+const char *SCDImgLogger::levelName(int level)
+{
+   static const char *names[] = {"D","I","W","E"};
+
+   return names[qBound(0,level,3)];
+}
+
+/**
+ * @brief SCDImgLogger::levelFromName
+ * @param name debug, info, warning, error, none
+ * @return level (LV_INFO if name is unknown)
+ */
+int SCDImgLogger::levelFromName(QString name)
+{
+   static const char *names[] = {"debug","info","warning","error","none"};
+
+   for (int level=LV_DEBUG; level<=LV_NONE; level++)
+   {
+      if (name.trimmed().toLower()==names[level])
+      {
+         return level;
+      }
+   }
+
+   return LV_INFO;
+}
+
+/**
+ * @brief SCDImgLogger::run logger thread: flush rings until stopped
+ */
+void SCDImgLogger::run()
+{
+   forever
+   {
+      int flushed = drain();
+
+      QMutexLocker locker(&waitLock);
+
+      if (stopping)
+      {
+         break;
+      }
+
+      if (flushed==0)
+      {
+         wakeUp.wait(&waitLock,20);
+      }
+   }
+
+   drain();
+}
+
+/**
+ * @brief SCDImgLogger::threadRing
+ * @return ring of calling thread (acquired on first message)
+ */
+SCDImgLogRing *SCDImgLogger::threadRing()
+{
+   static thread_local SCDImgLogRingRef ref;
+
+   if (ref.logger!=this)
+   {
+      ref.logger = this;
+      ref.ring   = acquireRing();
+   }
+
+   return ref.ring;
+}
+
+/**
+ * @brief SCDImgLogger::acquireRing
+ * @return a ring of a finished thread, or a new one
+ */
+SCDImgLogRing *SCDImgLogger::acquireRing()
+{
+   QMutexLocker locker(&ringsLock);
+
+   if (!freeRings.isEmpty())
+   {
+      return freeRings.takeLast();
+   }
+
+   SCDImgLogRing *ring = new SCDImgLogRing();
+
+   rings.append(ring);
+
+   return ring;
+}
+
+/**
+ * @brief SCDImgLogger::releaseRing give back the ring of a finishing thread (pending records are flushed anyway)
+ * @param ring
+ */
+void SCDImgLogger::releaseRing(SCDImgLogRing *ring)
+{
+   QMutexLocker locker(&ringsLock);
+
+   freeRings.append(ring);
+}
+
+/**
+ * @brief SCDImgLogger::drain write the records of all rings to channels outputs
+ * @return number of written records
+ */
+int SCDImgLogger::drain()
+{
+   QList<SCDImgLogRing*> list;
+
+   {
+      QMutexLocker locker(&ringsLock);
+
+      list = rings;
+   }
+
+   SCDImgLogRecord record;
+
+   QByteArray buff[CH_COUNT];
+
+   int count = 0;
+
+   foreach (SCDImgLogRing *ring, list)
+   {
+      while (ring->pop(record))
+      {
+         if (record.channel==CH_ACCESS)
+         {
+            buff[CH_ACCESS].append(QByteArray::number(record.time));
+            buff[CH_ACCESS].append('\t');
+         }
+         else
+         {
+            buff[CH_SERVER].append(QDateTime::fromMSecsSinceEpoch(record.time).toString("yyyy-MM-dd hh:mm:ss.zzz").toLatin1());
+            buff[CH_SERVER].append(" [");
+            buff[CH_SERVER].append(levelName(record.level));
+            buff[CH_SERVER].append("] ");
+         }
+
+         buff[record.channel].append(record.text,record.length);
+         buff[record.channel].append('\n');
+
+         count++;
+      }
+   }
+
+   for (int channel=0; channel<CH_COUNT; channel++)
+   {
+      if (!buff[channel].isEmpty() && outputs[channel].isOpen())
+      {
+         outputs[channel].write(buff[channel]);
+         outputs[channel].flush();
+      }
+   }
+
+   return count;
+}
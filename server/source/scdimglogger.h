@@ -0,0 +1,154 @@
+#ifndef SCDIMGLOGGER_H
+#define SCDIMGLOGGER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QTextStream>
+
+#include <atomic>
+
+#define LOG_TEXT_SIZE 232 // max bytes of a message (longer messages are truncated)
+#define LOG_RING_SIZE 256 // records of a thread ring (power of two)
+
+/**
+ * @brief The SCDImgLogRecord struct is a fixed size log record
+ */
+struct SCDImgLogRecord
+{
+   qint64  time;    // msecs since epoch
+   quint8  level;
+   quint8  channel;
+   quint16 length;
+   char    text[LOG_TEXT_SIZE];
+};
+
+/**
+ * @brief The SCDImgLogRing class is a single producer (logging thread), single consumer (flusher) lock-free ring
+ */
+class SCDImgLogRing
+{
+   public:
+
+     SCDImgLogRing();
+
+     bool push(int level, int channel, const QByteArray &text); // false if ring is full
+     bool pop(SCDImgLogRecord &record);
+
+     std::atomic<quint64> dropped; // records dropped because ring was full
+
+   private:
+
+     SCDImgLogRecord records[LOG_RING_SIZE];
+
+     std::atomic<quint32> head; // next record to write (producer)
+     std::atomic<quint32> tail; // next record to read (consumer)
+};
+
+/**
+ * @brief The SCDImgLogger class is the asynchronous logger: each thread writes into its own ring (rings are
+ *        pooled and reused by new threads), a background thread flushes rings to the channels outputs.
+ *        When a ring is full messages are dropped and counted, the logging thread never blocks.
+ */
+class SCDImgLogger : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     enum Level   {LV_DEBUG=0,LV_INFO=1,LV_WARNING=2,LV_ERROR=3,LV_NONE=4};
+     enum Channel {CH_SERVER=0,CH_ACCESS=1,CH_COUNT=2};
+
+     explicit SCDImgLogger(QObject *parent=0, int level=LV_INFO, QString serverLog=QString(), QString accessLog=QString());
+
+     ~SCDImgLogger();
+
+     int  open();  // open channels outputs and start flusher thread
+     void stop();  // flush pending records and stop flusher thread
+
+     quint64 dropped();
+
+     QString lastError();
+
+     static SCDImgLogger *instance();
+
+     static bool enabled(int level);                          // false: message is not formatted at all
+     static bool accessEnabled();
+     static void log(int level, int channel, const QString &text);
+
+     static const char *levelName(int level);
+     static int         levelFromName(QString name); // debug, info, warning, error, none
+
+     void run();
+
+   private:
+
+     static std::atomic<SCDImgLogger*> current;
+
+     int level;
+
+     QString serverLogName; // empty: stderr
+     QString accessLogName; // empty: access log disabled
+
+     QFile outputs[CH_COUNT];
+
+     QMutex               ringsLock;
+     QList<SCDImgLogRing*> rings;     // all rings
+     QList<SCDImgLogRing*> freeRings; // rings of finished threads
+
+     QMutex         waitLock;
+     QWaitCondition wakeUp;
+     bool           stopping;
+
+     QString lastErrorMsg;
+
+     SCDImgLogRing *threadRing();  // ring of calling thread
+     int            drain();       // flush rings, return number of flushed records
+
+     friend struct SCDImgLogRingRef;
+
+     SCDImgLogRing *acquireRing();
+     void           releaseRing(SCDImgLogRing *ring);
+};
+
+/**
+ * @brief The SCDImgLogLine class formats a log message and hands it to the logger when destroyed
+ */
+class SCDImgLogLine
+{
+   public:
+
+     SCDImgLogLine(int level, int channel=SCDImgLogger::CH_SERVER) : level(level), channel(channel), stream(&text) {}
+
+     ~SCDImgLogLine()
+     {
+        stream.flush();
+
+        SCDImgLogger::log(level,channel,text);
+     }
+
+     template <typename T> SCDImgLogLine &operator<<(const T &value)
+     {
+        stream << value;
+        return *this;
+     }
+
+   private:
+
+     int         level;
+     int         channel;
+     QString     text;
+     QTextStream stream;
+};
+
+// log macros: arguments are not evaluated when level is disabled
+
+#define logDebug()   if (!SCDImgLogger::enabled(SCDImgLogger::LV_DEBUG))   ; else SCDImgLogLine(SCDImgLogger::LV_DEBUG)
+#define logInfo()    if (!SCDImgLogger::enabled(SCDImgLogger::LV_INFO))    ; else SCDImgLogLine(SCDImgLogger::LV_INFO)
+#define logWarning() if (!SCDImgLogger::enabled(SCDImgLogger::LV_WARNING)) ; else SCDImgLogLine(SCDImgLogger::LV_WARNING)
+#define logError()   if (!SCDImgLogger::enabled(SCDImgLogger::LV_ERROR))   ; else SCDImgLogLine(SCDImgLogger::LV_ERROR)
+
+#endif // SCDIMGLOGGER_H
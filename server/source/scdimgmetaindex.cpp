@@ -0,0 +1,419 @@
+/**
+ * @class SCDImgMetaIndex - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server image metadata index. Width, height, format, EXIF orientation and capture date of uploaded
+ *        images are read from their headers (QImageReader and EXIF segment, no decoding) when the upload completes:
+ *        the INFO command answers from the index without opening the objects.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QImageReader>
+#include <QImageIOHandler>
+
+#include "scdimgmetaindex.h"
+#include "scdimgexif.h"
+
+#define DATE_FORMAT "yyyy-MM-dd'T'HH:mm:ss" // ISO 8601, camera local time
+
+/**
+ * @brief record index log line of an entry
+ * @param key
+ * @param meta
+ * @return
+ */
+static QByteArray record(const QString &key, const SCDImgMetaIndex::Meta &meta)
+{
+   return "M\t" + key.toUtf8() + "\t" + meta.validator + "\t" + SCDImgMetaIndex::fields(meta) + "\n";
+}
+
+/**
+ * @brief SCDImgMetaIndex::SCDImgMetaIndex
+ * @param parent
+ * @param fileName index log file
+ */
+SCDImgMetaIndex::SCDImgMetaIndex(QObject *parent, QString fileName) : QObject(parent), log(fileName,"metadata index")
+{
+   extractCount.store(0);
+
+   extractor = 0;
+}
+
+/**
+ * @brief SCDImgMetaIndex::~SCDImgMetaIndex
+ */
+SCDImgMetaIndex::~SCDImgMetaIndex()
+{
+   stopExtractor();
+}
+
+/**
+ * @brief SCDImgMetaIndex::open replay index log, rewrite it with live entries only and open it for append
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgMetaIndex::open()
+{
+   QMutexLocker locker(&mutex);
+
+   entries.clear();
+
+   int ret = log.replay([this](const QList<QByteArray> &fields)
+   {
+      QString key = QString::fromUtf8(fields.value(1));
+
+      if (fields.at(0)=="M" && fields.count()==8)
+      {
+         Meta meta;
+
+         meta.validator   = fields.at(2);
+         meta.width       = fields.at(3).toInt();
+         meta.height      = fields.at(4).toInt();
+         meta.format      = (fields.at(5)=="-") ? QByteArray() : fields.at(5);
+         meta.orientation = fields.at(6).toInt();
+         meta.date        = QDateTime::fromString(QString::fromLatin1(fields.at(7)), DATE_FORMAT);
+
+         entries.insert(key,meta);
+      }
+      else
+      if (fields.at(0)=="D" && fields.count()==2)
+      {
+         entries.remove(key);
+      }
+      // else: truncated last line
+   });
+
+   // compact: live entries only ---------------------------------------------
+
+   if (ret)
+   {
+      ret = log.rewrite([this](QFile &tmp)
+      {
+         for (QHash<QString,Meta>::const_iterator it=entries.constBegin(); it!=entries.constEnd(); ++it)
+         {
+            tmp.write(record(it.key(),it.value()));
+         }
+      });
+   }
+
+   if (!ret)
+   {
+      lastErrorMsg = log.errorString();
+   }
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgMetaIndex::insert record the metadata of a stored object
+ * @param key  object path
+ * @param meta
+ */
+void SCDImgMetaIndex::insert(const QString &key, const Meta &meta)
+{
+   QMutexLocker locker(&mutex);
+
+   entries.insert(key,meta);
+
+   log.append(record(key,meta));
+}
+
+/**
+ * @brief SCDImgMetaIndex::remove forget the metadata of a deleted object
+ * @param key
+ */
+void SCDImgMetaIndex::remove(const QString &key)
+{
+   QMutexLocker locker(&mutex);
+
+   if (!entries.remove(key))
+   {
+      return;
+   }
+
+   log.append("D\t" + key.toUtf8() + "\n");
+}
+
+/**
+ * @brief SCDImgMetaIndex::lookup
+ * @param key
+ * @param meta output param (its validator must be checked against the object)
+ * @return false if object has no recorded metadata
+ */
+bool SCDImgMetaIndex::lookup(const QString &key, Meta &meta)
+{
+   QMutexLocker locker(&mutex);
+
+   QHash<QString,Meta>::const_iterator it = entries.constFind(key);
+
+   if (it==entries.constEnd())
+   {
+      return false;
+   }
+
+   meta = it.value();
+
+   return true;
+}
+
+/**
+ * @brief SCDImgMetaIndex::count
+ * @return objects with recorded metadata
+ */
+int SCDImgMetaIndex::count()
+{
+   QMutexLocker locker(&mutex);
+
+   return entries.count();
+}
+
+/**
+ * @brief SCDImgMetaIndex::extracted count a metadata extraction (upload completed, or stale entry requested)
+ */
+void SCDImgMetaIndex::extracted()
+{
+   extractCount++;
+}
+
+/**
+ * @brief SCDImgMetaIndex::extractions
+ * @return
+ */
+quint64 SCDImgMetaIndex::extractions()
+{
+   return extractCount.load();
+}
+
+/**
+ * @brief SCDImgMetaIndex::startExtractor start the background extractor of uploaded objects. Call it after open()
+ * @param extract reads the metadata of an object and records it (see SignalsHandler::extractMeta)
+ */
+void SCDImgMetaIndex::startExtractor(std::function<void(const QString &key)> extract)
+{
+   extractor = new SCDImgMetaExtractor(this,extract);
+
+   extractor->start(QThread::LowPriority);
+}
+
+/**
+ * @brief SCDImgMetaIndex::stopExtractor stop the background extractor: keys still queued are not extracted
+ */
+void SCDImgMetaIndex::stopExtractor()
+{
+   if (!extractor)
+   {
+      return;
+   }
+
+   extractor->stop();
+   extractor->wait();
+
+   delete extractor;
+
+   extractor = 0;
+}
+
+/**
+ * @brief SCDImgMetaIndex::queue extract the metadata of an uploaded object in background
+ * @param key
+ */
+void SCDImgMetaIndex::queue(const QString &key)
+{
+   if (extractor)
+   {
+      extractor->push(key);
+   }
+}
+
+/**
+ * @brief SCDImgMetaIndex::queued
+ * @return objects waiting for background extraction
+ */
+int SCDImgMetaIndex::queued()
+{
+   return extractor ? extractor->count() : 0;
+}
+
+/**
+ * @brief SCDImgMetaIndex::lastError
+ * @return
+ */
+QString SCDImgMetaIndex::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief exifOrientation EXIF orientation of a QImageReader transformation
+ * @param transformation
+ * @return 1..8
+ */
+static int exifOrientation(QImageIOHandler::Transformations transformation)
+{
+   switch (transformation)
+   {
+      case QImageIOHandler::TransformationMirror:            return 2;
+      case QImageIOHandler::TransformationRotate180:         return 3;
+      case QImageIOHandler::TransformationFlip:              return 4;
+      case QImageIOHandler::TransformationFlipAndRotate90:   return 5;
+      case QImageIOHandler::TransformationRotate90:          return 6;
+      case QImageIOHandler::TransformationMirrorAndRotate90: return 7;
+      case QImageIOHandler::TransformationRotate270:         return 8;
+      default:                                               return 1;
+   }
+}
+
+/**
+ * @brief SCDImgMetaIndex::extract read image metadata from headers: format, size and orientation by QImageReader
+ *                                 (header only reads), capture date from EXIF segment. Pixels are never decoded.
+ * @param device opened object (file or packed object buffer)
+ * @param meta   output param (validator is not set)
+ * @return true if device is an image (meta is filled anyway: an empty format marks a non image object)
+ */
+bool SCDImgMetaIndex::extract(QIODevice *device, Meta &meta)
+{
+   meta.width       = 0;
+   meta.height      = 0;
+   meta.orientation = 1;
+
+   meta.format.clear();
+
+   meta.date = QDateTime();
+
+   SCDImgExif exif(device->peek(SCDImgExif::HEAD_SIZE));
+
+   QImageReader reader(device);
+
+   if (!reader.canRead())
+   {
+      return false;
+   }
+
+   meta.format = reader.format();
+
+   QSize size = reader.size();
+
+   if (!size.isValid())
+   {
+      size = exif.imageSize(); // format handler without size option
+   }
+
+   if (size.isValid())
+   {
+      meta.width  = size.width();
+      meta.height = size.height();
+   }
+
+   meta.orientation = exifOrientation(reader.transformation());
+
+   if (exif.hasExif())
+   {
+      meta.date = exif.captureDate();
+   }
+
+   return true;
+}
+
+/**
+ * @brief SCDImgMetaIndex::fields metadata as INFO reply fields (unknown format and date are '-')
+ * @param meta
+ * @return <width>\t<height>\t<format>\t<orientation>\t<date>
+ */
+QByteArray SCDImgMetaIndex::fields(const Meta &meta)
+{
+   return QByteArray::number(meta.width) + "\t" + QByteArray::number(meta.height) + "\t" + (meta.format.isEmpty() ? QByteArray("-") : meta.format) + "\t" +
+          QByteArray::number(meta.orientation) + "\t" + (meta.date.isValid() ? meta.date.toString(DATE_FORMAT).toLatin1() : QByteArray("-"));
+}
+
+/**
+ * @class SCDImgMetaExtractor
+ *
+ * @brief Background thread which extracts the metadata of uploaded objects
+ */
+
+/**
+ * @brief SCDImgMetaExtractor::SCDImgMetaExtractor constructor
+ * @param parent
+ * @param extract   reads the metadata of an object and records it
+ * @param maxQueued keys beyond this are dropped
+ */
+SCDImgMetaExtractor::SCDImgMetaExtractor(QObject *parent, std::function<void(const QString &key)> extract, int maxQueued) : QThread(parent), extract(extract), maxQueued(maxQueued)
+{
+   stopped = false;
+}
+
+/**
+ * @brief SCDImgMetaExtractor::run extraction loop
+ */
+void SCDImgMetaExtractor::run()
+{
+   forever
+   {
+      mutex.lock();
+
+      while (!stopped && keys.isEmpty())
+      {
+         wait.wait(&mutex);
+      }
+
+      if (stopped)
+      {
+         mutex.unlock();
+         break;
+      }
+
+      QString key = keys.takeFirst();
+
+      queued.remove(key);
+
+      mutex.unlock();
+
+      extract(key);
+   }
+}
+
+/**
+ * @brief SCDImgMetaExtractor::stop wake up and stop the extraction loop
+ */
+void SCDImgMetaExtractor::stop()
+{
+   QMutexLocker locker(&mutex);
+
+   stopped = true;
+
+   wait.wakeAll();
+}
+
+/**
+ * @brief SCDImgMetaExtractor::push queue a key (once)
+ * @param key
+ */
+void SCDImgMetaExtractor::push(const QString &key)
+{
+   QMutexLocker locker(&mutex);
+
+   if (queued.contains(key) || keys.count()>=maxQueued)
+   {
+      return;
+   }
+
+   keys.append(key);
+   queued.insert(key);
+
+   wait.wakeOne();
+}
+
+/**
+ * @brief SCDImgMetaExtractor::count
+ * @return queued keys
+ */
+int SCDImgMetaExtractor::count()
+{
+   QMutexLocker locker(&mutex);
+
+   return keys.count();
+}
@@ -0,0 +1,125 @@
+#ifndef SCDIMGMETAINDEX_H
+#define SCDIMGMETAINDEX_H
+
+#include <QObject>
+#include <QThread>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QIODevice>
+
+#include <atomic>
+#include <functional>
+
+#include "scdimgindexlog.h"
+
+class SCDImgMetaExtractor;
+
+/**
+ * @brief The SCDImgMetaIndex class keeps the image metadata of stored objects (size, format, EXIF orientation and
+ *        capture date), extracted when an upload completes by reading image headers only. Each entry keeps the object
+ *        validator at extraction time: an entry whose object has changed since is stale and is extracted again.
+ *        The index is a log of lines
+ *
+ *          M\t<key>\t<validator>\t<width>\t<height>\t<format>\t<orientation>\t<date>\n   object metadata
+ *          D\t<key>\n                                                                   object deleted
+ *
+ *        replayed and compacted on open. It is not synced: a lost entry is extracted again on request.
+ *        Uploaded objects are queued to a background extractor: the upload reply does not wait for it.
+ */
+class SCDImgMetaIndex : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     struct Meta
+     {
+        QByteArray validator;   // object validator when metadata was extracted
+        int        width;
+        int        height;
+        QByteArray format;      // image format (empty: not an image)
+        int        orientation; // EXIF orientation 1..8 (1: normal)
+        QDateTime  date;        // capture date (invalid if unknown)
+     };
+
+     explicit SCDImgMetaIndex(QObject *parent=0, QString fileName="./metadata.idx");
+
+     ~SCDImgMetaIndex();
+
+     int open(); // load and compact the index
+
+     void insert(const QString &key, const Meta &meta);
+     void remove(const QString &key);
+
+     bool lookup(const QString &key, Meta &meta); // false if key has no metadata
+
+     int count();
+
+     void    extracted(); // count a metadata extraction
+     quint64 extractions();
+
+     void startExtractor(std::function<void(const QString &key)> extract); // background extraction of queued objects
+     void stopExtractor();
+     void queue(const QString &key); // extract metadata of an uploaded object in background
+     int  queued();
+
+     QString lastError();
+
+     static bool       extract(QIODevice *device, Meta &meta); // read image headers of an opened device (nothing is decoded)
+     static QByteArray fields(const Meta &meta);                // <width>\t<height>\t<format>\t<orientation>\t<date>
+
+   private:
+
+     QMutex         mutex;
+     SCDImgIndexLog log;
+
+     QHash<QString,Meta> entries; // key => metadata
+
+     std::atomic<quint64> extractCount;
+
+     SCDImgMetaExtractor *extractor; // null if not started
+
+     QString lastErrorMsg;
+};
+
+/**
+ * @brief The SCDImgMetaExtractor class extracts the metadata of uploaded objects in background, in upload order.
+ *        A key queued again before its extraction is extracted once; when the queue is full keys are dropped
+ *        (their metadata is extracted on the first INFO request).
+ */
+class SCDImgMetaExtractor : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgMetaExtractor(QObject *parent, std::function<void(const QString &key)> extract, int maxQueued=65536);
+
+     void run();
+     void stop();
+
+     void push(const QString &key);
+     int  count();
+
+   private:
+
+     std::function<void(const QString &key)> extract;
+
+     int maxQueued;
+
+     QStringList   keys;   // keys waiting for extraction
+     QSet<QString> queued; // same keys, for lookup
+
+     bool stopped;
+
+     QMutex         mutex;
+     QWaitCondition wait;
+};
+
+#endif // SCDIMGMETAINDEX_H
@@ -0,0 +1,527 @@
+/**
+ * @class SCDImgMetrics - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server metrics. Each connection thread updates its own counters block (single writer,
+ *        no locks and no atomic read-modify-write), blocks are merged only when metrics are scraped.
+ *        Latencies are recorded into HDR-style log-linear histograms, exported as Prometheus histograms
+ *        and as precomputed quantiles.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QSet>
+#include <QtAlgorithms>
+
+#include "scdimgmetrics.h"
+
+static const double bucketBounds[] = {0.0001,0.00025,0.0005,0.001,0.0025,0.005,0.01,0.025,0.05,0.1,0.25,0.5,1,2.5,5,10}; // seconds
+static const double quantiles[]    = {0.5,0.9,0.99,0.999};
+
+/**
+ * @brief SCDImgHistogram::SCDImgHistogram constructor
+ */
+SCDImgHistogram::SCDImgHistogram()
+{
+   for (int i=0; i<HIST_BUCKETS; i++)
+   {
+      counts[i].store(0);
+   }
+
+   sum.store(0);
+}
+
+/**
+ * @brief SCDImgHistogram::record record a value. Call it only from the owner thread.
+ * @param usecs
+ */
+void SCDImgHistogram::record(quint64 usecs)
+{
+   std::atomic<quint64> &count = counts[index(usecs)];
+
+   count.store(count.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+   sum.store(sum.load(std::memory_order_relaxed)+usecs,std::memory_order_relaxed);
+}
+
+/**
+ * @brief SCDImgHistogram::index
+ * @param value
+ * @return bucket of value: values below HIST_SUB have their own bucket, then every power of two
+ *         is split into HIST_SUB linear sub-buckets
+ */
+int SCDImgHistogram::index(quint64 value)
+{
+   if (value<HIST_SUB)
+   {
+      return static_cast<int>(value);
+   }
+
+   int exp = 63 - static_cast<int>(qCountLeadingZeroBits(value));
+
+   if (exp>HIST_MAX_EXP)
+   {
+      return HIST_BUCKETS-1;
+   }
+
+   return (exp-HIST_SUB_BITS+1)*HIST_SUB + static_cast<int>((value >> (exp-HIST_SUB_BITS)) & (HIST_SUB-1));
+}
+
+/**
+ * @brief SCDImgHistogram::lowerBound
+ * @param index
+ * @return lowest value of bucket index
+ */
+quint64 SCDImgHistogram::lowerBound(int index)
+{
+   if (index<HIST_SUB)
+   {
+      return static_cast<quint64>(index);
+   }
+
+   int exp = index/HIST_SUB + HIST_SUB_BITS - 1;
+
+   return static_cast<quint64>(HIST_SUB + index%HIST_SUB) << (exp-HIST_SUB_BITS);
+}
+
+/**
+ * @brief SCDImgHistogram::upperBound
+ * @param index
+ * @return highest value of bucket index
+ */
+quint64 SCDImgHistogram::upperBound(int index)
+{
+   return lowerBound(index+1)-1;
+}
+
+/**
+ * @class SCDImgHistogramSnapshot
+ *
+ * @brief Merged histograms
+ */
+
+/**
+ * @brief SCDImgHistogramSnapshot::SCDImgHistogramSnapshot constructor
+ */
+SCDImgHistogramSnapshot::SCDImgHistogramSnapshot() : counts(HIST_BUCKETS,0)
+{
+   total = 0;
+   sum   = 0;
+}
+
+/**
+ * @brief SCDImgHistogramSnapshot::add merge a histogram
+ * @param histogram
+ */
+void SCDImgHistogramSnapshot::add(const SCDImgHistogram &histogram)
+{
+   for (int i=0; i<HIST_BUCKETS; i++)
+   {
+      quint64 count = histogram.counts[i].load(std::memory_order_relaxed);
+
+      counts[i] += count;
+      total     += count;
+   }
+
+   sum += histogram.sum.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief SCDImgHistogramSnapshot::quantile
+ * @param q 0..1
+ * @return highest value of the bucket holding quantile q (0 if empty)
+ */
+quint64 SCDImgHistogramSnapshot::quantile(double q) const
+{
+   if (total==0)
+   {
+      return 0;
+   }
+
+   quint64 rank = qMax<quint64>(1, static_cast<quint64>(q*total + 0.5));
+   quint64 seen = 0;
+
+   for (int i=0; i<HIST_BUCKETS; i++)
+   {
+      seen += counts[i];
+
+      if (seen>=rank)
+      {
+         return SCDImgHistogram::upperBound(i);
+      }
+   }
+
+   return SCDImgHistogram::upperBound(HIST_BUCKETS-1);
+}
+
+/**
+ * @brief SCDImgHistogramSnapshot::countBelow
+ * @param usecs
+ * @return number of values of the buckets entirely below usecs
+ */
+quint64 SCDImgHistogramSnapshot::countBelow(quint64 usecs) const
+{
+   quint64 count = 0;
+
+   for (int i=0; i<HIST_BUCKETS && SCDImgHistogram::upperBound(i)<=usecs; i++)
+   {
+      count += counts[i];
+   }
+
+   return count;
+}
+
+/**
+ * @class SCDImgMetricsBlock
+ *
+ * @brief Counters of a connection thread
+ */
+
+/**
+ * @brief SCDImgMetricsBlock::SCDImgMetricsBlock constructor
+ */
+SCDImgMetricsBlock::SCDImgMetricsBlock()
+{
+   for (int op=0; op<OP_COUNT; op++)
+   {
+      errors[op].store(0);
+   }
+
+   bytesIn.store(0);
+   bytesOut.store(0);
+   buffered.store(0);
+}
+
+/**
+ * @class SCDImgMetrics
+ *
+ * @brief Metrics registry
+ */
+
+/**
+ * @brief SCDImgMetrics::SCDImgMetrics constructor
+ * @param parent
+ */
+SCDImgMetrics::SCDImgMetrics(QObject *parent) : QObject(parent)
+{
+
+}
+
+/**
+ * @brief SCDImgMetrics::~SCDImgMetrics destructor
+ */
+SCDImgMetrics::~SCDImgMetrics()
+{
+   qDeleteAll(blocks);
+}
+
+/**
+ * @brief SCDImgMetrics::acquire get a counters block for a connection thread (a released one if available)
+ * @return
+ */
+SCDImgMetricsBlock *SCDImgMetrics::acquire()
+{
+   QMutexLocker locker(&lock);
+
+   if (!freeBlocks.isEmpty())
+   {
+      return freeBlocks.takeLast();
+   }
+
+   SCDImgMetricsBlock *block = new SCDImgMetricsBlock();
+
+   blocks.append(block);
+
+   return block;
+}
+
+/**
+ * @brief SCDImgMetrics::release give back the block of a finishing connection thread
+ * @param block
+ */
+void SCDImgMetrics::release(SCDImgMetricsBlock *block)
+{
+   block->buffered.store(0);
+
+   QMutexLocker locker(&lock);
+
+   freeBlocks.append(block);
+}
+
+/**
+ * @brief SCDImgMetrics::addGauge register a gauge read at scrape time
+ * @param name  metric name, optionally with labels
+ * @param help
+ * @param value
+ */
+void SCDImgMetrics::addGauge(QString name, QString help, std::function<double()> value)
+{
+   QMutexLocker locker(&lock);
+
+   External metric = {name,help,"gauge",value};
+
+   externals.append(metric);
+}
+
+/**
+ * @brief SCDImgMetrics::addCounter register a counter read at scrape time
+ * @param name  metric name, optionally with labels
+ * @param help
+ * @param value
+ */
+void SCDImgMetrics::addCounter(QString name, QString help, std::function<double()> value)
+{
+   QMutexLocker locker(&lock);
+
+   External metric = {name,help,"counter",value};
+
+   externals.append(metric);
+}
+
+/**
+ * @brief SCDImgMetrics::opName
+ * @param op SCDImgMetricsBlock::Op
+ * @return command label
+ */
+const char *SCDImgMetrics::opName(int op)
+{
+   static const char *names[] = {"get","get_thumbnail","put","del","info","sheet"};
+
+   return names[op];
+}
+
+/**
+ * @brief writeHistogram write a Prometheus histogram
+ * @param out
+ * @param name
+ * @param labels  labels of histogram (without braces), may be empty
+ * @param snap
+ */
+static void writeHistogram(QTextStream &out, const QString &name, const QString &labels, const SCDImgHistogramSnapshot &snap)
+{
+   QString sep = labels.isEmpty() ? QString() : labels + ",";
+
+   for (double bound : bucketBounds)
+   {
+      out << name << "_bucket{" << sep << "le=\"" << bound << "\"} " << snap.countBelow(static_cast<quint64>(bound*1e6)) << "\n";
+   }
+
+   out << name << "_bucket{" << sep << "le=\"+Inf\"} " << snap.total << "\n";
+
+   QString braces = labels.isEmpty() ? QString() : "{" + labels + "}";
+
+   out << name << "_sum" << braces << " " << snap.sum/1e6 << "\n";
+   out << name << "_count" << braces << " " << snap.total << "\n";
+}
+
+/**
+ * @brief writeQuantiles
+ * @param out
+ * @param name
+ * @param labels labels (without braces), may be empty
+ * @param snap
+ */
+static void writeQuantiles(QTextStream &out, const QString &name, const QString &labels, const SCDImgHistogramSnapshot &snap)
+{
+   QString sep = labels.isEmpty() ? QString() : labels + ",";
+
+   for (double q : quantiles)
+   {
+      out << name << "{" << sep << "quantile=\"" << q << "\"} " << snap.quantile(q)/1e6 << "\n";
+   }
+}
+
+/**
+ * @brief SCDImgMetrics::exposition merge all counters blocks and read registered gauges
+ * @return metrics in Prometheus text format
+ */
+QByteArray SCDImgMetrics::exposition()
+{
+   SCDImgHistogramSnapshot latency[SCDImgMetricsBlock::OP_COUNT];
+   SCDImgHistogramSnapshot thumbnail;
+
+   quint64 errors[SCDImgMetricsBlock::OP_COUNT] = {0,0,0,0,0,0};
+   quint64 bytesIn  = 0;
+   quint64 bytesOut = 0;
+   qint64  buffered = 0;
+
+   QList<External> gauges;
+
+   {
+      QMutexLocker locker(&lock);
+
+      foreach (SCDImgMetricsBlock *block, blocks)
+      {
+         for (int op=0; op<SCDImgMetricsBlock::OP_COUNT; op++)
+         {
+            latency[op].add(block->latency[op]);
+
+            errors[op] += block->errors[op].load(std::memory_order_relaxed);
+         }
+
+         thumbnail.add(block->thumbnail);
+
+         bytesIn  += block->bytesIn.load(std::memory_order_relaxed);
+         bytesOut += block->bytesOut.load(std::memory_order_relaxed);
+         buffered += block->buffered.load(std::memory_order_relaxed);
+      }
+
+      gauges = externals;
+   }
+
+   QByteArray text;
+
+   QTextStream out(&text);
+
+   out << "# HELP scdimg_requests_total Completed requests by command.\n";
+   out << "# TYPE scdimg_requests_total counter\n";
+
+   for (int op=0; op<SCDImgMetricsBlock::OP_COUNT; op++)
+   {
+      out << "scdimg_requests_total{op=\"" << opName(op) << "\"} " << latency[op].total << "\n";
+   }
+
+   out << "# HELP scdimg_request_errors_total Failed requests by command.\n";
+   out << "# TYPE scdimg_request_errors_total counter\n";
+
+   for (int op=0; op<SCDImgMetricsBlock::OP_COUNT; op++)
+   {
+      out << "scdimg_request_errors_total{op=\"" << opName(op) << "\"} " << errors[op] << "\n";
+   }
+
+   out << "# HELP scdimg_request_duration_seconds Request latency, from header to reply.\n";
+   out << "# TYPE scdimg_request_duration_seconds histogram\n";
+
+   for (int op=0; op<SCDImgMetricsBlock::OP_COUNT; op++)
+   {
+      writeHistogram(out, "scdimg_request_duration_seconds", QString("op=\"%1\"").arg(opName(op)), latency[op]);
+   }
+
+   out << "# HELP scdimg_request_duration_quantile_seconds Request latency quantiles (HDR histogram).\n";
+   out << "# TYPE scdimg_request_duration_quantile_seconds gauge\n";
+
+   for (int op=0; op<SCDImgMetricsBlock::OP_COUNT; op++)
+   {
+      writeQuantiles(out, "scdimg_request_duration_quantile_seconds", QString("op=\"%1\"").arg(opName(op)), latency[op]);
+   }
+
+   out << "# HELP scdimg_thumbnail_duration_seconds Thumbnail generation time.\n";
+   out << "# TYPE scdimg_thumbnail_duration_seconds histogram\n";
+
+   writeHistogram(out, "scdimg_thumbnail_duration_seconds", QString(), thumbnail);
+
+   out << "# HELP scdimg_received_bytes_total Bytes received from clients.\n";
+   out << "# TYPE scdimg_received_bytes_total counter\n";
+   out << "scdimg_received_bytes_total " << bytesIn << "\n";
+
+   out << "# HELP scdimg_sent_bytes_total Bytes sent to clients.\n";
+   out << "# TYPE scdimg_sent_bytes_total counter\n";
+   out << "scdimg_sent_bytes_total " << bytesOut << "\n";
+
+   out << "# HELP scdimg_buffer_bytes Memory held by connections buffers.\n";
+   out << "# TYPE scdimg_buffer_bytes gauge\n";
+   out << "scdimg_buffer_bytes " << buffered << "\n";
+
+   QSet<QString> described;
+
+   foreach (const External &gauge, gauges)
+   {
+      QString base = gauge.name.section('{',0,0);
+
+      if (!described.contains(base))
+      {
+         out << "# HELP " << base << " " << gauge.help << "\n";
+         out << "# TYPE " << base << " " << gauge.type << "\n";
+
+         described.insert(base);
+      }
+
+      out << gauge.name << " " << gauge.value() << "\n";
+   }
+
+   out.flush();
+
+   return text;
+}
+
+/**
+ * @class SCDImgMetricsServer
+ *
+ * @brief Metrics HTTP endpoint
+ */
+
+/**
+ * @brief SCDImgMetricsServer::SCDImgMetricsServer constructor
+ * @param metrics
+ * @param parent
+ */
+SCDImgMetricsServer::SCDImgMetricsServer(SCDImgMetrics *metrics, QObject *parent) : QTcpServer(parent), metrics(metrics)
+{
+
+}
+
+/**
+ * @brief SCDImgMetricsServer::incomingConnection
+ * @param socketDescriptor
+ */
+void SCDImgMetricsServer::incomingConnection(qintptr socketDescriptor)
+{
+   QTcpSocket *socket = new QTcpSocket(this);
+
+   if (!socket->setSocketDescriptor(socketDescriptor))
+   {
+      delete socket;
+      return;
+   }
+
+   connect(socket, SIGNAL(readyRead()),    this,   SLOT(readyRead()));
+   connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+}
+
+/**
+ * @brief SCDImgMetricsServer::readyRead read HTTP request and reply with metrics exposition
+ */
+void SCDImgMetricsServer::readyRead()
+{
+   QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+
+   if (!socket)
+   {
+      return;
+   }
+
+   QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+
+   if (!request.contains("\r\n\r\n") && !request.contains("\n\n"))
+   {
+      if (request.size()>8192)
+      {
+         socket->abort();
+         return;
+      }
+
+      socket->setProperty("request",request); // wait for the whole request
+      return;
+   }
+
+   QByteArray reply;
+
+   if (request.startsWith("GET /metrics ") || request.startsWith("GET / "))
+   {
+      QByteArray body = metrics->exposition();
+
+      reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+   }
+   else
+   {
+      reply = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+   }
+
+   socket->write(reply);
+   socket->disconnectFromHost();
+}
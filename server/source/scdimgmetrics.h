@@ -0,0 +1,155 @@
+#ifndef SCDIMGMETRICS_H
+#define SCDIMGMETRICS_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QMutex>
+#include <QList>
+#include <QVector>
+#include <QByteArray>
+
+#include <atomic>
+#include <functional>
+
+#define HIST_SUB_BITS 4                                          // 16 sub-buckets per power of two: ~6% precision
+#define HIST_SUB      (1<<HIST_SUB_BITS)
+#define HIST_MAX_EXP  40                                         // max recordable value 2^41-1 usecs
+#define HIST_BUCKETS  ((HIST_MAX_EXP-HIST_SUB_BITS+2)*HIST_SUB)
+
+/**
+ * @brief The SCDImgHistogram class is a HDR-style log-linear histogram of durations (usecs).
+ *        It has a single writer (the owning thread): counts are updated without atomic read-modify-write.
+ */
+class SCDImgHistogram
+{
+   public:
+
+     SCDImgHistogram();
+
+     void record(quint64 usecs);
+
+     static int     index(quint64 value);
+     static quint64 lowerBound(int index);
+     static quint64 upperBound(int index);
+
+   private:
+
+     friend class SCDImgHistogramSnapshot;
+
+     std::atomic<quint64> counts[HIST_BUCKETS];
+     std::atomic<quint64> sum;
+};
+
+/**
+ * @brief The SCDImgHistogramSnapshot class merges histograms at scrape time
+ */
+class SCDImgHistogramSnapshot
+{
+   public:
+
+     SCDImgHistogramSnapshot();
+
+     void add(const SCDImgHistogram &histogram);
+
+     quint64 quantile(double q) const;        // usecs
+     quint64 countBelow(quint64 usecs) const; // values <= usecs
+
+     quint64 total;
+     quint64 sum;
+
+   private:
+
+     QVector<quint64> counts;
+};
+
+/**
+ * @brief The SCDImgMetricsBlock class holds the counters of a connection thread. Blocks are pooled:
+ *        a block released by a finished thread is reused by the next one, so counts are cumulative.
+ */
+class SCDImgMetricsBlock
+{
+   public:
+
+     enum Op {OP_GET=0,OP_GETTHUMB=1,OP_PUT=2,OP_DEL=3,OP_INFO=4,OP_SHEET=5,OP_COUNT=6};
+
+     SCDImgMetricsBlock();
+
+     SCDImgHistogram latency[OP_COUNT]; // request latency per command
+     SCDImgHistogram thumbnail;         // thumbnail generation time
+
+     std::atomic<quint64> errors[OP_COUNT];
+     std::atomic<quint64> bytesIn;
+     std::atomic<quint64> bytesOut;
+     std::atomic<qint64>  buffered;     // buffer memory of the connection (gauge)
+
+     static void add(std::atomic<quint64> &counter, quint64 n) // single writer increment
+     {
+        counter.store(counter.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+     }
+};
+
+/**
+ * @brief The SCDImgMetrics class is the registry of connection threads counters and server gauges.
+ *        Counters are aggregated only when scraped.
+ */
+class SCDImgMetrics : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgMetrics(QObject *parent=0);
+
+     ~SCDImgMetrics();
+
+     SCDImgMetricsBlock *acquire();                // counters block of a connection thread
+     void release(SCDImgMetricsBlock *block);
+
+     void addGauge(QString name, QString help, std::function<double()> value);   // name may have labels: name{label="value"}
+     void addCounter(QString name, QString help, std::function<double()> value);
+
+     QByteArray exposition(); // Prometheus text format
+
+     static const char *opName(int op);
+
+   private:
+
+     struct External
+     {
+        QString                 name;
+        QString                 help;
+        QString                 type;
+        std::function<double()> value;
+     };
+
+     QMutex                     lock;
+     QList<SCDImgMetricsBlock*> blocks;     // all blocks
+     QList<SCDImgMetricsBlock*> freeBlocks; // released blocks
+     QList<External>            externals;
+};
+
+/**
+ * @brief The SCDImgMetricsServer class serves metrics exposition over HTTP (GET /metrics)
+ */
+class SCDImgMetricsServer : public QTcpServer
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgMetricsServer(SCDImgMetrics *metrics, QObject *parent=0);
+
+   private slots:
+
+     void readyRead();
+
+   protected:
+
+     void incomingConnection(qintptr socketDescriptor);
+
+   private:
+
+     SCDImgMetrics *metrics;
+};
+
+#endif // SCDIMGMETRICS_H
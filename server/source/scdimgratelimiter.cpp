@@ -0,0 +1,346 @@
+/**
+ * @class SCDImgRateLimiter - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server bandwidth shaping. Token buckets limit the bytes sent and received
+ *        globally, per client IP and per connection (each direction is limited separately).
+ *        Rates are read by buckets at every refill, so they can be changed at runtime.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <limits>
+
+#include "scdimgratelimiter.h"
+
+#define BURST_MSECS 250   // bucket capacity: tokens of 250 msecs
+#define MIN_BURST   16384
+
+/**
+ * @brief startedClock
+ * @return a started monotonic clock
+ */
+static QElapsedTimer startedClock()
+{
+   QElapsedTimer clock;
+
+   clock.start();
+
+   return clock;
+}
+
+/**
+ * @brief monotonicNsecs
+ * @return monotonic time in nsecs
+ */
+static qint64 monotonicNsecs()
+{
+   static const QElapsedTimer clock = startedClock();
+
+   return clock.nsecsElapsed();
+}
+
+/**
+ * @brief SCDImgTokenBucket::SCDImgTokenBucket constructor
+ */
+SCDImgTokenBucket::SCDImgTokenBucket()
+{
+   rate   = 0;
+   tokens = 0;
+   last   = monotonicNsecs();
+}
+
+/**
+ * @brief SCDImgTokenBucket::bind bind bucket to a rate
+ * @param rate bytes/sec (0: unlimited)
+ */
+void SCDImgTokenBucket::bind(const std::atomic<qint64> *rate)
+{
+   this->rate = rate;
+}
+
+/**
+ * @brief SCDImgTokenBucket::refill add the tokens produced since last refill. Call it holding mutex.
+ * @return current rate
+ */
+qint64 SCDImgTokenBucket::refill()
+{
+   qint64 r   = rate ? rate->load(std::memory_order_relaxed) : 0;
+   qint64 now = monotonicNsecs();
+
+   if (r>0)
+   {
+      double burst = qMax<double>(MIN_BURST, r*BURST_MSECS/1000.0);
+
+      tokens = qMin(burst, tokens + (now-last)*r/1e9);
+   }
+
+   last = now;
+
+   return r;
+}
+
+/**
+ * @brief SCDImgTokenBucket::limited
+ * @return false if bucket rate is unlimited
+ */
+bool SCDImgTokenBucket::limited()
+{
+   return (rate && rate->load(std::memory_order_relaxed)>0);
+}
+
+/**
+ * @brief SCDImgTokenBucket::available
+ * @return available tokens (max qint64 if unlimited)
+ */
+qint64 SCDImgTokenBucket::available()
+{
+   QMutexLocker locker(&mutex);
+
+   if (refill()==0)
+   {
+      return std::numeric_limits<qint64>::max();
+   }
+
+   return (tokens>0) ? static_cast<qint64>(tokens) : 0;
+}
+
+/**
+ * @brief SCDImgTokenBucket::consume
+ * @param bytes
+ */
+void SCDImgTokenBucket::consume(qint64 bytes)
+{
+   QMutexLocker locker(&mutex);
+
+   if (refill()>0)
+   {
+      tokens -= bytes; // may go negative on concurrent grants: next waits are longer
+   }
+}
+
+/**
+ * @brief SCDImgTokenBucket::waitTime
+ * @param bytes
+ * @return msecs until bytes tokens are available (bytes are clamped to bucket capacity)
+ */
+int SCDImgTokenBucket::waitTime(qint64 bytes)
+{
+   QMutexLocker locker(&mutex);
+
+   qint64 r = refill();
+
+   if (r==0)
+   {
+      return 0;
+   }
+
+   double need = qMin<double>(bytes, qMax<double>(MIN_BURST, r*BURST_MSECS/1000.0)) - tokens;
+
+   if (need<=0)
+   {
+      return 0;
+   }
+
+   return qMax(1, static_cast<int>(need*1000/r) + 1);
+}
+
+/**
+ * @class SCDImgRateLimit
+ *
+ * @brief Rate limit of a connection
+ */
+
+/**
+ * @brief SCDImgRateLimit::SCDImgRateLimit constructor
+ * @param limiter
+ * @param peer client IP address
+ */
+SCDImgRateLimit::SCDImgRateLimit(SCDImgRateLimiter *limiter, QString peer) : limiter(limiter), peer(peer)
+{
+   SCDImgRateLimiter::ClientIp *ip = limiter->acquireClientIp(peer);
+
+   for (int dir=RL_IN; dir<=RL_OUT; dir++)
+   {
+      connection[dir].bind(&limiter->rates[SCDImgRateLimiter::RL_CONNECTION]);
+
+      buckets[dir][SCDImgRateLimiter::RL_GLOBAL]     = &limiter->global[dir];
+      buckets[dir][SCDImgRateLimiter::RL_CLIENTIP]   = &ip->bucket[dir];
+      buckets[dir][SCDImgRateLimiter::RL_CONNECTION] = &connection[dir];
+   }
+}
+
+/**
+ * @brief SCDImgRateLimit::~SCDImgRateLimit destructor
+ */
+SCDImgRateLimit::~SCDImgRateLimit()
+{
+   limiter->releaseClientIp(peer);
+}
+
+/**
+ * @brief SCDImgRateLimit::limited
+ * @param dir RL_IN or RL_OUT
+ * @return true if a rate limit is set at any level
+ */
+bool SCDImgRateLimit::limited(int dir)
+{
+   return (buckets[dir][0]->limited() || buckets[dir][1]->limited() || buckets[dir][2]->limited());
+}
+
+/**
+ * @brief SCDImgRateLimit::grant consume the bytes available at every level
+ * @param dir    RL_IN or RL_OUT
+ * @param wanted
+ * @return granted bytes (0..wanted)
+ */
+qint64 SCDImgRateLimit::grant(int dir, qint64 wanted)
+{
+   qint64 bytes = wanted;
+
+   for (int level=0; level<3; level++)
+   {
+      bytes = qMin(bytes, buckets[dir][level]->available());
+   }
+
+   if (bytes>0)
+   {
+      for (int level=0; level<3; level++)
+      {
+         buckets[dir][level]->consume(bytes);
+      }
+   }
+
+   return bytes;
+}
+
+/**
+ * @brief SCDImgRateLimit::waitTime
+ * @param dir   RL_IN or RL_OUT
+ * @param bytes
+ * @return msecs until bytes are available at every level
+ */
+int SCDImgRateLimit::waitTime(int dir, qint64 bytes)
+{
+   int wait = 0;
+
+   for (int level=0; level<3; level++)
+   {
+      wait = qMax(wait, buckets[dir][level]->waitTime(bytes));
+   }
+
+   return wait;
+}
+
+/**
+ * @class SCDImgRateLimiter
+ *
+ * @brief Server rate limiter
+ */
+
+/**
+ * @brief SCDImgRateLimiter::SCDImgRateLimiter constructor
+ * @param parent
+ */
+SCDImgRateLimiter::SCDImgRateLimiter(QObject *parent) : QObject(parent)
+{
+   for (int level=RL_GLOBAL; level<=RL_CONNECTION; level++)
+   {
+      rates[level].store(0);
+   }
+
+   global[SCDImgRateLimit::RL_IN].bind(&rates[RL_GLOBAL]);
+   global[SCDImgRateLimit::RL_OUT].bind(&rates[RL_GLOBAL]);
+}
+
+/**
+ * @brief SCDImgRateLimiter::~SCDImgRateLimiter destructor
+ */
+SCDImgRateLimiter::~SCDImgRateLimiter()
+{
+   qDeleteAll(clientIps);
+}
+
+/**
+ * @brief SCDImgRateLimiter::setRates set rate limits (bytes/sec, 0: unlimited). Applied to existing connections too.
+ * @param global
+ * @param perClientIp
+ * @param perConnection
+ */
+void SCDImgRateLimiter::setRates(qint64 global, qint64 perClientIp, qint64 perConnection)
+{
+   rates[RL_GLOBAL].store(qMax<qint64>(0,global));
+   rates[RL_CLIENTIP].store(qMax<qint64>(0,perClientIp));
+   rates[RL_CONNECTION].store(qMax<qint64>(0,perConnection));
+}
+
+/**
+ * @brief SCDImgRateLimiter::rate
+ * @param level RL_GLOBAL, RL_CLIENTIP, RL_CONNECTION
+ * @return bytes/sec
+ */
+qint64 SCDImgRateLimiter::rate(int level)
+{
+   return rates[level].load();
+}
+
+/**
+ * @brief SCDImgRateLimiter::attach
+ * @param peer client IP address
+ * @return the rate limit of a new connection (owned by caller)
+ */
+SCDImgRateLimit *SCDImgRateLimiter::attach(QString peer)
+{
+   return new SCDImgRateLimit(this,peer);
+}
+
+/**
+ * @brief SCDImgRateLimiter::acquireClientIp get (or create) the buckets of a client IP
+ * @param peer
+ * @return
+ */
+SCDImgRateLimiter::ClientIp *SCDImgRateLimiter::acquireClientIp(QString peer)
+{
+   QMutexLocker locker(&ipLock);
+
+   ClientIp *ip = clientIps.value(peer);
+
+   if (!ip)
+   {
+      ip = new ClientIp();
+
+      ip->refs = 0;
+      ip->bucket[SCDImgRateLimit::RL_IN].bind(&rates[RL_CLIENTIP]);
+      ip->bucket[SCDImgRateLimit::RL_OUT].bind(&rates[RL_CLIENTIP]);
+
+      clientIps.insert(peer,ip);
+   }
+
+   ip->refs++;
+
+   return ip;
+}
+
+/**
+ * @brief SCDImgRateLimiter::releaseClientIp release the buckets of a client IP, deleted when unused
+ * @param peer
+ */
+void SCDImgRateLimiter::releaseClientIp(QString peer)
+{
+   QMutexLocker locker(&ipLock);
+
+   ClientIp *ip = clientIps.value(peer);
+
+   if (ip && --ip->refs==0)
+   {
+      clientIps.remove(peer);
+
+      delete ip;
+   }
+}
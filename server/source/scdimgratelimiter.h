@@ -0,0 +1,110 @@
+#ifndef SCDIMGRATELIMITER_H
+#define SCDIMGRATELIMITER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QHash>
+
+#include <atomic>
+
+/**
+ * @brief The SCDImgTokenBucket class is a token bucket (1 token = 1 byte) refilled at the rate
+ *        it is bound to. A rate of 0 means unlimited.
+ */
+class SCDImgTokenBucket
+{
+   public:
+
+     SCDImgTokenBucket();
+
+     void bind(const std::atomic<qint64> *rate); // bytes/sec, read at every refill (runtime adjustable)
+
+     bool   limited();
+     qint64 available();
+     void   consume(qint64 bytes);
+     int    waitTime(qint64 bytes); // msecs until bytes are available
+
+   private:
+
+     const std::atomic<qint64> *rate;
+
+     QMutex mutex;
+     double tokens;
+     qint64 last;   // last refill time (nsecs)
+
+     qint64 refill(); // return current rate
+};
+
+class SCDImgRateLimiter;
+
+/**
+ * @brief The SCDImgRateLimit class is the rate limit of a connection: bytes are granted only if
+ *        available at global, client IP and connection level
+ */
+class SCDImgRateLimit
+{
+   public:
+
+     enum Direction {RL_IN=0,RL_OUT=1};
+
+     SCDImgRateLimit(SCDImgRateLimiter *limiter, QString peer);
+
+     ~SCDImgRateLimit();
+
+     bool   limited(int dir);
+     qint64 grant(int dir, qint64 wanted);  // consume and return the granted bytes (0..wanted)
+     int    waitTime(int dir, qint64 bytes); // msecs until bytes are granted
+
+   private:
+
+     SCDImgRateLimiter *limiter;
+     QString            peer;
+
+     SCDImgTokenBucket  connection[2];
+     SCDImgTokenBucket *buckets[2][3]; // [direction] => global, client IP, connection
+};
+
+/**
+ * @brief The SCDImgRateLimiter class holds the global and per client IP token buckets, and the
+ *        configured rates (bytes/sec) for each level
+ */
+class SCDImgRateLimiter : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     enum Level {RL_GLOBAL=0,RL_CLIENTIP=1,RL_CONNECTION=2};
+
+     explicit SCDImgRateLimiter(QObject *parent=0);
+
+     ~SCDImgRateLimiter();
+
+     void setRates(qint64 global, qint64 perClientIp, qint64 perConnection);
+
+     qint64 rate(int level);
+
+     SCDImgRateLimit *attach(QString peer); // allocates the rate limit of a new connection (owned by caller)
+
+   private:
+
+     friend class SCDImgRateLimit;
+
+     struct ClientIp
+     {
+        SCDImgTokenBucket bucket[2];
+        int               refs;
+     };
+
+     std::atomic<qint64> rates[3];
+
+     SCDImgTokenBucket global[2];
+
+     QMutex                    ipLock;
+     QHash<QString,ClientIp*>  clientIps;
+
+     ClientIp *acquireClientIp(QString peer);
+     void      releaseClientIp(QString peer);
+};
+
+#endif // SCDIMGRATELIMITER_H
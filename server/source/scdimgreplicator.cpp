@@ -0,0 +1,1071 @@
+/**
+ * @class SCDImgReplicator - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server asynchronous replication. Every completed PUT and DEL is appended to a durable
+ *        replication log and acknowledged to the client without waiting for peers. A shipper thread for each
+ *        peer reads the log from its last acknowledged entry and re-issues the commands to the peer, flagged R
+ *        so that the peer does not replicate them again (peers can replicate each other).
+ *
+ *        Shipping is batched (batch entries read at once) and pipelined (up to pipeline commands in flight on
+ *        concurrent connections). Commands on the same path are never in flight together, so their order is kept.
+ *        PUT sends the current version of the object: an object deleted meanwhile is skipped, its DEL follows.
+ *        A peer that cannot be reached is retried with exponential backoff, resuming from the persisted ack.
+ *
+ *        Log entries are written to the page cache at every append (they survive a server crash) and flushed
+ *        to disk every second (they survive a power loss, except for the last second).
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <QDateTime>
+#include <QTcpSocket>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scdimgreplicator.h"
+#include "scdimgserver.h"
+#include "scdimglogger.h"
+
+#define SHIP_CHUNK 262144 // file read chunk
+
+/**
+ * @brief permanentRefusals peer answers that will not change on retry: malformed commands, DEL of an object the peer
+ *        has not. Any other answer ("Server busy", disk full, I/O errors) is transient and the entry is retried.
+ */
+static const char *permanentRefusals[] = {"Bad header", "Invalid ", "Null header line", "Unknown header field",
+                                          "remote file path must start", "Path line too long", "File not exists", 0};
+
+/**
+ * @brief SCDImgReplicationLog::SCDImgReplicationLog constructor
+ * @param path           folder of log segments
+ * @param maxSegmentSize a new segment is started when the active one exceeds this size
+ */
+SCDImgReplicationLog::SCDImgReplicationLog(QString path, qint64 maxSegmentSize) : folder(path), maxSegmentSize(maxSegmentSize)
+{
+   fd         = -1;
+   activeSize = 0;
+   lastSeqNo  = 0;
+   dirty      = false;
+}
+
+/**
+ * @brief SCDImgReplicationLog::~SCDImgReplicationLog
+ */
+SCDImgReplicationLog::~SCDImgReplicationLog()
+{
+   close();
+}
+
+/**
+ * @brief SCDImgReplicationLog::open scan segment files, recover last seq and open the last segment for appending
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgReplicationLog::open()
+{
+   QMutexLocker locker(&mutex);
+
+   QDir dir(folder);
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastErrorMsg = "Create dir failure: " + dir.absolutePath();
+      return 0;
+   }
+
+   segments.clear();
+
+   foreach (QString file, dir.entryList(QStringList("*.rlog"),QDir::Files,QDir::Name))
+   {
+      bool ok;
+
+      quint64 firstSeq = QFileInfo(file).completeBaseName().toULongLong(&ok,16);
+
+      if (ok && firstSeq>0)
+      {
+         segments.insert(firstSeq, dir.absoluteFilePath(file));
+      }
+   }
+
+   if (segments.isEmpty())
+   {
+      lastSeqNo = 0;
+
+      return rollSegment();
+   }
+
+   // recover last seq from last segment: drop a torn tail entry ---------------
+
+   quint64 firstSeq = segments.lastKey();
+
+   QFile f(segments.last());
+
+   if (!f.open(QIODevice::ReadWrite))
+   {
+      lastErrorMsg = "Open replication log error: " + f.fileName() + " => " + f.errorString();
+      return 0;
+   }
+
+   lastSeqNo = firstSeq-1;
+
+   qint64 valid = 0;
+
+   while (!f.atEnd())
+   {
+      QByteArray line = f.readLine();
+
+      Entry entry;
+
+      if (!line.endsWith('\n') || !parse(line,entry))
+      {
+         break;
+      }
+
+      valid    += line.size();
+      lastSeqNo = entry.seq;
+   }
+
+   if (valid<f.size())
+   {
+      logWarning() << "Replication log torn tail dropped: " << f.fileName() << " " << (f.size()-valid) << " bytes";
+
+      f.resize(valid);
+   }
+
+   f.close();
+
+   fd = ::open(QFile::encodeName(segments.last()).constData(), O_WRONLY|O_APPEND|O_CLOEXEC);
+
+   if (fd<0)
+   {
+      lastErrorMsg = "Open replication log error: " + segments.last() + " => " + QString(strerror(errno));
+      return 0;
+   }
+
+   activeSize = valid;
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgReplicationLog::close
+ */
+void SCDImgReplicationLog::close()
+{
+   QMutexLocker locker(&mutex);
+
+   if (fd>=0)
+   {
+      ::fdatasync(fd);
+      ::close(fd);
+
+      fd = -1;
+   }
+}
+
+/**
+ * @brief SCDImgReplicationLog::append append an entry
+ * @param op  OP_PUT or OP_DEL
+ * @param key object path
+ * @return entry seq, 0 on failure
+ */
+quint64 SCDImgReplicationLog::append(char op, const QString &key)
+{
+   QMutexLocker locker(&mutex);
+
+   if (fd<0)
+   {
+      return 0;
+   }
+
+   if (activeSize>=maxSegmentSize && !rollSegment())
+   {
+      return 0;
+   }
+
+   quint64 seq = lastSeqNo+1;
+
+   QByteArray line = QByteArray::number(seq) + '\t' + QByteArray::number(QDateTime::currentMSecsSinceEpoch()) + '\t' + op + '\t' + key.toUtf8() + '\n';
+
+   ssize_t ret = ::write(fd, line.constData(), static_cast<size_t>(line.size()));
+
+   if (ret!=line.size())
+   {
+      lastErrorMsg = "Write replication log error: " + QString(ret<0 ? strerror(errno) : "short write");
+
+      if (ret>0 && ::ftruncate(fd, activeSize)!=0) // drop partial entry
+      {
+         logError() << "Replication log truncate error: " << strerror(errno);
+      }
+
+      return 0;
+   }
+
+   activeSize += ret;
+   lastSeqNo   = seq;
+   dirty       = true;
+
+   return seq;
+}
+
+/**
+ * @brief SCDImgReplicationLog::read read the entries following cursor
+ * @param cursor  reading position, moved after the last entry read
+ * @param max     max entries to read
+ * @param entries output entries
+ * @return number of entries read
+ */
+int SCDImgReplicationLog::read(Cursor &cursor, int max, QList<Entry> &entries)
+{
+   mutex.lock();
+
+   QMap<quint64,QString> list = segments; // segment files are read without holding the lock
+
+   mutex.unlock();
+
+   entries.clear();
+
+   if (list.isEmpty())
+   {
+      return 0;
+   }
+
+   if (!list.contains(cursor.segment)) // locate segment of next entry
+   {
+      QMap<quint64,QString>::const_iterator it = list.upperBound(cursor.seq+1);
+
+      if (it!=list.constBegin())
+      {
+         --it;
+      }
+
+      cursor.segment = it.key();
+      cursor.offset  = 0;
+   }
+
+   while (entries.count()<max)
+   {
+      QFile f(list.value(cursor.segment));
+
+      if (!f.open(QIODevice::ReadOnly) || !f.seek(cursor.offset))
+      {
+         break;
+      }
+
+      while (entries.count()<max)
+      {
+         QByteArray line = f.readLine();
+
+         if (!line.endsWith('\n')) // end of segment, or entry being appended
+         {
+            break;
+         }
+
+         cursor.offset += line.size();
+
+         Entry entry;
+
+         if (!parse(line,entry) || entry.seq<=cursor.seq)
+         {
+            continue;
+         }
+
+         cursor.seq = entry.seq;
+
+         entries.append(entry);
+      }
+
+      bool complete = f.atEnd(); // segment read up to its end
+
+      f.close();
+
+      QMap<quint64,QString>::const_iterator next = list.upperBound(cursor.segment);
+
+      if (!complete || next==list.constEnd())
+      {
+         break;
+      }
+
+      cursor.segment = next.key(); // a segment is never appended again once a new one is started
+      cursor.offset  = 0;
+   }
+
+   return entries.count();
+}
+
+/**
+ * @brief SCDImgReplicationLog::sync flush appended entries to disk
+ */
+void SCDImgReplicationLog::sync()
+{
+   QMutexLocker locker(&mutex);
+
+   if (fd>=0 && dirty)
+   {
+      ::fdatasync(fd);
+
+      dirty = false;
+   }
+}
+
+/**
+ * @brief SCDImgReplicationLog::truncate delete the segments whose entries have been acknowledged by all peers
+ * @param acked lowest seq acknowledged by peers
+ */
+void SCDImgReplicationLog::truncate(quint64 acked)
+{
+   QMutexLocker locker(&mutex);
+
+   while (segments.count()>1)
+   {
+      QMap<quint64,QString>::iterator next = segments.begin()+1;
+
+      if (next.key()-1>acked) // first segment has entries not yet acknowledged
+      {
+         break;
+      }
+
+      QFile::remove(segments.first());
+
+      segments.erase(segments.begin());
+   }
+}
+
+/**
+ * @brief SCDImgReplicationLog::lastSeq
+ * @return seq of last appended entry
+ */
+quint64 SCDImgReplicationLog::lastSeq()
+{
+   QMutexLocker locker(&mutex);
+
+   return lastSeqNo;
+}
+
+/**
+ * @brief SCDImgReplicationLog::path
+ * @return log folder
+ */
+QString SCDImgReplicationLog::path()
+{
+   return folder;
+}
+
+/**
+ * @brief SCDImgReplicationLog::lastError
+ * @return
+ */
+QString SCDImgReplicationLog::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgReplicationLog::segmentName
+ * @param firstSeq
+ * @return segment file name: first seq as 16 hex digits, so segments sort by name
+ */
+QString SCDImgReplicationLog::segmentName(quint64 firstSeq)
+{
+   return QDir(folder).absoluteFilePath(QString("%1.rlog").arg(firstSeq,16,16,QChar('0')));
+}
+
+/**
+ * @brief SCDImgReplicationLog::rollSegment start a new segment (mutex must be held)
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgReplicationLog::rollSegment()
+{
+   QString fileName = segmentName(lastSeqNo+1);
+
+   int newFd = ::open(QFile::encodeName(fileName).constData(), O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644);
+
+   if (newFd<0)
+   {
+      lastErrorMsg = "Create replication log error: " + fileName + " => " + QString(strerror(errno));
+      return 0;
+   }
+
+   if (fd>=0)
+   {
+      ::fdatasync(fd);
+      ::close(fd);
+   }
+
+   fd         = newFd;
+   activeSize = 0;
+
+   segments.insert(lastSeqNo+1, fileName);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgReplicationLog::parse
+ * @param line  entry line
+ * @param entry output entry
+ * @return true if line is a valid entry
+ */
+bool SCDImgReplicationLog::parse(const QByteArray &line, Entry &entry)
+{
+   QList<QByteArray> fields = line.trimmed().split('\t');
+
+   if (fields.count()!=4 || fields.at(2).size()!=1)
+   {
+      return false;
+   }
+
+   bool ok1, ok2;
+
+   entry.seq  = fields.at(0).toULongLong(&ok1);
+   entry.time = fields.at(1).toLongLong(&ok2);
+   entry.op   = fields.at(2).at(0);
+   entry.key  = QString::fromUtf8(fields.at(3));
+
+   return ok1 && ok2 && (entry.op==OP_PUT || entry.op==OP_DEL) && entry.key.startsWith('/');
+}
+
+/**
+ * @brief SCDImgReplicaShipper::SCDImgReplicaShipper
+ * @param replicator
+ * @param host     peer host
+ * @param port     peer port
+ * @param batch    entries read from log at once
+ * @param pipeline max commands in flight
+ * @param timeout  msecs to connect and to receive a reply
+ */
+SCDImgReplicaShipper::SCDImgReplicaShipper(SCDImgReplicator *replicator, QString host, quint16 port, int batch, int pipeline, int timeout) : replicator(replicator), host(host), port(port), batch(qMax(1,batch)), pipeline(qMax(1,pipeline)), timeout(timeout)
+{
+   ackSeq.store(0);
+   shippedCount.store(0);
+   oldestPending.store(0);
+
+   stopped = false;
+   woken   = false;
+}
+
+/**
+ * @brief SCDImgReplicaShipper::run shipping loop: read a batch of entries, ship it, persist the ack
+ */
+void SCDImgReplicaShipper::run()
+{
+   loadAck();
+
+   SCDImgReplicationLog::Cursor cursor;
+
+   cursor.seq     = ackSeq.load();
+   cursor.segment = 0;
+   cursor.offset  = 0;
+
+   QList<SCDImgReplicationLog::Entry> entries;
+
+   int backoff = 0;
+
+   forever
+   {
+      if (entries.isEmpty())
+      {
+         replicator->log()->read(cursor, batch, entries);
+      }
+
+      if (entries.isEmpty())
+      {
+         oldestPending.store(0);
+
+         if (!pause(1000,true)) // wait for new entries
+         {
+            break;
+         }
+
+         continue;
+      }
+
+      oldestPending.store(entries.first().time);
+
+      int done = ship(entries);
+
+      if (done>0)
+      {
+         ackSeq.store(entries.at(done-1).seq);
+         shippedCount.fetch_add(static_cast<quint64>(done));
+
+         saveAck();
+
+         replicator->acked();
+
+         entries = entries.mid(done);
+
+         if (!entries.isEmpty())
+         {
+            oldestPending.store(entries.first().time);
+         }
+      }
+
+      if (entries.isEmpty())
+      {
+         backoff = 0;
+         continue;
+      }
+
+      // peer not reachable: retry the remaining entries later -----------------
+
+      if (backoff==0)
+      {
+         logWarning() << "Replication to " << peer() << " suspended, retrying";
+      }
+
+      backoff = qBound(500,backoff*2,30000);
+
+      if (!pause(backoff,false))
+      {
+         break;
+      }
+   }
+}
+
+/**
+ * @brief SCDImgReplicaShipper::stop stop shipping loop (in-flight commands are completed)
+ */
+void SCDImgReplicaShipper::stop()
+{
+   QMutexLocker locker(&mutex);
+
+   stopped = true;
+
+   wait.wakeAll();
+}
+
+/**
+ * @brief SCDImgReplicaShipper::wake new entries have been appended to log
+ */
+void SCDImgReplicaShipper::wake()
+{
+   QMutexLocker locker(&mutex);
+
+   woken = true;
+
+   wait.wakeAll();
+}
+
+/**
+ * @brief SCDImgReplicaShipper::peer
+ * @return host:port
+ */
+QString SCDImgReplicaShipper::peer()
+{
+   return host + ":" + QString::number(port);
+}
+
+/**
+ * @brief SCDImgReplicaShipper::acked
+ * @return last seq acknowledged by peer
+ */
+quint64 SCDImgReplicaShipper::acked()
+{
+   return ackSeq.load();
+}
+
+/**
+ * @brief SCDImgReplicaShipper::shipped
+ * @return entries shipped since start
+ */
+quint64 SCDImgReplicaShipper::shipped()
+{
+   return shippedCount.load();
+}
+
+/**
+ * @brief SCDImgReplicaShipper::lagSeconds
+ * @return age of the oldest entry not yet acknowledged by peer, 0 if peer is up to date
+ */
+double SCDImgReplicaShipper::lagSeconds()
+{
+   qint64 oldest = oldestPending.load();
+
+   if (oldest==0)
+   {
+      return 0;
+   }
+
+   return qMax<qint64>(0,QDateTime::currentMSecsSinceEpoch()-oldest)/1000.0;
+}
+
+/**
+ * @brief SCDImgReplicaShipper::ackFile
+ * @return file of last acknowledged seq
+ */
+QString SCDImgReplicaShipper::ackFile()
+{
+   return QDir(replicator->log()->path()).absoluteFilePath(host + "_" + QString::number(port) + ".ack");
+}
+
+/**
+ * @brief SCDImgReplicaShipper::loadAck read persisted ack. A new peer receives the entries still in the log
+ */
+void SCDImgReplicaShipper::loadAck()
+{
+   QFile f(ackFile());
+
+   if (f.open(QIODevice::ReadOnly))
+   {
+      ackSeq.store(f.readAll().trimmed().toULongLong());
+   }
+}
+
+/**
+ * @brief SCDImgReplicaShipper::saveAck persist ack (temporary file and rename: never torn)
+ */
+void SCDImgReplicaShipper::saveAck()
+{
+   QString fileName = ackFile();
+
+   QFile f(fileName + ".tmp");
+
+   if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate))
+   {
+      logWarning() << "Write replication ack error: " << f.fileName() << " => " << f.errorString();
+      return;
+   }
+
+   f.write(QByteArray::number(ackSeq.load()) + "\n");
+   f.close();
+
+   ::rename(QFile::encodeName(f.fileName()).constData(), QFile::encodeName(fileName).constData());
+}
+
+/**
+ * @brief SCDImgReplicaShipper::ship send entries to peer, pipeline commands at a time.
+ *                                   Commands permanently refused by peer are logged and skipped, transient refusals
+ *                                   are retried as connection failures
+ * @param entries
+ * @return number of leading entries done, less than entries count if peer is not reachable or busy
+ */
+int SCDImgReplicaShipper::ship(const QList<SCDImgReplicationLog::Entry> &entries)
+{
+   int done = 0;
+
+   while (done<entries.count())
+   {
+      QList<Request> chunk;
+      QSet<QString>  keys;
+
+      for (int i=done; i<entries.count() && chunk.count()<pipeline; i++)
+      {
+         if (keys.contains(entries.at(i).key))
+         {
+            break; // commands on the same path are not in flight together
+         }
+
+         keys.insert(entries.at(i).key);
+
+         Request request;
+
+         request.entry  = &entries.at(i);
+         request.socket = new QTcpSocket();
+         request.skip   = false;
+
+         request.socket->connectToHost(host, port);
+
+         chunk.append(request);
+      }
+
+      // send all commands, then collect replies ------------------------------
+
+      for (int i=0; i<chunk.count(); i++)
+      {
+         send(chunk[i]);
+      }
+
+      int ok = 0;
+
+      for (int i=0; i<chunk.count(); i++)
+      {
+         int ret = reply(chunk[i]);
+
+         if (ret<0)
+         {
+            break;
+         }
+
+         ok++;
+      }
+
+      foreach (const Request &request, chunk)
+      {
+         request.socket->abort();
+
+         delete request.socket;
+      }
+
+      done += ok;
+
+      if (ok<chunk.count())
+      {
+         break; // peer not reachable
+      }
+   }
+
+   return done;
+}
+
+/**
+ * @brief SCDImgReplicaShipper::send send the command of an entry
+ * @param request
+ * @return 1 on success, 0 on failure (reply() reports it)
+ */
+int SCDImgReplicaShipper::send(Request &request)
+{
+   QTcpSocket *socket = request.socket;
+
+   const SCDImgReplicationLog::Entry &entry = *request.entry;
+
+   if (entry.op==SCDImgReplicationLog::OP_DEL)
+   {
+      if (!socket->waitForConnected(timeout))
+      {
+         return 0;
+      }
+
+      socket->write("SCDFTH:1.0\tDEL:" + entry.key.toUtf8() + "\tR\n");
+
+      return 1;
+   }
+
+   QString    fileName;
+   QByteArray data;
+
+   int ret = replicator->readObject(entry.key, fileName, data);
+
+   QFile f(fileName);
+
+   if (ret==1 && !f.open(QIODevice::ReadOnly))
+   {
+      ret = 0; // deleted meanwhile
+   }
+
+   qint64 size = (ret==1) ? f.size() : data.size();
+
+   if (ret==0 || size==0)
+   {
+      request.skip = true; // object deleted (its DEL follows) or empty (not accepted by SCDFTH)
+      return 1;
+   }
+
+   if (!socket->waitForConnected(timeout))
+   {
+      return 0;
+   }
+
+   socket->write("SCDFTH:1.0\tPUT:" + entry.key.toUtf8() + "\t" + QByteArray::number(size) + "\tR\n");
+
+   if (ret==2)
+   {
+      socket->write(data);
+
+      return 1;
+   }
+
+   qint64 sent = 0;
+
+   while (sent<size)
+   {
+      QByteArray chunk = f.read(qMin<qint64>(SHIP_CHUNK,size-sent));
+
+      if (chunk.isEmpty())
+      {
+         socket->abort(); // file truncated: peer would wait for missing bytes
+         return 0;
+      }
+
+      socket->write(chunk);
+
+      sent += chunk.size();
+
+      while (socket->bytesToWrite()>4*SHIP_CHUNK)
+      {
+         if (!socket->waitForBytesWritten(timeout))
+         {
+            return 0;
+         }
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgReplicaShipper::reply wait for the reply of peer
+ * @param request
+ * @return 1 ok (or skipped), 0 permanently refused by peer, -1 connection failure or transient refusal
+ */
+int SCDImgReplicaShipper::reply(Request &request)
+{
+   if (request.skip)
+   {
+      return 1;
+   }
+
+   QTcpSocket *socket = request.socket;
+
+   QByteArray answer;
+
+   while (socket->state()==QAbstractSocket::ConnectedState)
+   {
+      socket->flush();
+
+      if (!socket->waitForReadyRead(timeout))
+      {
+         break;
+      }
+
+      answer += socket->readAll();
+   }
+
+   answer += socket->readAll();
+
+   if (answer.isEmpty())
+   {
+      return -1;
+   }
+
+   answer = answer.trimmed();
+
+   if (answer=="ok")
+   {
+      return 1;
+   }
+
+   if (answer.startsWith("Server busy")) // admission control of peer
+   {
+      return -1;
+   }
+
+   for (int i=0; permanentRefusals[i]; i++)
+   {
+      if (answer.startsWith(permanentRefusals[i]))
+      {
+         if (request.entry->op==SCDImgReplicationLog::OP_PUT) // a DEL of an object the peer has not is not an error
+         {
+            logError() << "Replication of " << request.entry->key << " refused by " << peer() << ": " << answer;
+         }
+
+         return 0;
+      }
+   }
+
+   logWarning() << "Replication of " << request.entry->key << " failed on " << peer() << ": " << answer << ", retrying";
+
+   return -1;
+}
+
+/**
+ * @brief SCDImgReplicaShipper::pause wait msecs
+ * @param msecs
+ * @param wakeable wake up when new entries are appended
+ * @return false if shipper has been stopped
+ */
+bool SCDImgReplicaShipper::pause(int msecs, bool wakeable)
+{
+   QMutexLocker locker(&mutex);
+
+   QElapsedTimer timer;
+
+   timer.start();
+
+   while (!stopped && !(wakeable && woken) && timer.elapsed()<msecs)
+   {
+      wait.wait(&mutex, static_cast<unsigned long>(msecs-timer.elapsed()));
+   }
+
+   woken = false;
+
+   return !stopped;
+}
+
+/**
+ * @brief SCDImgReplicator::SCDImgReplicator
+ * @param server
+ * @param peers       host:port list
+ * @param logPath     replication log folder
+ * @param batch       entries read from log at once
+ * @param pipeline    max commands in flight for each peer
+ * @param segmentSize max size of log segments
+ * @param timeout     msecs to connect to a peer and to receive a reply
+ */
+SCDImgReplicator::SCDImgReplicator(SCDImgServer *server, QStringList peers, QString logPath, int batch, int pipeline, qint64 segmentSize, int timeout) : QObject(server), server(server)
+{
+   replog = new SCDImgReplicationLog(logPath, segmentSize);
+
+   foreach (QString peer, peers)
+   {
+      peer = peer.trimmed();
+
+      int port = peer.section(':',1).toInt();
+
+      if (peer.section(':',0,0).isEmpty() || port<=0 || port>65535)
+      {
+         logWarning() << "Invalid replication peer: " << peer;
+         continue;
+      }
+
+      shipperList.append(new SCDImgReplicaShipper(this, peer.section(':',0,0), static_cast<quint16>(port), batch, pipeline, timeout));
+   }
+
+   connect(&syncTimer, SIGNAL(timeout()), this, SLOT(syncLog()));
+}
+
+/**
+ * @brief SCDImgReplicator::~SCDImgReplicator
+ */
+SCDImgReplicator::~SCDImgReplicator()
+{
+   stop();
+
+   qDeleteAll(shipperList);
+
+   delete replog;
+}
+
+/**
+ * @brief SCDImgReplicator::start open replication log and start shippers
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgReplicator::start()
+{
+   if (!replog->open())
+   {
+      lastErrorMsg = replog->lastError();
+      return 0;
+   }
+
+   foreach (SCDImgReplicaShipper *shipper, shipperList)
+   {
+      shipper->start(QThread::LowPriority);
+   }
+
+   syncTimer.start(1000);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgReplicator::stop stop shippers and close log
+ */
+void SCDImgReplicator::stop()
+{
+   syncTimer.stop();
+
+   foreach (SCDImgReplicaShipper *shipper, shipperList)
+   {
+      shipper->stop();
+   }
+
+   foreach (SCDImgReplicaShipper *shipper, shipperList)
+   {
+      shipper->wait();
+   }
+
+   replog->close();
+}
+
+/**
+ * @brief SCDImgReplicator::append log a completed command and wake shippers
+ * @param op  SCDImgReplicationLog::OP_PUT or OP_DEL
+ * @param key object path
+ */
+void SCDImgReplicator::append(char op, const QString &key)
+{
+   if (!replog->append(op, key))
+   {
+      logError() << replog->lastError() << " " << key << " not replicated";
+      return;
+   }
+
+   foreach (SCDImgReplicaShipper *shipper, shipperList)
+   {
+      shipper->wake();
+   }
+}
+
+/**
+ * @brief SCDImgReplicator::log
+ * @return replication log
+ */
+SCDImgReplicationLog *SCDImgReplicator::log()
+{
+   return replog;
+}
+
+/**
+ * @brief SCDImgReplicator::shippers
+ * @return shippers of peers
+ */
+QList<SCDImgReplicaShipper*> SCDImgReplicator::shippers()
+{
+   return shipperList;
+}
+
+/**
+ * @brief SCDImgReplicator::readObject find the current version of an object
+ * @param key      object path
+ * @param fileName output file holding the object
+ * @param data     output data of a packed object
+ * @return 1 file, 2 packed object, 0 not found
+ */
+int SCDImgReplicator::readObject(const QString &key, QString &fileName, QByteArray &data)
+{
+   SCDImgSegmentStore *store = server->segmentStore();
+
+   if (store && store->contains(key))
+   {
+      return store->read(key, data) ? 2 : 0;
+   }
+
+   fileName = server->rootPaths()->locate(key);
+
+   return QFile::exists(fileName) ? 1 : 0;
+}
+
+/**
+ * @brief SCDImgReplicator::acked drop log segments acknowledged by all peers
+ */
+void SCDImgReplicator::acked()
+{
+   quint64 acked = replog->lastSeq();
+
+   foreach (SCDImgReplicaShipper *shipper, shipperList)
+   {
+      acked = qMin(acked, shipper->acked());
+   }
+
+   replog->truncate(acked);
+}
+
+/**
+ * @brief SCDImgReplicator::lastError
+ * @return
+ */
+QString SCDImgReplicator::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgReplicator::syncLog flush log entries appended during last second
+ */
+void SCDImgReplicator::syncLog()
+{
+   replog->sync();
+}
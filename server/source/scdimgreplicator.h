@@ -0,0 +1,188 @@
+#ifndef SCDIMGREPLICATOR_H
+#define SCDIMGREPLICATOR_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QTimer>
+#include <QMap>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include <atomic>
+
+class QTcpSocket;
+class SCDImgServer;
+class SCDImgReplicator;
+
+/**
+ * @brief The SCDImgReplicationLog class is the durable log of completed PUT and DEL commands to replicate.
+ *        Entries are appended to segment files, one text line each: <seq>\t<msecs since epoch>\t<P|D>\t<path>\n
+ *        Segments acknowledged by every peer are deleted.
+ */
+class SCDImgReplicationLog
+{
+   public:
+
+     enum Op {OP_PUT='P',OP_DEL='D'};
+
+     struct Entry
+     {
+        quint64 seq;
+        qint64  time; // msecs since epoch
+        char    op;
+        QString key;
+     };
+
+     struct Cursor // reading position of a peer
+     {
+        quint64 seq;     // last entry read
+        quint64 segment; // first seq of segment being read (0: to be located)
+        qint64  offset;  // offset of next entry into segment
+     };
+
+     explicit SCDImgReplicationLog(QString path="./replication/", qint64 maxSegmentSize=16777216);
+
+     ~SCDImgReplicationLog();
+
+     int  open();  // scan segments and recover last seq (a torn tail entry is dropped)
+     void close();
+
+     quint64 append(char op, const QString &key); // return seq, 0 on failure
+     int     read(Cursor &cursor, int max, QList<Entry> &entries); // entries after cursor, cursor is moved forward
+     void    sync();                              // flush appended entries to disk
+     void    truncate(quint64 acked);             // delete segments entirely acknowledged
+
+     quint64 lastSeq();
+
+     QString path();
+     QString lastError();
+
+   private:
+
+     QMutex mutex;
+
+     QString folder;
+     qint64  maxSegmentSize;
+
+     QMap<quint64,QString> segments; // first seq => segment file
+     int     fd;                     // active segment (last one)
+     qint64  activeSize;
+     quint64 lastSeqNo;
+     bool    dirty;                  // entries appended since last sync
+
+     QString lastErrorMsg;
+
+     QString segmentName(quint64 firstSeq);
+     int     rollSegment();
+
+     static bool parse(const QByteArray &line, Entry &entry);
+};
+
+/**
+ * @brief The SCDImgReplicaShipper class ships the replication log to a peer server. Entries are read in batches
+ *        and sent over up to pipeline concurrent connections, as SCDFTH commands flagged R (not replicated again).
+ *        The last acknowledged seq is persisted: after a peer or a server restart shipping resumes from it.
+ */
+class SCDImgReplicaShipper : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgReplicaShipper(SCDImgReplicator *replicator, QString host, quint16 port, int batch, int pipeline, int timeout);
+
+     void run();
+     void stop();
+     void wake(); // new entries appended
+
+     QString peer();
+     quint64 acked();
+     quint64 shipped();
+     double  lagSeconds(); // age of oldest entry not yet acknowledged
+
+   private:
+
+     struct Request
+     {
+        const SCDImgReplicationLog::Entry *entry;
+        QTcpSocket                        *socket;
+        bool                               skip; // nothing to send (object no more existing)
+     };
+
+     SCDImgReplicator *replicator;
+
+     QString host;
+     quint16 port;
+     int     batch;
+     int     pipeline;
+     int     timeout;
+
+     std::atomic<quint64> ackSeq;
+     std::atomic<quint64> shippedCount;
+     std::atomic<qint64>  oldestPending; // msecs since epoch, 0: nothing pending
+
+     bool           stopped;
+     bool           woken;
+     QMutex         mutex;
+     QWaitCondition wait;
+
+     QString ackFile();
+     void    loadAck();
+     void    saveAck();
+
+     int  ship(const QList<SCDImgReplicationLog::Entry> &entries); // return entries done
+     int  send(Request &request);
+     int  reply(Request &request);                                 // 1 ok, 0 permanently refused by peer, -1 retry
+     bool pause(int msecs, bool wakeable);                         // false if stopped
+};
+
+/**
+ * @brief The SCDImgReplicator class forwards completed PUT and DEL commands to peer servers, asynchronously:
+ *        commands are appended to the replication log and shipped by a thread for each peer.
+ */
+class SCDImgReplicator : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgReplicator(SCDImgServer *server, QStringList peers, QString logPath, int batch=64, int pipeline=8, qint64 segmentSize=16777216, int timeout=30000);
+
+     ~SCDImgReplicator();
+
+     int  start();
+     void stop();
+
+     void append(char op, const QString &key); // called by connection threads when a command is completed
+
+     SCDImgReplicationLog *log();
+
+     QList<SCDImgReplicaShipper*> shippers();
+
+     int readObject(const QString &key, QString &fileName, QByteArray &data); // 1 file, 2 packed object, 0 not found
+
+     void acked(); // a peer acknowledged entries: drop segments acknowledged by all peers
+
+     QString lastError();
+
+   private slots:
+
+     void syncLog();
+
+   private:
+
+     SCDImgServer         *server;
+     SCDImgReplicationLog *replog;
+
+     QList<SCDImgReplicaShipper*> shipperList;
+
+     QTimer syncTimer;
+
+     QString lastErrorMsg;
+};
+
+#endif // SCDIMGREPLICATOR_H
@@ -0,0 +1,518 @@
+/**
+ * @class SCDImgRootPaths - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server root paths striping: files are spread across several root paths (disks) by
+ *        rendezvous (highest random weight) hashing of their logical path. The weight of a root for a file
+ *        is a 64 bit mix of file path hash and root path hash, the root with highest weight is the home root.
+ *        Placement depends only on file path and root paths, so it is stable across restarts and roots order.
+ *
+ *        Adding a root moves to it only the files for which it wins, about 1/n of them: until they are
+ *        rebalanced, lookups find them on their old root. Rebalancing copies a misplaced file into a temporary
+ *        file on its home root, links it to the final name only if no newer upload has been stored meanwhile,
+ *        then removes the old copy: it can run while server is serving requests.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+
+#include "scdimgrootpaths.h"
+#include "scdimglogger.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * @brief SCDImgRootPaths::SCDImgRootPaths constructor
+ * @param paths root paths (duplicates and empty entries are ignored)
+ */
+SCDImgRootPaths::SCDImgRootPaths(QStringList paths)
+{
+   foreach (QString path, paths)
+   {
+      path = path.trimmed();
+
+      if (path.isEmpty())
+      {
+         continue;
+      }
+
+      if (!path.endsWith('/'))
+      {
+         path += '/';
+      }
+
+      if (roots.contains(path))
+      {
+         continue;
+      }
+
+      roots.append(path);
+
+      rootHashes.append(hash(QDir::cleanPath(path).toUtf8()));
+   }
+
+   if (roots.isEmpty())
+   {
+      roots.append("./");
+      rootHashes.append(hash(QDir::cleanPath("./").toUtf8()));
+   }
+
+   moved   = 0;
+   removed = 0;
+   failed  = 0;
+}
+
+/**
+ * @brief SCDImgRootPaths::count
+ * @return number of root paths
+ */
+int SCDImgRootPaths::count()
+{
+   return roots.count();
+}
+
+/**
+ * @brief SCDImgRootPaths::paths
+ * @return root paths, ending with '/'
+ */
+QStringList SCDImgRootPaths::paths()
+{
+   return roots;
+}
+
+/**
+ * @brief SCDImgRootPaths::homeIndex rendezvous hashing: root with highest weight for the file
+ * @param key logical file path (/dir/file.jpg)
+ * @return index of home root
+ */
+int SCDImgRootPaths::homeIndex(QString key)
+{
+   if (roots.count()==1)
+   {
+      return 0;
+   }
+
+   quint64 keyHash = hash(relativePath(key).toUtf8());
+
+   int     best       = 0;
+   quint64 bestWeight = 0;
+
+   for (int i=0; i<rootHashes.count(); i++)
+   {
+      quint64 weight = mix(keyHash ^ rootHashes.at(i));
+
+      if (i==0 || weight>bestWeight)
+      {
+         best       = i;
+         bestWeight = weight;
+      }
+   }
+
+   return best;
+}
+
+/**
+ * @brief SCDImgRootPaths::home
+ * @param key logical file path
+ * @return file name on home root
+ */
+QString SCDImgRootPaths::home(QString key)
+{
+   return roots.at(homeIndex(key)) + relativePath(key);
+}
+
+/**
+ * @brief SCDImgRootPaths::locate find the root holding a file: the home root is checked first, then the other roots
+ *                                (files stored before a root was added and not yet rebalanced)
+ * @param key logical file path
+ * @return file name on the root holding the file, file name on home root if not found
+ */
+QString SCDImgRootPaths::locate(QString key)
+{
+   QString fileName = home(key);
+
+   if (roots.count()==1 || QFile::exists(fileName))
+   {
+      return fileName;
+   }
+
+   QString relPath = relativePath(key);
+
+   foreach (const QString &root, roots)
+   {
+      if (QFile::exists(root + relPath))
+      {
+         return root + relPath;
+      }
+   }
+
+   return fileName;
+}
+
+/**
+ * @brief SCDImgRootPaths::removeCopies remove copies of a file, and their thumbnails, stored on roots other than keep one.
+ *                                      Called when a file is overwritten or deleted: no stale version can be found later
+ * @param key  logical file path
+ * @param keep file name not to remove (empty: remove all copies)
+ * @return number of removed copies
+ */
+int SCDImgRootPaths::removeCopies(QString key, QString keep)
+{
+   if (roots.count()==1)
+   {
+      return 0;
+   }
+
+   QString relPath = relativePath(key);
+
+   int count = 0;
+
+   foreach (const QString &root, roots)
+   {
+      QString fileName = root + relPath;
+
+      if (fileName==keep || !QFile::exists(fileName))
+      {
+         continue;
+      }
+
+      if (QFile::remove(fileName))
+      {
+         QFile::remove(thumbName(fileName));
+
+         count++;
+      }
+      else
+      {
+         logWarning() << "Removing stale copy failure: " << fileName;
+      }
+   }
+
+   return count;
+}
+
+/**
+ * @brief SCDImgRootPaths::check
+ * @return 1 if all root paths exist, 0 otherwise
+ */
+int SCDImgRootPaths::check()
+{
+   foreach (const QString &root, roots)
+   {
+      if (!QFile::exists(root))
+      {
+         lastErrorMsg = "Root path not exixst: " + root;
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgRootPaths::setExcludedPaths files and folders of the server state (segments, replication log, indexes,
+ *                                          logs, configuration) skipped by rebalance: a root containing the server
+ *                                          working folder (as the default ./) must not move them to other roots
+ * @param paths files or folders, relative to working folder or absolute (empty entries are ignored)
+ */
+void SCDImgRootPaths::setExcludedPaths(QStringList paths)
+{
+   excluded.clear();
+
+   foreach (QString path, paths)
+   {
+      path = path.trimmed();
+
+      if (!path.isEmpty())
+      {
+         excluded.append(QDir::cleanPath(QFileInfo(path).absoluteFilePath()));
+      }
+   }
+}
+
+/**
+ * @brief SCDImgRootPaths::isExcluded
+ * @param fileName
+ * @return true if fileName is an excluded path or lies in an excluded folder
+ */
+bool SCDImgRootPaths::isExcluded(QString fileName)
+{
+   QString path = QDir::cleanPath(QFileInfo(fileName).absoluteFilePath());
+
+   foreach (const QString &exclude, excluded)
+   {
+      if (path==exclude || path.startsWith(exclude + '/'))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/**
+ * @brief SCDImgRootPaths::rebalance move every file stored on a root other than its home root.
+ *                                   Thumbnails are not moved: they are removed with their source file
+ *                                   and generated again on the home root when requested.
+ *                                   Server state paths (see setExcludedPaths) are skipped.
+ * @param dryRun count misplaced files only
+ * @return 1 on success, 0 if some file could not be moved (see failedFiles())
+ */
+int SCDImgRootPaths::rebalance(bool dryRun)
+{
+   moved   = 0;
+   removed = 0;
+   failed  = 0;
+
+   if (!check())
+   {
+      return 0;
+   }
+
+   for (int i=0; i<roots.count(); i++)
+   {
+      QDir root(roots.at(i));
+
+      QDirIterator it(roots.at(i), QDir::Files|QDir::Hidden|QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+
+      while (it.hasNext())
+      {
+         QString source = it.next();
+
+         if (source.endsWith(".tmp") || source.endsWith(".tmb.png") || source.endsWith(".rebalance"))
+         {
+            continue; // uploads in progress, thumbnails, rebalance temporary files
+         }
+
+         if (isExcluded(source))
+         {
+            continue; // server state: segments, replication log, indexes, logs
+         }
+
+         QString key = "/" + root.relativeFilePath(source);
+
+         int h = homeIndex(key);
+
+         if (h==i)
+         {
+            continue;
+         }
+
+         if (!moveFile(source, roots.at(h) + relativePath(key), dryRun))
+         {
+            failed++;
+
+            logWarning() << "Rebalance failure: " << lastErrorMsg;
+         }
+      }
+   }
+
+   if (failed)
+   {
+      lastErrorMsg = QString::number(failed) + " files not moved";
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgRootPaths::moveFile move a file to its home root. The copy is made into a temporary file,
+ *                                  then hard linked to target name: link fails if target exists, so a file
+ *                                  uploaded meanwhile is never overwritten by the old version. A source deleted
+ *                                  while it was copied is unlinked from target too: the move must not revive it
+ * @param source
+ * @param target
+ * @param dryRun
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgRootPaths::moveFile(QString source, QString target, bool dryRun)
+{
+   if (dryRun)
+   {
+      logInfo() << "Misplaced: " << source << " => " << target;
+
+      moved++;
+
+      return 1;
+   }
+
+   if (!QFile::exists(target))
+   {
+      QDir dir = QFileInfo(target).absoluteDir();
+
+      if (!dir.mkpath(dir.absolutePath()))
+      {
+         lastErrorMsg = "Create dir failure: " + dir.absolutePath();
+         return 0;
+      }
+
+      QString tmpFile = target + ".rebalance";
+
+      QFile::remove(tmpFile); // left by an interrupted rebalance
+
+      if (!QFile::copy(source, tmpFile))
+      {
+         if (!QFile::exists(source))
+         {
+            return 1; // deleted or overwritten meanwhile
+         }
+
+         lastErrorMsg = "Copy failure: " + source + " => " + tmpFile;
+         return 0;
+      }
+
+      int ret = ::link(QFile::encodeName(tmpFile).constData(), QFile::encodeName(target).constData());
+      int err = errno;
+
+      struct stat linked;
+
+      bool known = (ret==0 && ::stat(QFile::encodeName(tmpFile).constData(),&linked)==0);
+
+      QFile::remove(tmpFile);
+
+      if (ret!=0 && err!=EEXIST)
+      {
+         lastErrorMsg = "Link failure: " + tmpFile + " => " + target + " " + QString(strerror(err));
+         return 0;
+      }
+
+      if (ret==0 && !QFile::exists(source)) // deleted between copy and link
+      {
+         struct stat st;
+
+         if (known && ::stat(QFile::encodeName(target).constData(),&st)==0 && st.st_dev==linked.st_dev && st.st_ino==linked.st_ino) // not uploaded again meanwhile
+         {
+            QFile::remove(target);
+            QFile::remove(thumbName(target));
+         }
+
+         return 1;
+      }
+
+      if (ret==0)
+      {
+         logDebug() << "Moved: " << source << " => " << target;
+
+         moved++;
+      }
+   }
+
+   // target exists: source is an old version or has just been copied ---------
+
+   if (QFile::remove(source))
+   {
+      removed++;
+   }
+
+   QFile::remove(thumbName(source));
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgRootPaths::movedFiles
+ * @return files moved by last rebalance (misplaced files on dry run)
+ */
+qint64 SCDImgRootPaths::movedFiles()
+{
+   return moved;
+}
+
+/**
+ * @brief SCDImgRootPaths::removedFiles
+ * @return copies removed from not home roots by last rebalance
+ */
+qint64 SCDImgRootPaths::removedFiles()
+{
+   return removed;
+}
+
+/**
+ * @brief SCDImgRootPaths::failedFiles
+ * @return files not moved by last rebalance
+ */
+qint64 SCDImgRootPaths::failedFiles()
+{
+   return failed;
+}
+
+/**
+ * @brief SCDImgRootPaths::lastError
+ * @return
+ */
+QString SCDImgRootPaths::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgRootPaths::relativePath
+ * @param key logical file path
+ * @return path relative to roots (no leading '/')
+ */
+QString SCDImgRootPaths::relativePath(QString key)
+{
+   while (key.startsWith('/'))
+   {
+      key.remove(0,1);
+   }
+
+   return key;
+}
+
+/**
+ * @brief SCDImgRootPaths::hash FNV-1a 64 bit hash: stable across runs and platforms, unlike qHash
+ * @param data
+ * @return
+ */
+quint64 SCDImgRootPaths::hash(const QByteArray &data)
+{
+   quint64 h = 14695981039346656037ULL;
+
+   for (int i=0; i<data.size(); i++)
+   {
+      h ^= static_cast<quint8>(data.at(i));
+      h *= 1099511628211ULL;
+   }
+
+   return h;
+}
+
+/**
+ * @brief SCDImgRootPaths::mix splitmix64 finalizer: spreads the weights of similar file/root hash pairs
+ * @param value
+ * @return
+ */
+quint64 SCDImgRootPaths::mix(quint64 value)
+{
+   value ^= value >> 30;
+   value *= 0xbf58476d1ce4e5b9ULL;
+   value ^= value >> 27;
+   value *= 0x94d049bb133111ebULL;
+   value ^= value >> 31;
+
+   return value;
+}
+
+/**
+ * @brief SCDImgRootPaths::thumbName thumbnail file name of a file (same rule of connection handler)
+ * @param fileName
+ * @return
+ */
+QString SCDImgRootPaths::thumbName(QString fileName)
+{
+   QFileInfo fi(fileName);
+
+   return fi.absoluteDir().absolutePath() + "/" + fi.completeBaseName() + ".tmb.png";
+}
@@ -0,0 +1,61 @@
+#ifndef SCDIMGROOTPATHS_H
+#define SCDIMGROOTPATHS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief The SCDImgRootPaths class stripes files across several root paths (one for each disk).
+ *        The home root of a file is chosen by rendezvous hashing of its logical path: adding or removing
+ *        a root moves only the files whose home changes (about 1/n of them).
+ *        Lookups check the home root first, then the other roots: files not yet rebalanced are still found.
+ */
+class SCDImgRootPaths
+{
+   public:
+
+     explicit SCDImgRootPaths(QStringList paths);
+
+     int         count();
+     QStringList paths();
+
+     int     homeIndex(QString key);           // index of home root of a logical path (/dir/file.jpg)
+     QString home(QString key);                // file name on home root
+     QString locate(QString key);              // file name holding the file: home root first, then other roots
+     int     removeCopies(QString key, QString keep); // remove copies (and thumbnails) on roots other than keep one
+
+     int check();                              // 1: all root paths exist
+
+     void setExcludedPaths(QStringList paths); // server state files and folders, never moved by rebalance
+
+     int rebalance(bool dryRun=false);         // move misplaced files to their home root, safe while server runs
+
+     qint64 movedFiles();
+     qint64 removedFiles();
+     qint64 failedFiles();
+
+     QString lastError();
+
+   private:
+
+     QStringList      roots;      // root paths, ending with '/'
+     QVector<quint64> rootHashes; // root identities, from root path (roots order is not relevant)
+     QStringList      excluded;   // absolute paths skipped by rebalance
+
+     qint64 moved;
+     qint64 removed;
+     qint64 failed;
+
+     QString lastErrorMsg;
+
+     static quint64 hash(const QByteArray &data);
+     static quint64 mix(quint64 value);
+     static QString thumbName(QString fileName);
+
+     QString relativePath(QString key);
+     bool    isExcluded(QString fileName);
+     int     moveFile(QString source, QString target, bool dryRun);
+};
+
+#endif // SCDIMGROOTPATHS_H
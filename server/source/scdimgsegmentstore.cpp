@@ -0,0 +1,1070 @@
+/**
+ * @class SCDImgSegmentStore - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server small objects store. Objects smaller than a size threshold are appended
+ *        (needles) to large segment files instead of being stored as single files, saving inodes,
+ *        directory entries and open/close calls. An in-memory needle index maps each object path to
+ *        its segment, offset and length, so an object is read with a single pread.
+ *
+ *        Segment record layout: <magic:4><flags:1><reserved:1><key length:2><data length:8><crc32:4><key><data>
+ *        The CRC covers header fields, key and data. Records of the first layout (magic 'SCDN', no crc32)
+ *        are still read.
+ *
+ *        Deleted objects are recorded by tombstone needles, so the index can be rebuilt at startup
+ *        scanning the segment files. The space of overwritten or deleted needles is reclaimed by
+ *        compaction, which moves live needles to the active segment and drops the old segment file.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QDir>
+#include <QFile>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scdimgsegmentstore.h"
+#include "scdimglogger.h"
+
+#define NEEDLE_MAGIC      0x4E444353 // 'SCDN' record without crc (first layout)
+#define NEEDLE_MAGIC_CRC  0x43444353 // 'SCDC'
+#define NEEDLE_HEADER     16         // header without crc
+#define NEEDLE_HEADER_CRC 20
+#define CRC_CHUNK         262144     // data read chunk verifying crc
+
+/**
+ * @brief crcTable CRC-32 (IEEE 802.3) lookup table
+ * @return
+ */
+static const quint32 *crcTable()
+{
+   static quint32 table[256];
+
+   for (quint32 i=0; i<256; i++)
+   {
+      quint32 c = i;
+
+      for (int k=0; k<8; k++)
+      {
+         c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+      }
+
+      table[i] = c;
+   }
+
+   return table;
+}
+
+/**
+ * @brief needleCrc update a CRC-32 with data
+ * @param crc  crc of previous data (0 at start)
+ * @param data
+ * @param size
+ * @return
+ */
+static quint32 needleCrc(quint32 crc, const char *data, qint64 size)
+{
+   static const quint32 *table = crcTable(); // built once
+
+   crc = ~crc;
+
+   for (qint64 i=0; i<size; i++)
+   {
+      crc = table[(crc ^ static_cast<quint8>(data[i])) & 0xFF] ^ (crc >> 8);
+   }
+
+   return ~crc;
+}
+
+/**
+ * @brief readAll read exactly size bytes at offset, retrying on short reads
+ * @return 1 on success, 0 on failure
+ */
+static int readAll(int fd, char *data, qint64 size, qint64 offset)
+{
+   while (size>0)
+   {
+      ssize_t ret = ::pread(fd, data, static_cast<size_t>(size), offset);
+
+      if (ret<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (ret<=0)
+      {
+         return 0;
+      }
+
+      data   += ret;
+      size   -= ret;
+      offset += ret;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief writeAll write exactly size bytes at offset, retrying on short writes
+ * @return 1 on success, 0 on failure
+ */
+static int writeAll(int fd, const char *data, qint64 size, qint64 offset)
+{
+   while (size>0)
+   {
+      ssize_t ret = ::pwrite(fd, data, static_cast<size_t>(size), offset);
+
+      if (ret<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (ret<=0)
+      {
+         return 0;
+      }
+
+      data   += ret;
+      size   -= ret;
+      offset += ret;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::SCDImgSegmentStore constructor
+ * @param parent
+ * @param path           folder of segment files
+ * @param threshold      objects smaller than threshold are packed into segments
+ * @param maxSegmentSize when active segment exceeds this size a new segment is started
+ */
+SCDImgSegmentStore::SCDImgSegmentStore(QObject *parent, QString path, qint64 threshold, qint64 maxSegmentSize) : QObject(parent), path(path), threshold(threshold), maxSegmentSize(maxSegmentSize)
+{
+   activeSegment = 0;
+
+   dirtyFolder = false;
+}
+
+/**
+ * @brief SCDImgSegmentStore::~SCDImgSegmentStore destructor
+ */
+SCDImgSegmentStore::~SCDImgSegmentStore()
+{
+   close();
+}
+
+/**
+ * @brief SCDImgSegmentStore::open open all segment files and rebuild the needle index
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::open()
+{
+   QDir dir(path);
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastErrorMsg = "Create segments dir failure: " + dir.absolutePath();
+      return 0;
+   }
+
+   path = dir.absolutePath() + "/";
+
+   QList<quint32> list;
+
+   foreach (QString name, dir.entryList(QStringList() << "segment.*.dat", QDir::Files))
+   {
+      bool ok;
+
+      quint32 segment = name.section('.',1,1).toUInt(&ok);
+
+      if (ok)
+      {
+         list.append(segment);
+      }
+   }
+
+   std::sort(list.begin(), list.end());
+
+   foreach (quint32 segment, list)
+   {
+      if (!openSegment(segment,false) || !scanSegment(segment))
+      {
+         return 0;
+      }
+
+      activeSegment = segment;
+   }
+
+   if (segments.isEmpty())
+   {
+      activeSegment = 1;
+
+      if (!openSegment(activeSegment,true))
+      {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::close close all segment files
+ */
+void SCDImgSegmentStore::close()
+{
+   QWriteLocker locker(&lock);
+
+   foreach (SegmentInfo info, segments)
+   {
+      ::close(info.fd);
+   }
+
+   segments.clear();
+   index.clear();
+}
+
+/**
+ * @brief SCDImgSegmentStore::accepts return true if an object of size bytes must be packed
+ * @param size
+ * @return
+ */
+bool SCDImgSegmentStore::accepts(qint64 size)
+{
+   return (size>0 && size<threshold);
+}
+
+/**
+ * @brief SCDImgSegmentStore::contains return true if key is a packed object
+ * @param key
+ * @return
+ */
+bool SCDImgSegmentStore::contains(const QString &key)
+{
+   QReadLocker locker(&lock);
+
+   return index.contains(key);
+}
+
+/**
+ * @brief SCDImgSegmentStore::locate
+ * @param key
+ * @param needle location of current object version (changes whenever object is written or moved)
+ * @return false if object is not packed
+ */
+bool SCDImgSegmentStore::locate(const QString &key, SCDImgNeedle &needle)
+{
+   QReadLocker locker(&lock);
+
+   if (!index.contains(key))
+   {
+      return false;
+   }
+
+   needle = index.value(key);
+
+   return true;
+}
+
+/**
+ * @brief SCDImgSegmentStore::put append object data to the active segment, replacing a previous version
+ * @param key  object path
+ * @param data object data
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::put(const QString &key, const QByteArray &data)
+{
+   SCDImgNeedle needle;
+
+   needle.record = -1; // not moving
+
+   return append(key, data, RF_DATA, needle);
+}
+
+/**
+ * @brief SCDImgSegmentStore::read read a packed object with a single pread
+ * @param key
+ * @param data output object data
+ * @return 1 on success, 0 if object not found or on read error
+ */
+int SCDImgSegmentStore::read(const QString &key, QByteArray &data)
+{
+   QReadLocker locker(&lock); // segment file can not be dropped by compaction while reading
+
+   QHash<QString,SCDImgNeedle>::const_iterator it = index.constFind(key);
+
+   if (it==index.constEnd())
+   {
+      return 0;
+   }
+
+   data.resize(static_cast<int>(it->length));
+
+   return readAll(segments.value(it->segment).fd, data.data(), it->length, it->offset);
+}
+
+/**
+ * @brief SCDImgSegmentStore::remove delete a packed object appending a tombstone needle
+ * @param key
+ * @return 1 on success, 0 if object not found or on write error
+ */
+int SCDImgSegmentStore::remove(const QString &key)
+{
+   if (!contains(key))
+   {
+      return 0;
+   }
+
+   SCDImgNeedle needle;
+
+   needle.record = -1;
+
+   return append(key, QByteArray(), RF_TOMBSTONE, needle);
+}
+
+/**
+ * @brief SCDImgSegmentStore::sync flush segments appended since last sync, and segments folder if a segment
+ *                                 has been created. Concurrent syncs are serialized, so a sync returning after
+ *                                 another one has taken the dirty segments still waits for their flush.
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::sync()
+{
+   QMutexLocker syncing(&syncLock);
+
+   QSet<quint32> dirty;
+   bool          folder;
+
+   {
+      QMutexLocker appending(&appendLock);
+
+      dirty.swap(dirtySegments);
+
+      folder      = dirtyFolder;
+      dirtyFolder = false;
+   }
+
+   int ret = 1;
+
+   foreach (quint32 segment, dirty)
+   {
+      int fd;
+
+      {
+         QReadLocker locker(&lock);
+
+         if (!segments.contains(segment))
+         {
+            continue; // dropped by compaction: live objects have been appended to active segment
+         }
+
+         fd = ::dup(segments.value(segment).fd);
+      }
+
+      if (fd<0 || ::fdatasync(fd)!=0)
+      {
+         lastErrorMsg = "Sync segment file error: " + segmentFileName(segment) + " => " + QString::fromLocal8Bit(strerror(errno));
+         ret = 0;
+      }
+
+      if (fd>=0)
+      {
+         ::close(fd);
+      }
+   }
+
+   if (folder)
+   {
+      int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+      if (fd<0 || ::fsync(fd)!=0)
+      {
+         lastErrorMsg = "Sync segments folder error: " + path + " => " + QString::fromLocal8Bit(strerror(errno));
+         ret = 0;
+      }
+
+      if (fd>=0)
+      {
+         ::close(fd);
+      }
+   }
+
+   if (!ret) // flushed again by next sync
+   {
+      QMutexLocker appending(&appendLock);
+
+      dirtySegments.unite(dirty);
+
+      dirtyFolder = dirtyFolder || folder;
+   }
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgSegmentStore::openNeedle locate a packed object and return a duplicated descriptor
+ *                                       of its segment file. The descriptor remains valid even if the
+ *                                       segment is compacted meanwhile; the caller must close it.
+ * @param key
+ * @param needle output needle location
+ * @return segment file descriptor, -1 if object not found
+ */
+int SCDImgSegmentStore::openNeedle(const QString &key, SCDImgNeedle &needle)
+{
+   QReadLocker locker(&lock);
+
+   QHash<QString,SCDImgNeedle>::const_iterator it = index.constFind(key);
+
+   if (it==index.constEnd())
+   {
+      return -1;
+   }
+
+   needle = *it;
+
+   return ::dup(segments.value(it->segment).fd);
+}
+
+/**
+ * @brief SCDImgSegmentStore::count return the number of packed objects
+ * @return
+ */
+int SCDImgSegmentStore::count()
+{
+   QReadLocker locker(&lock);
+
+   return index.size();
+}
+
+/**
+ * @brief SCDImgSegmentStore::keys list packed objects of a folder (sub folders excluded). Scans the whole needle
+ *                                 index: callers cache the result of listings
+ * @param folder logical folder path without trailing '/' (empty: root)
+ * @return
+ */
+QStringList SCDImgSegmentStore::keys(const QString &folder)
+{
+   QString prefix = folder + "/";
+
+   QStringList list;
+
+   QReadLocker locker(&lock);
+
+   for (QHash<QString,SCDImgNeedle>::const_iterator it=index.constBegin(); it!=index.constEnd(); ++it)
+   {
+      if (it.key().startsWith(prefix) && it.key().indexOf('/',prefix.size())<0)
+      {
+         list.append(it.key());
+      }
+   }
+
+   return list;
+}
+
+/**
+ * @brief SCDImgSegmentStore::lastError
+ * @return
+ */
+QString SCDImgSegmentStore::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgSegmentStore::segmentFileName
+ * @param segment
+ * @return
+ */
+QString SCDImgSegmentStore::segmentFileName(quint32 segment)
+{
+   return path + QString("segment.%1.dat").arg(segment,6,10,QChar('0'));
+}
+
+/**
+ * @brief SCDImgSegmentStore::recordSize return the size of a needle record on segment file
+ * @param key
+ * @param length
+ * @return
+ */
+qint64 SCDImgSegmentStore::recordSize(const QString &key, qint64 length)
+{
+   return NEEDLE_HEADER_CRC + key.toUtf8().size() + length;
+}
+
+/**
+ * @brief SCDImgSegmentStore::readRecord read and check a needle record: it must fit into end and, when verify is
+ *                                       set, match its crc
+ * @param fd
+ * @param offset record offset
+ * @param end    segment file size
+ * @param verify check crc (reads object data)
+ * @param record output param
+ * @return 1 on valid record, 0 on invalid or truncated record
+ */
+int SCDImgSegmentStore::readRecord(int fd, qint64 offset, qint64 end, bool verify, Record &record)
+{
+   char head[NEEDLE_HEADER_CRC];
+
+   if (offset+NEEDLE_HEADER>end || !readAll(fd, head, NEEDLE_HEADER, offset))
+   {
+      return 0;
+   }
+
+   quint32 magic;
+   quint16 keyLength;
+   quint64 dataLength;
+
+   memcpy(&magic     , head   , 4);
+   memcpy(&keyLength , head+6 , 2);
+   memcpy(&dataLength, head+8 , 8);
+
+   qint64 headerSize;
+
+   switch (magic)
+   {
+      case NEEDLE_MAGIC:     headerSize = NEEDLE_HEADER;     break;
+      case NEEDLE_MAGIC_CRC: headerSize = NEEDLE_HEADER_CRC; break;
+      default:               return 0;
+   }
+
+   if (dataLength>static_cast<quint64>(end) || offset+headerSize+keyLength+static_cast<qint64>(dataLength)>end) // torn write
+   {
+      return 0;
+   }
+
+   record.name.resize(keyLength);
+
+   if (!readAll(fd, head+NEEDLE_HEADER, headerSize-NEEDLE_HEADER, offset+NEEDLE_HEADER) ||
+       !readAll(fd, record.name.data(), keyLength, offset+headerSize))
+   {
+      return 0;
+   }
+
+   record.flags      = head[4];
+   record.dataOffset = offset + headerSize + keyLength;
+   record.dataLength = static_cast<qint64>(dataLength);
+   record.size       = headerSize + keyLength + record.dataLength;
+
+   if (!verify || magic==NEEDLE_MAGIC)
+   {
+      return 1;
+   }
+
+   quint32 crc = needleCrc(0, head, NEEDLE_HEADER);
+
+   crc = needleCrc(crc, record.name.constData(), keyLength);
+
+   QByteArray chunk(static_cast<int>(qMin<qint64>(record.dataLength,CRC_CHUNK)),0);
+
+   for (qint64 pos=0; pos<record.dataLength; pos+=chunk.size())
+   {
+      qint64 size = qMin<qint64>(record.dataLength-pos,chunk.size());
+
+      if (!readAll(fd, chunk.data(), size, record.dataOffset+pos))
+      {
+         return 0;
+      }
+
+      crc = needleCrc(crc, chunk.constData(), size);
+   }
+
+   quint32 stored;
+
+   memcpy(&stored, head+NEEDLE_HEADER, 4);
+
+   return (crc==stored) ? 1 : 0;
+}
+
+/**
+ * @brief SCDImgSegmentStore::openSegment open (or create) a segment file
+ * @param segment
+ * @param create
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::openSegment(quint32 segment, bool create)
+{
+   QString fileName = segmentFileName(segment);
+
+   int fd = ::open(fileName.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+
+   if (fd<0)
+   {
+      lastErrorMsg = "Open segment file error: " + fileName + " => " + QString::fromLocal8Bit(strerror(errno));
+      return 0;
+   }
+
+   SegmentInfo info;
+
+   info.fd        = fd;
+   info.size      = 0;
+   info.deadBytes = 0;
+
+   QWriteLocker locker(&lock);
+
+   segments.insert(segment,info);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::scanSegment read all needle records of a segment and update the index.
+ *                                        The first invalid record (interrupted append: truncated, or not
+ *                                        matching its crc) ends the segment, which is truncated there.
+ * @param segment
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::scanSegment(quint32 segment)
+{
+   SegmentInfo &info = segments[segment];
+
+   struct stat st;
+
+   if (::fstat(info.fd,&st)!=0)
+   {
+      lastErrorMsg = "Stat segment file error: " + segmentFileName(segment) + " => " + QString::fromLocal8Bit(strerror(errno));
+      return 0;
+   }
+
+   qint64 end    = static_cast<qint64>(st.st_size);
+   qint64 offset = 0;
+
+   Record record;
+
+   while (offset<end && readRecord(info.fd, offset, end, true, record))
+   {
+      qint64 size = record.size;
+
+      QString key = QString::fromUtf8(record.name);
+
+      QHash<QString,SCDImgNeedle>::iterator it = index.find(key);
+
+      if (it!=index.end()) // previous version is dead
+      {
+         segments[it->segment].deadBytes += (it->offset - it->record) + it->length;
+      }
+
+      if (record.flags==RF_TOMBSTONE)
+      {
+         info.deadBytes += size;
+
+         if (it!=index.end())
+         {
+            index.erase(it);
+         }
+      }
+      else
+      {
+         SCDImgNeedle needle;
+
+         needle.segment = segment;
+         needle.record  = offset;
+         needle.offset  = record.dataOffset;
+         needle.length  = record.dataLength;
+
+         index.insert(key,needle);
+      }
+
+      offset += size;
+   }
+
+   if (offset<end) // torn tail: later appends must not leave a hole
+   {
+      logWarning() << "Segment torn tail dropped: " << segmentFileName(segment) << " " << (end-offset) << " bytes";
+
+      if (::ftruncate(info.fd, offset)!=0)
+      {
+         lastErrorMsg = "Truncate segment file error: " + segmentFileName(segment) + " => " + QString::fromLocal8Bit(strerror(errno));
+         return 0;
+      }
+   }
+
+   info.size = offset;
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::rollSegment start a new active segment. Call it holding appendLock.
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::rollSegment()
+{
+   quint32 segment;
+
+   {
+      QReadLocker locker(&lock);
+
+      segment = segments.lastKey() + 1;
+   }
+
+   if (!openSegment(segment,true))
+   {
+      logError() << lastErrorMsg;
+      return 0;
+   }
+
+   QWriteLocker locker(&lock);
+
+   activeSegment = segment;
+
+   dirtyFolder = true;
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::append append a needle record to the active segment and update the index.
+ *                                   When moving a needle (compaction) the index is updated only if
+ *                                   the object has not been overwritten or deleted meanwhile.
+ * @param key
+ * @param data
+ * @param flags  RF_DATA or RF_TOMBSTONE
+ * @param needle in: current location of moved needle (record<0 if not moving), out: new location
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::append(const QString &key, const QByteArray &data, int flags, SCDImgNeedle &needle)
+{
+   QByteArray name = key.toUtf8();
+
+   if (name.size()>0xFFFF)
+   {
+      return 0;
+   }
+
+   bool moving = (flags==RF_DATA && needle.record>=0);
+
+   QMutexLocker appending(&appendLock);
+
+   qint64 size = NEEDLE_HEADER_CRC + name.size() + data.size();
+
+   qint64 offset;
+   int    fd;
+
+   {
+      QReadLocker locker(&lock);
+
+      offset = segments.value(activeSegment).size;
+   }
+
+   if (offset>0 && offset+size>maxSegmentSize)
+   {
+      if (!rollSegment())
+      {
+         return 0;
+      }
+
+      offset = 0;
+   }
+
+   {
+      QReadLocker locker(&lock);
+
+      fd = segments.value(activeSegment).fd;
+   }
+
+   // write needle record -----------------------------------------------------
+
+   QByteArray record(NEEDLE_HEADER_CRC,0);
+
+   quint32 magic      = NEEDLE_MAGIC_CRC;
+   quint16 keyLength  = static_cast<quint16>(name.size());
+   quint64 dataLength = static_cast<quint64>(data.size());
+
+   memcpy(record.data()  , &magic     , 4);
+   memcpy(record.data()+6, &keyLength , 2);
+   memcpy(record.data()+8, &dataLength, 8);
+
+   record[4] = static_cast<char>(flags);
+
+   quint32 crc = needleCrc(needleCrc(needleCrc(0, record.constData(), NEEDLE_HEADER), name.constData(), name.size()), data.constData(), data.size());
+
+   memcpy(record.data()+NEEDLE_HEADER, &crc, 4);
+
+   record.append(name);
+   record.append(data);
+
+   if (!writeAll(fd, record.constData(), record.size(), offset))
+   {
+      return 0;
+   }
+
+   dirtySegments.insert(activeSegment);
+
+   // update index ------------------------------------------------------------
+
+   QWriteLocker locker(&lock);
+
+   SegmentInfo &info = segments[activeSegment];
+
+   info.size = offset + size;
+
+   QHash<QString,SCDImgNeedle>::iterator it = index.find(key);
+
+   if (flags==RF_TOMBSTONE)
+   {
+      info.deadBytes += size;
+
+      if (it!=index.end())
+      {
+         segments[it->segment].deadBytes += (it->offset - it->record) + it->length;
+         index.erase(it);
+      }
+
+      return 1;
+   }
+
+   if (moving && (it==index.end() || it->segment!=needle.segment || it->record!=needle.record))
+   {
+      info.deadBytes += size; // object changed while moving: copy is dead
+
+      return 1;
+   }
+
+   if (it!=index.end())
+   {
+      segments[it->segment].deadBytes += (it->offset - it->record) + it->length;
+   }
+
+   needle.segment = activeSegment;
+   needle.record  = offset;
+   needle.offset  = offset + NEEDLE_HEADER_CRC + name.size();
+   needle.length  = data.size();
+
+   index.insert(key,needle);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSegmentStore::compact compact all sealed segments whose dead bytes exceed ratio
+ * @param ratio
+ * @return number of compacted segments
+ */
+int SCDImgSegmentStore::compact(double ratio)
+{
+   QMutexLocker compacting(&compactLock);
+
+   QList<quint32> list;
+
+   {
+      QReadLocker locker(&lock);
+
+      QMap<quint32,SegmentInfo>::const_iterator it;
+
+      for (it=segments.constBegin(); it!=segments.constEnd(); ++it)
+      {
+         if (it.key()!=activeSegment && it->size>0 && it->deadBytes>=it->size*ratio)
+         {
+            list.append(it.key());
+         }
+      }
+   }
+
+   int count = 0;
+
+   foreach (quint32 segment, list)
+   {
+      quint32 oldest;
+
+      {
+         QReadLocker locker(&lock);
+
+         oldest = segments.firstKey();
+      }
+
+      if (compactSegment(segment, segment==oldest))
+      {
+         count++;
+      }
+      else
+      {
+         break; // keep segments order: a tombstone must never precede older records
+      }
+   }
+
+   return count;
+}
+
+/**
+ * @brief SCDImgSegmentStore::compactSegment move live needles of a segment to the active segment,
+ *                                           flush them, then drop the segment file. Tombstones are moved too
+ *                                           unless segment is the oldest one (nothing left to hide).
+ *                                           If the flush fails the segment is kept.
+ * @param segment
+ * @param oldest
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSegmentStore::compactSegment(quint32 segment, bool oldest)
+{
+   int    fd;
+   qint64 size;
+
+   {
+      QReadLocker locker(&lock);
+
+      fd   = segments.value(segment).fd;
+      size = segments.value(segment).size;
+   }
+
+   qint64 offset = 0;
+
+   Record record;
+
+   while (offset<size)
+   {
+      if (!readRecord(fd, offset, size, false, record)) // records were checked by scan or written by append
+      {
+         return 0;
+      }
+
+      QString key = QString::fromUtf8(record.name);
+
+      SCDImgNeedle needle;
+
+      needle.segment = segment;
+      needle.record  = offset;
+      needle.offset  = record.dataOffset;
+      needle.length  = record.dataLength;
+
+      if (record.flags==RF_TOMBSTONE)
+      {
+         if (!oldest && !contains(key))
+         {
+            needle.record = -1;
+
+            if (!append(key, QByteArray(), RF_TOMBSTONE, needle))
+            {
+               return 0;
+            }
+         }
+      }
+      else
+      {
+         bool live;
+
+         {
+            QReadLocker locker(&lock);
+
+            QHash<QString,SCDImgNeedle>::const_iterator it = index.constFind(key);
+
+            live = (it!=index.constEnd() && it->segment==segment && it->record==offset);
+         }
+
+         if (live)
+         {
+            QByteArray data(static_cast<int>(needle.length),0);
+
+            if (!readAll(fd, data.data(), needle.length, needle.offset) || !append(key, data, RF_DATA, needle))
+            {
+               return 0;
+            }
+         }
+      }
+
+      offset += record.size;
+   }
+
+   // flush moved records and segments folder: the segment file holds the only durable copy until then
+
+   {
+      QMutexLocker appending(&appendLock);
+
+      dirtyFolder = true;
+   }
+
+   if (!sync())
+   {
+      return 0;
+   }
+
+   // drop segment file -------------------------------------------------------
+
+   {
+      QWriteLocker locker(&lock);
+
+      ::close(fd);
+      ::unlink(segmentFileName(segment).toLocal8Bit().constData());
+
+      segments.remove(segment);
+   }
+
+   QMutexLocker appending(&appendLock);
+
+   dirtyFolder = true; // unlink is made durable by next sync
+
+   return 1;
+}
+
+/**
+ * @class SCDImgSegmentCompactor
+ *
+ * @brief Background thread which periodically compacts the segment store
+ */
+
+/**
+ * @brief SCDImgSegmentCompactor::SCDImgSegmentCompactor constructor
+ * @param store
+ * @param interval seconds between two compaction passes
+ * @param ratio    dead bytes ratio which triggers segment compaction
+ */
+SCDImgSegmentCompactor::SCDImgSegmentCompactor(SCDImgSegmentStore *store, int interval, double ratio) : QThread(store), store(store), interval(interval), ratio(ratio)
+{
+   stopped = false;
+}
+
+/**
+ * @brief SCDImgSegmentCompactor::run compaction loop
+ */
+void SCDImgSegmentCompactor::run()
+{
+   forever
+   {
+      mutex.lock();
+
+      if (!stopped)
+      {
+         wait.wait(&mutex, static_cast<unsigned long>(interval)*1000);
+      }
+
+      bool exit = stopped;
+
+      mutex.unlock();
+
+      if (exit)
+      {
+         break;
+      }
+
+      int count = store->compact(ratio);
+
+      if (count)
+      {
+         logInfo() << "Segments compacted: " << count;
+      }
+   }
+}
+
+/**
+ * @brief SCDImgSegmentCompactor::stop wake up and stop the compaction loop
+ */
+void SCDImgSegmentCompactor::stop()
+{
+   QMutexLocker locker(&mutex);
+
+   stopped = true;
+
+   wait.wakeAll();
+}
@@ -0,0 +1,140 @@
+#ifndef SCDIMGSEGMENTSTORE_H
+#define SCDIMGSEGMENTSTORE_H
+
+#include <QObject>
+#include <QThread>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QStringList>
+
+/**
+ * @brief The SCDImgNeedle struct locates a packed object into a segment file
+ */
+struct SCDImgNeedle
+{
+   quint32 segment; // segment number
+   qint64  offset;  // offset of object data into segment file
+   qint64  length;  // object data length
+   qint64  record;  // offset of needle record into segment file
+};
+
+/**
+ * @brief The SCDImgSegmentStore class packs small objects into large append-only segment files
+ */
+class SCDImgSegmentStore : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgSegmentStore(QObject *parent=0, QString path="./segments/", qint64 threshold=65536, qint64 maxSegmentSize=1073741824);
+
+     ~SCDImgSegmentStore();
+
+     int open();  // open store and rebuild needle index scanning segment files
+     void close();
+
+     bool accepts(qint64 size);
+     bool contains(const QString &key);
+     bool locate(const QString &key, SCDImgNeedle &needle); // needle of current object version
+
+     int put(const QString &key, const QByteArray &data);
+     int read(const QString &key, QByteArray &data);
+     int remove(const QString &key);
+
+     int sync(); // flush segments appended since last sync: one flush commits every object appended before it
+
+     int openNeedle(const QString &key, SCDImgNeedle &needle); // return a duplicated segment descriptor (caller must close it)
+
+     int compact(double ratio); // rewrite segments having dead bytes ratio greater than ratio
+
+     int count();
+
+     QStringList keys(const QString &folder); // packed objects directly under folder (/dir, empty for root)
+
+     QString lastError();
+
+   private:
+
+     enum RecordFlags {RF_DATA=0,RF_TOMBSTONE=1};
+
+     struct Record
+     {
+        int        flags;      // RF_DATA or RF_TOMBSTONE
+        QByteArray name;       // object key (UTF-8)
+        qint64     dataOffset; // offset of object data into segment file
+        qint64     dataLength;
+        qint64     size;       // whole record size
+     };
+
+     struct SegmentInfo
+     {
+        int    fd;
+        qint64 size;      // total bytes written
+        qint64 deadBytes; // bytes of overwritten or deleted records
+     };
+
+     QString path;
+     qint64  threshold;
+     qint64  maxSegmentSize;
+
+     QHash <QString,SCDImgNeedle> index;    // needle index: key => (segment, offset, length)
+     QMap  <quint32,SegmentInfo>  segments; // opened segment files
+
+     quint32 activeSegment;
+
+     QReadWriteLock lock;       // protects index and segments map
+     QMutex         appendLock; // serializes appends on active segment
+     QMutex         compactLock;
+     QMutex         syncLock;   // serializes syncs: a sync returns when appends preceding it are on disk
+
+     QSet<quint32> dirtySegments; // segments appended since last sync (protected by appendLock)
+     bool          dirtyFolder;   // segment files created since last sync (protected by appendLock)
+
+     QString lastErrorMsg;
+
+     QString segmentFileName(quint32 segment);
+
+     int openSegment(quint32 segment, bool create);
+     int scanSegment(quint32 segment);
+     int rollSegment();
+     int append(const QString &key, const QByteArray &data, int flags, SCDImgNeedle &needle);
+     int compactSegment(quint32 segment, bool oldest);
+
+     static qint64 recordSize(const QString &key, qint64 length);
+     static int    readRecord(int fd, qint64 offset, qint64 end, bool verify, Record &record); // 1 valid, 0 invalid or truncated
+};
+
+/**
+ * @brief The SCDImgSegmentCompactor class periodically reclaims the space of deleted packed objects
+ */
+class SCDImgSegmentCompactor : public QThread
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgSegmentCompactor(SCDImgSegmentStore *store, int interval=60, double ratio=0.5);
+
+     void run();
+     void stop();
+
+   private:
+
+     SCDImgSegmentStore *store;
+
+     int    interval; // seconds between two compaction passes
+     double ratio;    // dead bytes ratio which triggers segment compaction
+
+     bool stopped;
+
+     QMutex         mutex;
+     QWaitCondition wait;
+};
+
+#endif // SCDIMGSEGMENTSTORE_H
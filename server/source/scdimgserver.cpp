@@ -13,6 +13,14 @@
 
 #include "scdimgserver.h"
 #include "scdimgserverthread.h"
+#include "scdimghttp.h"
+#include "scdimglocal.h"
+#include "scdimglogger.h"
+
+#include <QSettings>
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 /**
  * @brief SCDImgServer::SCDImgServer constructor
@@ -20,7 +28,90 @@
  */
 SCDImgServer::SCDImgServer(QObject *parent, int port, QString rootPath) : QTcpServer(parent), port(port), rootPath(rootPath)
 {
+   roots = new SCDImgRootPaths(QStringList(rootPath));
+
+   segStore  = 0;
+   compactor = 0;
+
+   ioRing = 0;
+
+   writer             = 0;
+   sockReadBufferSize = 0;
+
+   commitStage = new SCDImgCommitter(this);
+
+   limiter    = new SCDImgRateLimiter(this);
+   cfgWatcher = 0;
+
+   wheel              = new SCDImgTimerWheel(this);
+   maxConnections     = 0;
+   acceptBacklog      = 128;
+   headerTimeoutMsecs = 0;
+   idleTimeoutMsecs   = 0;
+
+   connections.store(0);
+   rejects.store(0);
+   headerEvictions.store(0);
+   idleEvictions.store(0);
+
+   metricsRegistry = new SCDImgMetrics(this);
+   metricsServer   = 0;
+   metricsAddress  = "127.0.0.1";
+   metricsPort     = 0;
+
+   registerMetrics();
+
+   slow = 0;
 
+   capture = 0;
+
+   replication = 0;
+
+   hashes = 0;
+
+   metadata = 0;
+
+   sheets = 0;
+
+   httpGateway = 0;
+   httpAddress = "0.0.0.0";
+   httpPort    = 0;
+
+   localListener = 0;
+   localWorld    = false;
+}
+
+/**
+ * @brief SCDImgServer::~SCDImgServer destructor
+ */
+SCDImgServer::~SCDImgServer()
+{
+   if (replication)
+   {
+      replication->stop(); // shippers read objects from storage
+   }
+
+   if (compactor)
+   {
+      compactor->stop();
+      compactor->wait();
+   }
+
+   if (writer)
+   {
+      writer->stop();
+   }
+
+   commitStage->stop(); // after disk writer: its last files are committed too
+
+   if (metadata)
+   {
+      metadata->stopExtractor(); // reads objects from storage
+   }
+
+   SCDImgStorageIO::destroyRing(ioRing);
+
+   delete roots;
 }
 
 /**
@@ -28,23 +119,178 @@ SCDImgServer::SCDImgServer(QObject *parent, int port, QString rootPath) : QTcpSe
  */
 int SCDImgServer::start()
 {
-   if (!QFile::exists(rootPath))
+   if (!roots->check())
    {
-      lastErrorMsg = "Root path not exixst\n";
-      qDebug() << lastError();
+      lastErrorMsg = roots->lastError();
+      logError() << lastError();
       return 0;
    }
 
+   if (roots->count()>1)
+   {
+      logInfo() << "Files striped across " << roots->count() << " root paths";
+   }
+
+   if (segStore)
+   {
+      if (!segStore->open())
+      {
+         lastErrorMsg = "Unable to open segment store: " + segStore->lastError();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Segment store opened, packed objects: " << segStore->count();
+
+      compactor->start(QThread::LowPriority);
+   }
+
+   commitStage->setSegmentStore(segStore);
+
+   if (commitStage->mode()==SCDImgCommitter::DM_GROUP)
+   {
+      commitStage->start(QThread::HighPriority); // acknowledgements of all uploads wait for it
+   }
+
+   if (writer)
+   {
+      writer->setCommitter(commitStage);
+      writer->start();
+   }
+
+   if (slow && !slow->open())
+   {
+      lastErrorMsg = slow->lastError();
+      logError() << lastErrorMsg;
+      return 0;
+   }
+
+   if (capture)
+   {
+      if (!capture->open())
+      {
+         lastErrorMsg = capture->lastError();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Traffic capture started";
+   }
+
+   if (replication)
+   {
+      if (!replication->start())
+      {
+         lastErrorMsg = "Unable to open replication log: " + replication->lastError();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Replicating to " << replication->shippers().count() << " peers, log entries: " << replication->log()->lastSeq();
+   }
+
+   if (hashes)
+   {
+      if (!hashes->open())
+      {
+         lastErrorMsg = hashes->lastError();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Hash index opened, objects with content hash: " << hashes->count();
+   }
+
+   if (metadata)
+   {
+      if (!metadata->open())
+      {
+         lastErrorMsg = metadata->lastError();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Metadata index opened, objects with metadata: " << metadata->count();
+
+      SCDImgMetaIndex    *index = metadata;
+      SCDImgSegmentStore *store = segStore;
+      SCDImgRootPaths    *paths = roots;
+
+      metadata->startExtractor([index,store,paths](const QString &key) // uploads are queued by requestDone()
+      {
+         SCDImgMetaIndex::Meta meta;
+
+         if (!SignalsHandler::extractMeta(index,store,paths,key,meta))
+         {
+            index->remove(key); // not stored anymore
+         }
+      });
+   }
+
+   wheel->start();
+
+   if (metricsPort>0)
+   {
+      metricsServer = new SCDImgMetricsServer(metricsRegistry,this);
+
+      if (!metricsServer->listen(QHostAddress(metricsAddress),metricsPort))
+      {
+         lastErrorMsg = "Unable to start metrics endpoint on " + metricsAddress + ":" + QString::number(metricsPort) + " " + metricsServer->errorString();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      logInfo() << "Metrics endpoint: http://" + metricsAddress + ":" + QString::number(metricsPort) + "/metrics";
+   }
+
+   if (httpPort>0)
+   {
+      httpGateway = new SCDImgHttpGateway(this);
+
+      if (!httpGateway->listen(QHostAddress(httpAddress),httpPort))
+      {
+         lastErrorMsg = "Unable to start HTTP gateway on " + httpAddress + ":" + QString::number(httpPort) + " " + httpGateway->errorString();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      ::listen(static_cast<int>(httpGateway->socketDescriptor()),acceptBacklog);
+
+      logInfo() << "HTTP gateway: http://" + httpAddress + ":" + QString::number(httpPort) + "/";
+   }
+
+   if (!localPath.isEmpty())
+   {
+      QLocalServer::removeServer(localPath); // socket file left by a previous run
+
+      localListener = new SCDImgLocalListener(this);
+
+      localListener->setSocketOptions(localWorld ? QLocalServer::WorldAccessOption : (QLocalServer::UserAccessOption | QLocalServer::GroupAccessOption));
+
+      if (!localListener->listen(localPath))
+      {
+         lastErrorMsg = "Unable to start local socket listener on " + localPath + " " + localListener->errorString();
+         logError() << lastErrorMsg;
+         return 0;
+      }
+
+      ::listen(static_cast<int>(localListener->socketDescriptor()),acceptBacklog);
+
+      logInfo() << "Local socket: " + localPath;
+   }
+
    if (listen(QHostAddress::Any,port))
    {
+      ::listen(static_cast<int>(socketDescriptor()),acceptBacklog); // bounded accept backlog (QTcpServer listens with a fixed one)
+
       lastErrorMsg = "Image Server is listening on port:" + QString::number(port) + " for incoming connections...";
-      qDebug() <<  lastError();
+      logInfo() <<  lastError();
       return 1;
    }
 
    lastErrorMsg = "Unable to start server on port:" + QString::number(port) + this->errorString();
 
-   qDebug() << lastErrorMsg;
+   logError() << lastErrorMsg;
 
    return 0;
 }
@@ -60,13 +306,531 @@ QString SCDImgServer::lastError()
 
 /**
  * @brief SCDImgServer::getRootPath
- * @return
+ * @return first root path
  */
 QString SCDImgServer::getRootPath()
 {
    return rootPath;
 }
 
+/**
+ * @brief SCDImgServer::setRootPaths stripe files across several root paths (one for each disk). Call it before start()
+ * @param paths root paths, the server root path is used if empty
+ */
+void SCDImgServer::setRootPaths(QStringList paths)
+{
+   if (paths.isEmpty())
+   {
+      paths.append(rootPath);
+   }
+
+   delete roots;
+
+   roots = new SCDImgRootPaths(paths);
+
+   rootPath = roots->paths().first();
+}
+
+/**
+ * @brief SCDImgServer::rootPaths
+ * @return root paths
+ */
+SCDImgRootPaths *SCDImgServer::rootPaths()
+{
+   return roots;
+}
+
+/**
+ * @brief SCDImgServer::setSegmentStore enable small objects packing into segment files. Call it before start()
+ * @param path            folder of segment files
+ * @param threshold       objects smaller than threshold bytes are packed
+ * @param maxSegmentSize  max size of a segment file
+ * @param compactInterval seconds between two compaction passes
+ * @param compactRatio    dead bytes ratio which triggers segment compaction
+ */
+void SCDImgServer::setSegmentStore(QString path, qint64 threshold, qint64 maxSegmentSize, int compactInterval, double compactRatio)
+{
+   segStore  = new SCDImgSegmentStore(this,path,threshold,maxSegmentSize);
+   compactor = new SCDImgSegmentCompactor(segStore,compactInterval,compactRatio);
+}
+
+/**
+ * @brief SCDImgServer::segmentStore
+ * @return segment store, null if small objects packing is disabled
+ */
+SCDImgSegmentStore *SCDImgServer::segmentStore()
+{
+   return segStore;
+}
+
+/**
+ * @brief SCDImgServer::setStorageIO select storage I/O backend used by connection threads. The io_uring backend
+ *                                   sets up one ring here, shared by every connection and writer thread.
+ *                                   Call it before start()
+ * @param backend    SCDImgStorageIO::Backend
+ * @param queueDepth submission queue depth (io_uring backend)
+ */
+void SCDImgServer::setStorageIO(int backend, int queueDepth)
+{
+   SCDImgStorageIO::destroyRing(ioRing);
+
+   ioRing = SCDImgStorageIO::createRing(backend,queueDepth);
+}
+
+/**
+ * @brief SCDImgServer::createStorageIO allocates a storage I/O handle of the selected backend (owned by caller)
+ * @return
+ */
+SCDImgStorageIO *SCDImgServer::createStorageIO()
+{
+   return SCDImgStorageIO::create(ioRing);
+}
+
+/**
+ * @brief SCDImgServer::setDiskWriter enable disk writer stage: received buffers are written by writer threads.
+ *                                    Call it before start()
+ * @param threads        number of writer threads
+ * @param queueSize      capacity of each writer queue (buffers)
+ * @param readBufferSize socket read buffer size of an upload (bytes)
+ */
+void SCDImgServer::setDiskWriter(int threads, int queueSize, qint64 readBufferSize)
+{
+   writer = new SCDImgDiskWriter(this,threads,queueSize);
+
+   sockReadBufferSize = readBufferSize;
+}
+
+/**
+ * @brief SCDImgServer::diskWriter
+ * @return disk writer stage, null if disabled
+ */
+SCDImgDiskWriter *SCDImgServer::diskWriter()
+{
+   return writer;
+}
+
+/**
+ * @brief SCDImgServer::setDurability guarantee given by upload acknowledgement. Call it before start()
+ * @param mode          SCDImgCommitter::Mode (none, fsync, group)
+ * @param groupInterval msecs between group commits
+ */
+void SCDImgServer::setDurability(int mode, int groupInterval)
+{
+   delete commitStage;
+
+   commitStage = new SCDImgCommitter(this,mode,groupInterval);
+
+   if (mode!=SCDImgCommitter::DM_GROUP)
+   {
+      return;
+   }
+
+   metricsRegistry->addCounter("scdimg_group_commits_total","Group commits (durability mode group).",[this]() {return static_cast<double>(commitStage->batches());});
+   metricsRegistry->addCounter("scdimg_group_commit_files_total","Uploads made durable by group commits.",[this]() {return static_cast<double>(commitStage->files());});
+}
+
+/**
+ * @brief SCDImgServer::committer
+ * @return durability stage of uploads
+ */
+SCDImgCommitter *SCDImgServer::committer()
+{
+   return commitStage;
+}
+
+/**
+ * @brief SCDImgServer::readBufferSize
+ * @return socket read buffer size of uploads handed to disk writer
+ */
+qint64 SCDImgServer::readBufferSize()
+{
+   return sockReadBufferSize;
+}
+
+/**
+ * @brief SCDImgServer::rateLimiter
+ * @return
+ */
+SCDImgRateLimiter *SCDImgServer::rateLimiter()
+{
+   return limiter;
+}
+
+/**
+ * @brief SCDImgServer::setRateLimits set bandwidth limits of each direction (bytes/sec, 0: unlimited).
+ *                                    It can be called at runtime: new limits apply to current connections too.
+ * @param global        all connections
+ * @param perClientIp   all connections of a client IP
+ * @param perConnection each connection
+ */
+void SCDImgServer::setRateLimits(qint64 global, qint64 perClientIp, qint64 perConnection)
+{
+   limiter->setRates(global,perClientIp,perConnection);
+}
+
+/**
+ * @brief SCDImgServer::watchConfig watch config file: runtime adjustable settings (rate limits) are reloaded on change
+ * @param fileName
+ */
+void SCDImgServer::watchConfig(QString fileName)
+{
+   cfgFile = fileName;
+
+   if (!cfgWatcher)
+   {
+      cfgWatcher = new QFileSystemWatcher(this);
+
+      connect(cfgWatcher, SIGNAL(fileChanged(QString)), this, SLOT(configChanged(QString)));
+   }
+
+   cfgWatcher->addPath(fileName);
+}
+
+/**
+ * @brief SCDImgServer::configChanged reload runtime adjustable settings
+ * @param fileName
+ */
+void SCDImgServer::configChanged(const QString &fileName)
+{
+   if (!cfgWatcher->files().contains(fileName) && QFile::exists(fileName))
+   {
+      cfgWatcher->addPath(fileName); // file replaced by editor: watch the new one
+   }
+
+   QSettings cfg(cfgFile,QSettings::IniFormat);
+
+   qint64 global        = cfg.value("ratelimit/global",limiter->rate(SCDImgRateLimiter::RL_GLOBAL)).toLongLong();
+   qint64 perClientIp   = cfg.value("ratelimit/perclientip",limiter->rate(SCDImgRateLimiter::RL_CLIENTIP)).toLongLong();
+   qint64 perConnection = cfg.value("ratelimit/perconnection",limiter->rate(SCDImgRateLimiter::RL_CONNECTION)).toLongLong();
+
+   setRateLimits(global,perClientIp,perConnection);
+
+   logInfo() << "Rate limits reloaded (bytes/sec) global: " << global << " per client ip: " << perClientIp << " per connection: " << perConnection;
+}
+
+/**
+ * @brief SCDImgServer::setConnectionLimits set admission control and connections timeouts. Call it before start()
+ * @param maxConnections max concurrent connections: further connections are rejected (0: unlimited)
+ * @param backlog        accept backlog: connections not yet accepted queued by kernel
+ * @param headerTimeout  msecs allowed to send the request header from connection (0: disabled)
+ * @param idleTimeout    msecs of inactivity allowed after the request header (0: disabled)
+ * @param timerTick      timer wheel resolution (msecs)
+ */
+void SCDImgServer::setConnectionLimits(int maxConnections, int backlog, int headerTimeout, int idleTimeout, int timerTick)
+{
+   this->maxConnections = qMax(0,maxConnections);
+
+   acceptBacklog      = qMax(1,backlog);
+   headerTimeoutMsecs = qMax(0,headerTimeout);
+   idleTimeoutMsecs   = qMax(0,idleTimeout);
+
+   delete wheel;
+
+   wheel = new SCDImgTimerWheel(this,timerTick);
+}
+
+/**
+ * @brief SCDImgServer::timerWheel
+ * @return timer wheel of connections timeouts
+ */
+SCDImgTimerWheel *SCDImgServer::timerWheel()
+{
+   return wheel;
+}
+
+/**
+ * @brief SCDImgServer::headerTimeout
+ * @return msecs allowed to send the request header (0: disabled)
+ */
+int SCDImgServer::headerTimeout()
+{
+   return headerTimeoutMsecs;
+}
+
+/**
+ * @brief SCDImgServer::idleTimeout
+ * @return msecs of inactivity allowed after the request header (0: disabled)
+ */
+int SCDImgServer::idleTimeout()
+{
+   return idleTimeoutMsecs;
+}
+
+/**
+ * @brief SCDImgServer::connectionEvicted count a connection closed by timeout
+ * @param headerTimeout true: header timeout, false: idle timeout
+ */
+void SCDImgServer::connectionEvicted(bool headerTimeout)
+{
+   if (headerTimeout)
+   {
+      headerEvictions++;
+   }
+   else
+   {
+      idleEvictions++;
+   }
+}
+
+/**
+ * @brief SCDImgServer::activeConnections
+ * @return
+ */
+int SCDImgServer::activeConnections()
+{
+   return connections.load();
+}
+
+/**
+ * @brief SCDImgServer::rejectedConnections
+ * @return connections rejected by admission control
+ */
+quint64 SCDImgServer::rejectedConnections()
+{
+   return rejects.load();
+}
+
+/**
+ * @brief SCDImgServer::headerTimeouts
+ * @return connections evicted by header timeout
+ */
+quint64 SCDImgServer::headerTimeouts()
+{
+   return headerEvictions.load();
+}
+
+/**
+ * @brief SCDImgServer::idleTimeouts
+ * @return connections evicted by idle timeout
+ */
+quint64 SCDImgServer::idleTimeouts()
+{
+   return idleEvictions.load();
+}
+
+/**
+ * @brief SCDImgServer::setMetricsEndpoint enable metrics endpoint (Prometheus text format). Call it before start()
+ * @param address listen address (keep it local)
+ * @param port    0: disabled
+ */
+void SCDImgServer::setMetricsEndpoint(QString address, int port)
+{
+   metricsAddress = address;
+   metricsPort    = port;
+}
+
+/**
+ * @brief SCDImgServer::metrics
+ * @return metrics registry
+ */
+SCDImgMetrics *SCDImgServer::metrics()
+{
+   return metricsRegistry;
+}
+
+/**
+ * @brief SCDImgServer::setSlowLog enable requests phase tracing: requests slower than threshold are logged. Call it before start()
+ * @param fileName       slow log file (JSON lines)
+ * @param thresholdMsecs
+ */
+void SCDImgServer::setSlowLog(QString fileName, int thresholdMsecs)
+{
+   slow = new SCDImgSlowLog(this,fileName,thresholdMsecs);
+}
+
+/**
+ * @brief SCDImgServer::slowLog
+ * @return slow requests log, null if tracing is disabled
+ */
+SCDImgSlowLog *SCDImgServer::slowLog()
+{
+   return slow;
+}
+
+/**
+ * @brief SCDImgServer::setCapture record the metadata of every request (op, path, size, outcome, latency) into a binary
+ *                                 capture, to be replayed by scdimgbench. Call it before start()
+ * @param fileName capture file (overwritten)
+ * @param maxSize  max capture size: further requests are not recorded
+ */
+void SCDImgServer::setCapture(QString fileName, qint64 maxSize)
+{
+   capture = new SCDImgCaptureLog(this,fileName,maxSize);
+
+   metricsRegistry->addCounter("scdimg_capture_records_total","Requests recorded into traffic capture.",[this]() {return static_cast<double>(capture->records());});
+   metricsRegistry->addCounter("scdimg_capture_dropped_total","Requests not recorded: traffic capture reached max size.",[this]() {return static_cast<double>(capture->dropped());});
+}
+
+/**
+ * @brief SCDImgServer::captureLog
+ * @return traffic capture, null if disabled
+ */
+SCDImgCaptureLog *SCDImgServer::captureLog()
+{
+   return capture;
+}
+
+/**
+ * @brief SCDImgServer::setReplication forward completed PUT and DEL commands to peer servers. Call it before start()
+ * @param peers       host:port list
+ * @param logPath     replication log folder
+ * @param batch       log entries shipped at once
+ * @param pipeline    max commands in flight for each peer
+ * @param segmentSize max size of replication log segments
+ * @param timeout     msecs to connect to a peer and to receive a reply
+ */
+void SCDImgServer::setReplication(QStringList peers, QString logPath, int batch, int pipeline, qint64 segmentSize, int timeout)
+{
+   replication = new SCDImgReplicator(this,peers,logPath,batch,pipeline,segmentSize,timeout);
+
+   foreach (SCDImgReplicaShipper *shipper, replication->shippers())
+   {
+      QString label = "{peer=\"" + shipper->peer() + "\"}";
+
+      metricsRegistry->addGauge("scdimg_replication_lag_entries" + label,"Replication log entries not yet acknowledged by peer.",[this,shipper]() -> double
+      {
+         return static_cast<double>(replication->log()->lastSeq()-qMin(replication->log()->lastSeq(),shipper->acked()));
+      });
+
+      metricsRegistry->addGauge("scdimg_replication_lag_seconds" + label,"Age of oldest replication log entry not yet acknowledged by peer.",[shipper]() {return shipper->lagSeconds();});
+
+      metricsRegistry->addCounter("scdimg_replication_shipped_total" + label,"Replication log entries shipped to peer.",[shipper]() {return static_cast<double>(shipper->shipped());});
+   }
+}
+
+/**
+ * @brief SCDImgServer::replicator
+ * @return replicator, null if replication is disabled
+ */
+SCDImgReplicator *SCDImgServer::replicator()
+{
+   return replication;
+}
+
+/**
+ * @brief SCDImgServer::setHttpGateway enable HTTP/1.1 gateway: GET and HEAD of files, packed objects and thumbnails. Call it before start()
+ * @param address listen address
+ * @param port    0: disabled
+ */
+void SCDImgServer::setHttpGateway(QString address, int port)
+{
+   httpAddress = address;
+   httpPort    = port;
+}
+
+/**
+ * @brief SCDImgServer::setLocalSocket listen on a Unix socket too: local clients skip the loopback stack and can
+ *                                     receive GET replies as read-only descriptors. Call it before start()
+ * @param path        socket path (empty: disabled)
+ * @param worldAccess any local user can connect, otherwise only the server user and its group
+ */
+void SCDImgServer::setLocalSocket(QString path, bool worldAccess)
+{
+   localPath  = path;
+   localWorld = worldAccess;
+}
+
+/**
+ * @brief SCDImgServer::setHashIndex enable deduplication of hash-first uploads: an upload whose content is already
+ *                                   stored under its path, or under another path, completes without receiving data.
+ *                                   Call it before start()
+ * @param fileName index log file
+ */
+void SCDImgServer::setHashIndex(QString fileName)
+{
+   hashes = new SCDImgHashIndex(this,fileName);
+
+   metricsRegistry->addCounter("scdimg_dedup_unchanged_total","Hash-first uploads skipped: object already had the content.",[this]() {return static_cast<double>(hashes->unchanged());});
+   metricsRegistry->addCounter("scdimg_dedup_copies_total","Hash-first uploads stored as a copy of another object.",[this]() {return static_cast<double>(hashes->copies());});
+}
+
+/**
+ * @brief SCDImgServer::hashIndex
+ * @return content hash index, null if dedup is disabled
+ */
+SCDImgHashIndex *SCDImgServer::hashIndex()
+{
+   return hashes;
+}
+
+/**
+ * @brief SCDImgServer::setMetaIndex extract width, height, format, orientation and capture date of each upload from
+ *                                   its image headers, and keep them in an index: INFO answers without reading
+ *                                   objects. Without index INFO reads the headers on each request.
+ *                                   Call it before start()
+ * @param fileName index log file
+ */
+void SCDImgServer::setMetaIndex(QString fileName)
+{
+   metadata = new SCDImgMetaIndex(this,fileName);
+
+   metricsRegistry->addGauge("scdimg_metadata_objects","Objects with image metadata in index.",[this]() {return static_cast<double>(metadata->count());});
+   metricsRegistry->addCounter("scdimg_metadata_extractions_total","Image metadata read from object headers.",[this]() {return static_cast<double>(metadata->extractions());});
+   metricsRegistry->addGauge("scdimg_metadata_queued","Uploaded objects waiting for metadata extraction.",[this]() {return static_cast<double>(metadata->queued());});
+}
+
+/**
+ * @brief SCDImgServer::metaIndex
+ * @return image metadata index, null if disabled
+ */
+SCDImgMetaIndex *SCDImgServer::metaIndex()
+{
+   return metadata;
+}
+
+/**
+ * @brief SCDImgServer::setSheetCache keep contact sheets in memory: a SHEET of a folder is composed again only after
+ *                                    an upload or delete into that folder. Call it before start()
+ * @param maxBytes max bytes of cached sheets (0: disabled, sheets are composed on each request)
+ */
+void SCDImgServer::setSheetCache(qint64 maxBytes)
+{
+   if (maxBytes<=0)
+   {
+      return;
+   }
+
+   sheets = new SCDImgSheetCache(this,maxBytes);
+
+   metricsRegistry->addCounter("scdimg_sheet_cache_hits_total","Contact sheets served from cache.",[this]() {return static_cast<double>(sheets->hits());});
+   metricsRegistry->addCounter("scdimg_sheet_cache_misses_total","Contact sheets composed.",[this]() {return static_cast<double>(sheets->misses());});
+}
+
+/**
+ * @brief SCDImgServer::sheetCache
+ * @return contact sheets cache, null if disabled
+ */
+SCDImgSheetCache *SCDImgServer::sheetCache()
+{
+   return sheets;
+}
+
+/**
+ * @brief SCDImgServer::registerMetrics register server gauges, read when metrics are scraped
+ */
+void SCDImgServer::registerMetrics()
+{
+   metricsRegistry->addGauge("scdimg_active_connections","Active client connections.",[this]() {return activeConnections();});
+
+   metricsRegistry->addCounter("scdimg_connections_rejected_total","Connections rejected by admission control.",[this]() {return rejectedConnections();});
+
+   metricsRegistry->addCounter("scdimg_connections_evicted_total{reason=\"header_timeout\"}","Connections evicted by timeout.",[this]() {return headerTimeouts();});
+   metricsRegistry->addCounter("scdimg_connections_evicted_total{reason=\"idle_timeout\"}","Connections evicted by timeout.",[this]() {return idleTimeouts();});
+
+   metricsRegistry->addGauge("scdimg_armed_timers","Connection timeouts armed into timer wheel.",[this]() {return wheel->count();});
+
+   metricsRegistry->addGauge("scdimg_writer_queue_depth","Jobs queued to disk writer threads.",[this]() {return writer ? writer->queueDepth() : 0;});
+
+   metricsRegistry->addGauge("scdimg_packed_objects","Objects packed into segment store.",[this]() {return segStore ? segStore->count() : 0;});
+
+   metricsRegistry->addCounter("scdimg_log_dropped_total","Log messages dropped because a log ring was full.",[]() -> double
+   {
+      SCDImgLogger *logger = SCDImgLogger::instance();
+
+      return logger ? logger->dropped() : 0;
+   });
+}
+
 /**
  * @brief SCDImgServer::threadDestroyed handle signal threadDestroyed emit when client thared is destroyed
  * @param obj
@@ -80,6 +844,8 @@ void SCDImgServer::threadDestroyed(QObject *obj)
    QTextStream mess(&msg);
 
    mess << "Thread destroyed ID: " << thd->getSocketDescriptor();
+
+   connections--;
 }
 
 /**
@@ -88,9 +854,44 @@ void SCDImgServer::threadDestroyed(QObject *obj)
  */
 void SCDImgServer::incomingConnection(qintptr socketDescriptor)
 {
-   qDebug() << "New socket connection: " << socketDescriptor;
+   acceptConnection(socketDescriptor, SCDImgServerThread::PR_SCDFTH);
+}
+
+/**
+ * @brief SCDImgServer::acceptConnection start a connection thread, shared by SCDFTH and HTTP listeners
+ * @param socketDescriptor
+ * @param protocol         SCDImgServerThread::Protocol
+ */
+void SCDImgServer::acceptConnection(qintptr socketDescriptor, int protocol)
+{
+   logDebug() << "New socket connection: " << socketDescriptor;
+
+   if (maxConnections>0 && connections.load()>=maxConnections) // admission control: reject without starting a thread
+   {
+      static const char busy[]     = "Server busy\n";
+      static const char httpBusy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\nRetry-After: 1\r\n\r\n";
+
+      if (protocol==SCDImgServerThread::PR_HTTP)
+      {
+         ::send(static_cast<int>(socketDescriptor),httpBusy,sizeof(httpBusy)-1,MSG_NOSIGNAL|MSG_DONTWAIT);
+      }
+      else
+      {
+         ::send(static_cast<int>(socketDescriptor),busy,sizeof(busy)-1,MSG_NOSIGNAL|MSG_DONTWAIT);
+      }
+
+      ::close(static_cast<int>(socketDescriptor));
+
+      rejects++;
+
+      logWarning() << "Connection rejected, max connections reached: " << maxConnections;
+
+      return;
+   }
+
+   connections++;
 
-   SCDImgServerThread *sckThread = new SCDImgServerThread(this,socketDescriptor);
+   SCDImgServerThread *sckThread = new SCDImgServerThread(this,socketDescriptor,protocol);
 
    connect(sckThread, SIGNAL(finished())         , sckThread , SLOT(deleteLater()));
    connect(sckThread, SIGNAL(destroyed(QObject*)), this      , SLOT(threadDestroyed(QObject*)));
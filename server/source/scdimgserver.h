@@ -2,6 +2,26 @@
 #define SCDIMGSERVER_H
 
 #include <QTcpServer>
+#include <QFileSystemWatcher>
+
+#include <atomic>
+
+#include "scdimgsegmentstore.h"
+#include "scdimgstorageio.h"
+#include "scdimgdiskwriter.h"
+#include "scdimgcommitter.h"
+#include "scdimgratelimiter.h"
+#include "scdimgtimerwheel.h"
+#include "scdimgmetrics.h"
+#include "scdimgtrace.h"
+#include "scdimgrootpaths.h"
+#include "scdimgreplicator.h"
+#include "scdimghashindex.h"
+#include "scdimgmetaindex.h"
+#include "scdimgsheet.h"
+
+class SCDImgHttpGateway;
+class SCDImgLocalListener;
 
 class SCDImgServer : public QTcpServer
 {
@@ -13,15 +33,148 @@ class SCDImgServer : public QTcpServer
      QString rootPath;
      QString lastErrorMsg;
 
+     SCDImgRootPaths *roots; // root paths files are striped across
+
+     SCDImgSegmentStore     *segStore;  // small objects packing store (null if disabled)
+     SCDImgSegmentCompactor *compactor;
+
+     SCDImgUring *ioRing; // io_uring ring shared by storage handles (null: QFile backend)
+
+     SCDImgDiskWriter *writer;      // disk writer stage (null if disabled)
+     qint64 sockReadBufferSize;     // socket read buffer size of uploads handed to disk writer
+
+     SCDImgCommitter *commitStage;  // durability of uploads
+
+     SCDImgRateLimiter *limiter;    // bandwidth shaping
+
+     QFileSystemWatcher *cfgWatcher;
+     QString             cfgFile;
+
+     SCDImgTimerWheel *wheel;       // connections timeouts
+     int maxConnections;            // max concurrent connections (0: unlimited)
+     int acceptBacklog;             // listen backlog
+     int headerTimeoutMsecs;        // max time to receive the request header (0: disabled)
+     int idleTimeoutMsecs;          // max inactivity time after the header (0: disabled)
+
+     std::atomic<int>     connections;     // active connections
+     std::atomic<quint64> rejects;         // connections rejected by admission control
+     std::atomic<quint64> headerEvictions; // connections evicted by header timeout
+     std::atomic<quint64> idleEvictions;   // connections evicted by idle timeout
+
+     SCDImgMetrics       *metricsRegistry;
+     SCDImgMetricsServer *metricsServer;  // metrics endpoint (null if disabled)
+     QString              metricsAddress;
+     int                  metricsPort;    // 0: endpoint disabled
+
+     void registerMetrics();
+
+     SCDImgSlowLog *slow; // slow requests log (null if disabled)
+
+     SCDImgCaptureLog *capture; // traffic capture (null if disabled)
+
+     SCDImgReplicator *replication; // PUT/DEL forwarding to peers (null if disabled)
+
+     SCDImgHashIndex *hashes; // content hashes of hash-first uploads (null if dedup is disabled)
+
+     SCDImgMetaIndex *metadata; // image metadata of uploaded objects (null if disabled)
+
+     SCDImgSheetCache *sheets; // contact sheets cache (null if disabled)
+
+     SCDImgHttpGateway *httpGateway; // HTTP read-only gateway (null if disabled)
+     QString            httpAddress;
+     int                httpPort;    // 0: gateway disabled
+
+     SCDImgLocalListener *localListener; // Unix socket listener (null if disabled)
+     QString              localPath;     // empty: disabled
+     bool                 localWorld;    // any local user can connect (default: owner and group only)
+
    public:
 
      explicit SCDImgServer(QObject *parent = 0, int port=12345, QString rootPath="./");
 
+     ~SCDImgServer();
+
      int start(); // Start tcp server for incoming connections
 
      QString lastError();
 
-     QString getRootPath();
+     QString getRootPath(); // first root path
+
+     void setRootPaths(QStringList paths); // stripe files across several root paths. Call it before start()
+
+     SCDImgRootPaths *rootPaths();
+
+     void setSegmentStore(QString path, qint64 threshold, qint64 maxSegmentSize, int compactInterval, double compactRatio);
+
+     SCDImgSegmentStore *segmentStore();
+
+     void setStorageIO(int backend, int queueDepth);
+
+     SCDImgStorageIO *createStorageIO();
+
+     void setDiskWriter(int threads, int queueSize, qint64 readBufferSize);
+
+     SCDImgDiskWriter *diskWriter();
+
+     qint64 readBufferSize();
+
+     void setDurability(int mode, int groupInterval); // SCDImgCommitter::Mode. Call it before start()
+
+     SCDImgCommitter *committer();
+
+     SCDImgRateLimiter *rateLimiter();
+
+     void setRateLimits(qint64 global, qint64 perClientIp, qint64 perConnection);
+
+     void watchConfig(QString fileName); // reload runtime adjustable settings when config file changes
+
+     void setConnectionLimits(int maxConnections, int backlog, int headerTimeout, int idleTimeout, int timerTick);
+
+     SCDImgTimerWheel *timerWheel();
+
+     int headerTimeout();
+     int idleTimeout();
+
+     void connectionEvicted(bool headerTimeout); // count an evicted connection
+
+     int     activeConnections();
+     quint64 rejectedConnections();
+     quint64 headerTimeouts();
+     quint64 idleTimeouts();
+
+     void setMetricsEndpoint(QString address, int port); // Prometheus text endpoint. Call it before start()
+
+     SCDImgMetrics *metrics();
+
+     void setSlowLog(QString fileName, int thresholdMsecs); // trace requests and log slower ones. Call it before start()
+
+     SCDImgSlowLog *slowLog();
+
+     void setCapture(QString fileName, qint64 maxSize); // record requests metadata for replay. Call it before start()
+
+     SCDImgCaptureLog *captureLog();
+
+     void setReplication(QStringList peers, QString logPath, int batch, int pipeline, qint64 segmentSize, int timeout); // Call it before start()
+
+     SCDImgReplicator *replicator();
+
+     void setHttpGateway(QString address, int port); // HTTP/1.1 GET/HEAD gateway on storage. Call it before start()
+
+     void setLocalSocket(QString path, bool worldAccess=false); // Unix socket listener for clients on this host. Call it before start()
+
+     void setHashIndex(QString fileName); // skip hash-first uploads of content already stored. Call it before start()
+
+     SCDImgHashIndex *hashIndex();
+
+     void setMetaIndex(QString fileName); // extract image metadata of uploads for INFO command. Call it before start()
+
+     SCDImgMetaIndex *metaIndex();
+
+     void setSheetCache(qint64 maxBytes); // cache contact sheets of folders (SHEET command). Call it before start()
+
+     SCDImgSheetCache *sheetCache();
+
+     void acceptConnection(qintptr socketDescriptor, int protocol); // start a connection thread (admission control)
 
    signals:
 
@@ -29,6 +182,8 @@ class SCDImgServer : public QTcpServer
 
      void threadDestroyed(QObject *obj);
 
+     void configChanged(const QString &fileName);
+
    protected:
 
      void incomingConnection(qintptr SocketDescriptor);
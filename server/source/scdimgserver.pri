@@ -0,0 +1,64 @@
+# SCD Image Server sources shared by the server and the bench targets (main.cpp excluded)
+
+INCLUDEPATH += $$PWD
+INCLUDEPATH += $$PWD/../../lib/protocol
+
+SOURCES += \
+    $$PWD/scdimgserver.cpp \
+    $$PWD/scdimgcommitter.cpp \
+    $$PWD/scdimgdiskwriter.cpp \
+    $$PWD/scdimgexif.cpp \
+    $$PWD/scdimghashindex.cpp \
+    $$PWD/scdimghttp.cpp \
+    $$PWD/scdimgindexlog.cpp \
+    $$PWD/scdimglocal.cpp \
+    $$PWD/scdimglogger.cpp \
+    $$PWD/scdimgmetaindex.cpp \
+    $$PWD/scdimgmetrics.cpp \
+    $$PWD/scdimgratelimiter.cpp \
+    $$PWD/scdimgreplicator.cpp \
+    $$PWD/scdimgrootpaths.cpp \
+    $$PWD/scdimgsegmentstore.cpp \
+    $$PWD/scdimgsheet.cpp \
+    $$PWD/scdimgstorageio.cpp \
+    $$PWD/scdimgtimerwheel.cpp \
+    $$PWD/scdimgtrace.cpp \
+    $$PWD/scdimgserverthread.cpp \
+    $$PWD/../../lib/protocol/scdimgcapture.cpp \
+    $$PWD/../../lib/protocol/scdimgdelta.cpp \
+    $$PWD/../../lib/protocol/scdimglocalsocket.cpp
+
+HEADERS += \
+    $$PWD/scdimgserver.h \
+    $$PWD/scdimgboundedqueue.h \
+    $$PWD/scdimgcommitter.h \
+    $$PWD/scdimgdiskwriter.h \
+    $$PWD/scdimgexif.h \
+    $$PWD/scdimghashindex.h \
+    $$PWD/scdimghttp.h \
+    $$PWD/scdimgindexlog.h \
+    $$PWD/scdimglocal.h \
+    $$PWD/scdimglogger.h \
+    $$PWD/scdimgmetaindex.h \
+    $$PWD/scdimgmetrics.h \
+    $$PWD/scdimgratelimiter.h \
+    $$PWD/scdimgreplicator.h \
+    $$PWD/scdimgrootpaths.h \
+    $$PWD/scdimgsegmentstore.h \
+    $$PWD/scdimgsheet.h \
+    $$PWD/scdimgstorageio.h \
+    $$PWD/scdimgtimerwheel.h \
+    $$PWD/scdimgtrace.h \
+    $$PWD/scdimgserverthread.h \
+    $$PWD/../../lib/protocol/scdimgcapture.h \
+    $$PWD/../../lib/protocol/scdimgdelta.h \
+    $$PWD/../../lib/protocol/scdimglocalsocket.h
+
+# io_uring storage backend: build with "qmake CONFIG+=uring" (requires liburing)
+uring {
+    DEFINES += SCD_USE_URING
+    LIBS    += -luring
+
+    SOURCES += $$PWD/scdimguringio.cpp
+    HEADERS += $$PWD/scdimguringio.h
+}
@@ -17,10 +17,6 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 DESTDIR = ../bin
 
-SOURCES += main.cpp \
-    scdimgserver.cpp \
-    scdimgserverthread.cpp
+SOURCES += main.cpp
 
-HEADERS += \
-    scdimgserver.h \
-    scdimgserverthread.h
+include(scdimgserver.pri)
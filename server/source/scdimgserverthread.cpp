@@ -3,7 +3,7 @@
  *
  * @brief SCD Image Server Thread management
  *
- *        This is a this part of SCD Image Server
+ *        This is a part of SCD Image Server
  *
  * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
  *
@@ -16,16 +16,31 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QImageReader>
+#include <QBuffer>
 #include <QRegularExpression>
+#include <QTimer>
+#include <QSet>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "scdimgserverthread.h"
+#include "scdimghttp.h"
+#include "scdimgexif.h"
+#include "scdimglogger.h"
+#include "scdimglocalsocket.h"
+
+#define SEND_CHUNK 65536 // max bytes written to socket at once when output is rate limited
+#define INFO_PATHS 10000 // max objects of an INFO command
 
 /**
  * @brief SCDImgServerThread::SCDImgServerThread constructor
  * @param Id
  * @param parent
  */
-SCDImgServerThread::SCDImgServerThread(SCDImgServer *parent, qintptr socketDescriptor): QThread(parent), pserver(parent), socketDescriptor(socketDescriptor)
+SCDImgServerThread::SCDImgServerThread(SCDImgServer *parent, qintptr socketDescriptor, int protocol): QThread(parent), pserver(parent), socketDescriptor(socketDescriptor), protocol(protocol)
 {
 
 }
@@ -35,7 +50,7 @@ SCDImgServerThread::SCDImgServerThread(SCDImgServer *parent, qintptr socketDescr
  */
 void SCDImgServerThread::run()
 {
-   qDebug() << "Starting connection thread: " << socketDescriptor;
+   logDebug() << "Starting connection thread: " << socketDescriptor;
 
    QTcpSocket *socket = new QTcpSocket();                            // allocates new socket object (live into a thread memory space)
 
@@ -45,21 +60,23 @@ void SCDImgServerThread::run()
 
    if (socket->setSocketDescriptor(socketDescriptor))                // set a socket descriptor of new allocated socket object
    {
-      SignalsHandler sh(this,socket);
+      SignalsHandler *sh = (protocol==PR_HTTP) ? new SCDImgHttpHandler(this,socket) : new SignalsHandler(this,socket);
 
-      qDebug() << "Accepted connection from host: " << socketDescriptor
-               << " Address: " << socket->peerAddress().toString() << ":" << socket->peerPort();
+      logDebug() << "Accepted connection from host: " << socketDescriptor
+                 << " Address: " << socket->peerAddress().toString() << ":" << socket->peerPort();
 
       exec(); // starts event loop and waits until event loop exits
+
+      delete sh;
    }
    else
    {
-      qDebug() << "Error: Unable to set socket descriptor " << socket->error();
+      logError() << "Error: Unable to set socket descriptor " << socket->error();
    }
 
    delete socket; // explict socket deleting
 
-   qDebug() << "Connection thread end: " << socketDescriptor;
+   logDebug() << "Connection thread end: " << socketDescriptor;
 }
 
 /**
@@ -78,7 +95,7 @@ SCDImgServer *SCDImgServerThread::server()
  *        the server thread TCP Socket connection. This class live into thread space, and process
  *        the signal of thread event loop.
  *
- *        This is a this part of SCD Image Server
+ *        This is a part of SCD Image Server
  *
  * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
  *
@@ -90,11 +107,14 @@ SCDImgServer *SCDImgServerThread::server()
  * @param socket
  * @param mc
  */
-SignalsHandler::SignalsHandler(SCDImgServerThread *parent, QTcpSocket *socket): parent(parent), socket(socket)
+SignalsHandler::SignalsHandler(SCDImgServerThread *parent, QTcpSocket *socket): parent(parent), socket(socket), contentHasher(QCryptographicHash::Sha256)
 {
    commands.insert(GET, "GET");
    commands.insert(PUT, "PUT");
    commands.insert(DEL, "DEL");
+   commands.insert(DPUT,"DPUT");
+   commands.insert(INFO,"INFO");
+   commands.insert(SHEET,"SHEET");
 
    connect(socket,SIGNAL(readyRead()),this,SLOT(readyRead()));
    connect(socket,SIGNAL(disconnected()),this,SLOT(disconnected()));
@@ -104,7 +124,84 @@ SignalsHandler::SignalsHandler(SCDImgServerThread *parent, QTcpSocket *socket):
 
    maxHeaderSize = 1024;
 
-   rootPath = parent->server()->getRootPath();
+   roots = parent->server()->rootPaths();
+
+   store = parent->server()->segmentStore();
+
+   packed = false;
+   patch  = 0;
+
+   f = parent->server()->createStorageIO();
+
+   writer = parent->server()->diskWriter();
+
+   committer = parent->server()->committer();
+
+   replicator = parent->server()->replicator();
+   replicated = false;
+
+   hashes = parent->server()->hashIndex();
+
+   metaIndex = parent->server()->metaIndex();
+   infoCount = 0;
+
+   sheets    = parent->server()->sheetCache();
+   sheetPage = 0;
+   sheetSize = SCDImgSheetCache::MAX_IMAGES;
+
+   limit = parent->server()->rateLimiter()->attach(socket->peerAddress().toString());
+
+   outPos        = 0;
+   sendPaused    = false;
+   receivePaused = false;
+
+   connect(socket,SIGNAL(bytesWritten(qint64)),this,SLOT(sendChunk()));
+
+   wheel       = parent->server()->timerWheel();
+   idleTimeout = parent->server()->idleTimeout();
+
+   headerReceived = false;
+
+   thumbnail  = false;
+   validators = false;
+   local      = (parent->getProtocol()==SCDImgServerThread::PR_LOCAL);
+   descriptor = false;
+
+   metrics = parent->server()->metrics()->acquire();
+   op      = -1;
+
+   slowLog = parent->server()->slowLog();
+
+   capture = parent->server()->captureLog();
+
+   timeout.receiver = this;
+   timeout.method   = "onTimeout";
+
+   if (parent->server()->headerTimeout()>0) // header must be entirely received within header timeout
+   {
+      wheel->arm(&timeout,parent->server()->headerTimeout());
+   }
+}
+
+/**
+ * @brief SignalsHandler::~SignalsHandler destructor
+ */
+SignalsHandler::~SignalsHandler()
+{
+   wheel->cancel(&timeout);
+
+   traceDone();
+
+   if (upload)
+   {
+      upload->detach(status!=WAITFORCOMMIT); // file entirely received is committed anyway
+   }
+
+   parent->server()->metrics()->release(metrics);
+
+   delete limit;
+   delete f;
+   delete patch;
 }
 
 /**
@@ -134,34 +231,73 @@ void SignalsHandler::readyRead()
 
    Command command;
 
+   bufferUsage();
+
    switch (status)
    {
       case WAITFORHEADER:
 
+        if (!socket->canReadLine() && socket->bytesAvailable()<maxHeaderSize)
+        {
+           return; // header line not entirely received: wait for more data (or header timeout)
+        }
+
+        if (!headerReceived) // request begins
+        {
+           requestTimer.start();
+
+           trace.start(slowLog!=0);
+        }
+
         if (readHeader(command))
         {
+           trace.mark(SCDImgTrace::PH_HEADER);
+
+           headerReceived = true;
+
+           touch(); // header timeout is replaced by idle timeout
+
            if (fileName.startsWith('/'))  // check path syntax
            {
-              fileName = rootPath + fileName.remove(0,1);
+              objectKey = fileName;
+
+              fileName = (command==PUT || command==DPUT) ? roots->home(objectKey) : roots->locate(objectKey); // PUT always stores on home root
 
               switch (command)
               {
                  case GET: // GET command received: downloading file to client
 
-                   qDebug() << "GET: " + fileName;
+                   op = thumbnail ? SCDImgMetricsBlock::OP_GETTHUMB : SCDImgMetricsBlock::OP_GET;
+
+                   logDebug() << "GET: " + fileName;
 
                    if (thumbnail)
                    {
                       ret = sendThumbnail(fileName);
                    }
                    else
+                   if (descriptor)
+                   {
+                      ret = sendDescriptor(); // local client reads the object from a descriptor
+                   }
+                   else
+                   if (store && store->contains(objectKey))
+                   {
+                      ret = sendPacked(objectKey); // send a packed object to client
+                   }
+                   else
                    {
                       ret = sendFile(fileName); // send a file to client
                    }
 
                    if (ret>0)
                    {
-                      socket->disconnectFromHost();
+                      if (status!=DATASEND) // rate limited output closes connection when sent
+                      {
+                         requestDone(true);
+
+                         socket->disconnectFromHost();
+                      }
 
                       return; // success
                    }
@@ -170,12 +306,16 @@ void SignalsHandler::readyRead()
 
                  case DEL: // DEL command received: deleting file from server
 
-                   qDebug() << "DEl: " + fileName;
+                   op = SCDImgMetricsBlock::OP_DEL;
+
+                   logDebug() << "DEl: " + fileName;
 
                    ret = delFile(fileName); // delete a specified file
 
                    if (ret)
                    {
+                      requestDone(true);
+
                       socket->write("ok"); // sends confirm to client: client will close connection.
                       socket->flush();
                       socket->disconnectFromHost();
@@ -187,12 +327,42 @@ void SignalsHandler::readyRead()
 
                  case PUT: // PUT command found: uploading file to server
 
-                   qDebug() << "PUT: " + fileName;
+                   op = SCDImgMetricsBlock::OP_PUT;
+
+                   trace.setSize(fileSize);
+
+                   logDebug() << "PUT: " + fileName;
+
+                   if (!contentHash.isEmpty() && hashes) // hash-first upload: content may be already stored
+                   {
+                      ret = storedContent();
+
+                      if (ret==2)
+                      {
+                         trace.mark(SCDImgTrace::PH_COMMIT);
+
+                         requestDone(true);
+
+                         socket->write("ok");          // sends confirm to client: data is not sent
+                         socket->flush();
+                         socket->disconnectFromHost();
+
+                         return; // success
+                      }
+                   }
 
                    ret = fileReceivingPrepare(fileName); // preparing for file receiving
 
                    if (ret)
                    {
+                      if (!contentHash.isEmpty())
+                      {
+                         contentHasher.reset();
+
+                         socket->write("send\n"); // hash-first upload: client waits for it before sending data
+                         socket->flush();
+                      }
+
                       ret = readData(); // read remainign availaible data
 
                       if (ret==1) // buffer not entirely received: change status to WAITFORDATA
@@ -204,6 +374,62 @@ void SignalsHandler::readyRead()
                    }
 
                  break;
+
+                 case INFO: // INFO command received: image metadata of one or more objects
+
+                   op = SCDImgMetricsBlock::OP_INFO;
+
+                   logDebug() << "INFO: " + objectKey;
+
+                   ret = readInfoPaths(); // replies when all paths are received
+
+                   if (ret>0)
+                   {
+                      return; // success
+                   }
+
+                 break;
+
+                 case SHEET: // SHEET command received: contact sheet of a folder
+
+                   op = SCDImgMetricsBlock::OP_SHEET;
+
+                   logDebug() << "SHEET: " + objectKey;
+
+                   ret = sendSheet();
+
+                   if (ret>0)
+                   {
+                      if (status!=DATASEND) // rate limited output closes connection when sent
+                      {
+                         requestDone(true);
+
+                         socket->disconnectFromHost();
+                      }
+
+                      return; // success
+                   }
+
+                 break;
+
+                 case DPUT: // delta PUT: signatures of stored copy are sent, the client answers with the delta stream
+
+                   op = SCDImgMetricsBlock::OP_PUT;
+
+                   trace.setSize(fileSize);
+
+                   logDebug() << "DPUT: " + fileName;
+
+                   ret = deltaPrepare();
+
+                   if (ret)
+                   {
+                      status = WAITFORDATA;
+
+                      return; // success
+                   }
+
+                 break;
               }              
            }
            else
@@ -218,17 +444,47 @@ void SignalsHandler::readyRead()
 
       case WAITFORDATA: // receiving remainig data...
 
+        touch();
+
         if (readData()>0)
         {
            return;
         }
 
       break;
+
+      case WAITFORPATHS: // receiving remaining INFO paths...
+
+        touch();
+
+        ret = readInfoPaths();
+
+        if (ret>0)
+        {
+           return;
+        }
+
+      break;
+
+      case WAITFORCOMMIT: // file entirely received: waiting for disk writer
+
+        socket->readAll(); // discard exceeding data
+
+      return;
    }
 
-   // on error ---------------------------------------
+   replyError(ret);
+}
+
+/**
+ * @brief SignalsHandler::replyError on error sends last error message to client and closes connection
+ * @param ret 0: send error message, -1: socket error (abort connection)
+ */
+void SignalsHandler::replyError(int ret)
+{
+   logWarning() << lastErrorMsg;
 
-   qDebug() << lastErrorMsg;
+   requestDone(false);
 
    switch (ret)
    {
@@ -250,7 +506,11 @@ void SignalsHandler::readyRead()
  */
 void SignalsHandler::disconnected()
 {
-   qDebug() << "Client disconnected: " << socket->objectName();
+   logDebug() << "Client disconnected: " << socket->objectName();
+
+   trace.mark(SCDImgTrace::PH_DRAIN); // reply entirely sent
+
+   traceDone();
 
    thread()->quit(); // exit from thread event loop
 }
@@ -260,137 +520,503 @@ void SignalsHandler::disconnected()
  */
 void SignalsHandler::onSocketError(QAbstractSocket::SocketError error)
 {
-   qDebug() << error << socket->errorString();
+   logDebug() << "Socket error " << error << ": " << socket->errorString();
+
+   requestDone(false);
 
-   if (f.isOpen())
+   packBuff.clear();
+
+   if (upload)
+   {
+      upload->detach(true); // discard queued writes and remove file
+      upload.clear();
+   }
+
+   if (f->isOpen())
    {
-      f.close();
-      f.remove();
+      f->remove(); // close and delete file
    }
 
    socket->abort();
 }
 
 /**
- * @brief SignalsHandler::checkField split header intem anf get field name and valu,
- *                                   if field name match fieldName param add it to header map and return 1
- *                                   else return 0;
- * @param headerItem header item in format <field name>:<value>
- * @param fieldName
- * @return 1 on success, 0 un failure
+ * @brief SignalsHandler::writeResumed disk writer queue has free space: resume socket reading
  */
-int SignalsHandler::checkHeaderField(const QString &headerItem, const QString &fieldName)
+void SignalsHandler::writeResumed()
 {
-   QStringList field = headerItem.split(":"); // split into field name and value pair
-
-   if (field.size() != 2)
+   if (upload && status==WAITFORDATA)
    {
-      lastErrorMsg = "Bad header item: " + headerItem;
-      return 0;
+      readyRead();
    }
+}
 
-   QString name = field.at(0).trimmed();
+/**
+ * @brief SignalsHandler::writeCompleted disk writer or group commit has made the received file durable (or failed)
+ * @param ret    1 on success, 0 on failure
+ * @param errMsg
+ */
+void SignalsHandler::writeCompleted(int ret, QString errMsg)
+{
+   upload.clear();
 
-   if (name==fieldName)
+   trace.mark(SCDImgTrace::PH_COMMIT);
+
+   if (ret)
    {
-       header.insert(name,field.at(1).trimmed());
-       return 1;
+      requestDone(true);
+
+      socket->write("ok");          // sends confirm to client: client will close connection.
+      socket->flush();
+      socket->disconnectFromHost(); // close connection
+
+      return;
    }
 
-   lastErrorMsg = "Bad header field name: " + headerItem;
+   lastErrorMsg = errMsg;
 
-   return 0;
+   replyError(0);
 }
 
 /**
- * @brief SCDTopicServer::checkHeaderField
- * @param headerItem
- * @param cmd
- * @return
+ * @brief SignalsHandler::sendChunk send the next chunks of rate limited output, as long as tokens are available
+ *                                  and socket write buffer is not full. When all data is sent closes connection.
  */
-int SignalsHandler::checkHeaderField(const QString &headerItem, Command &cmd)
+void SignalsHandler::sendChunk()
 {
-    QStringList field = headerItem.split(":"); // split into field name and value pair
+   touch(); // bytes written: client is alive
 
-    if (field.size() != 2)
-    {
-       lastErrorMsg = "Bad header item: " + headerItem;
-       return 0;
-    }
+   bufferUsage();
 
-    QString name = field.at(0).trimmed();
+   if (status!=DATASEND || sendPaused)
+   {
+      return;
+   }
 
-    int index = commands.indexOf(QRegularExpression(name));
+   while (outPos<outBuff.size())
+   {
+      if (socket->bytesToWrite()>=SEND_CHUNK)
+      {
+         return; // wait for bytesWritten()
+      }
 
-    if (index>-1)
-    {
-       header.insert(name,field.at(1).trimmed());
+      qint64 wanted = qMin<qint64>(SEND_CHUNK, outBuff.size()-outPos);
+      qint64 bytes  = limit->grant(SCDImgRateLimit::RL_OUT, wanted);
 
-       cmd = static_cast<enum Command>(index);
+      if (bytes==0)
+      {
+         sendPaused = true;
 
-       return 1;
-    }
+         QTimer::singleShot(limit->waitTime(SCDImgRateLimit::RL_OUT,wanted), this, SLOT(sendResumed()));
 
-    lastErrorMsg = "Unknown header field: " + name;
+         return;
+      }
 
-    return 0;
+      if (socket->write(outBuff.constData()+outPos,bytes)==-1)
+      {
+         lastErrorMsg = "Socket write error";
+
+         replyError(-1);
+
+         return;
+      }
+
+      outPos += static_cast<int>(bytes);
+   }
+
+   outBuff.clear();
+
+   trace.mark(SCDImgTrace::PH_SEND);
+
+   outputDone();
 }
 
 /**
- * @brief SignalsHandler::readHeader read headers lines and fill header map.
- *        Call this method only when statu=WAITFORHEADER.
- *        when header read is complete the stustus change to WAITFORDATA.
- *        on error return 0, otherwise return 1.
- *        Do not use the sequence '|' (sharp) char into complete file path
- *
- *        SCDFTH (one line fast header struct)
- *
- *          PUT command => SCDFTH:1.0\tPUT:<complete file path>\t<FILESIZE>\n<FILESIZE DATA BYTES>
- *          GET command => SCDFTH:1.0\tGET:<complete file path>\n          // download a file
- *          GET command => SCDFTH:1.0\tGET:<complete file path>\tT\n       // get a thumbnail
- *          DEL command => SCDFTH:1.0\tDEL:<complete file path>\n          // delete a file
-  *
- *          See SCD Image Client to send a command to server
- *
- *          PUT command upload a binary file to server into a specified path
- *          GET command download a binary file from a specified path
- *          DEL command delete the specified file from server
- *
- * @return 1 on success, 0 on failure
- *
+ * @brief SignalsHandler::outputDone rate limited output entirely sent: request ends, connection is closed
  */
-int SignalsHandler::readHeader(Command &command)
+void SignalsHandler::outputDone()
 {
-   QByteArray row;
+   requestDone(true);
 
-   row = socket->readLine(maxHeaderSize);
+   socket->disconnectFromHost();
+}
 
-   if (row.size()==0)
+/**
+ * @brief SignalsHandler::sendResumed output tokens available
+ */
+void SignalsHandler::sendResumed()
+{
+   sendPaused = false;
+
+   sendChunk();
+}
+
+/**
+ * @brief SignalsHandler::receiveResumed input tokens available: read buffered data
+ */
+void SignalsHandler::receiveResumed()
+{
+   receivePaused = false;
+
+   if (status==WAITFORDATA)
    {
-      lastErrorMsg = "Null header line";
-      return -1;   // socket error
+      readyRead();
    }
+}
 
-   QString head = QString::fromLatin1(row);
-
-   QStringList fields = head.split("\t",QString::SkipEmptyParts);
+/**
+ * @brief SignalsHandler::onTimeout header or idle timeout expired: evict connection. A connection waiting
+ *                                  for the server (disk writer or rate limits) is not idle: timeout is re-armed.
+ */
+void SignalsHandler::onTimeout()
+{
+   if (!wheel->expired(&timeout)) // re-armed by activity after expiration: stale call
+   {
+      return;
+   }
 
-   if (fields.size()<2) // header must have at least two elements
+   if (headerReceived && (status==WAITFORCOMMIT || sendPaused || receivePaused || !pendingBuff.isEmpty()))
    {
-      lastErrorMsg = "Invalid header: " + head;
-      return 0;
+      touch();
+      return;
    }
 
-   if (checkHeaderField(fields.at(0),"SCDFTH"))   // first item must be header type declaration
-   { 
-      if (checkHeaderField(fields.at(1),command)) // get the command
-      {
+   parent->server()->connectionEvicted(!headerReceived);
+
+   requestDone(false);
+
+   logWarning() << (!headerReceived ? "Header timeout, evicting connection: " : "Idle timeout, evicting connection: ") << socket->objectName();
+
+   packBuff.clear();
+   outBuff.clear();
+
+   if (upload)
+   {
+      upload->detach(true); // discard queued writes and remove file
+      upload.clear();
+   }
+
+   if (f->isOpen())
+   {
+      f->remove(); // close and delete file
+   }
+
+   socket->abort();
+
+   thread()->quit(); // exit from thread event loop
+}
+
+/**
+ * @brief SignalsHandler::touch connection activity: re-arm idle timeout (cancels header timeout)
+ */
+void SignalsHandler::touch()
+{
+   if (idleTimeout>0)
+   {
+      wheel->arm(&timeout,idleTimeout);
+   }
+   else
+   {
+      wheel->cancel(&timeout);
+   }
+}
+
+/**
+ * @brief SignalsHandler::requestDone record latency (or error) of current request, and write it to access log
+ * @param success
+ */
+void SignalsHandler::requestDone(bool success)
+{
+   if (op<0)
+   {
+      return; // no request or already recorded
+   }
+
+   trace.setResult(op,success);
+
+   quint64 usecs = static_cast<quint64>(requestTimer.nsecsElapsed()/1000);
+
+   if (SCDImgLogger::accessEnabled())
+   {
+      SCDImgLogLine(SCDImgLogger::LV_INFO,SCDImgLogger::CH_ACCESS) << socket->peerAddress().toString() << '\t' << SCDImgMetrics::opName(op) << '\t'
+                                                                  << objectKey << '\t' << (success ? "ok" : "error") << '\t' << trace.size() << '\t' << usecs;
+   }
+
+   if (capture)
+   {
+      capture->record(op, objectKey, trace.size(), static_cast<qint64>(usecs), success);
+   }
+
+   if (success)
+   {
+      metrics->latency[op].record(usecs);
+
+      if (op==SCDImgMetricsBlock::OP_PUT || op==SCDImgMetricsBlock::OP_DEL) // the object may have moved between file and segment store
+      {
+         dropThumbnails();
+      }
+
+      if (hashes && (op==SCDImgMetricsBlock::OP_PUT || op==SCDImgMetricsBlock::OP_DEL)) // keep content hashes of stored objects
+      {
+         if (op==SCDImgMetricsBlock::OP_PUT && !contentHash.isEmpty())
+         {
+            hashes->insert(objectKey, contentHash, objectValidator(objectKey));
+         }
+         else
+         {
+            hashes->remove(objectKey);
+         }
+      }
+
+      if (sheets && (op==SCDImgMetricsBlock::OP_PUT || op==SCDImgMetricsBlock::OP_DEL)) // contact sheets of folder are stale
+      {
+         sheets->invalidate(SCDImgSheetCache::folderOf(objectKey));
+      }
+
+      if (metaIndex && (op==SCDImgMetricsBlock::OP_PUT || op==SCDImgMetricsBlock::OP_DEL)) // keep image metadata of stored objects
+      {
+         if (op==SCDImgMetricsBlock::OP_PUT)
+         {
+            metaIndex->queue(objectKey); // read by the background extractor: the reply does not wait for it
+         }
+         else
+         {
+            metaIndex->remove(objectKey);
+         }
+      }
+
+      if (replicator && !replicated && (op==SCDImgMetricsBlock::OP_PUT || op==SCDImgMetricsBlock::OP_DEL)) // object stored or deleted: forward it to peers
+      {
+         replicator->append(op==SCDImgMetricsBlock::OP_PUT ? SCDImgReplicationLog::OP_PUT : SCDImgReplicationLog::OP_DEL, objectKey);
+      }
+   }
+   else
+   {
+      SCDImgMetricsBlock::add(metrics->errors[op],1);
+   }
+
+   op = -1;
+}
+
+/**
+ * @brief SignalsHandler::traceDone end request tracing: write request to slow log if it exceeds threshold
+ */
+void SignalsHandler::traceDone()
+{
+   if (!trace.active())
+   {
+      return;
+   }
+
+   trace.stop();
+
+   if (slowLog->isSlow(trace))
+   {
+      slowLog->write(trace, socket->peerAddress().toString(), objectKey);
+   }
+}
+
+/**
+ * @brief SignalsHandler::bufferUsage update buffer memory gauge of this connection
+ */
+void SignalsHandler::bufferUsage()
+{
+   qint64 bytes = packBuff.capacity() + outBuff.capacity() + pendingBuff.capacity() + deltaIn.capacity() + deltaOut.capacity() + socket->bytesAvailable() + socket->bytesToWrite();
+
+   metrics->buffered.store(bytes,std::memory_order_relaxed);
+}
+
+/**
+ * @brief SignalsHandler::receive read the available socket data granted by input rate limit.
+ *                                If some data is left, reading is resumed when tokens are available.
+ * @return
+ */
+QByteArray SignalsHandler::receive()
+{
+   if (!limit->limited(SCDImgRateLimit::RL_IN))
+   {
+      QByteArray buff = socket->readAll();
+
+      SCDImgMetricsBlock::add(metrics->bytesIn,static_cast<quint64>(buff.size()));
+
+      return buff;
+   }
+
+   qint64 available = socket->bytesAvailable();
+   qint64 bytes     = limit->grant(SCDImgRateLimit::RL_IN, available);
+
+   if (bytes<available && !receivePaused)
+   {
+      receivePaused = true;
+
+      QTimer::singleShot(limit->waitTime(SCDImgRateLimit::RL_IN, available-bytes), this, SLOT(receiveResumed()));
+   }
+
+   SCDImgMetricsBlock::add(metrics->bytesIn,static_cast<quint64>(bytes));
+
+   return socket->read(bytes);
+}
+
+/**
+ * @brief SignalsHandler::checkField split header intem anf get field name and valu,
+ *                                   if field name match fieldName param add it to header map and return 1
+ *                                   else return 0;
+ * @param headerItem header item in format <field name>:<value>
+ * @param fieldName
+ * @return 1 on success, 0 un failure
+ */
+int SignalsHandler::checkHeaderField(const QString &headerItem, const QString &fieldName)
+{
+   QStringList field = headerItem.split(":"); // split into field name and value pair
+
+   if (field.size() != 2)
+   {
+      lastErrorMsg = "Bad header item: " + headerItem;
+      return 0;
+   }
+
+   QString name = field.at(0).trimmed();
+
+   if (name==fieldName)
+   {
+       header.insert(name,field.at(1).trimmed());
+       return 1;
+   }
+
+   lastErrorMsg = "Bad header field name: " + headerItem;
+
+   return 0;
+}
+
+/**
+ * @brief SCDTopicServer::checkHeaderField
+ * @param headerItem
+ * @param cmd
+ * @return
+ */
+int SignalsHandler::checkHeaderField(const QString &headerItem, Command &cmd)
+{
+    QStringList field = headerItem.split(":"); // split into field name and value pair
+
+    if (field.size() != 2)
+    {
+       lastErrorMsg = "Bad header item: " + headerItem;
+       return 0;
+    }
+
+    QString name = field.at(0).trimmed();
+
+    int index = commands.indexOf(QRegularExpression(name));
+
+    if (index>-1)
+    {
+       header.insert(name,field.at(1).trimmed());
+
+       cmd = static_cast<enum Command>(index);
+
+       return 1;
+    }
+
+    lastErrorMsg = "Unknown header field: " + name;
+
+    return 0;
+}
+
+/**
+ * @brief SignalsHandler::readHeader read headers lines and fill header map.
+ *        Call this method only when statu=WAITFORHEADER.
+ *        when header read is complete the stustus change to WAITFORDATA.
+ *        on error return 0, otherwise return 1.
+ *        Do not use the sequence '|' (sharp) char into complete file path
+ *
+ *        SCDFTH (one line fast header struct)
+ *
+ *          PUT command => SCDFTH:1.0\tPUT:<complete file path>\t<FILESIZE>\n<FILESIZE DATA BYTES>
+ *          PUT command => SCDFTH:1.0\tPUT:<complete file path>\t<FILESIZE>\tH:<SHA-256>\n => ok (already stored) or send\n <= <DATA>
+ *          DPUT command => SCDFTH:1.0\tDPUT:<complete file path>\t<FILESIZE>\n => <BLOCKSIZE>\t<COUNT>\n<SIGNATURES> <= <DELTA STREAM>
+ *          GET command => SCDFTH:1.0\tGET:<complete file path>\n          // download a file
+ *          GET command => SCDFTH:1.0\tGET:<complete file path>\tT\n       // get a thumbnail
+ *          GET command => SCDFTH:1.0\tGET:<complete file path>\tV\n       // get a file and its validator
+ *          GET command => SCDFTH:1.0\tGET:<complete file path>\tIF:<validator>\n // conditional get
+ *          GET command => SCDFTH:1.0\tGET:<complete file path>\tF\n       // local connections: FD\t<offset>\t<size>\n + descriptor
+ *          DEL command => SCDFTH:1.0\tDEL:<complete file path>\n          // delete a file
+ *          INFO command => SCDFTH:1.0\tINFO:<complete file path>[\t<COUNT>]\n[<COUNT more paths, one per line>] => <SIZE>\n<one line per path>
+ *          SHEET command => SCDFTH:1.0\tSHEET:<folder path>[\t<PAGE>\t<PAGE SIZE>]\n => <SIZE>\n<table><JPEG sprite> (see SCDImgSheetCache)
+  *
+ *          See SCD Image Client to send a command to server
+ *
+ *          PUT command upload a binary file to server into a specified path
+ *          GET command download a binary file from a specified path
+ *          DEL command delete the specified file from server
+ *          INFO command returns width, height, format, orientation and capture date of images (see SCDImgMetaIndex)
+ *          SHEET command returns the thumbnails of the images of a folder page in a single sprite
+ *
+ * @return 1 on success, 0 on failure
+ *
+ */
+int SignalsHandler::readHeader(Command &command)
+{
+   QByteArray row;
+
+   row = socket->readLine(maxHeaderSize);
+
+   if (row.size()==0)
+   {
+      lastErrorMsg = "Null header line";
+      return -1;   // socket error
+   }
+
+   QString head = QString::fromLatin1(row);
+
+   QStringList fields = head.split("\t",QString::SkipEmptyParts);
+
+   if (fields.size()<2) // header must have at least two elements
+   {
+      lastErrorMsg = "Invalid header: " + head;
+      return 0;
+   }
+
+   if (checkHeaderField(fields.at(0),"SCDFTH"))   // first item must be header type declaration
+   { 
+      if (checkHeaderField(fields.at(1),command)) // get the command
+      {
          switch (command)
          {
             case PUT:
+            case DPUT:
 
-              if (fields.size()==3)
+              replicated = false;
+
+              contentHash.clear();
+
+              if (fields.size()>=3)
               {
+                 for (int i=3; i<fields.size(); i++) // options: R replicated by a peer, H:<SHA-256 hex> hash-first upload
+                 {
+                    QString option = fields.at(i).trimmed();
+
+                    if (option=="R")
+                    {
+                       replicated = true;
+                    }
+                    else
+                    if (option.startsWith("H:") && command==PUT)
+                    {
+                       contentHash = QByteArray::fromHex(option.mid(2).toLatin1());
+
+                       if (contentHash.size()!=32)
+                       {
+                          lastErrorMsg = "Invalid content hash: " + head;
+                          return 0;
+                       }
+                    }
+                    else
+                    {
+                       lastErrorMsg = "Invalid header: " + head;
+                       return 0;
+                    }
+                 }
+
                  fileSize = fields.at(2).toInt();
 
                  if (fileSize>0)
@@ -405,189 +1031,1228 @@ int SignalsHandler::readHeader(Command &command)
                  lastErrorMsg = "Invalid header: " + head;
               }
 
-            break;
+            break;
+
+            case GET:
+
+              fileName = header[commands[command]].toString();
+
+              thumbnail  = false;
+              validators = false;
+              descriptor = false;
+
+              ifMatch.clear();
+
+              for (int i=2; i<fields.size(); i++) // options: T thumbnail, V validator, IF:<validator> conditional get, F descriptor
+              {
+                 QString option = fields.at(i).trimmed();
+
+                 if (option=="T")
+                 {
+                    thumbnail = true;
+                 }
+                 else
+                 if (option=="F" && local)
+                 {
+                    descriptor = true;
+                 }
+                 else
+                 if (option=="V")
+                 {
+                    validators = true;
+                 }
+                 else
+                 if (option.startsWith("IF:"))
+                 {
+                    validators = true;
+
+                    ifMatch = option.mid(3);
+                 }
+                 else
+                 {
+                    lastErrorMsg = "Invalid header: " + head;
+                    return 0;
+                 }
+              }
+
+              if (descriptor && thumbnail)
+              {
+                 lastErrorMsg = "Descriptor of thumbnails not supported: " + head;
+                 return 0;
+              }
+
+            return 1;
+
+            case DEL:
+
+              fileName = header[commands[command]].toString();
+
+              replicated = (fields.size()==3 && fields.at(2).trimmed()=="R"); // option: R replicated by a peer
+
+            return 1;
+
+            case INFO:
+
+              fileName = header[commands[command]].toString();
+
+              infoCount = 0;
+
+              if (fields.size()==3) // batch: more paths follow, one per line
+              {
+                 bool ok;
+
+                 infoCount = fields.at(2).trimmed().toInt(&ok);
+
+                 if (!ok || infoCount<0 || infoCount>=INFO_PATHS)
+                 {
+                    lastErrorMsg = "Invalid paths count: " + head;
+                    return 0;
+                 }
+              }
+              else
+              if (fields.size()>3)
+              {
+                 lastErrorMsg = "Invalid header: " + head;
+                 return 0;
+              }
+
+              infoKeys.clear();
+              infoKeys.append(fileName);
+
+            return 1;
+
+            case SHEET:
+
+              fileName = header[commands[command]].toString();
+
+              sheetPage = 0;
+              sheetSize = SCDImgSheetCache::MAX_IMAGES;
+
+              if (fields.size()==4) // page of folder images
+              {
+                 bool pageOk;
+                 bool sizeOk;
+
+                 sheetPage = fields.at(2).trimmed().toInt(&pageOk);
+                 sheetSize = fields.at(3).trimmed().toInt(&sizeOk);
+
+                 if (!pageOk || !sizeOk || sheetPage<0 || sheetSize<1 || sheetSize>SCDImgSheetCache::MAX_IMAGES)
+                 {
+                    lastErrorMsg = "Invalid page: " + head;
+                    return 0;
+                 }
+              }
+              else
+              if (fields.size()!=2)
+              {
+                 lastErrorMsg = "Invalid header: " + head;
+                 return 0;
+              }
+
+            return 1;
+         }
+      }
+   }
+
+   return 0;  // failure
+}
+
+/**
+ * @brief SignalsHandler::fileReceivingPrepare
+ * @return
+ */
+int SignalsHandler::fileReceivingPrepare(QString fileName)
+{
+   if (limit->limited(SCDImgRateLimit::RL_IN))
+   {
+      socket->setReadBufferSize(4*SEND_CHUNK); // bounded socket buffer: TCP window closes when tokens are over
+   }
+
+   packed = (store && store->accepts(fileSize));
+
+   roots->removeCopies(objectKey, fileName); // previous version stored on another root (not yet rebalanced)
+
+   if (packed) // small object: bufferize it and pack into segment store when entirely received
+   {
+      if (QFile::exists(fileName) && !QFile::remove(fileName))
+      {
+         lastErrorMsg = "Removing existing file failure: " + fileName;
+         return 0;
+      }
+
+      packBuff.clear();
+      packBuff.reserve(fileSize);
+
+      readedBytes = 0;
+
+      trace.mark(SCDImgTrace::PH_OPEN);
+
+      return 1;
+   }
+
+   if (store)
+   {
+      store->remove(objectKey); // drop previous packed version
+   }
+
+   QDir dir = QFileInfo(fileName).absoluteDir();
+
+   // Create destionation file path if not exists -----------------------------
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      lastErrorMsg = "Create dir failure: " + dir.absolutePath();
+      return 0;
+   }
+
+   // remove file if already existing -----------------------------------------
+
+   if (QFile::exists(fileName))
+   {
+      if (!f->unlink(fileName))
+      {
+         lastErrorMsg = "Removing existing file failure: " + fileName + " => " + f->errorString();
+         return 0;
+      }
+   }
+
+   // open destionation file for (create/append)--------------------------------
+
+   QString tmpFile = dir.absolutePath() + "/" + QFileInfo(fileName).completeBaseName() + ".tmp";
+
+   f->setFileName(tmpFile);
+
+   if (f->open(QIODevice::WriteOnly))
+   {
+      if (!f->allocate(fileSize)) // reserve file blocks: fails early if disk is full
+      {
+         lastErrorMsg = "allocate file error: " + f->fileName() + " => " + f->errorString();
+
+         f->remove();
+
+         return 0;
+      }
+
+      if (writer && !patch) // hand opened file to disk writer stage (delta is rebuilt by connection thread)
+      {
+         upload = SCDImgUploadPtr(new SCDImgUpload(writer->nextId(), f, fileName, this));
+
+         f = parent->server()->createStorageIO();
+
+         socket->setReadBufferSize(parent->server()->readBufferSize()); // bounded socket buffer: TCP window closes when disk writer is late
+
+         pendingBuff.clear();
+      }
+
+      trace.mark(SCDImgTrace::PH_OPEN);
+
+      readedBytes = 0;
+      return 1;
+   }
+
+   lastErrorMsg = "open file error: " + f->fileName() + " => " + f->errorString();
+   return 0;
+}
+
+/**
+ * @brief SignalsHandler::readData
+ */
+int SignalsHandler::readData()
+{
+   if (upload)
+   {
+      return queueData();
+   }
+
+   QByteArray buff;
+
+   if (patch)
+   {
+      if (!readPatch(buff)) // rebuild file data from delta stream
+      {
+         packBuff.clear();
+
+         if (f->isOpen())
+         {
+            f->remove(); // close and delete file
+         }
+
+         return 0;
+      }
+   }
+   else
+   {
+      buff = receive(); // read available data from socket connection
+   }
+
+   trace.mark(SCDImgTrace::PH_RECEIVE);
+
+   readedBytes += buff.size();   
+
+   if (!contentHash.isEmpty())
+   {
+      contentHasher.addData(buff);
+
+      if (readedBytes>=fileSize && !checkContentHash())
+      {
+         packBuff.clear();
+
+         if (f->isOpen())
+         {
+            f->remove(); // close and delete file
+         }
+
+         return 0;
+      }
+   }
+
+   if (packed)
+   {
+      packBuff.append(buff);
+
+      if (readedBytes<fileSize)
+      {
+         return 1; // success buffer received
+      }
+
+      if (store->put(objectKey,packBuff))
+      {
+         trace.mark(SCDImgTrace::PH_WRITE);
+
+         packBuff.clear();
+
+         store->remove(getThumbName(objectKey)); // drop thumbnail of previous version
+
+         if (committer->mode()==SCDImgCommitter::DM_GROUP) // reply sent by writeCompleted() after next group commit
+         {
+            upload = SCDImgUploadPtr(new SCDImgUpload(0, 0, objectKey, this));
+
+            committer->submit(upload);
+
+            status = WAITFORCOMMIT;
+
+            return 2;
+         }
+
+         if (committer->mode()==SCDImgCommitter::DM_FSYNC && !store->sync())
+         {
+            lastErrorMsg = "Segment sync error: " + store->lastError();
+
+            return 0;
+         }
+
+         trace.mark(SCDImgTrace::PH_COMMIT);
+
+         requestDone(true);
+
+         socket->write("ok");          // sends confirm to client: client will close connection.
+         socket->flush();
+         socket->disconnectFromHost(); // close connection
+
+         return 2; // object entirely received
+      }
+
+      packBuff.clear();
+
+      lastErrorMsg = "Segment write error: " + objectKey;
+
+      return 0;
+   }
+
+   if (f->write(buff)!=-1)   // file writing success
+   {
+      trace.mark(SCDImgTrace::PH_WRITE);
+
+      if (readedBytes>=fileSize) // if file is entirely readed close file
+      {
+         if (committer->mode()==SCDImgCommitter::DM_FSYNC && !f->sync()) // data on disk before rename
+         {
+            lastErrorMsg = "sync file error: " + f->fileName() + " => " + f->errorString();
+
+            f->remove();
+
+            return 0;
+         }
+
+         if (!f->close())       // waits queued writes
+         {
+            f->remove();
+
+            lastErrorMsg = "write file error: " + f->fileName() + " => " + f->errorString();
+
+            return 0;
+         }
+
+         if (committer->mode()==SCDImgCommitter::DM_GROUP) // synced, renamed and replied by writeCompleted() after next group commit
+         {
+            upload = SCDImgUploadPtr(new SCDImgUpload(0, f, fileName, this));
+
+            f = parent->server()->createStorageIO();
+
+            committer->submit(upload);
+
+            status = WAITFORCOMMIT;
+
+            return 2;
+         }
+
+         if (f->rename(fileName))
+         {
+            if (committer->mode()==SCDImgCommitter::DM_FSYNC && !SCDImgCommitter::syncDir(QFileInfo(fileName).absolutePath(),lastErrorMsg))
+            {
+               return 0; // renamed, but the rename may not survive a power loss
+            }
+
+            trace.mark(SCDImgTrace::PH_COMMIT);
+
+            requestDone(true);
+
+            socket->write("ok");          // sends confirm to client: client will close connection.
+            socket->flush();
+            socket->disconnectFromHost(); // close connection
+
+            return 2; // file entirely received
+         }
+         else
+         {
+            lastErrorMsg = "Rename file error: " + f->fileName() + " => " + f->errorString();
+
+            f->remove(); // delete file
+
+            return 0;
+         }
+      }
+
+      return 1; // success buffer received
+   }
+
+   // on write error ----------------------------------------------------------
+
+   lastErrorMsg = "write file error: " + f->fileName() + " => " + f->errorString();
+
+   f->remove(); // close and delete file
+
+   return 0;
+}
+
+/**
+ * @brief SignalsHandler::deltaPrepare delta PUT: send the block signatures of the stored copy (file or packed object),
+ *                                     then prepare receiving as PUT does. The stored copy is opened first: it can be
+ *                                     read by the patch while the new file is rebuilt, even once it has been replaced.
+ * @return 1 on success, 0 on failure
+ */
+int SignalsHandler::deltaPrepare()
+{
+   QIODevice *base = 0;
+
+   if (store && store->contains(objectKey))
+   {
+      QByteArray data;
+
+      if (store->read(objectKey,data))
+      {
+         QBuffer *buff = new QBuffer();
+
+         buff->setData(data);
+         buff->open(QIODevice::ReadOnly);
+
+         base = buff;
+      }
+   }
+   else
+   {
+      QFile *file = new QFile(roots->locate(objectKey));
+
+      if (file->exists() && file->open(QIODevice::ReadOnly))
+      {
+         base = file;
+      }
+      else
+      {
+         delete file; // no stored copy: the whole file is sent as literal
+      }
+   }
+
+   int        blockSize = 0;
+   QByteArray sigs;
+
+   if (base)
+   {
+      blockSize = SCDImgDelta::blockSize(base->size());
+
+      if (!SCDImgDelta::signatures(base, blockSize, sigs, lastErrorMsg))
+      {
+         delete base;
+         return 0;
+      }
+   }
+
+   delete patch;
+
+   patch = new SCDImgDeltaPatch(base, blockSize, fileSize);
+
+   deltaIn.clear();
+   deltaOut.clear();
+
+   if (!fileReceivingPrepare(fileName))
+   {
+      return 0;
+   }
+
+   QByteArray reply = QByteArray::number(blockSize) + "\t" + QByteArray::number(sigs.size()/SCDImgDelta::SIG_SIZE) + "\n" + sigs;
+
+   SCDImgMetricsBlock::add(metrics->bytesOut,static_cast<quint64>(reply.size()));
+
+   socket->write(reply);
+   socket->flush();
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::readPatch read available delta stream and rebuild the data it describes. Last rebuilt bytes
+ *                                  are held until the end of stream has verified the file: it is never completed
+ *                                  (renamed) before.
+ * @param buff output param: rebuilt data
+ * @return 1 on success, 0 on invalid delta stream
+ */
+int SignalsHandler::readPatch(QByteArray &buff)
+{
+   deltaIn.append(receive());
+
+   int ret = patch->apply(deltaIn, deltaOut);
+
+   if (!ret)
+   {
+      lastErrorMsg = "Delta error: " + patch->lastError();
+      return 0;
+   }
+
+   if (ret==2 || patch->written()<fileSize)
+   {
+      buff.swap(deltaOut);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::storedContent hash-first PUT: check whether the declared content is already stored, under
+ *                                      the requested path or another one (copied without receiving data).
+ *                                      Index entries whose object has changed since they were recorded are ignored.
+ * @return 2 content stored (upload completed), 1 data must be received
+ */
+int SignalsHandler::storedContent()
+{
+   QByteArray hash;
+   QByteArray validator;
+
+   if (hashes->lookup(objectKey,hash,validator) && hash==contentHash && validator==objectValidator(objectKey))
+   {
+      logDebug() << "PUT unchanged: " + objectKey;
+
+      hashes->skipped(false);
+
+      return 2;
+   }
+
+   foreach (const QString &key, hashes->keys(contentHash))
+   {
+      if (key==objectKey || !hashes->lookup(key,hash,validator) || validator!=objectValidator(key))
+      {
+         continue; // stale entry
+      }
+
+      if (copyContent(key)==2)
+      {
+         logDebug() << "PUT copied from " + key + ": " + objectKey;
+
+         hashes->skipped(true);
+
+         return 2;
+      }
+
+      break; // copy failed: receive data
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::copyContent store the requested object as a copy of another object having the same content.
+ *                                    Files are hard linked (files are never modified in place: a new upload or a
+ *                                    delete of one of them does not affect the other), and copied across file systems.
+ * @param source key of stored object
+ * @return 2 on success, 1 on failure (data must be received)
+ */
+int SignalsHandler::copyContent(QString source)
+{
+   if (store && store->contains(source))
+   {
+      QByteArray data;
+
+      if (!store->accepts(fileSize) || !store->read(source,data) || data.size()!=fileSize)
+      {
+         return 1;
+      }
+
+      roots->removeCopies(objectKey, fileName);
+
+      if ((QFile::exists(fileName) && !QFile::remove(fileName)) || !store->put(objectKey,data))
+      {
+         return 1;
+      }
+
+      store->remove(getThumbName(objectKey)); // drop thumbnail of previous version
+
+      if (committer->mode()!=SCDImgCommitter::DM_NONE && !store->sync())
+      {
+         return 1;
+      }
+
+      return 2;
+   }
+
+   if (store && store->accepts(fileSize))
+   {
+      return 1; // source is a file, object is packed: received as usual
+   }
+
+   QString sourceName = roots->locate(source);
+   QDir    dir        = QFileInfo(fileName).absoluteDir();
+   QString tmpFile    = dir.absolutePath() + "/" + QFileInfo(fileName).completeBaseName() + ".tmp";
+
+   if (!dir.mkpath(dir.absolutePath()))
+   {
+      return 1;
+   }
+
+   QFile::remove(tmpFile);
+
+   if (::link(QFile::encodeName(sourceName).constData(), QFile::encodeName(tmpFile).constData())!=0)
+   {
+      if (committer->mode()!=SCDImgCommitter::DM_NONE || !QFile::copy(sourceName,tmpFile))
+      {
+         return 1; // durable modes: only a hard link shares data already on disk
+      }
+   }
+
+   if (store)
+   {
+      store->remove(objectKey); // drop previous packed version
+   }
+
+   roots->removeCopies(objectKey, fileName);
+
+   if ((QFile::exists(fileName) && !QFile::remove(fileName)) || !QFile::rename(tmpFile,fileName))
+   {
+      QFile::remove(tmpFile);
+      return 1;
+   }
+
+   QFile::remove(getThumbName(fileName)); // drop thumbnail of previous version
+
+   if (committer->mode()!=SCDImgCommitter::DM_NONE && !SCDImgCommitter::syncDir(dir.absolutePath(),lastErrorMsg))
+   {
+      return 1;
+   }
+
+   return 2;
+}
+
+/**
+ * @brief SignalsHandler::checkContentHash hash-first PUT entirely received: verify data against the declared hash
+ * @return 1 on success (or plain PUT), 0 on mismatch
+ */
+int SignalsHandler::checkContentHash()
+{
+   if (contentHash.isEmpty() || contentHasher.result()==contentHash)
+   {
+      return 1;
+   }
+
+   lastErrorMsg = "Content hash mismatch: " + objectKey;
+
+   contentHash.clear(); // never recorded
+
+   return 0;
+}
+
+/**
+ * @brief SignalsHandler::queueData read available data from socket and hand it to disk writer stage.
+ *                                  If writer queue is full, stops reading the socket until writeResumed()
+ * @return 1 data queued (or reading paused), 2 file entirely received (completion queued), 0 content hash mismatch
+ */
+int SignalsHandler::queueData()
+{
+   if (pendingBuff.isEmpty())
+   {
+      pendingBuff = receive(); // read available data from socket connection
+
+      trace.mark(SCDImgTrace::PH_RECEIVE);
+
+      readedBytes += pendingBuff.size();
+
+      if (!contentHash.isEmpty())
+      {
+         contentHasher.addData(pendingBuff);
+      }
+   }
+
+   if (!pendingBuff.isEmpty())
+   {
+      if (!writer->write(upload,pendingBuff))
+      {
+         return 1; // queue full: reading paused
+      }
+
+      pendingBuff.clear();
+
+      trace.mark(SCDImgTrace::PH_WRITE); // queued to disk writer (waits for free space are included)
+   }
+
+   if (readedBytes>=fileSize) // file entirely received: close and rename by disk writer
+   {
+      if (!checkContentHash())
+      {
+         upload->detach(true); // discard queued writes and remove file
+         upload.clear();
+
+         return 0;
+      }
+
+      if (!writer->finish(upload))
+      {
+         return 1; // queue full: completion queued on resume
+      }
+
+      status = WAITFORCOMMIT;
+
+      return 2;
+   }
+
+   return 1; // success buffer queued
+}
+
+/**
+ * @brief SignalsHandler::sendFile
+ * @return
+ */
+int SignalsHandler::sendFile(QString fileName)
+{
+   if (!QFile::exists(fileName))
+   {
+      lastErrorMsg = "File not exists: " + fileName;
+      return 0; // system file error
+   }
+
+   if (validators)
+   {
+      etag = fileValidator(fileName);
+
+      if (!ifMatch.isEmpty() && etag==ifMatch.toLatin1())
+      {
+         return sendNotModified(); // client cached copy is still valid: file is not read at all
+      }
+   }
+
+   // send file to client -----------------------------
+
+   f->setFileName(fileName);
+
+   if (!f->open(QIODevice::ReadOnly))
+   {
+      lastErrorMsg = "Open file error: " + fileName;
+      return 0; // system file error
+   }
+
+   trace.mark(SCDImgTrace::PH_OPEN);
+
+   QByteArray buff;
+
+   f->readAll(buff); //read file
+   f->close();
+
+   trace.mark(SCDImgTrace::PH_READ);
+
+   if (buff.size()==0)
+   {
+      lastErrorMsg = "Read file error: " + fileName;
+      return 0; // system file error
+   }
+
+   return sendData(buff);
+}
+
+/**
+ * @brief SignalsHandler::sendPacked send an object packed into segment store
+ * @param key
+ * @return
+ */
+int SignalsHandler::sendPacked(QString key)
+{
+   if (validators)
+   {
+      etag = packedValidator(key);
+
+      if (!ifMatch.isEmpty() && etag==ifMatch.toLatin1())
+      {
+         return sendNotModified();
+      }
+   }
+
+   QByteArray buff;
+
+   if (!store->read(key,buff) || buff.size()==0)
+   {
+      lastErrorMsg = "Read packed object error: " + key;
+      return 0; // system file error
+   }
+
+   trace.mark(SCDImgTrace::PH_READ);
+
+   return sendData(buff);
+}
+
+/**
+ * @brief SignalsHandler::sendData write size header (and validator if requested) and data to client
+ * @param buff
+ * @return 1 on success, -1 on socket error
+ */
+int SignalsHandler::sendData(const QByteArray &buff)
+{
+   SCDImgMetricsBlock::add(metrics->bytesOut,static_cast<quint64>(buff.size()));
+
+   trace.setSize(buff.size());
+
+   if (limit->limited(SCDImgRateLimit::RL_OUT))
+   {
+      QByteArray head = QByteArray::number(buff.size()) + (validators ? "\t" + etag : QByteArray()) + "\n";
+
+      outBuff = head + buff; // sent by sendChunk() at the granted rate
+      outPos  = 0;
+      status  = DATASEND;
+
+      sendChunk();
+
+      return 1;
+   }
+
+   QByteArray head = QByteArray::number(buff.size());
+
+   if (validators)
+   {
+      head.append("\t" + etag);
+   }
+
+   head.append("\n");
+
+   // write header ------------------------------------
+
+   if (socket->write(head.constData(),head.size())==-1)
+   {
+      lastErrorMsg = "Write error";
+      return -1; // socket error
+   }
+
+   if (socket->write(buff.constData(),buff.size())==-1)
+   {
+      lastErrorMsg = "Socket write error";
+      return -1; // socket error
+   }
+
+   trace.mark(SCDImgTrace::PH_SEND);
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::sendNotModified reply to a conditional GET whose validator still matches: "NM\t<validator>\n", no data
+ * @return 1 on success, -1 on socket error
+ */
+int SignalsHandler::sendNotModified()
+{
+   trace.setSize(0);
+
+   QByteArray head = "NM\t" + etag + "\n";
+
+   if (socket->write(head.constData(),head.size())==-1)
+   {
+      lastErrorMsg = "Write error";
+      return -1; // socket error
+   }
+
+   trace.mark(SCDImgTrace::PH_SEND);
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::sendDescriptor local GET: pass a read-only descriptor of the file with its range:
+ *                                      "FD\t<offset>\t<size>[\t<validator>]\n". A packed object is copied into a
+ *                                      sealed memfd: its segment descriptor would expose every object of the segment.
+ *                                      The descriptor keeps reading the current version even if the object is
+ *                                      replaced or compacted afterwards.
+ * @return 1 on success, 0 on failure, -1 on socket error
+ */
+int SignalsHandler::sendDescriptor()
+{
+   int    fd     = -1;
+   qint64 offset = 0;
+   qint64 length = 0;
+
+   if (store && store->contains(objectKey))
+   {
+      SCDImgNeedle needle;
+
+      int segment = store->openNeedle(objectKey,needle);
+
+      if (segment>=0)
+      {
+         fd = ::memfd_create("scdimg-object", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+         if (fd>=0 && (!SCDImgLocalSocket::copyRange(segment, needle.offset, needle.length, fd) ||
+                       ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)<0))
+         {
+            ::close(fd);
+            fd = -1;
+         }
+
+         ::close(segment);
+      }
+
+      length = needle.length;
+
+      if (validators)
+      {
+         etag = packedValidator(objectKey);
+      }
+   }
+   else
+   {
+      fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+
+      struct stat st;
+
+      if (fd>=0 && (::fstat(fd,&st)!=0 || !S_ISREG(st.st_mode))) // regular files only
+      {
+         ::close(fd);
+         fd = -1;
+      }
+
+      if (fd>=0)
+      {
+         length = st.st_size;
+      }
+
+      if (validators)
+      {
+         etag = fileValidator(fileName);
+      }
+   }
+
+   if (fd<0)
+   {
+      lastErrorMsg = "File not exists: " + fileName;
+      return 0;
+   }
+
+   trace.mark(SCDImgTrace::PH_OPEN);
+
+   if (!ifMatch.isEmpty() && etag==ifMatch.toLatin1())
+   {
+      ::close(fd);
+
+      return sendNotModified();
+   }
+
+   QByteArray head = "FD\t" + QByteArray::number(offset) + "\t" + QByteArray::number(length) + (validators ? "\t" + etag : QByteArray()) + "\n";
+
+   int ret = SCDImgLocalSocket::sendDescriptor(socket->socketDescriptor(), fd, head);
+
+   ::close(fd); // the client has its own descriptor
+
+   if (!ret)
+   {
+      lastErrorMsg = "Send descriptor error: " + objectKey;
+      return -1;
+   }
+
+   trace.setSize(length);
+   trace.mark(SCDImgTrace::PH_SEND);
+
+   return 1;
+}
+
+/**
+ * @brief SignalsHandler::readInfoPaths read the paths of a batched INFO; when all are received sends the reply
+ * @return 1 on success (reply sent or more paths awaited), 0 on failure, -1 on socket error
+ */
+int SignalsHandler::readInfoPaths()
+{
+   while (infoKeys.count()<=infoCount && socket->canReadLine())
+   {
+      QString key = QString::fromLatin1(socket->readLine(maxHeaderSize)).trimmed(); // as header paths
+
+      if (!key.startsWith('/'))
+      {
+         lastErrorMsg = "remote file path must start with '/': " + key;
+         return 0;
+      }
+
+      infoKeys.append(key);
+   }
+
+   if (infoKeys.count()<=infoCount)
+   {
+      if (socket->bytesAvailable()>=maxHeaderSize)
+      {
+         lastErrorMsg = "Path line too long";
+         return 0;
+      }
+
+      status = WAITFORPATHS;
+
+      return 1; // wait for more paths
+   }
 
-            case GET:
+   trace.mark(SCDImgTrace::PH_HEADER);
 
-              fileName = header[commands[command]].toString();
+   int ret = sendInfo();
 
-              if (fields.size()==3)
-              {
-                 if (fields.at(2).trimmed()=="T")
-                 {
-                    thumbnail = true;
-                 }
-                 else
-                 {
-                    lastErrorMsg = "Invalid header: " + head;
-                    return 0;
-                 }
-              }
-              else
-              {
-                 thumbnail = false;
-              }
+   if (ret>0 && status!=DATASEND) // rate limited output closes connection when sent
+   {
+      requestDone(true);
 
-            return 1;
+      socket->disconnectFromHost();
+   }
 
-            case DEL:
+   return ret;
+}
 
-              fileName = header[commands[command]].toString();
+/**
+ * @brief SignalsHandler::sendInfo send the metadata of requested objects, one line for each path in request order:
+ *                                 <width>\t<height>\t<format>\t<orientation>\t<date> ('-' for unknown format and
+ *                                 date, a non image object has format '-'), or '-' if the object is not stored
+ * @return 1 on success, -1 on socket error
+ */
+int SignalsHandler::sendInfo()
+{
+   QByteArray reply;
 
-            return 1;
-         }
-      }
+   foreach (const QString &key, infoKeys)
+   {
+      SCDImgMetaIndex::Meta meta;
+
+      reply += objectMeta(key,meta) ? SCDImgMetaIndex::fields(meta) : QByteArray("-");
+      reply += "\n";
    }
 
-   return 0;  // failure
+   trace.mark(SCDImgTrace::PH_READ);
+
+   validators = false;
+
+   return sendData(reply);
 }
 
 /**
- * @brief SignalsHandler::fileReceivingPrepare
- * @return
+ * @brief SignalsHandler::objectMeta image metadata of a stored object: from the index if its entry is current,
+ *                                   otherwise read from object headers (and recorded into the index)
+ * @param key
+ * @param meta output param
+ * @return 1 on success, 0 if object is not stored
  */
-int SignalsHandler::fileReceivingPrepare(QString fileName)
+int SignalsHandler::objectMeta(const QString &key, SCDImgMetaIndex::Meta &meta)
 {
-   QDir dir = QFileInfo(fileName).absoluteDir();
+   return extractMeta(metaIndex,store,roots,key,meta);
+}
 
-   // Create destionation file path if not exists -----------------------------
+/**
+ * @brief SignalsHandler::extractMeta image metadata of a stored object: from index (null if disabled) if its entry is
+ *                                    current, otherwise read from object headers and recorded into index. Used by
+ *                                    connections and by the background extractor of the metadata index
+ * @param index
+ * @param store
+ * @param roots
+ * @param key
+ * @param meta output param
+ * @return 1 on success, 0 if object is not stored
+ */
+int SignalsHandler::extractMeta(SCDImgMetaIndex *index, SCDImgSegmentStore *store, SCDImgRootPaths *roots, const QString &key, SCDImgMetaIndex::Meta &meta)
+{
+   QByteArray validator = objectValidator(store,roots,key);
 
-   if (!dir.mkpath(dir.absolutePath()))
+   if (validator.isEmpty())
    {
-      lastErrorMsg = "Create dir failure: " + dir.absolutePath();
       return 0;
    }
 
-   // remove file if already existing -----------------------------------------
+   if (index && index->lookup(key,meta) && meta.validator==validator)
+   {
+      return 1;
+   }
 
-   if (QFile::exists(fileName))
+   if (store && store->contains(key))
    {
-      if (!QFile::remove(fileName))
+      QByteArray data;
+
+      if (!store->read(key,data))
       {
-         lastErrorMsg = "Removing existing file failure: " + fileName;
          return 0;
       }
+
+      QBuffer buff(&data);
+
+      buff.open(QIODevice::ReadOnly);
+
+      SCDImgMetaIndex::extract(&buff,meta);
    }
+   else
+   {
+      QFile file(roots->locate(key));
 
-   // open destionation file for (create/append)--------------------------------
+      if (!file.open(QIODevice::ReadOnly))
+      {
+         return 0;
+      }
 
-   QString tmpFile = dir.absolutePath() + "/" + QFileInfo(fileName).completeBaseName() + ".tmp";
+      SCDImgMetaIndex::extract(&file,meta);
+   }
 
-   f.setFileName(tmpFile);
+   meta.validator = validator;
 
-   if (f.open(QIODevice::WriteOnly))
+   if (index)
    {
-      readedBytes = 0;
-      return 1;
+      index->extracted();
+
+      if (objectValidator(store,roots,key)==validator) // not replaced while reading
+      {
+         index->insert(key,meta);
+      }
    }
 
-   lastErrorMsg = "open file error: " + f.fileName() + " => " + f.errorString();
-   return 0;
+   return 1;
 }
 
 /**
- * @brief SignalsHandler::readData
+ * @brief SignalsHandler::sendSheet send the contact sheet of a folder page: served from cache if no object of the
+ *                                  folder has been stored or deleted since it was composed. Thumbnails missing are
+ *                                  made (and kept) as for GET T; files that cannot be loaded are left out.
+ * @return 1 on success, -1 on socket error
  */
-int SignalsHandler::readData()
+int SignalsHandler::sendSheet()
 {
-   QByteArray buff = socket->readAll(); // read all available data from socket connection
+   QString folder = objectKey;
 
-   readedBytes += buff.size();   
+   while (folder.endsWith('/'))
+   {
+      folder.chop(1);
+   }
+
+   QString key      = folder + "\t" + QString::number(sheetPage) + "\t" + QString::number(sheetSize);
+   quint64 sequence = sheets ? sheets->sequence(folder) : 0; // read before listing: a change meanwhile makes the sheet stale
 
-   if (f.write(buff)!=-1)    // file writing success
+   QByteArray sheet;
+
+   if (!sheets || !sheets->lookup(key,sequence,sheet))
    {
-      if (readedBytes>=fileSize) // if file is entirely readed close file
+      QStringList names = folderImages(folder);
+
+      int total = names.count();
+
+      qint64 first = static_cast<qint64>(sheetPage)*sheetSize;
+
+      names = (first<total) ? QStringList(names.mid(static_cast<int>(first),sheetSize)) : QStringList();
+
+      QStringList   sheetNames;
+      QList<QImage> thumbnails;
+
+      foreach (const QString &name, names)
       {
-         f.close();
+         QString objKey = folder + "/" + name;
+         QString thumbName;
+         QImage  thumb;
 
-         if (f.rename(fileName))
+         if (store && store->contains(objKey))
          {
-            socket->write("ok");          // sends confirm to client: client will close connection.
-            socket->flush();
-            socket->disconnectFromHost(); // close connection
+            QByteArray png;
 
-            return 2; // file entirely received
+            if (makePackedThumbnail(objKey,thumbName) && store->read(thumbName,png))
+            {
+               thumb.loadFromData(png,"png");
+            }
          }
          else
+         if (makeThumbnail(roots->locate(objKey),thumbName))
          {
-            f.remove(); // delete file
-
-            lastErrorMsg = "Rename file error: " + f.fileName() + " => " + f.errorString();
+            thumb.load(thumbName,"png");
+         }
 
-            return 0;
+         if (!thumb.isNull())
+         {
+            sheetNames.append(name);
+            thumbnails.append(thumb);
          }
       }
 
-      return 1; // success buffer received
-   }
+      sheet = SCDImgSheetCache::compose(sheetNames,thumbnails,total);
 
-   // on write error ----------------------------------------------------------
+      trace.mark(SCDImgTrace::PH_READ);
 
-   f.close();  // close file
-   f.remove(); // delete file
+      if (sheets)
+      {
+         sheets->insert(key,sequence,sheet);
+      }
+   }
 
-   lastErrorMsg = "write file error: " + f.fileName() + " => " + f.errorString();
+   validators = false;
 
-   return 0;
+   return sendData(sheet);
 }
 
 /**
- * @brief SignalsHandler::sendFile
- * @return
+ * @brief SignalsHandler::folderImages list the images of a folder: files on every root path and packed objects,
+ *                                     by extension of the image formats supported (thumbnails excluded)
+ * @param folder logical folder path without trailing '/' (empty: root)
+ * @return file names sorted by name
  */
-int SignalsHandler::sendFile(QString fileName)
+QStringList SignalsHandler::folderImages(const QString &folder)
 {
-   if (!QFile::exists(fileName))
-   {
-      lastErrorMsg = "File not exists: " + fileName;
-      return 0; // system file error
-   }
-
-   QFile f(fileName);
-
-   // send file to client -----------------------------
+   QSet<QString> names;
 
-   if (!f.open(QIODevice::ReadOnly))
+   foreach (const QString &root, roots->paths()) // files not yet rebalanced may be on any root
    {
-      lastErrorMsg = "Open file error: " + fileName;
-      return 0; // system file error
-   }
+      QDir dir(root + folder.mid(1));
 
-   // Get file size ----------------------------------
-
-   int size = f.size();
-
-   QByteArray buff = QByteArray::number(size);
-
-   buff.append("\n");
-
-   // write header ------------------------------------
+      foreach (const QString &name, dir.entryList(QDir::Files))
+      {
+         names.insert(name);
+      }
+   }
 
-   if (socket->write(buff.constData(),buff.size())==-1)
+   if (store)
    {
-      lastErrorMsg = "Write error";
-      return -1; // socket error
+      foreach (const QString &key, store->keys(folder))
+      {
+         names.insert(key.mid(folder.size()+1));
+      }
    }
 
-   buff = f.readAll(); //read file
+   QList<QByteArray> formats = QImageReader::supportedImageFormats();
 
-   if (buff.size()==0)
-   {
-      f.close();
-      lastErrorMsg = "Read file error: " + fileName;
-      return 0; // system file error
-   }
+   QStringList images;
 
-   if (socket->write(buff.constData(),buff.size())==-1)
+   foreach (const QString &name, names)
    {
-      f.close();
-      lastErrorMsg = "Socket write error";
-      return -1; // socket error
+      if (!name.endsWith(".tmb.png") && formats.contains(QFileInfo(name).suffix().toLower().toLatin1()))
+      {
+         images.append(name);
+      }
    }
 
-   f.close();
+   images.sort();
 
-   return 1;
+   return images;
 }
 
 /**
@@ -596,19 +2261,43 @@ int SignalsHandler::sendFile(QString fileName)
  */
 int SignalsHandler::delFile(QString fileName)
 {
-   QFile f(fileName);
+   if (store && store->contains(objectKey))
+   {
+      if (!store->remove(objectKey))
+      {
+         lastErrorMsg = "Delete packed object error: " + objectKey;
+         return 0; // system file error
+      }
+
+      store->remove(getThumbName(objectKey));
+
+      trace.mark(SCDImgTrace::PH_DELETE);
+
+      return 1;
+   }
 
-   if (!f.remove())
+   if (!QFile::exists(fileName))
+   {
+      lastErrorMsg = "File not exists: " + fileName;
+      return 0;
+   }
+
+   if (!f->unlink(fileName))
    {
-      lastErrorMsg = "Delete file error: " + fileName + " => " + f.errorString();
+      lastErrorMsg = "Delete file error: " + fileName + " => " + f->errorString();
       return 0; // system file error
    }
 
+   roots->removeCopies(objectKey, fileName); // copies left on other roots by an interrupted rebalance
+
+   trace.mark(SCDImgTrace::PH_DELETE);
+
    return 1;
 }
 
 /**
- * @brief SignalsHandler::makeThumbnail make a thumbanil from image file filename, if already exists it will not be re-generated
+ * @brief SignalsHandler::makeThumbnail make a thumbanil from image file filename, if already exists it will not be re-generated.
+ *                                      The EXIF embedded preview is scaled when suitable, otherwise the whole image is decoded.
  * @param fileName  name of file from which the thumbnail will be generated
  * @param thumbName output params file name of tuhmbnail generated thumbnail name has PNG extension
  * @return
@@ -619,22 +2308,46 @@ int SignalsHandler::makeThumbnail(QString fileName, QString &thumbName)
 
    if (!QFile::exists(thumbName)) // if thumbnai not exists
    {
-      QImageReader imgr;
+      QElapsedTimer timer;
+
+      timer.start();
+
+      QFile      file(fileName);
+      QByteArray head;
+
+      if (file.open(QIODevice::ReadOnly))
+      {
+         head = file.read(SCDImgExif::HEAD_SIZE);
+         file.close();
+      }
+
+      SCDImgExif exif(head);
+
+      QImage img = exif.preview(QSize(100,75)); // EXIF embedded preview: a few KB are decoded instead of the whole image
+
+      if (img.isNull())
+      {
+         QImageReader imgr;
 
-      imgr.setDecideFormatFromContent(true);
-      imgr.setScaledSize(QSize(100,25));
-      imgr.setFileName(fileName);
+         imgr.setDecideFormatFromContent(true);
+         imgr.setScaledSize(QSize(100,25));
+         imgr.setFileName(fileName);
 
-      QByteArray format = imgr.format();
+         QByteArray format = imgr.format();
 
-      QImage img;
+         img.load(fileName,format.constData()); // load image file name
+      }
 
-      if (img.load(fileName,format.constData())) // load image file name
+      if (!img.isNull())
       {
-         QImage thumbnail = img.scaled(100,75,Qt::IgnoreAspectRatio,Qt::SmoothTransformation); // make thumbnail
+         QImage thumbnail = SCDImgExif::orient(img,exif.orientation()).scaled(100,75,Qt::IgnoreAspectRatio,Qt::SmoothTransformation); // make thumbnail
 
          if (thumbnail.save(thumbName,"png")) // save thumbnail to file in format PNG
          {
+            metrics->thumbnail.record(static_cast<quint64>(timer.nsecsElapsed()/1000));
+
+            trace.mark(SCDImgTrace::PH_THUMBNAIL);
+
             return 1; // return success
          }
 
@@ -651,6 +2364,75 @@ int SignalsHandler::makeThumbnail(QString fileName, QString &thumbName)
    return 1; // success: thumbnail already exists
 }
 
+/**
+ * @brief SignalsHandler::makePackedThumbnail make the thumbnail of a packed object and pack it into segment store,
+ *                                            if already exists it will not be re-generated
+ * @param key      object path
+ * @param thumbKey output param path of packed thumbnail
+ * @return
+ */
+int SignalsHandler::makePackedThumbnail(QString key, QString &thumbKey)
+{
+   thumbKey = getThumbName(key);
+
+   if (store->contains(thumbKey))
+   {
+      return 1; // success: thumbnail already exists
+   }
+
+   QElapsedTimer timer;
+
+   timer.start();
+
+   QByteArray data;
+
+   QImage img;
+
+   if (store->read(key,data))
+   {
+      SCDImgExif exif(data);
+
+      img = exif.preview(QSize(100,75)); // EXIF embedded preview
+
+      if (img.isNull())
+      {
+         img.loadFromData(data); // load packed image
+      }
+
+      if (!img.isNull())
+      {
+         img = SCDImgExif::orient(img,exif.orientation());
+      }
+   }
+
+   if (!img.isNull())
+   {
+      QImage thumbnail = img.scaled(100,75,Qt::IgnoreAspectRatio,Qt::SmoothTransformation); // make thumbnail
+
+      QByteArray png;
+      QBuffer    buffer(&png);
+
+      buffer.open(QIODevice::WriteOnly);
+
+      if (thumbnail.save(&buffer,"png") && store->put(thumbKey,png)) // pack thumbnail in format PNG
+      {
+         metrics->thumbnail.record(static_cast<quint64>(timer.nsecsElapsed()/1000));
+
+         trace.mark(SCDImgTrace::PH_THUMBNAIL);
+
+         return 1; // return success
+      }
+
+      lastErrorMsg = "Save thumbail error: " + thumbKey;
+   }
+   else
+   {
+      lastErrorMsg = "loading image file error: " + key;
+   }
+
+   return 0;
+}
+
 /**
  * @brief SignalsHandler::sendThumbnail
  * @param fileName
@@ -660,6 +2442,16 @@ int SignalsHandler::sendThumbnail(QString fileName)
 {
    QString thumbnail;
 
+   if (store && store->contains(objectKey))
+   {
+      if (makePackedThumbnail(objectKey,thumbnail))
+      {
+         return sendPacked(thumbnail);
+      }
+
+      return 0;
+   }
+
    if (makeThumbnail(fileName,thumbnail))
    {
       return sendFile(thumbnail);
@@ -679,3 +2471,93 @@ QString SignalsHandler::getThumbName(QString fileName)
 
    return fi.absoluteDir().absolutePath() + "/" + fi.completeBaseName() + ".tmb.png";
 }
+
+/**
+ * @brief SignalsHandler::dropThumbnails drop both kinds of thumbnail of the object, the file one and the packed one:
+ *                                      an overwrite can move the object between file and segment store
+ */
+void SignalsHandler::dropThumbnails()
+{
+   QFile::remove(getThumbName(fileName));
+
+   if (store)
+   {
+      store->remove(getThumbName(objectKey));
+   }
+}
+
+/**
+ * @brief SignalsHandler::fileValidator validator of a file: inode, modification time (nsecs) and size.
+ *        Uploads are renamed into place, so every new version gets a new validator
+ * @param fileName
+ * @return hex validator, empty if file does not exist
+ */
+QByteArray SignalsHandler::fileValidator(QString fileName)
+{
+   struct stat st;
+
+   if (::stat(QFile::encodeName(fileName).constData(),&st)!=0)
+   {
+      return QByteArray();
+   }
+
+   qint64 mtime = static_cast<qint64>(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+
+   return "f" + QByteArray::number(static_cast<qulonglong>(st.st_ino),16) + "-" + QByteArray::number(mtime,16) + "-" + QByteArray::number(static_cast<qint64>(st.st_size),16);
+}
+
+/**
+ * @brief SignalsHandler::packedValidator validator of a packed object: its location into segment store
+ *        (changes when object is written again or moved by compaction)
+ * @param key
+ * @return hex validator, empty if object is not packed
+ */
+QByteArray SignalsHandler::packedValidator(QString key)
+{
+   return packedValidator(store,key);
+}
+
+/**
+ * @brief SignalsHandler::packedValidator validator of a packed object of store
+ * @param store
+ * @param key
+ * @return hex validator, empty if object is not packed
+ */
+QByteArray SignalsHandler::packedValidator(SCDImgSegmentStore *store, QString key)
+{
+   SCDImgNeedle needle;
+
+   if (!store->locate(key,needle))
+   {
+      return QByteArray();
+   }
+
+   return "p" + QByteArray::number(needle.segment,16) + "-" + QByteArray::number(needle.offset,16) + "-" + QByteArray::number(needle.length,16);
+}
+
+/**
+ * @brief SignalsHandler::objectValidator validator of a stored object, packed or file
+ * @param key
+ * @return hex validator, empty if object is not stored
+ */
+QByteArray SignalsHandler::objectValidator(QString key)
+{
+   return objectValidator(store,roots,key);
+}
+
+/**
+ * @brief SignalsHandler::objectValidator validator of an object stored into store (null if disabled) or roots
+ * @param store
+ * @param roots
+ * @param key
+ * @return hex validator, empty if object is not stored
+ */
+QByteArray SignalsHandler::objectValidator(SCDImgSegmentStore *store, SCDImgRootPaths *roots, QString key)
+{
+   if (store && store->contains(key))
+   {
+      return packedValidator(store,key);
+   }
+
+   return fileValidator(roots->locate(key));
+}
@@ -5,8 +5,18 @@
 #include <QTcpSocket>
 #include <QByteArray>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
 
 #include "scdimgserver.h"
+#include "scdimgstorageio.h"
+#include "scdimgdiskwriter.h"
+#include "scdimgratelimiter.h"
+#include "scdimgtimerwheel.h"
+#include "scdimgmetrics.h"
+#include "scdimgtrace.h"
+#include "scdimgdelta.h"
+#include "scdimgsheet.h"
 
 /**
  * @brief The SCDImgServerThread class
@@ -17,12 +27,16 @@ class SCDImgServerThread : public QThread
 
    public:
 
-     explicit SCDImgServerThread(SCDImgServer *parent = 0, qintptr socketDescriptor=-1);
+     enum Protocol {PR_SCDFTH,PR_HTTP,PR_LOCAL};
+
+     explicit SCDImgServerThread(SCDImgServer *parent = 0, qintptr socketDescriptor=-1, int protocol=PR_SCDFTH);
 
      void run(); // thread execution
 
      qintptr getSocketDescriptor() {return socketDescriptor;}
 
+     int getProtocol() {return protocol;}
+
      SCDImgServer *server();
 
    private:
@@ -30,6 +44,7 @@ class SCDImgServerThread : public QThread
      SCDImgServer *pserver;
 
      qintptr socketDescriptor; // descriptor(handle) of current socket
+     int     protocol;         // protocol of connection (Protocol)
 };
 
 /**
@@ -39,38 +54,103 @@ class SignalsHandler : public QObject
 {
    Q_OBJECT
 
+   friend class SCDImgMicroBench; // exercises header parsing, thumbnailing and receive path in isolation
+
    public:
 
      explicit SignalsHandler(SCDImgServerThread *parent=0, QTcpSocket *socket=0);
 
+     virtual ~SignalsHandler();
+
      QString lastError();
 
      QMap <QString,QVariant> getHeader();
 
+     static int extractMeta(SCDImgMetaIndex *index, SCDImgSegmentStore *store, SCDImgRootPaths *roots, const QString &key, SCDImgMetaIndex::Meta &meta); // see objectMeta()
+
    signals:
 
-   private slots:
+   protected slots: // storage, thumbnail and connection management are shared with the HTTP gateway handler
 
-     void readyRead();
+     virtual void readyRead();
      void disconnected();
      void onSocketError(QAbstractSocket::SocketError error);
 
-   private:
+     void writeResumed();                          // disk writer queue has free space: resume socket reading
+     void writeCompleted(int ret, QString errMsg); // disk writer has closed and renamed the received file
+
+     void sendChunk();      // send next chunk of rate limited output
+     void sendResumed();    // output tokens available
+     void receiveResumed(); // input tokens available
+
+     void onTimeout();      // header or idle timeout expired: evict connection
 
-     enum Status  {WAITFORHEADER,WAITFORDATA,DATASEND,DELETE};
-     enum Command {GET=0,PUT=1,DEL=2};
+   protected:
+
+     enum Status  {WAITFORHEADER,WAITFORDATA,WAITFORCOMMIT,DATASEND,DELETE,WAITFORPATHS};
+     enum Command {GET=0,PUT=1,DEL=2,DPUT=3,INFO=4,SHEET=5};
 
      int status;          // current reading status
 
      SCDImgServerThread *parent;
      QTcpSocket         *socket;  // current connection socket
 
-     QString rootPath;
+     SCDImgRootPaths *roots; // root paths files are striped across
      QStringList commands;
 
-     QFile f;
+     SCDImgStorageIO *f; // storage I/O handle of current file
+
+     SCDImgDiskWriter *writer;     // disk writer stage (null if disk writes are made by connection thread)
+     SCDImgCommitter  *committer;  // durability of received files and packed objects
+     SCDImgUploadPtr   upload;     // file being written by disk writer
+     QByteArray        pendingBuff; // buffer not yet queued to disk writer (queue full)
+
+     SCDImgRateLimit *limit;        // connection bandwidth limit
+     QByteArray       outBuff;      // rate limited output
+     int              outPos;       // bytes of outBuff already sent
+     bool             sendPaused;   // waiting for output tokens
+     bool             receivePaused; // waiting for input tokens
+
+     SCDImgTimerWheel *wheel;
+     SCDImgWheelTimer  timeout;      // header timeout, then idle timeout
+     int               idleTimeout;  // msecs (0: disabled)
+     bool              headerReceived;
+
+     SCDImgMetricsBlock *metrics;      // counters of this thread
+     int                 op;           // SCDImgMetricsBlock::Op of current request (-1: none)
+     QElapsedTimer       requestTimer; // request latency
+
+     SCDImgSlowLog *slowLog; // null if tracing is disabled
+     SCDImgTrace    trace;   // phases of current request
+
+     SCDImgCaptureLog *capture; // null if traffic capture is disabled
+
+     SCDImgSegmentStore *store; // small objects store (null if disabled)
+
+     SCDImgReplicator *replicator; // null if replication is disabled
+     bool              replicated; // current command comes from a peer: it is not replicated again
+
+     SCDImgHashIndex   *hashes;        // content hashes of stored objects (null if dedup is disabled)
+     QByteArray         contentHash;   // hash-first PUT: SHA-256 declared by client (empty for plain PUT)
+     QCryptographicHash contentHasher; // hash of received data, verified against contentHash
+
+     SCDImgDeltaPatch *patch;    // delta PUT: rebuilds the file from received delta (null for plain PUT)
+     QByteArray        deltaIn;  // delta stream not yet applied (incomplete op)
+     QByteArray        deltaOut; // rebuilt data held until the end of stream is verified
+
+     SCDImgMetaIndex *metaIndex; // image metadata of stored objects (null if disabled)
+     QStringList      infoKeys;  // INFO: requested objects
+     int              infoCount; // INFO: paths following the header line
+
+     SCDImgSheetCache *sheets;    // contact sheets cache (null if disabled)
+     int               sheetPage; // SHEET: page of folder images
+     int               sheetSize; // SHEET: images for each page
+
+     QByteArray packBuff;        // receiving buffer of object to pack into segment store
+     bool       packed;          // current object is packed into segment store
 
      QString fileName;
+     QString objectKey;          // requested object path relative to root path
      QString lastErrorMsg;
 
      QMap <QString,QVariant> header; // current header entries readed
@@ -80,17 +160,58 @@ class SignalsHandler : public QObject
      int  fileSize;
      bool thumbnail;
 
+     bool       validators; // GET reply carries the object validator
+     bool       local;      // connection from the Unix socket listener
+     bool       descriptor; // GET reply is a read-only descriptor (local connections)
+     QString    ifMatch;    // conditional GET: validator of client cached copy
+     QByteArray etag;       // validator of object being sent
+
      int checkHeaderField(const QString &headerItem, const QString &fieldName);
      int checkHeaderField(const QString &headerItem, Command &cmd);
      int readHeader(Command &command);
      int fileReceivingPrepare(QString fileName);
      int readData();
+     int deltaPrepare();
+     int storedContent();
+     int copyContent(QString source);
+     int checkContentHash();
+     int readPatch(QByteArray &buff);
+     QByteArray receive();
+     int queueData();
      int sendFile(QString fileName);
+     int sendPacked(QString key);
+     int sendData(const QByteArray &buff);
+     int sendNotModified();
+     int sendDescriptor();
      int delFile(QString fileName);
+     int readInfoPaths();
+     int sendInfo();
+     int objectMeta(const QString &key, SCDImgMetaIndex::Meta &meta);
+     int sendSheet();
+     QStringList folderImages(const QString &folder);
      int makeThumbnail(QString fileName, QString &thumbName);
+     int makePackedThumbnail(QString key, QString &thumbKey);
      int sendThumbnail(QString fileName);
 
      QString getThumbName(QString fileName);
+     void    dropThumbnails(); // thumbnail file and packed thumbnail of objectKey
+
+     QByteArray packedValidator(QString key);
+     QByteArray objectValidator(QString key);
+
+     static QByteArray fileValidator(QString fileName);
+     static QByteArray packedValidator(SCDImgSegmentStore *store, QString key);
+     static QByteArray objectValidator(SCDImgSegmentStore *store, SCDImgRootPaths *roots, QString key);
+
+     void replyError(int ret);
+
+     void touch(); // connection activity: re-arm idle timeout
+
+     virtual void outputDone();      // rate limited output entirely sent
+
+     void requestDone(bool success); // record request latency or error
+     void bufferUsage();             // update buffer memory gauge
+     void traceDone();               // log traced request if slow
 };
 
 #endif // SCDIMGSERVERTHREAD_H
@@ -0,0 +1,178 @@
+/**
+ * @class SCDImgSheetCache - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server contact sheets. A gallery screen asks the thumbnails of a whole folder page with one SHEET
+ *        command instead of a GET for each image: the thumbnails are composed into a single JPEG sprite, cached
+ *        in memory until an object of the folder is stored or deleted.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QPainter>
+#include <QBuffer>
+
+#include "scdimgsheet.h"
+
+#define JPEG_QUALITY 85 // sprite quality
+
+/**
+ * @brief SCDImgSheetCache::SCDImgSheetCache
+ * @param parent
+ * @param maxBytes max bytes of cached sheets
+ */
+SCDImgSheetCache::SCDImgSheetCache(QObject *parent, qint64 maxBytes) : QObject(parent)
+{
+   entries.setMaxCost(static_cast<int>(qMin<qint64>(maxBytes/1024,0x7FFFFFFF)));
+
+   counter = 0;
+
+   hitCount.store(0);
+   missCount.store(0);
+}
+
+/**
+ * @brief SCDImgSheetCache::sequence
+ * @param folder
+ * @return change sequence of last upload or delete into folder, 0 if unchanged since start
+ */
+quint64 SCDImgSheetCache::sequence(const QString &folder)
+{
+   QMutexLocker locker(&mutex);
+
+   return changes.value(folder,0);
+}
+
+/**
+ * @brief SCDImgSheetCache::invalidate an object of folder has been stored or deleted: its sheets are stale
+ * @param folder
+ */
+void SCDImgSheetCache::invalidate(const QString &folder)
+{
+   QMutexLocker locker(&mutex);
+
+   changes.insert(folder,++counter);
+}
+
+/**
+ * @brief SCDImgSheetCache::lookup
+ * @param key      sheet key (folder and page)
+ * @param sequence current change sequence of folder, read before listing it
+ * @param sheet    output param
+ * @return true on hit, false if sheet is missing or stale
+ */
+bool SCDImgSheetCache::lookup(const QString &key, quint64 sequence, QByteArray &sheet)
+{
+   QMutexLocker locker(&mutex);
+
+   Entry *entry = entries.object(key);
+
+   if (!entry || entry->sequence!=sequence)
+   {
+      missCount++;
+      return false;
+   }
+
+   sheet = entry->sheet;
+
+   hitCount++;
+
+   return true;
+}
+
+/**
+ * @brief SCDImgSheetCache::insert cache a sheet. A sheet larger than cache is not cached
+ * @param key
+ * @param sequence change sequence of folder read before listing it: if folder has changed meanwhile the entry is stale
+ * @param sheet
+ */
+void SCDImgSheetCache::insert(const QString &key, quint64 sequence, const QByteArray &sheet)
+{
+   Entry *entry = new Entry;
+
+   entry->sequence = sequence;
+   entry->sheet    = sheet;
+
+   QMutexLocker locker(&mutex);
+
+   entries.insert(key, entry, qMax(1,sheet.size()/1024)); // deleted at once if too large
+}
+
+/**
+ * @brief SCDImgSheetCache::hits
+ * @return sheets served from cache
+ */
+quint64 SCDImgSheetCache::hits()
+{
+   return hitCount.load();
+}
+
+/**
+ * @brief SCDImgSheetCache::misses
+ * @return sheets composed
+ */
+quint64 SCDImgSheetCache::misses()
+{
+   return missCount.load();
+}
+
+/**
+ * @brief SCDImgSheetCache::folderOf
+ * @param key object path (/dir/file.jpg)
+ * @return logical folder without trailing '/' (/dir), empty for root
+ */
+QString SCDImgSheetCache::folderOf(const QString &key)
+{
+   return key.left(qMax(0,key.lastIndexOf('/')));
+}
+
+/**
+ * @brief SCDImgSheetCache::compose compose a sheet: thumbnails are placed row by row, COLUMNS for each row
+ * @param names      file names of thumbnails (without folder)
+ * @param thumbnails CELL_WIDTH x CELL_HEIGHT images
+ * @param total      images of folder
+ * @return sheet reply: table and JPEG sprite (no sprite if there are no thumbnails)
+ */
+QByteArray SCDImgSheetCache::compose(const QStringList &names, const QList<QImage> &thumbnails, int total)
+{
+   int count   = thumbnails.count();
+   int columns = qMin<int>(count,COLUMNS);
+   int rows    = (count+COLUMNS-1)/COLUMNS;
+
+   QByteArray sheet = QByteArray::number(count) + "\t" + QByteArray::number(total) + "\t" + QByteArray::number(columns) + "\n";
+
+   if (count==0)
+   {
+      return sheet;
+   }
+
+   QImage sprite(columns*CELL_WIDTH, rows*CELL_HEIGHT, QImage::Format_RGB32);
+
+   sprite.fill(Qt::white);
+
+   QPainter painter(&sprite);
+
+   for (int i=0; i<count; i++)
+   {
+      QRect cell((i%COLUMNS)*CELL_WIDTH, (i/COLUMNS)*CELL_HEIGHT, CELL_WIDTH, CELL_HEIGHT);
+
+      painter.drawImage(cell, thumbnails.at(i));
+
+      sheet += QByteArray::number(cell.x()) + "\t" + QByteArray::number(cell.y()) + "\t" + QByteArray::number(cell.width()) + "\t" +
+               QByteArray::number(cell.height()) + "\t" + names.at(i).toUtf8() + "\n";
+   }
+
+   painter.end();
+
+   QBuffer buffer(&sheet);
+
+   buffer.open(QIODevice::WriteOnly | QIODevice::Append);
+
+   sprite.save(&buffer, "jpg", JPEG_QUALITY);
+
+   return sheet;
+}
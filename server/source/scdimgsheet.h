@@ -0,0 +1,66 @@
+#ifndef SCDIMGSHEET_H
+#define SCDIMGSHEET_H
+
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QImage>
+#include <QList>
+
+#include <atomic>
+
+/**
+ * @brief The SCDImgSheetCache class composes and caches contact sheets: the thumbnails of the images of a folder (or
+ *        a page of them) in a single JPEG sprite, with the table of their positions. Each folder has a change
+ *        sequence, bumped by uploads and deletes of its objects: a sheet composed before the last change is stale.
+ *        The reply of SHEET command is
+ *
+ *          <count>\t<total>\t<columns>\n                 images of sheet, images of folder, sprite columns
+ *          <x>\t<y>\t<width>\t<height>\t<name>\n         one line for each image (count lines)
+ *          <JPEG sprite>
+ */
+class SCDImgSheetCache : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     enum {CELL_WIDTH=100,CELL_HEIGHT=75,COLUMNS=10,MAX_IMAGES=500}; // thumbnail size, sprite columns, max images of a sheet
+
+     explicit SCDImgSheetCache(QObject *parent=0, qint64 maxBytes=67108864);
+
+     quint64 sequence(const QString &folder);   // last change of folder (0: unchanged since start)
+     void    invalidate(const QString &folder); // an object of folder has been stored or deleted
+
+     bool lookup(const QString &key, quint64 sequence, QByteArray &sheet); // false if missing or composed before sequence
+     void insert(const QString &key, quint64 sequence, const QByteArray &sheet);
+
+     quint64 hits();
+     quint64 misses();
+
+     static QString    folderOf(const QString &key); // logical folder of an object (/dir, empty for root)
+     static QByteArray compose(const QStringList &names, const QList<QImage> &thumbnails, int total);
+
+   private:
+
+     struct Entry
+     {
+        quint64    sequence;
+        QByteArray sheet;
+     };
+
+     QMutex mutex;
+
+     QCache<QString,Entry>  entries;  // sheet key (folder, page) => sheet, cost in KB
+     QHash<QString,quint64> changes;  // folder => sequence of last change
+     quint64                counter;  // change sequence
+
+     std::atomic<quint64> hitCount;
+     std::atomic<quint64> missCount;
+};
+
+#endif // SCDIMGSHEET_H
@@ -0,0 +1,299 @@
+/**
+ * @class SCDImgStorageIO - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server storage I/O backends. The backend is selected into config.cfg ([io] backend):
+ *
+ *          qfile => blocking QFile calls (default)
+ *          uring => io_uring submissions (requires build with CONFIG+=uring), fallback to qfile if unavailable
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "scdimgstorageio.h"
+#include "scdimglogger.h"
+
+#ifdef SCD_USE_URING
+#include "scdimguringio.h"
+#endif
+
+/**
+ * @brief SCDImgStorageIO::createRing set up the submission ring shared by every handle of the io_uring backend.
+ *                                    If backend is not available returns null: handles use the QFile backend.
+ * @param backend    BK_QFILE or BK_URING
+ * @param queueDepth submission queue depth (io_uring backend)
+ * @return
+ */
+SCDImgUring *SCDImgStorageIO::createRing(int backend, int queueDepth)
+{
+#ifdef SCD_USE_URING
+   if (backend==BK_URING)
+   {
+      SCDImgUring *ring = new SCDImgUring(queueDepth);
+
+      if (ring->isValid())
+      {
+         return ring;
+      }
+
+      logWarning() << "io_uring setup error: " << ring->errorString() << " => fallback to qfile backend";
+
+      delete ring;
+   }
+#else
+   Q_UNUSED(backend)
+   Q_UNUSED(queueDepth)
+#endif
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgStorageIO::destroyRing release a ring set up by createRing() (its handles must have been deleted)
+ * @param ring
+ */
+void SCDImgStorageIO::destroyRing(SCDImgUring *ring)
+{
+#ifdef SCD_USE_URING
+   delete ring;
+#else
+   Q_UNUSED(ring)
+#endif
+}
+
+/**
+ * @brief SCDImgStorageIO::create allocates a storage handle
+ * @param ring shared ring of io_uring backend (null: QFile backend)
+ * @return
+ */
+SCDImgStorageIO *SCDImgStorageIO::create(SCDImgUring *ring)
+{
+#ifdef SCD_USE_URING
+   if (ring)
+   {
+      return new SCDImgUringIO(ring);
+   }
+#else
+   Q_UNUSED(ring)
+#endif
+
+   return new SCDImgQFileIO();
+}
+
+/**
+ * @brief SCDImgStorageIO::backendFromName
+ * @param name backend name (qfile, uring)
+ * @return
+ */
+int SCDImgStorageIO::backendFromName(QString name)
+{
+   if (name.trimmed().toLower()=="uring")
+   {
+#ifndef SCD_USE_URING
+      logWarning() << "io_uring backend not built (qmake CONFIG+=uring): using qfile backend";
+#endif
+      return BK_URING;
+   }
+
+   return BK_QFILE;
+}
+
+/**
+ * @class SCDImgQFileIO
+ *
+ * @brief Blocking storage backend, based on QFile
+ */
+
+/**
+ * @brief SCDImgQFileIO::setFileName
+ * @param name
+ */
+void SCDImgQFileIO::setFileName(const QString &name)
+{
+   f.setFileName(name);
+}
+
+/**
+ * @brief SCDImgQFileIO::fileName
+ * @return
+ */
+QString SCDImgQFileIO::fileName()
+{
+   return f.fileName();
+}
+
+/**
+ * @brief SCDImgQFileIO::open
+ * @param mode
+ * @return
+ */
+int SCDImgQFileIO::open(QIODevice::OpenMode mode)
+{
+   if (f.open(mode))
+   {
+      return 1;
+   }
+
+   lastErrorMsg = f.errorString();
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::isOpen
+ * @return
+ */
+bool SCDImgQFileIO::isOpen()
+{
+   return f.isOpen();
+}
+
+/**
+ * @brief SCDImgQFileIO::allocate
+ * @param size
+ * @return
+ */
+int SCDImgQFileIO::allocate(qint64 size)
+{
+   int ret = ::posix_fallocate(f.handle(), 0, size);
+
+   if (ret==0 || ret==EOPNOTSUPP || ret==EINVAL) // not supported by file system: not an error
+   {
+      return 1;
+   }
+
+   lastErrorMsg = QString::fromLocal8Bit(strerror(ret));
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::write
+ * @param buff
+ * @return
+ */
+qint64 SCDImgQFileIO::write(const QByteArray &buff)
+{
+   qint64 ret = f.write(buff);
+
+   if (ret==-1)
+   {
+      lastErrorMsg = f.errorString();
+   }
+
+   return ret;
+}
+
+/**
+ * @brief SCDImgQFileIO::readAll
+ * @param buff
+ * @return
+ */
+int SCDImgQFileIO::readAll(QByteArray &buff)
+{
+   buff = f.readAll();
+
+   if (buff.size()==0 && f.size()>0)
+   {
+      lastErrorMsg = f.errorString();
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgQFileIO::sync
+ * @return
+ */
+int SCDImgQFileIO::sync()
+{
+   if (f.flush() && ::fdatasync(f.handle())==0)
+   {
+      return 1;
+   }
+
+   lastErrorMsg = QString::fromLocal8Bit(strerror(errno));
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::close
+ * @return
+ */
+int SCDImgQFileIO::close()
+{
+   f.close();
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgQFileIO::rename
+ * @param newName
+ * @return
+ */
+int SCDImgQFileIO::rename(const QString &newName)
+{
+   if (f.rename(newName))
+   {
+      return 1;
+   }
+
+   lastErrorMsg = f.errorString();
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::remove
+ * @return
+ */
+int SCDImgQFileIO::remove()
+{
+   if (f.remove())
+   {
+      return 1;
+   }
+
+   lastErrorMsg = f.errorString();
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::unlink
+ * @param name
+ * @return
+ */
+int SCDImgQFileIO::unlink(const QString &name)
+{
+   QFile file(name);
+
+   if (file.remove())
+   {
+      return 1;
+   }
+
+   lastErrorMsg = file.errorString();
+
+   return 0;
+}
+
+/**
+ * @brief SCDImgQFileIO::errorString
+ * @return
+ */
+QString SCDImgQFileIO::errorString()
+{
+   return lastErrorMsg;
+}
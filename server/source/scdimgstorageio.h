@@ -0,0 +1,78 @@
+#ifndef SCDIMGSTORAGEIO_H
+#define SCDIMGSTORAGEIO_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+
+class SCDImgUring; // shared io_uring submission ring (scdimguringio.h)
+
+/**
+ * @brief The SCDImgStorageIO class is the storage I/O backend interface: a file handle used by connection
+ *        threads to receive (write), send (read), rename and remove files.
+ */
+class SCDImgStorageIO
+{
+   public:
+
+     enum Backend {BK_QFILE=0,BK_URING=1};
+
+     static SCDImgUring     *createRing(int backend, int queueDepth); // shared ring of io_uring backend, null for QFile backend
+     static void             destroyRing(SCDImgUring *ring);
+     static SCDImgStorageIO *create(SCDImgUring *ring);                // allocates a handle on ring, QFile backend handle if null
+     static int backendFromName(QString name);
+
+     virtual ~SCDImgStorageIO() {}
+
+     virtual void    setFileName(const QString &name) = 0;
+     virtual QString fileName() = 0;
+
+     virtual int  open(QIODevice::OpenMode mode) = 0; // open file (WriteOnly truncates)
+     virtual bool isOpen() = 0;
+
+     virtual int    allocate(qint64 size) = 0;           // preallocate size bytes of opened file
+     virtual qint64 write(const QByteArray &buff) = 0;   // append buffer to opened file, -1 on error
+     virtual int    readAll(QByteArray &buff) = 0;       // read the whole opened file
+     virtual int    sync() = 0;                          // flush file data to disk
+     virtual int    close() = 0;                         // wait pending writes and close file
+
+     virtual int rename(const QString &newName) = 0;     // rename (closed) file replacing newName
+     virtual int remove() = 0;                           // close and remove file
+     virtual int unlink(const QString &name) = 0;        // remove a file by name
+
+     virtual QString errorString() = 0;
+};
+
+/**
+ * @brief The SCDImgQFileIO class is the default blocking storage backend, based on QFile
+ */
+class SCDImgQFileIO : public SCDImgStorageIO
+{
+   public:
+
+     void    setFileName(const QString &name);
+     QString fileName();
+
+     int  open(QIODevice::OpenMode mode);
+     bool isOpen();
+
+     int    allocate(qint64 size);
+     qint64 write(const QByteArray &buff);
+     int    readAll(QByteArray &buff);
+     int    sync();
+     int    close();
+
+     int rename(const QString &newName);
+     int remove();
+     int unlink(const QString &name);
+
+     QString errorString();
+
+   private:
+
+     QFile f;
+
+     QString lastErrorMsg;
+};
+
+#endif // SCDIMGSTORAGEIO_H
@@ -0,0 +1,242 @@
+/**
+ * @class SCDImgTimerWheel - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server hierarchical timer wheel, used for connections timeouts.
+ *
+ *        WHEEL_LEVELS wheels of WHEEL_SLOTS slots: level 0 slots hold the timers expiring within
+ *        WHEEL_SLOTS ticks, each upper level slot covers WHEEL_SLOTS slots of the lower level and is
+ *        cascaded down when the lower wheel wraps. With 100 msecs tick the wheel covers ~19 days.
+ *
+ *        The wheel is driven by a QTimer of the server thread; connection threads arm and cancel
+ *        their timers under the wheel mutex. Expired timers are notified by a queued invocation of
+ *        the receiver slot, made holding the mutex: a receiver cancelling its timer on destruction
+ *        can never receive a call after it has been destroyed.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QMetaObject>
+
+#include "scdimgtimerwheel.h"
+
+/**
+ * @brief SCDImgTimerWheel::SCDImgTimerWheel constructor
+ * @param parent
+ * @param tickMsecs wheel resolution
+ */
+SCDImgTimerWheel::SCDImgTimerWheel(QObject *parent, int tickMsecs) : QObject(parent), tickMsecs(qMax(1,tickMsecs))
+{
+   for (int level=0; level<WHEEL_LEVELS; level++)
+   {
+      for (int slot=0; slot<WHEEL_SLOTS; slot++)
+      {
+         wheel[level][slot].prev = &wheel[level][slot];
+         wheel[level][slot].next = &wheel[level][slot];
+      }
+   }
+
+   current    = 0;
+   armedCount = 0;
+
+   ticker.setInterval(this->tickMsecs);
+
+   connect(&ticker, SIGNAL(timeout()), this, SLOT(onTick()));
+
+   clock.start();
+}
+
+/**
+ * @brief SCDImgTimerWheel::start start wheel ticking (call it from the thread owning the wheel)
+ */
+void SCDImgTimerWheel::start()
+{
+   ticker.start();
+}
+
+/**
+ * @brief SCDImgTimerWheel::arm schedule timer expiration, rescheduling it if already armed
+ * @param timer
+ * @param msecs
+ */
+void SCDImgTimerWheel::arm(SCDImgWheelTimer *timer, int msecs)
+{
+   QMutexLocker locker(&mutex);
+
+   if (timer->armed())
+   {
+      unlink(timer);
+   }
+
+   quint64 ticks = static_cast<quint64>(qMax(1,(msecs + tickMsecs - 1)/tickMsecs));
+
+   timer->expires = qMax(current, now() + ticks);
+
+   insert(timer);
+
+   armedCount++;
+}
+
+/**
+ * @brief SCDImgTimerWheel::cancel cancel an armed timer
+ * @param timer
+ */
+void SCDImgTimerWheel::cancel(SCDImgWheelTimer *timer)
+{
+   QMutexLocker locker(&mutex);
+
+   if (timer->armed())
+   {
+      unlink(timer);
+   }
+}
+
+/**
+ * @brief SCDImgTimerWheel::expired check an expiration notified by a queued call: the timer may have been re-armed
+ *                                  (new activity) between the expiration and the call
+ * @param timer
+ * @return true if timer is still expired, false if it has a new deadline (stale notification)
+ */
+bool SCDImgTimerWheel::expired(SCDImgWheelTimer *timer)
+{
+   QMutexLocker locker(&mutex);
+
+   return !timer->armed();
+}
+
+/**
+ * @brief SCDImgTimerWheel::count
+ * @return number of armed timers
+ */
+int SCDImgTimerWheel::count()
+{
+   QMutexLocker locker(&mutex);
+
+   return armedCount;
+}
+
+/**
+ * @brief SCDImgTimerWheel::now
+ * @return elapsed ticks
+ */
+quint64 SCDImgTimerWheel::now()
+{
+   return static_cast<quint64>(clock.elapsed()/tickMsecs);
+}
+
+/**
+ * @brief SCDImgTimerWheel::insert link timer into the slot of its expiration tick. Call it holding mutex.
+ * @param timer
+ */
+void SCDImgTimerWheel::insert(SCDImgWheelTimer *timer)
+{
+   quint64 maxDelta = (Q_UINT64_C(1) << (WHEEL_LEVELS*WHEEL_BITS)) - 1;
+
+   if (timer->expires<current)
+   {
+      timer->expires = current;
+   }
+
+   if (timer->expires-current>maxDelta)
+   {
+      timer->expires = current + maxDelta;
+   }
+
+   quint64 delta = timer->expires - current;
+
+   int level = 0;
+
+   while (level<WHEEL_LEVELS-1 && delta>=(Q_UINT64_C(1) << ((level+1)*WHEEL_BITS)))
+   {
+      level++;
+   }
+
+   SCDImgWheelTimer *head = &wheel[level][(timer->expires >> (level*WHEEL_BITS)) & WHEEL_MASK];
+
+   timer->next       = head;
+   timer->prev       = head->prev;
+   head->prev->next  = timer;
+   head->prev        = timer;
+}
+
+/**
+ * @brief SCDImgTimerWheel::unlink remove timer from its slot. Call it holding mutex.
+ * @param timer
+ */
+void SCDImgTimerWheel::unlink(SCDImgWheelTimer *timer)
+{
+   timer->prev->next = timer->next;
+   timer->next->prev = timer->prev;
+
+   timer->prev = 0;
+   timer->next = 0;
+
+   armedCount--;
+}
+
+/**
+ * @brief SCDImgTimerWheel::cascade move the timers of an upper level slot to lower levels. Call it holding mutex.
+ * @param level
+ * @param index
+ */
+void SCDImgTimerWheel::cascade(int level, int index)
+{
+   SCDImgWheelTimer *head  = &wheel[level][index];
+   SCDImgWheelTimer *timer = head->next;
+
+   head->prev = head;
+   head->next = head;
+
+   while (timer!=head)
+   {
+      SCDImgWheelTimer *next = timer->next;
+
+      insert(timer);
+
+      timer = next;
+   }
+}
+
+/**
+ * @brief SCDImgTimerWheel::onTick process elapsed ticks: cascade upper levels and expire level 0 slots
+ */
+void SCDImgTimerWheel::onTick()
+{
+   QMutexLocker locker(&mutex);
+
+   quint64 target = now();
+
+   while (current<=target)
+   {
+      int index = static_cast<int>(current & WHEEL_MASK);
+
+      for (int level=1; index==0 && level<WHEEL_LEVELS; level++) // lower wheel wraps: cascade upper level slot
+      {
+         int upper = static_cast<int>((current >> (level*WHEEL_BITS)) & WHEEL_MASK);
+
+         cascade(level, upper);
+
+         if (upper!=0)
+         {
+            break;
+         }
+      }
+
+      SCDImgWheelTimer *head = &wheel[0][index];
+
+      while (head->next!=head)
+      {
+         SCDImgWheelTimer *timer = head->next;
+
+         unlink(timer);
+
+         QMetaObject::invokeMethod(timer->receiver, timer->method, Qt::QueuedConnection);
+      }
+
+      current++;
+   }
+}
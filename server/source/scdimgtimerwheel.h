@@ -0,0 +1,75 @@
+#ifndef SCDIMGTIMERWHEEL_H
+#define SCDIMGTIMERWHEEL_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1<<WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS-1)
+
+/**
+ * @brief The SCDImgWheelTimer struct is a timer node of the timer wheel (owned by its receiver).
+ *        On expiration the receiver method (a slot without arguments) is invoked by a queued call.
+ */
+struct SCDImgWheelTimer
+{
+   SCDImgWheelTimer *prev;
+   SCDImgWheelTimer *next;
+   quint64           expires;  // expiration tick
+   QObject          *receiver;
+   const char       *method;
+
+   SCDImgWheelTimer(QObject *receiver=0, const char *method=0) : prev(0), next(0), expires(0), receiver(receiver), method(method) {}
+
+   bool armed() const {return next!=0;}
+};
+
+/**
+ * @brief The SCDImgTimerWheel class is a hierarchical timer wheel: arming, re-arming and cancelling
+ *        a timer are O(1) operations, so every connection can keep its own timeouts cheaply
+ */
+class SCDImgTimerWheel : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgTimerWheel(QObject *parent=0, int tickMsecs=100);
+
+     void start();
+
+     void arm(SCDImgWheelTimer *timer, int msecs); // (re)schedule timer expiration
+     void cancel(SCDImgWheelTimer *timer);
+     bool expired(SCDImgWheelTimer *timer); // false if timer has been re-armed after its expiration was notified
+
+     int count(); // armed timers
+
+   private slots:
+
+     void onTick();
+
+   private:
+
+     QMutex mutex;
+
+     SCDImgWheelTimer wheel[WHEEL_LEVELS][WHEEL_SLOTS]; // slots list heads
+
+     quint64 current;   // next tick to process
+     int     tickMsecs;
+     int     armedCount;
+
+     QTimer        ticker;
+     QElapsedTimer clock;
+
+     quint64 now(); // elapsed ticks
+
+     void insert(SCDImgWheelTimer *timer);
+     void unlink(SCDImgWheelTimer *timer);
+     void cascade(int level, int index);
+};
+
+#endif // SCDIMGTIMERWHEEL_H
@@ -0,0 +1,372 @@
+/**
+ * @class SCDImgTrace - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server request phase tracing. A connection stamps the phase boundaries of its request
+ *        (header, open, read, thumbnail, send, receive, write, commit, delete, drain); requests slower than
+ *        the slow log threshold are written to the slow log as JSON lines:
+ *
+ *          {"time":"2019-06-01T10:00:00.000","peer":"...","op":"get","path":"/a.jpg","size":123,"status":"ok","total_ms":1520.3,
+ *           "phases_ms":{"header":0.1,"open":0.2,"read":1.3,"send":0.4,"drain":1518.3}}
+ *
+ *        The capture log records every request (op, path, size, outcome, latency) in binary for replay.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QDir>
+#include <QFileInfo>
+
+#include "scdimgtrace.h"
+#include "scdimgmetrics.h"
+
+/**
+ * @brief SCDImgTrace::SCDImgTrace constructor
+ */
+SCDImgTrace::SCDImgTrace()
+{
+   enabled       = false;
+   last          = 0;
+   requestOp     = -1;
+   requestFailed = false;
+   objectSize    = -1;
+}
+
+/**
+ * @brief SCDImgTrace::start request begins. Result and size are reset anyway: the capture log reads them
+ *                           also when tracing is disabled
+ * @param enabled false: marks are ignored
+ */
+void SCDImgTrace::start(bool enabled)
+{
+   this->enabled = enabled;
+
+   requestOp     = -1;
+   requestFailed = false;
+   objectSize    = -1;
+
+   if (!enabled)
+   {
+      return;
+   }
+
+   for (int i=0; i<PH_COUNT; i++)
+   {
+      phases[i] = 0;
+   }
+
+   last = 0;
+
+   clock.start();
+}
+
+/**
+ * @brief SCDImgTrace::stop request ends: ignore further marks
+ */
+void SCDImgTrace::stop()
+{
+   enabled = false;
+}
+
+/**
+ * @brief SCDImgTrace::setResult
+ * @param op      SCDImgMetricsBlock::Op
+ * @param success
+ */
+void SCDImgTrace::setResult(int op, bool success)
+{
+   requestOp     = op;
+   requestFailed = !success;
+}
+
+/**
+ * @brief SCDImgTrace::elapsed
+ * @return nsecs since request start
+ */
+qint64 SCDImgTrace::elapsed() const
+{
+   return clock.nsecsElapsed();
+}
+
+/**
+ * @brief SCDImgTrace::phase
+ * @param phase
+ * @return nsecs spent in phase
+ */
+qint64 SCDImgTrace::phase(int phase) const
+{
+   return phases[phase];
+}
+
+/**
+ * @brief SCDImgTrace::record add the time since previous mark to phase
+ * @param phase
+ */
+void SCDImgTrace::record(int phase)
+{
+   qint64 now = clock.nsecsElapsed();
+
+   phases[phase] += now - last;
+
+   last = now;
+}
+
+/**
+ * @brief SCDImgTrace::phaseName
+ * @param phase
+ * @return
+ */
+const char *SCDImgTrace::phaseName(int phase)
+{
+   static const char *names[] = {"header","open","read","thumbnail","send","receive","write","commit","delete","drain"};
+
+   return names[phase];
+}
+
+/**
+ * @class SCDImgSlowLog
+ *
+ * @brief Slow requests log
+ */
+
+/**
+ * @brief SCDImgSlowLog::SCDImgSlowLog constructor
+ * @param parent
+ * @param fileName
+ * @param thresholdMsecs requests taking at least thresholdMsecs are logged
+ */
+SCDImgSlowLog::SCDImgSlowLog(QObject *parent, QString fileName, int thresholdMsecs) : QObject(parent), file(fileName)
+{
+   threshold = static_cast<qint64>(thresholdMsecs)*1000000;
+}
+
+/**
+ * @brief SCDImgSlowLog::open open log file for append
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgSlowLog::open()
+{
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+   {
+      lastErrorMsg = "Open slow log error: " + file.fileName() + " => " + file.errorString();
+      return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgSlowLog::isSlow
+ * @param trace
+ * @return true if traced request exceeds threshold
+ */
+bool SCDImgSlowLog::isSlow(const SCDImgTrace &trace) const
+{
+   return (trace.elapsed()>=threshold);
+}
+
+/**
+ * @brief SCDImgSlowLog::write append a request to log
+ * @param trace
+ * @param peer client address
+ * @param path requested object path
+ */
+void SCDImgSlowLog::write(const SCDImgTrace &trace, const QString &peer, const QString &path)
+{
+   QJsonObject phases;
+
+   for (int i=0; i<SCDImgTrace::PH_COUNT; i++)
+   {
+      if (trace.phase(i)>0)
+      {
+         phases.insert(SCDImgTrace::phaseName(i), trace.phase(i)/1e6);
+      }
+   }
+
+   QJsonObject entry;
+
+   entry.insert("time",      QDateTime::currentDateTime().toString("yyyy-MM-dd'T'hh:mm:ss.zzz"));
+   entry.insert("peer",      peer);
+   entry.insert("op",        trace.op()>=0 ? SCDImgMetrics::opName(trace.op()) : "none");
+   entry.insert("path",      path);
+   entry.insert("size",      trace.size());
+   entry.insert("status",    trace.failed() ? "error" : "ok");
+   entry.insert("total_ms",  trace.elapsed()/1e6);
+   entry.insert("phases_ms", phases);
+
+   QByteArray line = QJsonDocument(entry).toJson(QJsonDocument::Compact) + "\n";
+
+   QMutexLocker locker(&mutex);
+
+   file.write(line);
+   file.flush();
+}
+
+/**
+ * @brief SCDImgSlowLog::lastError
+ * @return
+ */
+QString SCDImgSlowLog::lastError()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @class SCDImgCaptureLog
+ *
+ * @brief Traffic capture
+ */
+
+/**
+ * @brief SCDImgCaptureLog::SCDImgCaptureLog constructor
+ * @param parent
+ * @param fileName capture file
+ * @param maxSize  max capture size: further requests are not recorded
+ */
+SCDImgCaptureLog::SCDImgCaptureLog(QObject *parent, QString fileName, qint64 maxSize) : QObject(parent), file(fileName), maxSize(maxSize)
+{
+   captureSize = 0;
+
+   recordCount.store(0);
+   droppedCount.store(0);
+
+   connect(&timer, SIGNAL(timeout()), this, SLOT(flush()));
+}
+
+/**
+ * @brief SCDImgCaptureLog::~SCDImgCaptureLog write buffered records
+ */
+SCDImgCaptureLog::~SCDImgCaptureLog()
+{
+   flush();
+}
+
+/**
+ * @brief SCDImgCaptureLog::open create capture file and write its header
+ * @return 1 on success, 0 on failure
+ */
+int SCDImgCaptureLog::open()
+{
+   QMutexLocker locker(&mutex);
+
+   QDir().mkpath(QFileInfo(file.fileName()).absolutePath());
+
+   if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+   {
+      lastErrorMsg = "Open capture error: " + file.fileName() + " => " + file.errorString();
+      return 0;
+   }
+
+   buffer      = SCDImgCapture::header(QDateTime::currentMSecsSinceEpoch());
+   captureSize = buffer.size();
+
+   clock.start();
+
+   timer.start(FLUSH_INTERVAL);
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgCaptureLog::record append a request to capture. Called by connection threads when a request ends:
+ *                                 its arrival time is now minus its latency.
+ * @param op      SCDImgMetricsBlock::Op
+ * @param path    object path
+ * @param size    bytes received or sent (-1: unknown)
+ * @param latency usecs
+ * @param success
+ */
+void SCDImgCaptureLog::record(int op, const QString &path, qint64 size, qint64 latency, bool success)
+{
+   if (op>SCDImgMetricsBlock::OP_DEL)
+   {
+      return; // INFO and SHEET are not replayed
+   }
+
+   SCDImgCapture::Record record;
+
+   record.latency   = latency;
+   record.size      = qMax<qint64>(0,size);
+   record.op        = (op==SCDImgMetricsBlock::OP_PUT) ? SCDImgCapture::OP_PUT : (op==SCDImgMetricsBlock::OP_DEL) ? SCDImgCapture::OP_DEL : SCDImgCapture::OP_GET;
+   record.thumbnail = (op==SCDImgMetricsBlock::OP_GETTHUMB);
+   record.failed    = !success;
+   record.path      = path;
+
+   QMutexLocker locker(&mutex);
+
+   if (!file.isOpen() || captureSize>=maxSize)
+   {
+      droppedCount++;
+      return;
+   }
+
+   record.time = clock.nsecsElapsed()/1000 - latency;
+
+   int before = buffer.size();
+
+   SCDImgCapture::append(buffer,record);
+
+   captureSize += buffer.size()-before;
+
+   recordCount++;
+
+   if (buffer.size()>=FLUSH_SIZE)
+   {
+      file.write(buffer);
+      file.flush();
+
+      buffer.clear();
+   }
+}
+
+/**
+ * @brief SCDImgCaptureLog::flush write buffered records
+ */
+void SCDImgCaptureLog::flush()
+{
+   QMutexLocker locker(&mutex);
+
+   if (!file.isOpen() || buffer.isEmpty())
+   {
+      return;
+   }
+
+   file.write(buffer);
+   file.flush();
+
+   buffer.clear();
+}
+
+/**
+ * @brief SCDImgCaptureLog::records
+ * @return requests captured
+ */
+quint64 SCDImgCaptureLog::records()
+{
+   return recordCount.load();
+}
+
+/**
+ * @brief SCDImgCaptureLog::dropped
+ * @return requests not captured because capture reached max size
+ */
+quint64 SCDImgCaptureLog::dropped()
+{
+   return droppedCount.load();
+}
+
+/**
+ * @brief SCDImgCaptureLog::lastError
+ * @return
+ */
+QString SCDImgCaptureLog::lastError()
+{
+   return lastErrorMsg;
+}
@@ -0,0 +1,134 @@
+#ifndef SCDIMGTRACE_H
+#define SCDIMGTRACE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <atomic>
+
+#include "scdimgcapture.h"
+
+/**
+ * @brief The SCDImgTrace class stamps the phases of a request with monotonic timestamps.
+ *        When tracing is disabled mark() is a single branch.
+ */
+class SCDImgTrace
+{
+   public:
+
+     enum Phase {PH_HEADER=0,PH_OPEN,PH_READ,PH_THUMBNAIL,PH_SEND,PH_RECEIVE,PH_WRITE,PH_COMMIT,PH_DELETE,PH_DRAIN,PH_COUNT};
+
+     SCDImgTrace();
+
+     void start(bool enabled);             // request begins
+     void stop();
+
+     void mark(int phase)                  // phase ends: time since previous mark is added to phase
+     {
+        if (enabled)
+        {
+           record(phase);
+        }
+     }
+
+     void setResult(int op, bool success); // request command (SCDImgMetricsBlock::Op) and result
+     void setSize(qint64 size)  {objectSize = size;}
+
+     bool   active() const {return enabled;}
+     qint64 elapsed() const;               // nsecs since start
+     qint64 phase(int phase) const;        // nsecs spent in phase
+     int    op() const {return requestOp;}
+     bool   failed() const {return requestFailed;}
+     qint64 size() const {return objectSize;}
+
+     static const char *phaseName(int phase);
+
+   private:
+
+     bool          enabled;
+     QElapsedTimer clock;
+     qint64        last;             // last mark (nsecs since start)
+     qint64        phases[PH_COUNT];
+     int           requestOp;
+     bool          requestFailed;
+     qint64        objectSize;
+
+     void record(int phase);
+};
+
+/**
+ * @brief The SCDImgSlowLog class writes requests slower than a threshold as JSON lines, with their phases breakdown
+ */
+class SCDImgSlowLog : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     explicit SCDImgSlowLog(QObject *parent=0, QString fileName="./slow.log", int thresholdMsecs=1000);
+
+     int open();
+
+     bool isSlow(const SCDImgTrace &trace) const;
+
+     void write(const SCDImgTrace &trace, const QString &peer, const QString &path);
+
+     QString lastError();
+
+   private:
+
+     QMutex  mutex;
+     QFile   file;
+     qint64  threshold; // nsecs
+     QString lastErrorMsg;
+};
+
+/**
+ * @brief The SCDImgCaptureLog class records the metadata of each request (SCDImgCapture format) for replay.
+ *        Records are buffered and written every FLUSH_INTERVAL msecs or FLUSH_SIZE bytes; capture stops at max size.
+ */
+class SCDImgCaptureLog : public QObject
+{
+   Q_OBJECT
+
+   public:
+
+     enum {FLUSH_SIZE=65536,FLUSH_INTERVAL=1000};
+
+     explicit SCDImgCaptureLog(QObject *parent=0, QString fileName="./capture.bin", qint64 maxSize=1073741824);
+
+     ~SCDImgCaptureLog();
+
+     int open(); // a new capture is started (previous capture is overwritten)
+
+     void record(int op, const QString &path, qint64 size, qint64 latency, bool success); // op: SCDImgMetricsBlock::Op, latency usecs
+
+     quint64 records(); // requests captured
+     quint64 dropped(); // requests not captured (max size reached)
+
+     QString lastError();
+
+   public slots:
+
+     void flush();
+
+   private:
+
+     QMutex        mutex;
+     QFile         file;
+     QByteArray    buffer;
+     QElapsedTimer clock;       // capture start
+     QTimer        timer;       // flush timer
+     qint64        maxSize;
+     qint64        captureSize; // buffer included
+
+     std::atomic<quint64> recordCount;
+     std::atomic<quint64> droppedCount;
+
+     QString lastErrorMsg;
+};
+
+#endif // SCDIMGTRACE_H
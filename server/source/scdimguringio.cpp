@@ -0,0 +1,640 @@
+/**
+ * @class SCDImgUringIO - https://github.com/sc-develop/scd-imgserver
+ *
+ * @brief SCD Image Server io_uring storage backend (liburing, Linux 5.11+).
+ *
+ *        The server sets up a single ring (SCDImgUring), shared by the storage handles of every connection and
+ *        writer thread. Writes and reads are prepared as sqes carrying their request and submitted in batches;
+ *        their completions are reaped lazily, while open, fallocate, fsync, close, renameat and unlinkat
+ *        are executed as synchronous operations, reaping pending completions meanwhile.
+ *
+ *        This is a part of SCD Image Server
+ *
+ * @author Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com
+ *
+ * @copyright (c) 2019 (MIT) Ing. Salvatore Cerami - dev.salvatore.cerami@gmail.com - https://github.com/sc-develop/
+*/
+
+#include <QMutexLocker>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "scdimguringio.h"
+
+#define READ_CHUNK (1024*1024)
+
+/**
+ * @brief SCDImgUring::SCDImgUring constructor
+ * @param queueDepth submission queue depth: max reads/writes in flight for all handles
+ */
+SCDImgUring::SCDImgUring(int queueDepth) : depth(queueDepth>0 ? queueDepth : 64)
+{
+   batch    = qMax(1,depth/4);
+   queued   = 0;
+   inflight = 0;
+   reaping  = false;
+
+   int ret = io_uring_queue_init(static_cast<unsigned>(depth), &ring, 0);
+
+   valid = (ret==0);
+
+   if (!valid)
+   {
+      lastErrorMsg = QString::fromLocal8Bit(strerror(-ret));
+   }
+}
+
+/**
+ * @brief SCDImgUring::~SCDImgUring destructor (handles must have been closed)
+ */
+SCDImgUring::~SCDImgUring()
+{
+   if (valid)
+   {
+      io_uring_queue_exit(&ring);
+   }
+}
+
+/**
+ * @brief SCDImgUring::isValid return true if the ring has been successfully set up
+ * @return
+ */
+bool SCDImgUring::isValid()
+{
+   return valid;
+}
+
+/**
+ * @brief SCDImgUring::errorString
+ * @return
+ */
+QString SCDImgUring::errorString()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgUring::getSqe get a free sqe: if queue depth is reached waits for completions. Call it holding mutex
+ * @return
+ */
+struct io_uring_sqe *SCDImgUring::getSqe()
+{
+   while (inflight>=depth)
+   {
+      submit();
+      reap(true);
+   }
+
+   struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+   while (!sqe) // submission queue full: submit queued sqes
+   {
+      io_uring_submit(&ring);
+      queued = 0;
+
+      sqe = io_uring_get_sqe(&ring);
+   }
+
+   queued++;
+   inflight++;
+
+   return sqe;
+}
+
+/**
+ * @brief SCDImgUring::submit submit queued sqes. Call it holding mutex
+ */
+void SCDImgUring::submit()
+{
+   if (queued)
+   {
+      io_uring_submit(&ring);
+      queued = 0;
+   }
+}
+
+/**
+ * @brief SCDImgUring::reap consume available completions. Call it holding mutex: while waiting the mutex is
+ *                          released, so other threads go on submitting
+ * @param wait wait at least one completion, handled by this thread or by the one already reaping
+ */
+void SCDImgUring::reap(bool wait)
+{
+   if (reaping) // completions are consumed by one thread at a time
+   {
+      if (wait)
+      {
+         completed.wait(&mutex);
+      }
+
+      return;
+   }
+
+   struct io_uring_cqe *cqe;
+
+   int ret;
+
+   if (wait)
+   {
+      reaping = true;
+
+      mutex.unlock();
+
+      ret = io_uring_wait_cqe(&ring,&cqe);
+
+      mutex.lock();
+
+      reaping = false;
+   }
+   else
+   {
+      ret = io_uring_peek_cqe(&ring,&cqe);
+   }
+
+   while (ret==0)
+   {
+      complete(cqe);
+
+      io_uring_cqe_seen(&ring,cqe);
+
+      ret = io_uring_peek_cqe(&ring,&cqe);
+   }
+
+   if (wait)
+   {
+      completed.wakeAll();
+   }
+}
+
+/**
+ * @brief SCDImgUring::complete handle a completion. Call it holding mutex
+ * @param cqe
+ */
+void SCDImgUring::complete(struct io_uring_cqe *cqe)
+{
+   Request *r = static_cast<Request*>(io_uring_cqe_get_data(cqe));
+
+   inflight--;
+
+   if (r->op==OP_SYNC) // the request lives on the stack of the waiting thread
+   {
+      r->done   = true;
+      r->result = cqe->res;
+      return;
+   }
+
+   SCDImgUringIO *io = r->io;
+
+   io->pending--;
+
+   if (cqe->res<0)
+   {
+      if (!io->ioError)
+      {
+         io->ioError = cqe->res;
+      }
+
+      delete r;
+      return;
+   }
+
+   // short read/write: complete it synchronously ---------------------------
+
+   unsigned done = static_cast<unsigned>(cqe->res);
+
+   while (done<r->length)
+   {
+      ssize_t ret;
+
+      if (r->op==OP_WRITE)
+      {
+         ret = ::pwrite(r->fd, r->data.constData()+done, r->length-done, r->offset+done);
+      }
+      else
+      {
+         ret = ::pread(r->fd, r->dest+done, r->length-done, r->offset+done);
+      }
+
+      if (ret<0 && errno==EINTR)
+      {
+         continue;
+      }
+
+      if (ret<=0)
+      {
+         if (!io->ioError)
+         {
+            io->ioError = (ret<0) ? -errno : -EIO;
+         }
+
+         break;
+      }
+
+      done += static_cast<unsigned>(ret);
+   }
+
+   delete r;
+}
+
+/**
+ * @brief SCDImgUring::execute submit a synchronous operation and wait its completion. Call it holding mutex
+ * @param sqe
+ * @return operation result (-errno on failure)
+ */
+int SCDImgUring::execute(struct io_uring_sqe *sqe)
+{
+   Request r;
+
+   r.io     = 0;
+   r.op     = OP_SYNC;
+   r.fd     = -1;
+   r.dest   = 0;
+   r.length = 0;
+   r.offset = 0;
+   r.done   = false;
+   r.result = 0;
+
+   io_uring_sqe_set_data(sqe, &r);
+
+   submit();
+
+   while (!r.done)
+   {
+      reap(true);
+   }
+
+   return r.result;
+}
+
+/**
+ * @brief SCDImgUringIO::SCDImgUringIO constructor
+ * @param ring shared submission ring
+ */
+SCDImgUringIO::SCDImgUringIO(SCDImgUring *ring) : ring(ring)
+{
+   fd      = -1;
+   offset  = 0;
+   pending = 0;
+   ioError = 0;
+}
+
+/**
+ * @brief SCDImgUringIO::~SCDImgUringIO destructor
+ */
+SCDImgUringIO::~SCDImgUringIO()
+{
+   if (fd>=0)
+   {
+      close();
+   }
+}
+
+/**
+ * @brief SCDImgUringIO::setFileName
+ * @param name
+ */
+void SCDImgUringIO::setFileName(const QString &name)
+{
+   this->name = name;
+}
+
+/**
+ * @brief SCDImgUringIO::fileName
+ * @return
+ */
+QString SCDImgUringIO::fileName()
+{
+   return name;
+}
+
+/**
+ * @brief SCDImgUringIO::open
+ * @param mode
+ * @return
+ */
+int SCDImgUringIO::open(QIODevice::OpenMode mode)
+{
+   int flags = (mode & QIODevice::WriteOnly) ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+
+   QByteArray path = name.toLocal8Bit();
+
+   QMutexLocker locker(&ring->mutex);
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_openat(sqe, AT_FDCWD, path.constData(), flags | O_CLOEXEC, 0644);
+
+   int res = ring->execute(sqe);
+
+   if (res<0)
+   {
+      return failure(res);
+   }
+
+   fd      = res;
+   offset  = 0;
+   ioError = 0;
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::isOpen
+ * @return
+ */
+bool SCDImgUringIO::isOpen()
+{
+   return (fd>=0);
+}
+
+/**
+ * @brief SCDImgUringIO::allocate
+ * @param size
+ * @return
+ */
+int SCDImgUringIO::allocate(qint64 size)
+{
+   QMutexLocker locker(&ring->mutex);
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_fallocate(sqe, fd, 0, 0, static_cast<__u64>(size));
+
+   int res = ring->execute(sqe);
+
+   if (res<0 && res!=-EOPNOTSUPP && res!=-EINVAL) // not supported by file system: not an error
+   {
+      return failure(res);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::write queue an append write of buff: it does not wait for completion
+ * @param buff
+ * @return buffer size, -1 on error (of this or a previous queued write)
+ */
+qint64 SCDImgUringIO::write(const QByteArray &buff)
+{
+   QMutexLocker locker(&ring->mutex);
+
+   if (ioError)
+   {
+      failure(ioError);
+      return -1;
+   }
+
+   if (buff.isEmpty())
+   {
+      return 0;
+   }
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   SCDImgUring::Request *r = new SCDImgUring::Request;
+
+   r->io     = this;
+   r->op     = SCDImgUring::OP_WRITE;
+   r->fd     = fd;
+   r->data   = buff; // shared copy: keeps buffer alive until completion
+   r->dest   = 0;
+   r->length = static_cast<unsigned>(buff.size());
+   r->offset = offset;
+
+   io_uring_prep_write(sqe, fd, r->data.constData(), r->length, static_cast<__u64>(r->offset));
+   io_uring_sqe_set_data(sqe, r);
+
+   offset += buff.size();
+
+   pending++;
+
+   if (ring->queued>=ring->batch)
+   {
+      ring->submit();
+   }
+
+   ring->reap(false);
+
+   return buff.size();
+}
+
+/**
+ * @brief SCDImgUringIO::readAll read the whole opened file submitting all chunk reads at once
+ * @param buff
+ * @return
+ */
+int SCDImgUringIO::readAll(QByteArray &buff)
+{
+   struct stat st;
+
+   if (::fstat(fd,&st)!=0)
+   {
+      return failure(-errno);
+   }
+
+   buff.resize(static_cast<int>(st.st_size));
+
+   QMutexLocker locker(&ring->mutex);
+
+   ioError = 0;
+
+   for (qint64 pos=0; pos<st.st_size; pos+=READ_CHUNK)
+   {
+      struct io_uring_sqe *sqe = ring->getSqe();
+
+      SCDImgUring::Request *r = new SCDImgUring::Request;
+
+      r->io     = this;
+      r->op     = SCDImgUring::OP_READ;
+      r->fd     = fd;
+      r->dest   = buff.data() + pos;
+      r->length = static_cast<unsigned>(qMin<qint64>(READ_CHUNK, st.st_size-pos));
+      r->offset = pos;
+
+      io_uring_prep_read(sqe, fd, r->dest, r->length, static_cast<__u64>(pos));
+      io_uring_sqe_set_data(sqe, r);
+
+      pending++;
+   }
+
+   if (!drain())
+   {
+      return failure(ioError);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::sync wait queued writes and flush file data to disk
+ * @return
+ */
+int SCDImgUringIO::sync()
+{
+   QMutexLocker locker(&ring->mutex);
+
+   if (!drain())
+   {
+      return failure(ioError);
+   }
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+
+   int res = ring->execute(sqe);
+
+   if (res<0)
+   {
+      return failure(res);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::close wait queued writes and close file
+ * @return 0 if a queued write failed
+ */
+int SCDImgUringIO::close()
+{
+   QMutexLocker locker(&ring->mutex);
+
+   return closeFile();
+}
+
+/**
+ * @brief SCDImgUringIO::rename rename file replacing newName (renameat)
+ * @param newName
+ * @return
+ */
+int SCDImgUringIO::rename(const QString &newName)
+{
+   QByteArray oldPath = name.toLocal8Bit();
+   QByteArray newPath = newName.toLocal8Bit();
+
+   QMutexLocker locker(&ring->mutex);
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_renameat(sqe, AT_FDCWD, oldPath.constData(), AT_FDCWD, newPath.constData(), 0);
+
+   int res = ring->execute(sqe);
+
+   if (res<0)
+   {
+      return failure(res);
+   }
+
+   name = newName;
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::remove close and remove file
+ * @return
+ */
+int SCDImgUringIO::remove()
+{
+   close();
+
+   return unlink(name);
+}
+
+/**
+ * @brief SCDImgUringIO::unlink remove a file by name (unlinkat)
+ * @param name
+ * @return
+ */
+int SCDImgUringIO::unlink(const QString &name)
+{
+   QByteArray path = name.toLocal8Bit();
+
+   QMutexLocker locker(&ring->mutex);
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_unlinkat(sqe, AT_FDCWD, path.constData(), 0);
+
+   int res = ring->execute(sqe);
+
+   if (res<0)
+   {
+      return failure(res);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::errorString
+ * @return
+ */
+QString SCDImgUringIO::errorString()
+{
+   return lastErrorMsg;
+}
+
+/**
+ * @brief SCDImgUringIO::drain submit queued sqes and wait all pending reads/writes of this handle.
+ *                             Call it holding ring mutex
+ * @return 0 if a read/write failed
+ */
+int SCDImgUringIO::drain()
+{
+   ring->submit();
+
+   while (pending>0)
+   {
+      ring->reap(true);
+   }
+
+   return (ioError==0);
+}
+
+/**
+ * @brief SCDImgUringIO::closeFile wait queued writes and close file. Call it holding ring mutex
+ * @return 0 if a queued write failed
+ */
+int SCDImgUringIO::closeFile()
+{
+   if (fd<0)
+   {
+      return 1;
+   }
+
+   int ret = drain();
+
+   struct io_uring_sqe *sqe = ring->getSqe();
+
+   io_uring_prep_close(sqe, fd);
+
+   ring->execute(sqe);
+
+   fd = -1;
+
+   if (!ret)
+   {
+      return failure(ioError);
+   }
+
+   return 1;
+}
+
+/**
+ * @brief SCDImgUringIO::failure set last error message from an io_uring result
+ * @param res -errno
+ * @return 0
+ */
+int SCDImgUringIO::failure(int res)
+{
+   lastErrorMsg = QString::fromLocal8Bit(strerror(-res));
+
+   return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef SCDIMGURINGIO_H
+#define SCDIMGURINGIO_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <liburing.h>
+
+#include "scdimgstorageio.h"
+
+class SCDImgUringIO;
+
+/**
+ * @brief The SCDImgUring class is the io_uring submission ring shared by every storage handle of the server
+ *        (connection and writer threads): the reads and writes of all uploads are in flight together, up to
+ *        queue depth, instead of one at a time on a ring for each connection. One thread at a time waits for
+ *        completions and hands them to their handles; the others wait for it.
+ */
+class SCDImgUring
+{
+   public:
+
+     explicit SCDImgUring(int queueDepth=64);
+
+     ~SCDImgUring();
+
+     bool isValid();
+
+     QString errorString();
+
+   private:
+
+     friend class SCDImgUringIO;
+
+     enum Operation {OP_WRITE,OP_READ,OP_SYNC};
+
+     struct Request
+     {
+        SCDImgUringIO *io;     // owner handle
+        int            op;
+        int            fd;
+        QByteArray     data;   // write buffer (kept alive until completion)
+        char          *dest;   // read destination
+        unsigned       length;
+        qint64         offset;
+        bool           done;   // synchronous operation completed
+        int            result; // synchronous operation result
+     };
+
+     struct io_uring ring;
+
+     bool valid;
+     int  depth;
+     int  batch;    // number of queued sqes which triggers a submission
+
+     int  queued;   // prepared and not yet submitted sqes
+     int  inflight; // prepared sqes not yet completed
+     bool reaping;  // a thread is waiting for completions
+
+     QMutex         mutex;     // protects ring and the pending state of every handle
+     QWaitCondition completed; // completions handled by the reaping thread
+
+     QString lastErrorMsg;
+
+     struct io_uring_sqe *getSqe(); // call them holding mutex
+
+     void submit();
+     void reap(bool wait);
+     void complete(struct io_uring_cqe *cqe);
+     int  execute(struct io_uring_sqe *sqe);
+};
+
+/**
+ * @brief The SCDImgUringIO class is the io_uring storage backend: writes are queued on the shared ring without
+ *        waiting their completion and submitted in batches, so the disk is kept deep-queued while the
+ *        connection thread goes on reading the socket.
+ */
+class SCDImgUringIO : public SCDImgStorageIO
+{
+   public:
+
+     explicit SCDImgUringIO(SCDImgUring *ring);
+
+     ~SCDImgUringIO();
+
+     void    setFileName(const QString &name);
+     QString fileName();
+
+     int  open(QIODevice::OpenMode mode);
+     bool isOpen();
+
+     int    allocate(qint64 size);
+     qint64 write(const QByteArray &buff);
+     int    readAll(QByteArray &buff);
+     int    sync();
+     int    close();
+
+     int rename(const QString &newName);
+     int remove();
+     int unlink(const QString &name);
+
+     QString errorString();
+
+   private:
+
+     friend class SCDImgUring;
+
+     SCDImgUring *ring;
+
+     int     fd;
+     qint64  offset; // append offset of opened file
+     QString name;
+
+     int pending; // submitted reads/writes waiting for completion (protected by ring mutex)
+     int ioError; // first error (-errno) of a queued read/write (protected by ring mutex)
+
+     QString lastErrorMsg;
+
+     int drain();
+     int closeFile();
+     int failure(int res);
+};
+
+#endif // SCDIMGURINGIO_H